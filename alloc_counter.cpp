@@ -0,0 +1,108 @@
+#include "alloc_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef VK_TUT_BENCH
+
+namespace {
+
+std::atomic<uint64_t> allocationCount{0};
+
+void countAllocation() {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* allocateAligned(std::size_t size, std::size_t alignment) {
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    // aligned_alloc wants a multiple of the alignment
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+void freeAligned(void* memory) {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+
+}
+
+// the replaceable global allocation functions, the array and nothrow forms forward to these two by default.
+// The aligned ones are what over-aligned types (the SIMD aligned glm types) are allocated with
+void* operator new(std::size_t size) {
+    countAllocation();
+    if (size == 0) {
+        size = 1;
+    }
+    while (true) {
+        void* memory = std::malloc(size);
+        if (memory != nullptr) {
+            return memory;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    countAllocation();
+    if (size == 0) {
+        size = 1;
+    }
+    while (true) {
+        void* memory = allocateAligned(size, static_cast<std::size_t>(alignment));
+        if (memory != nullptr) {
+            return memory;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    freeAligned(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept {
+    freeAligned(memory);
+}
+
+uint64_t heapAllocationCount() {
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+bool isCountingHeapAllocations() {
+    return true;
+}
+
+#else
+
+uint64_t heapAllocationCount() {
+    return 0;
+}
+
+bool isCountingHeapAllocations() {
+    return false;
+}
+
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// heap allocations through operator new since startup, on all threads. Only the benchmark target replaces
+// operator new to count them, elsewhere this stays 0 and isCountingHeapAllocations() is false
+uint64_t heapAllocationCount();
+bool isCountingHeapAllocations();
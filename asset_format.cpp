@@ -0,0 +1,388 @@
+#include "asset_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// the file supplies both values, so the sum is never formed, it could wrap
+bool fitsIn(uint64_t offset, uint64_t length, uint64_t size) {
+    return offset <= size && length <= size - offset;
+}
+
+struct TexelBlock {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes;
+};
+
+std::optional<TexelBlock> texelBlockOf(VkFormat format) {
+    // the VkFormat enum keeps the variants of one layout (unorm, snorm, srgb, ...) next to each other
+    auto in = [format](VkFormat first, VkFormat last) { return format >= first && format <= last; };
+    if (in(VK_FORMAT_R8_UNORM, VK_FORMAT_R8_SRGB)) {
+        return TexelBlock{1, 1, 1};
+    }
+    if (in(VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8_SRGB) || in(VK_FORMAT_R16_UNORM, VK_FORMAT_R16_SFLOAT)) {
+        return TexelBlock{1, 1, 2};
+    }
+    if (in(VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_B8G8R8A8_SRGB) || in(VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16_SFLOAT)
+        || in(VK_FORMAT_R32_UINT, VK_FORMAT_R32_SFLOAT)) {
+        return TexelBlock{1, 1, 4};
+    }
+    if (in(VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16B16A16_SFLOAT) || in(VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32_SFLOAT)) {
+        return TexelBlock{1, 1, 8};
+    }
+    if (in(VK_FORMAT_R32G32B32A32_UINT, VK_FORMAT_R32G32B32A32_SFLOAT)) {
+        return TexelBlock{1, 1, 16};
+    }
+    if (in(VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGBA_SRGB_BLOCK) || in(VK_FORMAT_BC4_UNORM_BLOCK, VK_FORMAT_BC4_SNORM_BLOCK)
+        || in(VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK)
+        || in(VK_FORMAT_EAC_R11_UNORM_BLOCK, VK_FORMAT_EAC_R11_SNORM_BLOCK)) {
+        return TexelBlock{4, 4, 8};
+    }
+    if (in(VK_FORMAT_BC2_UNORM_BLOCK, VK_FORMAT_BC3_SRGB_BLOCK) || in(VK_FORMAT_BC5_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK)
+        || in(VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK)
+        || in(VK_FORMAT_EAC_R11G11_UNORM_BLOCK, VK_FORMAT_EAC_R11G11_SNORM_BLOCK)) {
+        return TexelBlock{4, 4, 16};
+    }
+    if (in(VK_FORMAT_ASTC_4x4_UNORM_BLOCK, VK_FORMAT_ASTC_12x12_SRGB_BLOCK)) {
+        // in enum order, a unorm and an srgb format each
+        static const uint32_t extents[14][2] = {{4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6},
+                                                {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}};
+        const uint32_t* extent = extents[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2];
+        return TexelBlock{extent[0], extent[1], 16};
+    }
+    return std::nullopt;
+}
+
+template<typename T>
+bool indicesBelow(const uint8_t* data, uint32_t indexCount, uint32_t vertexCount) {
+    // no early out, the loop stays a plain max the compiler vectorizes
+    const T* indices = reinterpret_cast<const T*>(data);
+    T maximum = 0;
+    for (uint32_t i = 0; i < indexCount; i++) {
+        maximum = std::max(maximum, indices[i]);
+    }
+    return indexCount == 0 || maximum < vertexCount;
+}
+
+template<typename T>
+void appendStream(std::vector<uint8_t>& data, const std::vector<T>& stream, uint64_t& offset) {
+    // every stream starts 16 byte aligned inside the section
+    data.resize(alignUp(data.size(), 16), 0);
+    offset = data.size();
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(stream.data());
+    data.insert(data.end(), bytes, bytes + stream.size() * sizeof(T));
+}
+
+}
+
+uint64_t assetImageBytes(VkFormat format, uint32_t width, uint32_t height) {
+    std::optional<TexelBlock> block = texelBlockOf(format);
+    if (!block.has_value()) {
+        return 0;
+    }
+    uint64_t blocksWide = (static_cast<uint64_t>(width) + block->width - 1) / block->width;
+    uint64_t blocksHigh = (static_cast<uint64_t>(height) + block->height - 1) / block->height;
+    return blocksWide * blocksHigh * block->bytes;
+}
+
+void AssetContainer::open(const std::string& path) {
+    file.open(path);
+    if (file.getSize() < sizeof(AssetFileHeader)) {
+        throw std::runtime_error("asset file " + path + " is corrupt: too small for a header!");
+    }
+    const auto* header = reinterpret_cast<const AssetFileHeader*>(file.getData());
+    if (header->magic != ASSET_MAGIC) {
+        throw std::runtime_error(path + " is not an asset file!");
+    }
+    if (header->version != ASSET_VERSION) {
+        throw std::runtime_error("asset file " + path + " has version " + std::to_string(header->version)
+                                 + ", expected " + std::to_string(ASSET_VERSION) + "!");
+    }
+    entryCount = header->entryCount;
+    checkRange(header->entriesOffset, static_cast<uint64_t>(entryCount) * sizeof(AssetEntry), alignof(AssetEntry), "entry table");
+    entries = reinterpret_cast<const AssetEntry*>(file.getData() + header->entriesOffset);
+    validate();
+}
+
+void AssetContainer::close() {
+    file.close();
+    entries = nullptr;
+    entryCount = 0;
+}
+
+std::string AssetContainer::getName(uint32_t index) const {
+    const char* name = entries[index].name;
+    return std::string(name, strnlen(name, ASSET_NAME_LENGTH));
+}
+
+std::optional<uint32_t> AssetContainer::find(const std::string& name) const {
+    for (uint32_t i = 0; i < entryCount; i++) {
+        if (getName(i) == name) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+const AssetMeshHeader& AssetContainer::getMesh(uint32_t index) const {
+    if (entries[index].type != AssetType::Mesh) {
+        throw std::runtime_error("asset " + getName(index) + " is not a mesh!");
+    }
+    return *reinterpret_cast<const AssetMeshHeader*>(file.getData() + entries[index].headerOffset);
+}
+
+const AssetTextureHeader& AssetContainer::getTexture(uint32_t index) const {
+    if (entries[index].type != AssetType::Texture) {
+        throw std::runtime_error("asset " + getName(index) + " is not a texture!");
+    }
+    return *reinterpret_cast<const AssetTextureHeader*>(file.getData() + entries[index].headerOffset);
+}
+
+void AssetContainer::validate() const {
+    /*
+     * This function checks every offset and size in the file against the mapping once, a truncated or
+     * corrupt file fails here instead of faulting on a streaming thread later
+     */
+    for (uint32_t i = 0; i < entryCount; i++) {
+        const AssetEntry& entry = entries[i];
+        if (entry.type == AssetType::Mesh) {
+            checkRange(entry.headerOffset, sizeof(AssetMeshHeader), alignof(AssetMeshHeader), "mesh header");
+            const AssetMeshHeader& mesh = getMesh(i);
+            checkRange(mesh.dataOffset, mesh.dataSize, ASSET_SECTION_ALIGNMENT, "mesh data");
+            uint64_t indexSize = mesh.indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+            if ((mesh.indexType != VK_INDEX_TYPE_UINT16 && mesh.indexType != VK_INDEX_TYPE_UINT32)
+                || !fitsIn(mesh.positionOffset, mesh.vertexCount * 8ull, mesh.dataSize)
+                || !fitsIn(mesh.normalOffset, mesh.vertexCount * 4ull, mesh.dataSize)
+                || !fitsIn(mesh.uvStreamOffset, mesh.vertexCount * 4ull, mesh.dataSize)
+                || !fitsIn(mesh.indexOffset, mesh.indexCount * indexSize, mesh.dataSize)
+                || mesh.indexOffset % indexSize != 0) {
+                throw std::runtime_error("asset file " + file.getPath() + " is corrupt: mesh " + getName(i) + " has streams outside its data!");
+            }
+        }
+        else if (entry.type == AssetType::Texture) {
+            checkRange(entry.headerOffset, sizeof(AssetTextureHeader), alignof(AssetTextureHeader), "texture header");
+            const AssetTextureHeader& texture = getTexture(i);
+            checkRange(texture.dataOffset, texture.dataSize, ASSET_SECTION_ALIGNMENT, "texture data");
+            if (texture.mipCount == 0 || texture.mipCount > ASSET_MAX_MIPS) {
+                throw std::runtime_error("asset file " + file.getPath() + " is corrupt: texture " + getName(i) + " has a bad mip count!");
+            }
+            VkFormat format = static_cast<VkFormat>(texture.format);
+            if (texture.width == 0 || texture.height == 0 || !texelBlockOf(format).has_value()) {
+                throw std::runtime_error("asset file " + file.getPath() + " is corrupt: texture " + getName(i) + " has a bad format or extent!");
+            }
+            // the streamer copies each mip with the extent from its header, the bytes have to be there for it
+            for (uint32_t mip = 0; mip < texture.mipCount; mip++) {
+                const AssetMip& assetMip = texture.mips[mip];
+                if (!fitsIn(assetMip.offset, assetMip.size, texture.dataSize) || assetMip.offset % 16 != 0) {
+                    throw std::runtime_error("asset file " + file.getPath() + " is corrupt: texture " + getName(i) + " has a mip outside its data!");
+                }
+                if (assetMip.width != std::max(texture.width >> mip, 1u) || assetMip.height != std::max(texture.height >> mip, 1u)
+                    || assetMip.size < assetImageBytes(format, assetMip.width, assetMip.height)) {
+                    throw std::runtime_error("asset file " + file.getPath() + " is corrupt: texture " + getName(i) + " has a mip of the wrong size!");
+                }
+            }
+        }
+        else {
+            throw std::runtime_error("asset file " + file.getPath() + " is corrupt: unknown asset type!");
+        }
+    }
+}
+
+void AssetContainer::checkMeshIndices(uint32_t index) const {
+    const AssetMeshHeader& mesh = getMesh(index);
+    const uint8_t* indices = getData(mesh.dataOffset + mesh.indexOffset);
+    bool valid = mesh.indexType == VK_INDEX_TYPE_UINT16
+                 ? indicesBelow<uint16_t>(indices, mesh.indexCount, mesh.vertexCount)
+                 : indicesBelow<uint32_t>(indices, mesh.indexCount, mesh.vertexCount);
+    if (!valid) {
+        throw std::runtime_error("asset file " + file.getPath() + " is corrupt: mesh " + getName(index) + " has indices past its vertices!");
+    }
+}
+
+void AssetContainer::checkRange(uint64_t offset, uint64_t size, uint64_t alignment, const char* what) const {
+    if (offset % alignment != 0 || offset > file.getSize() || size > file.getSize() - offset) {
+        throw std::runtime_error("asset file " + file.getPath() + " is corrupt: " + what + " is outside the file!");
+    }
+}
+
+void AssetWriter::addMesh(const std::string& name, const std::vector<float>& positions, const std::vector<float>& normals,
+                          const std::vector<float>& uvs, const std::vector<uint32_t>& indices) {
+    /*
+     * This function quantizes the vertex streams: positions to 16 bit snorm around the bounding box center,
+     * normals to 8 bit snorm and uvs to 16 bit unorm over their range. Indices become 16 bit where they fit
+     */
+    uint32_t vertexCount = static_cast<uint32_t>(positions.size() / 3);
+    if (vertexCount == 0 || positions.size() % 3 != 0 || (!normals.empty() && normals.size() != positions.size())
+        || (!uvs.empty() && uvs.size() != vertexCount * 2ull)) {
+        throw std::runtime_error("mesh " + name + " has mismatched vertex streams!");
+    }
+    // which also makes the 16 bit indices below fit
+    if (!indices.empty() && *std::max_element(indices.begin(), indices.end()) >= vertexCount) {
+        throw std::runtime_error("mesh " + name + " has indices past its vertices!");
+    }
+    PendingEntry& pendingEntry = addEntry(name, AssetType::Mesh);
+    AssetMeshHeader& mesh = pendingEntry.mesh;
+    mesh.vertexCount = vertexCount;
+    mesh.indexCount = static_cast<uint32_t>(indices.size());
+
+    float minimum[3] = {positions[0], positions[1], positions[2]};
+    float maximum[3] = {positions[0], positions[1], positions[2]};
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        for (int axis = 0; axis < 3; axis++) {
+            minimum[axis] = std::min(minimum[axis], positions[v * 3 + axis]);
+            maximum[axis] = std::max(maximum[axis], positions[v * 3 + axis]);
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        mesh.center[axis] = (minimum[axis] + maximum[axis]) * 0.5f;
+        mesh.extent[axis] = std::max((maximum[axis] - minimum[axis]) * 0.5f, 1e-6f);
+    }
+
+    std::vector<int16_t> quantizedPositions(vertexCount * 4ull, 0);
+    std::vector<int8_t> quantizedNormals(vertexCount * 4ull, 0);
+    std::vector<uint16_t> quantizedUvs(vertexCount * 2ull, 0);
+    float radiusSquared = 0.0f;
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        float distanceSquared = 0.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            float offset = positions[v * 3 + axis] - mesh.center[axis];
+            distanceSquared += offset * offset;
+            float unit = std::clamp(offset / mesh.extent[axis], -1.0f, 1.0f);
+            quantizedPositions[v * 4 + axis] = static_cast<int16_t>(std::lround(unit * 32767.0f));
+            if (!normals.empty()) {
+                float normal = std::clamp(normals[v * 3 + axis], -1.0f, 1.0f);
+                quantizedNormals[v * 4 + axis] = static_cast<int8_t>(std::lround(normal * 127.0f));
+            }
+        }
+        radiusSquared = std::max(radiusSquared, distanceSquared);
+    }
+    mesh.radius = std::sqrt(radiusSquared);
+
+    if (!uvs.empty()) {
+        for (int axis = 0; axis < 2; axis++) {
+            float low = uvs[axis];
+            float high = uvs[axis];
+            for (uint32_t v = 0; v < vertexCount; v++) {
+                low = std::min(low, uvs[v * 2 + axis]);
+                high = std::max(high, uvs[v * 2 + axis]);
+            }
+            mesh.uvOffset[axis] = low;
+            mesh.uvScale[axis] = high > low ? high - low : 1.0f;
+            for (uint32_t v = 0; v < vertexCount; v++) {
+                float unit = (uvs[v * 2 + axis] - low) / mesh.uvScale[axis];
+                quantizedUvs[v * 2 + axis] = static_cast<uint16_t>(std::lround(std::clamp(unit, 0.0f, 1.0f) * 65535.0f));
+            }
+        }
+    }
+    else {
+        mesh.uvScale[0] = 1.0f;
+        mesh.uvScale[1] = 1.0f;
+    }
+
+    std::vector<uint8_t>& data = pendingEntry.data;
+    appendStream(data, quantizedPositions, mesh.positionOffset);
+    appendStream(data, quantizedNormals, mesh.normalOffset);
+    appendStream(data, quantizedUvs, mesh.uvStreamOffset);
+    if (vertexCount <= 65536) {
+        mesh.indexType = VK_INDEX_TYPE_UINT16;
+        appendStream(data, std::vector<uint16_t>(indices.begin(), indices.end()), mesh.indexOffset);
+    }
+    else {
+        mesh.indexType = VK_INDEX_TYPE_UINT32;
+        appendStream(data, indices, mesh.indexOffset);
+    }
+}
+
+void AssetWriter::addTexture(const std::string& name, VkFormat format, uint32_t width, uint32_t height,
+                             const std::vector<std::vector<uint8_t>>& mips) {
+    if (mips.empty() || mips.size() > ASSET_MAX_MIPS) {
+        throw std::runtime_error("texture " + name + " needs between 1 and " + std::to_string(ASSET_MAX_MIPS) + " mips!");
+    }
+    if (width == 0 || height == 0 || !texelBlockOf(format).has_value()) {
+        throw std::runtime_error("texture " + name + " has an empty extent or a format asset files cannot hold!");
+    }
+    for (uint32_t mip = 0; mip < mips.size(); mip++) {
+        if (mips[mip].size() < assetImageBytes(format, std::max(width >> mip, 1u), std::max(height >> mip, 1u))) {
+            throw std::runtime_error("texture " + name + " mip " + std::to_string(mip) + " is too small for its extent!");
+        }
+    }
+    PendingEntry& pendingEntry = addEntry(name, AssetType::Texture);
+    AssetTextureHeader& texture = pendingEntry.texture;
+    texture.format = static_cast<uint32_t>(format);
+    texture.width = width;
+    texture.height = height;
+    texture.mipCount = static_cast<uint32_t>(mips.size());
+    for (uint32_t mip = 0; mip < texture.mipCount; mip++) {
+        texture.mips[mip].width = std::max(width >> mip, 1u);
+        texture.mips[mip].height = std::max(height >> mip, 1u);
+        texture.mips[mip].size = mips[mip].size();
+        appendStream(pendingEntry.data, mips[mip], texture.mips[mip].offset);
+    }
+}
+
+void AssetWriter::write(const std::string& path) const {
+    /*
+     * This function lays the file out as header, entry table, then per entry its typed header and its data
+     * section, and writes it in one go. The offsets in the headers are filled in here
+     */
+    AssetFileHeader header{};
+    header.magic = ASSET_MAGIC;
+    header.version = ASSET_VERSION;
+    header.entryCount = static_cast<uint32_t>(pending.size());
+    header.entriesOffset = sizeof(AssetFileHeader);
+
+    std::vector<uint8_t> bytes(header.entriesOffset + pending.size() * sizeof(AssetEntry), 0);
+    for (size_t i = 0; i < pending.size(); i++) {
+        AssetEntry entry = pending[i].entry;
+        bool isMesh = entry.type == AssetType::Mesh;
+        size_t headerSize = isMesh ? sizeof(AssetMeshHeader) : sizeof(AssetTextureHeader);
+        entry.headerOffset = alignUp(bytes.size(), 16);
+        uint64_t dataOffset = alignUp(entry.headerOffset + headerSize, ASSET_SECTION_ALIGNMENT);
+        bytes.resize(dataOffset + pending[i].data.size(), 0);
+
+        if (isMesh) {
+            AssetMeshHeader mesh = pending[i].mesh;
+            mesh.dataOffset = dataOffset;
+            mesh.dataSize = pending[i].data.size();
+            std::memcpy(&bytes[entry.headerOffset], &mesh, sizeof(mesh));
+        }
+        else {
+            AssetTextureHeader texture = pending[i].texture;
+            texture.dataOffset = dataOffset;
+            texture.dataSize = pending[i].data.size();
+            std::memcpy(&bytes[entry.headerOffset], &texture, sizeof(texture));
+        }
+        std::copy(pending[i].data.begin(), pending[i].data.end(), bytes.begin() + static_cast<ptrdiff_t>(dataOffset));
+        std::memcpy(&bytes[header.entriesOffset + i * sizeof(AssetEntry)], &entry, sizeof(entry));
+    }
+    header.fileSize = bytes.size();
+    std::memcpy(bytes.data(), &header, sizeof(header));
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!out) {
+        throw std::runtime_error("failed to write asset file " + path + "!");
+    }
+}
+
+AssetWriter::PendingEntry& AssetWriter::addEntry(const std::string& name, AssetType type) {
+    if (name.empty() || name.size() >= ASSET_NAME_LENGTH) {
+        throw std::runtime_error("asset name " + name + " has to be 1 to " + std::to_string(ASSET_NAME_LENGTH - 1) + " characters!");
+    }
+    PendingEntry& pendingEntry = pending.emplace_back();
+    pendingEntry.entry = {};
+    pendingEntry.mesh = {};
+    pendingEntry.texture = {};
+    std::memcpy(pendingEntry.entry.name, name.data(), name.size());
+    pendingEntry.entry.type = type;
+    return pendingEntry;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+ * The asset container is one file read through a memory map: a header, a table of named entries, and per entry
+ * a small typed header pointing at its data section. Every data section starts on ASSET_SECTION_ALIGNMENT and
+ * holds exactly the bytes the GPU resource gets, so loading is one memcpy from the mapping into the staging ring:
+ *
+ *   mesh:    quantized position, normal and uv streams and the indices, each at its stream offset, in one buffer
+ *   texture: the mip chain, already in the texture's (usually block compressed) format, largest mip first
+ *
+ * All integers are little endian, the structs below are the on disk layout
+ */
+
+constexpr uint32_t ASSET_MAGIC = 0x41544b56;   // "VKTA"
+constexpr uint32_t ASSET_VERSION = 1;
+// a multiple of every texel block size and of the usual optimalBufferCopyOffsetAlignment
+constexpr uint64_t ASSET_SECTION_ALIGNMENT = 256;
+constexpr uint32_t ASSET_NAME_LENGTH = 48;
+constexpr uint32_t ASSET_MAX_MIPS = 16;
+
+// the vertex stream formats, dequantized with the mesh header's center / extent and uv offset / scale
+constexpr VkFormat ASSET_POSITION_FORMAT = VK_FORMAT_R16G16B16A16_SNORM;
+constexpr VkFormat ASSET_NORMAL_FORMAT = VK_FORMAT_R8G8B8A8_SNORM;
+constexpr VkFormat ASSET_UV_FORMAT = VK_FORMAT_R16G16_UNORM;
+
+enum class AssetType : uint32_t {
+    Mesh = 1,
+    Texture = 2,
+};
+
+struct AssetFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+    uint64_t entriesOffset;
+    uint64_t fileSize;
+};
+
+struct AssetEntry {
+    // zero terminated
+    char name[ASSET_NAME_LENGTH];
+    AssetType type;
+    uint32_t reserved;
+    // of the AssetMeshHeader or AssetTextureHeader
+    uint64_t headerOffset;
+};
+
+struct AssetMeshHeader {
+    // bounding sphere, the center is also what positions are quantized around: position = center + q * extent
+    float center[3];
+    float radius;
+    float extent[3];
+    uint32_t vertexCount;
+    // uv = uvOffset + q * uvScale
+    float uvOffset[2];
+    float uvScale[2];
+    uint32_t indexCount;
+    // VK_INDEX_TYPE_UINT16 or VK_INDEX_TYPE_UINT32
+    uint32_t indexType;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    // relative to dataOffset, also the offsets in the GPU buffer
+    uint64_t positionOffset;
+    uint64_t normalOffset;
+    uint64_t uvStreamOffset;
+    uint64_t indexOffset;
+};
+
+struct AssetMip {
+    // relative to the texture's dataOffset
+    uint64_t offset;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct AssetTextureHeader {
+    // a VkFormat
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    AssetMip mips[ASSET_MAX_MIPS];
+};
+
+static_assert(sizeof(AssetFileHeader) == 32 && sizeof(AssetEntry) == 64 && sizeof(AssetMeshHeader) == 104
+              && sizeof(AssetMip) == 24 && sizeof(AssetTextureHeader) == 416, "the asset structs are the file layout");
+static_assert(std::is_trivially_copyable<AssetMeshHeader>::value && std::is_trivially_copyable<AssetTextureHeader>::value,
+              "the asset structs are read straight from the mapping");
+
+// the tightly packed size in bytes of a width x height image in format, 0 for a format asset files cannot hold
+// (uncompressed 8, 16 and 32 bit per channel colour formats, BCn, ETC2/EAC and ASTC LDR)
+uint64_t assetImageBytes(VkFormat format, uint32_t width, uint32_t height);
+
+class AssetContainer {
+    /*
+     * This class is a mapped asset file whose header, entries and section bounds were checked when it was opened,
+     * so the accessors hand out pointers into the mapping without further checks
+     */
+public:
+    void open(const std::string& path);
+    void close();
+
+    uint32_t getEntryCount() const { return entryCount; }
+    const AssetEntry& getEntry(uint32_t index) const { return entries[index]; }
+    std::string getName(uint32_t index) const;
+    std::optional<uint32_t> find(const std::string& name) const;
+
+    const AssetMeshHeader& getMesh(uint32_t index) const;
+    const AssetTextureHeader& getTexture(uint32_t index) const;
+    // throws unless every index of the mesh is below its vertex count. open() does not read the index data, the
+    // streamer calls this right before it copies the mesh, when the pages are being read anyway
+    void checkMeshIndices(uint32_t index) const;
+    const uint8_t* getData(uint64_t offset) const { return file.getData() + offset; }
+    const MappedFile& getFile() const { return file; }
+
+private:
+    MappedFile file;
+    const AssetEntry* entries = nullptr;
+    uint32_t entryCount = 0;
+
+    void validate() const;
+    void checkRange(uint64_t offset, uint64_t size, uint64_t alignment, const char* what) const;
+};
+
+class AssetWriter {
+    /*
+     * This class builds an asset file, it is what a content tool links against. Meshes are quantized here, once,
+     * textures come in already compressed (BCn, ASTC, ...) with their whole mip chain, encoding them is the
+     * texture tool's job
+     */
+public:
+    // positions and normals are xyz per vertex, uvs are uv per vertex, normals and uvs may be empty
+    void addMesh(const std::string& name, const std::vector<float>& positions, const std::vector<float>& normals,
+                 const std::vector<float>& uvs, const std::vector<uint32_t>& indices);
+    // mips[i] is mip level i in format, tightly packed
+    void addTexture(const std::string& name, VkFormat format, uint32_t width, uint32_t height,
+                    const std::vector<std::vector<uint8_t>>& mips);
+
+    void write(const std::string& path) const;
+
+private:
+    struct PendingEntry {
+        AssetEntry entry;
+        AssetMeshHeader mesh;
+        AssetTextureHeader texture;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<PendingEntry> pending;
+
+    PendingEntry& addEntry(const std::string& name, AssetType type);
+};
@@ -0,0 +1,549 @@
+#include "asset_streamer.h"
+
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+void AssetStreamer::create(VkPhysicalDevice physicalDeviceIn, DeviceMemoryAllocator& allocatorIn, StagingUploader& uploaderIn,
+                           BindlessDescriptors* bindlessIn, const std::vector<uint32_t>& queueFamiliesIn,
+                           uint32_t framesInFlightIn, uint32_t ioThreadCount, VkDeviceSize maxBytesInFlightIn) {
+    physicalDevice = physicalDeviceIn;
+    device = allocatorIn.getDevice();
+    allocator = &allocatorIn;
+    uploader = &uploaderIn;
+    bindless = bindlessIn;
+    queueFamilies = queueFamiliesIn;
+    maxBytesInFlight = maxBytesInFlightIn;
+    framesInFlight = framesInFlightIn;
+    stopping = false;
+    for (uint32_t i = 0; i < std::max(ioThreadCount, 1u); i++) {
+        ioThreads.emplace_back(&AssetStreamer::ioLoop, this);
+    }
+}
+
+void AssetStreamer::destroy() {
+    /*
+     * This function stops the I/O threads, requests still queued are dropped and one being loaded is finished,
+     * then frees every resource that was created, resident or not
+     */
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    budgetAvailable.notify_all();
+    for (std::thread& thread : ioThreads) {
+        thread.join();
+    }
+    ioThreads.clear();
+
+    for (const std::unique_ptr<Request>& request : requests) {
+        if (request->mesh.buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, request->mesh.buffer, nullptr);
+            allocator->free(request->mesh.allocation);
+        }
+        destroyTexture(request->texture);
+        destroyTexture(request->replacement);
+    }
+    for (RetiredTexture& retiredTexture : retired) {
+        destroyTexture(retiredTexture.texture);
+    }
+    retired.clear();
+    requests.clear();
+    queued.clear();
+    uploading.clear();
+    mipChangesQueued.clear();
+    mipChangesUploading.clear();
+    pendingMipChanges = 0;
+    bytesInFlight = 0;
+    containers.clear();
+}
+
+AssetId AssetStreamer::request(const std::string& path, const std::string& name, float screenSize) {
+    AssetId id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = static_cast<AssetId>(requests.size());
+        auto queuedRequest = std::make_unique<Request>();
+        queuedRequest->id = id;
+        queuedRequest->path = path;
+        queuedRequest->name = name;
+        queuedRequest->priority = screenSize;
+        queuedRequest->requested = std::chrono::steady_clock::now();
+        requests.push_back(std::move(queuedRequest));
+        queued.push_back(id);
+    }
+    workAvailable.notify_one();
+    return id;
+}
+
+std::vector<AssetId> AssetStreamer::requestAll(const std::string& path, float screenSize) {
+    // opening here checks the file up front, the I/O threads then find the container already mapped
+    std::shared_ptr<AssetContainer> container = openContainer(path);
+    std::vector<AssetId> ids;
+    for (uint32_t entry = 0; entry < container->getEntryCount(); entry++) {
+        ids.push_back(request(path, container->getName(entry), screenSize));
+    }
+    return ids;
+}
+
+void AssetStreamer::setPriority(AssetId id, float screenSize) {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.at(id)->priority = screenSize;
+}
+
+void AssetStreamer::poll(uint64_t frameNumber) {
+    /*
+     * This function retires the uploads the GPU has finished, only then are textures visible to shaders
+     * through the bindless set and meshes handed out by getMesh(). A finished change of mips swaps the new image
+     * in under a new bindless index, the old index and image are released framesInFlight frames later, when no
+     * frame recorded with them can still be running
+     */
+    if (!isCreated()) {
+        return;
+    }
+    TRACE_SCOPE("AssetStreamer::poll");
+    std::vector<Request*> failed;
+    std::vector<Request*> failedMipChanges;
+    VkDeviceSize released = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto finished = std::stable_partition(uploading.begin(), uploading.end(), [this](AssetId id) {
+            const Request& request = *requests[id];
+            return request.state == AssetState::Uploading && !uploader->isComplete(request.ticket);
+        });
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = finished; it != uploading.end(); ++it) {
+            Request& request = *requests[*it];
+            released += request.bytes;
+            if (request.state == AssetState::Failed) {
+                failed.push_back(&request);
+                continue;
+            }
+            if (request.type == AssetType::Texture && bindless != nullptr) {
+                request.texture.bindlessIndex = bindless->addSampledImage(request.texture.view);
+            }
+            request.state = AssetState::Resident;
+            double latencyMs = std::chrono::duration<double, std::milli>(now - request.requested).count();
+            totalLatencyMs += latencyMs;
+            maxLatencyMs = std::max(maxLatencyMs, latencyMs);
+            residentBytes += request.bytes;
+            residentCount++;
+        }
+        uploading.erase(finished, uploading.end());
+
+        auto changed = std::stable_partition(mipChangesUploading.begin(), mipChangesUploading.end(), [this](AssetId id) {
+            return !uploader->isComplete(requests[id]->replacementTicket);
+        });
+        for (auto it = changed; it != mipChangesUploading.end(); ++it) {
+            Request& request = *requests[*it];
+            released += request.replacementBytes;
+            request.replacementBytes = 0;
+            if (request.replacementFailed) {
+                // never visible to a frame, its uploads are done, so it can go right away
+                retired.push_back({request.replacement, frameNumber});
+                failedMipChanges.push_back(&request);
+            }
+            else {
+                if (bindless != nullptr) {
+                    request.replacement.bindlessIndex = bindless->addSampledImage(request.replacement.view);
+                }
+                residentBytes -= textureBytes(request.mipSizes, request.texture.firstMip);
+                residentBytes += textureBytes(request.mipSizes, request.replacement.firstMip);
+                if (request.replacement.firstMip > request.texture.firstMip) {
+                    mipsDropped += request.replacement.firstMip - request.texture.firstMip;
+                }
+                else {
+                    mipsRestored += request.texture.firstMip - request.replacement.firstMip;
+                }
+                retired.push_back({request.texture, frameNumber + framesInFlight});
+                request.texture = request.replacement;
+            }
+            request.replacement = StreamedTexture{};
+            request.replacementTicket = UploadTicket{};
+            request.replacementFailed = false;
+            request.pendingFirstMip.reset();
+            pendingMipChanges--;
+        }
+        mipChangesUploading.erase(changed, mipChangesUploading.end());
+        bytesInFlight -= released;
+    }
+    if (released > 0) {
+        budgetAvailable.notify_all();
+    }
+    for (const Request* request : failed) {
+        failedCount++;
+        std::cerr << "failed to stream asset " << request->name << " from " << request->path << ": " << request->error << std::endl;
+    }
+    for (const Request* request : failedMipChanges) {
+        std::cerr << "failed to change the mips of " << request->name << ", keeping the old ones: " << request->error << std::endl;
+    }
+
+    // the retired list is only touched on the main thread
+    auto expired = std::stable_partition(retired.begin(), retired.end(), [frameNumber](const RetiredTexture& retiredTexture) {
+        return retiredTexture.releaseFrame > frameNumber;
+    });
+    for (auto it = expired; it != retired.end(); ++it) {
+        destroyTexture(it->texture);
+    }
+    retired.erase(expired, retired.end());
+}
+
+std::vector<TextureResidency> AssetStreamer::getTextureResidency() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<TextureResidency> textures;
+    for (const std::unique_ptr<Request>& request : requests) {
+        if (request->state != AssetState::Resident || request->type != AssetType::Texture) {
+            continue;
+        }
+        TextureResidency residency;
+        residency.id = request->id;
+        residency.priority = request->priority;
+        residency.firstMip = request->texture.firstMip;
+        residency.mipSizes = request->mipSizes;
+        residency.changing = request->pendingFirstMip.has_value();
+        textures.push_back(std::move(residency));
+    }
+    return textures;
+}
+
+bool AssetStreamer::setFirstMip(AssetId id, uint32_t firstMip) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Request& request = *requests.at(id);
+        if (request.state != AssetState::Resident || request.type != AssetType::Texture || request.pendingFirstMip.has_value()
+            || firstMip >= request.mipSizes.size() || firstMip == request.texture.firstMip) {
+            return false;
+        }
+        request.pendingFirstMip = firstMip;
+        mipChangesQueued.push_back(id);
+        pendingMipChanges++;
+    }
+    workAvailable.notify_one();
+    return true;
+}
+
+void AssetStreamer::setLoadMipBias(uint32_t bias) {
+    std::lock_guard<std::mutex> lock(mutex);
+    loadMipBias = bias;
+}
+
+uint32_t AssetStreamer::getPendingMipChanges() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pendingMipChanges + static_cast<uint32_t>(retired.size());
+}
+
+AssetState AssetStreamer::getState(AssetId id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return requests.at(id)->state;
+}
+
+const StreamedMesh* AssetStreamer::getMesh(AssetId id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Request& request = *requests.at(id);
+    return request.state == AssetState::Resident && request.type == AssetType::Mesh ? &request.mesh : nullptr;
+}
+
+const StreamedTexture* AssetStreamer::getTexture(AssetId id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Request& request = *requests.at(id);
+    return request.state == AssetState::Resident && request.type == AssetType::Texture ? &request.texture : nullptr;
+}
+
+void AssetStreamer::printStats() const {
+    if (!isCreated() && residentCount == 0 && failedCount == 0) {
+        return;
+    }
+    size_t pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = requests.size() - residentCount - failedCount;
+    }
+    std::ios_base::fmtflags flags = std::cout.flags();
+    std::cout << "Asset streaming: " << residentCount << " resident (" << std::fixed << std::setprecision(1)
+              << static_cast<double>(residentBytes) / (1024.0 * 1024.0) << " MiB), " << failedCount << " failed, "
+              << pending << " pending, " << (residentCount > 0 ? totalLatencyMs / residentCount : 0.0)
+              << " ms average and " << maxLatencyMs << " ms worst from request to resident, " << mipsDropped
+              << " mips dropped and " << mipsRestored << " restored" << std::endl;
+    std::cout.flags(flags);
+}
+
+float AssetStreamer::screenSpaceSize(float radius, float distance, float fovY, float viewportHeight) {
+    // inside the sphere it covers the screen, which beats everything else
+    if (distance <= radius) {
+        return std::numeric_limits<float>::max();
+    }
+    return radius / (distance * std::tan(fovY * 0.5f)) * viewportHeight;
+}
+
+void AssetStreamer::ioLoop() {
+    /*
+     * This function is what every I/O thread runs, the priority is looked at when a request is picked rather
+     * than when it was queued, so setPriority() takes effect on everything still waiting. New loads go before
+     * changes of mips, a missing asset is worse than a blurry one
+     */
+    TRACE_THREAD_NAME("asset io");
+    while (true) {
+        Request* request;
+        bool mipChange;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workAvailable.wait(lock, [this] { return stopping || !queued.empty() || !mipChangesQueued.empty(); });
+            if (stopping) {
+                return;
+            }
+            mipChange = queued.empty();
+            std::vector<AssetId>& queue = mipChange ? mipChangesQueued : queued;
+            // the earliest of the largest, the queue is in request order
+            auto next = std::max_element(queue.begin(), queue.end(), [this](AssetId a, AssetId b) {
+                return requests[a]->priority < requests[b]->priority;
+            });
+            request = requests[*next].get();
+            queue.erase(next);
+            if (!mipChange) {
+                request->state = AssetState::Loading;
+            }
+        }
+
+        try {
+            if (mipChange) {
+                changeMips(*request);
+            }
+            else {
+                load(*request);
+            }
+        }
+        catch (const std::exception& error) {
+            std::lock_guard<std::mutex> lock(mutex);
+            request->error = error.what();
+            // poll() reports it, and returns the budget if any was taken
+            if (mipChange) {
+                request->replacementFailed = true;
+                mipChangesUploading.push_back(request->id);
+            }
+            else {
+                request->state = AssetState::Failed;
+                uploading.push_back(request->id);
+            }
+        }
+    }
+}
+
+void AssetStreamer::load(Request& request) {
+    TRACE_SCOPE("AssetStreamer::load");
+    std::shared_ptr<AssetContainer> container = openContainer(request.path);
+    std::optional<uint32_t> entry = container->find(request.name);
+    if (!entry.has_value()) {
+        throw std::runtime_error("no asset of that name in the file");
+    }
+    request.type = container->getEntry(entry.value()).type;
+    if (request.type == AssetType::Mesh) {
+        loadMesh(request, *container, entry.value());
+    }
+    else {
+        loadTexture(request, *container, entry.value());
+    }
+}
+
+void AssetStreamer::loadMesh(Request& request, const AssetContainer& container, uint32_t entry) {
+    /*
+     * This function creates one buffer for all of the mesh's streams and copies the data section into it as is
+     */
+    const AssetMeshHeader& header = container.getMesh(entry);
+    request.mesh.header = header;
+    container.getFile().prefetch(header.dataOffset, header.dataSize);
+    container.checkMeshIndices(entry);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = header.dataSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                       | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    applySharing(bufferInfo.sharingMode, bufferInfo.queueFamilyIndexCount, bufferInfo.pQueueFamilyIndices);
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &request.mesh.buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mesh buffer!");
+    }
+    request.mesh.allocation = allocator->allocateForBuffer(request.mesh.buffer, uploader->getStaticDataUsage());
+
+    reserveBudget(request.bytes, header.dataSize);
+    UploadTicket ticket = uploader->uploadBuffer(request.mesh.buffer, request.mesh.allocation, 0,
+                                                 container.getData(header.dataOffset), header.dataSize);
+    std::lock_guard<std::mutex> lock(mutex);
+    request.ticket = ticket;
+    request.state = AssetState::Uploading;
+    uploading.push_back(request.id);
+}
+
+void AssetStreamer::loadTexture(Request& request, const AssetContainer& container, uint32_t entry) {
+    /*
+     * This function creates the texture with its mip chain, less the top mips the load bias says to leave out.
+     * Compressed formats need their device feature, which is checked through the format
+     */
+    const AssetTextureHeader& header = container.getTexture(entry);
+    VkFormat format = static_cast<VkFormat>(header.format);
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+    if ((properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == 0) {
+        throw std::runtime_error("the device can not sample texture format " + std::to_string(header.format));
+    }
+    uint32_t firstMip;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        firstMip = std::min(loadMipBias, header.mipCount - 1);
+        for (uint32_t mip = 0; mip < header.mipCount; mip++) {
+            request.mipSizes.push_back(header.mips[mip].size);
+        }
+    }
+
+    UploadTicket ticket;
+    createTexture(header, container, firstMip, request.texture, request.bytes, ticket);
+    std::lock_guard<std::mutex> lock(mutex);
+    request.ticket = ticket;
+    request.state = AssetState::Uploading;
+    uploading.push_back(request.id);
+}
+
+void AssetStreamer::changeMips(Request& request) {
+    /*
+     * This function builds the replacement of a resident texture from the same mapping it was loaded from, the
+     * header is read again rather than kept, the container stays mapped anyway
+     */
+    TRACE_SCOPE("AssetStreamer::changeMips");
+    std::shared_ptr<AssetContainer> container = openContainer(request.path);
+    std::optional<uint32_t> entry = container->find(request.name);
+    if (!entry.has_value()) {
+        throw std::runtime_error("no asset of that name in the file");
+    }
+    // set under the lock before the request was queued, and left alone until poll() is done with it
+    uint32_t firstMip = request.pendingFirstMip.value();
+
+    // written straight into the request, poll() does not look at it before it is on the uploading list, and a
+    // failure halfway has to wait for the copies that were queued before it is freed
+    createTexture(container->getTexture(entry.value()), *container, firstMip, request.replacement, request.replacementBytes,
+                  request.replacementTicket);
+    std::lock_guard<std::mutex> lock(mutex);
+    mipChangesUploading.push_back(request.id);
+}
+
+void AssetStreamer::createTexture(const AssetTextureHeader& header, const AssetContainer& container, uint32_t firstMip,
+                                  StreamedTexture& texture, VkDeviceSize& reserved, UploadTicket& ticket) {
+    /*
+     * This function creates an image for the mips from firstMip down and queues one copy per mip, each straight
+     * from its place in the mapping. What it created is in texture as soon as it exists, so a failure halfway
+     * leaves nothing that destroyTexture() does not free
+     */
+    VkFormat format = static_cast<VkFormat>(header.format);
+    const AssetMip& topMip = header.mips[firstMip];
+    VkDeviceSize bytes = 0;
+    for (uint32_t mip = firstMip; mip < header.mipCount; mip++) {
+        container.getFile().prefetch(header.dataOffset + header.mips[mip].offset, header.mips[mip].size);
+        bytes += header.mips[mip].size;
+    }
+    texture.firstMip = firstMip;
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = format;
+    imageInfo.extent = {topMip.width, topMip.height, 1};
+    imageInfo.mipLevels = header.mipCount - firstMip;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    applySharing(imageInfo.sharingMode, imageInfo.queueFamilyIndexCount, imageInfo.pQueueFamilyIndices);
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device, &imageInfo, nullptr, &texture.image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture image!");
+    }
+    texture.allocation = allocator->allocateForImage(texture.image, MemoryUsage::GpuOnly);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = texture.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = imageInfo.mipLevels;
+    viewInfo.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(device, &viewInfo, nullptr, &texture.view) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture image view!");
+    }
+
+    reserveBudget(reserved, bytes);
+    for (uint32_t mip = firstMip; mip < header.mipCount; mip++) {
+        const AssetMip& assetMip = header.mips[mip];
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = mip - firstMip;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {assetMip.width, assetMip.height, 1};
+        ticket = uploader->uploadImage(texture.image, region, container.getData(header.dataOffset + assetMip.offset),
+                                       assetMip.size, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+}
+
+void AssetStreamer::destroyTexture(StreamedTexture& texture) {
+    if (texture.bindlessIndex != UINT32_MAX) {
+        bindless->remove(BindlessKind::SampledImage, texture.bindlessIndex);
+    }
+    if (texture.view != VK_NULL_HANDLE) {
+        vkDestroyImageView(device, texture.view, nullptr);
+    }
+    if (texture.image != VK_NULL_HANDLE) {
+        vkDestroyImage(device, texture.image, nullptr);
+        allocator->free(texture.allocation);
+    }
+    texture = StreamedTexture{};
+}
+
+void AssetStreamer::reserveBudget(VkDeviceSize& reserved, VkDeviceSize bytes) {
+    /*
+     * This function blocks the I/O thread until its bytes fit under the in flight cap. A single asset larger
+     * than the cap still goes through, alone
+     */
+    std::unique_lock<std::mutex> lock(mutex);
+    budgetAvailable.wait(lock, [this, bytes] {
+        return stopping || bytesInFlight == 0 || bytesInFlight + bytes <= maxBytesInFlight;
+    });
+    bytesInFlight += bytes;
+    // returned by poll() once the request leaves the uploading list, failed or resident
+    reserved = bytes;
+}
+
+VkDeviceSize AssetStreamer::textureBytes(const std::vector<VkDeviceSize>& mipSizes, uint32_t firstMip) {
+    VkDeviceSize bytes = 0;
+    for (size_t mip = firstMip; mip < mipSizes.size(); mip++) {
+        bytes += mipSizes[mip];
+    }
+    return bytes;
+}
+
+std::shared_ptr<AssetContainer> AssetStreamer::openContainer(const std::string& path) {
+    std::lock_guard<std::mutex> lock(containerMutex);
+    auto found = containers.find(path);
+    if (found != containers.end()) {
+        return found->second;
+    }
+    auto container = std::make_shared<AssetContainer>();
+    container->open(path);
+    containers.emplace(path, container);
+    return container;
+}
+
+void AssetStreamer::applySharing(VkSharingMode& sharingMode, uint32_t& familyCount, const uint32_t*& families) const {
+    // shared with the transfer family, so the uploader's writes need no ownership transfer
+    if (queueFamilies.size() > 1) {
+        sharingMode = VK_SHARING_MODE_CONCURRENT;
+        familyCount = static_cast<uint32_t>(queueFamilies.size());
+        families = queueFamilies.data();
+    }
+    else {
+        sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "asset_format.h"
+#include "bindless_descriptors.h"
+#include "gpu_allocator.h"
+#include "staging_uploader.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using AssetId = uint32_t;
+
+enum class AssetState {
+    Queued,
+    Loading,
+    // the copies are queued on the uploader, the asset is resident once their ticket completes
+    Uploading,
+    Resident,
+    Failed,
+};
+
+struct StreamedMesh {
+    /*
+     * This struct is a mesh on the GPU, every stream of the file's data section in one buffer at the
+     * header's offsets
+     */
+    VkBuffer buffer = VK_NULL_HANDLE;
+    GpuAllocation allocation;
+    AssetMeshHeader header{};
+};
+
+struct StreamedTexture {
+    VkImage image = VK_NULL_HANDLE;
+    GpuAllocation allocation;
+    VkImageView view = VK_NULL_HANDLE;
+    // index in the bindless image array, UINT32_MAX without a bindless set, a new one after every change of mips
+    uint32_t bindlessIndex = UINT32_MAX;
+    // the asset's mip that is the image's mip 0, everything above it was left out to save memory
+    uint32_t firstMip = 0;
+};
+
+struct TextureResidency {
+    /*
+     * This struct is what the residency manager sees of one resident texture
+     */
+    AssetId id = 0;
+    float priority = 0.0f;
+    uint32_t firstMip = 0;
+    // the upload size of every mip of the asset, about what the mip costs in memory too
+    std::vector<VkDeviceSize> mipSizes;
+    // a change of its mips is queued or uploading, it takes no other one until that is done
+    bool changing = false;
+};
+
+class AssetStreamer {
+    /*
+     * This class loads assets out of asset containers on its own I/O threads, the main loop never touches a file.
+     * A free I/O thread always takes the queued request with the largest screen space size, and a request's size
+     * can change while it waits. Loading maps the container, creates the resource and copies the section from the
+     * mapping straight into the staging ring, page faults and all happen on the I/O thread. The bytes handed to the
+     * uploader and not yet on the GPU are capped, so streaming never fills the ring for the frame's own uploads.
+     * poll() on the main thread moves finished uploads to resident and adds textures to the bindless set.
+     * setFirstMip() trades a resident texture's detail for memory or back. The texture is rebuilt with the new mip
+     * range on an I/O thread, from the mapping like a load, and the old image stays in use until the new one is on
+     * the GPU. The new image gets a new bindless index, the old one and its image are only released once no frame
+     * in flight can use them
+     */
+public:
+    void create(VkPhysicalDevice physicalDevice, DeviceMemoryAllocator& allocator, StagingUploader& uploader,
+                BindlessDescriptors* bindless, const std::vector<uint32_t>& queueFamilies, uint32_t framesInFlight,
+                uint32_t ioThreadCount = 2, VkDeviceSize maxBytesInFlight = 16ull * 1024 * 1024);
+    // the device has to be idle
+    void destroy();
+
+    // screenSize is the priority, see screenSpaceSize()
+    AssetId request(const std::string& path, const std::string& name, float screenSize);
+    std::vector<AssetId> requestAll(const std::string& path, float screenSize);
+    void setPriority(AssetId id, float screenSize);
+
+    // once a frame on the main thread, after the uploader's flush of the previous frame was submitted
+    void poll(uint64_t frameNumber);
+
+    // the resident textures, for the residency manager
+    std::vector<TextureResidency> getTextureResidency() const;
+    // queues rebuilding a resident texture with the mips from firstMip down, false if the texture is not resident,
+    // is already changing or has no such mip
+    bool setFirstMip(AssetId id, uint32_t firstMip);
+    // textures loaded from now on leave out this many top mips (never their last one)
+    void setLoadMipBias(uint32_t bias);
+    // mip changes queued, uploading, or swapped in with the old image not freed yet, main thread only
+    uint32_t getPendingMipChanges() const;
+
+    bool isCreated() const { return !ioThreads.empty(); }
+    AssetState getState(AssetId id) const;
+    // nullptr unless the asset is resident, the texture's bindless index changes with its mips, read it every frame
+    const StreamedMesh* getMesh(AssetId id) const;
+    const StreamedTexture* getTexture(AssetId id) const;
+    void printStats() const;
+
+    // the projected diameter in pixels of a sphere of radius at distance, for a vertical field of view fovY
+    static float screenSpaceSize(float radius, float distance, float fovY, float viewportHeight);
+
+private:
+    struct Request {
+        AssetId id;
+        std::string path;
+        std::string name;
+        float priority;
+        AssetState state = AssetState::Queued;
+        AssetType type = AssetType::Mesh;
+        StreamedMesh mesh;
+        StreamedTexture texture;
+        UploadTicket ticket;
+        VkDeviceSize bytes = 0;
+        std::chrono::steady_clock::time_point requested;
+        std::string error;
+
+        // textures, the upload size of every mip
+        std::vector<VkDeviceSize> mipSizes;
+        // a change of mips in progress, the replacement is built while texture stays in use
+        std::optional<uint32_t> pendingFirstMip;
+        StreamedTexture replacement;
+        UploadTicket replacementTicket;
+        VkDeviceSize replacementBytes = 0;
+        bool replacementFailed = false;
+    };
+
+    struct RetiredTexture {
+        StreamedTexture texture;
+        // destroyed at the start of this frame
+        uint64_t releaseFrame;
+    };
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    DeviceMemoryAllocator* allocator = nullptr;
+    StagingUploader* uploader = nullptr;
+    BindlessDescriptors* bindless = nullptr;
+    std::vector<uint32_t> queueFamilies;
+    VkDeviceSize maxBytesInFlight = 0;
+    uint32_t framesInFlight = 1;
+
+    std::vector<std::thread> ioThreads;
+    mutable std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable budgetAvailable;
+    bool stopping = false;
+    // stable addresses, the I/O threads work on a request outside the lock
+    std::vector<std::unique_ptr<Request>> requests;
+    std::vector<AssetId> queued;
+    std::vector<AssetId> uploading;
+    // mip changes, the queued ones are picked after every new load
+    std::vector<AssetId> mipChangesQueued;
+    std::vector<AssetId> mipChangesUploading;
+    uint32_t pendingMipChanges = 0;
+    uint32_t loadMipBias = 0;
+    VkDeviceSize bytesInFlight = 0;
+
+    std::mutex containerMutex;
+    std::map<std::string, std::shared_ptr<AssetContainer>> containers;
+
+    // main thread only
+    uint32_t residentCount = 0;
+    uint32_t failedCount = 0;
+    VkDeviceSize residentBytes = 0;
+    double totalLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+    std::vector<RetiredTexture> retired;
+    uint32_t mipsDropped = 0;
+    uint32_t mipsRestored = 0;
+
+    void ioLoop();
+    void load(Request& request);
+    void loadMesh(Request& request, const AssetContainer& container, uint32_t entry);
+    void loadTexture(Request& request, const AssetContainer& container, uint32_t entry);
+    void changeMips(Request& request);
+    void createTexture(const AssetTextureHeader& header, const AssetContainer& container, uint32_t firstMip,
+                       StreamedTexture& texture, VkDeviceSize& reserved, UploadTicket& ticket);
+    void destroyTexture(StreamedTexture& texture);
+    void reserveBudget(VkDeviceSize& reserved, VkDeviceSize bytes);
+    static VkDeviceSize textureBytes(const std::vector<VkDeviceSize>& mipSizes, uint32_t firstMip);
+    std::shared_ptr<AssetContainer> openContainer(const std::string& path);
+    void applySharing(VkSharingMode& sharingMode, uint32_t& familyCount, const uint32_t*& families) const;
+};
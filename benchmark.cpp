@@ -0,0 +1,124 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+
+const char* benchSceneName(BenchScene scene) {
+    switch (scene) {
+        case BenchScene::Clear: return "clear";
+        case BenchScene::Upload: return "upload";
+        case BenchScene::ManyItems: return "many-items";
+        case BenchScene::GpuDriven: return "gpu-driven";
+        case BenchScene::Particles: return "particles";
+    }
+    return "unknown";
+}
+
+std::optional<BenchScene> parseBenchScene(const std::string& name) {
+    if (name == "clear") return BenchScene::Clear;
+    if (name == "upload") return BenchScene::Upload;
+    if (name == "many-items") return BenchScene::ManyItems;
+    if (name == "gpu-driven") return BenchScene::GpuDriven;
+    if (name == "particles") return BenchScene::Particles;
+    return std::nullopt;
+}
+
+std::vector<BenchScene> allBenchScenes() {
+#ifdef VK_TUT_NO_SHADERS
+    // built without glslc, see benchSceneNeedsShaders()
+    return {BenchScene::Clear, BenchScene::Upload, BenchScene::ManyItems};
+#else
+    return {BenchScene::Clear, BenchScene::Upload, BenchScene::ManyItems, BenchScene::GpuDriven, BenchScene::Particles};
+#endif
+}
+
+bool benchSceneNeedsShaders(BenchScene scene) {
+    return scene == BenchScene::GpuDriven || scene == BenchScene::Particles;
+}
+
+double RunStats::startupMilliseconds() const {
+    double end = 0.0;
+    for (const StartupPhase& phase : startupPhases) {
+        end = std::max(end, phase.startMilliseconds + phase.milliseconds);
+    }
+    return end;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        if (static_cast<unsigned char>(c) >= 0x20) {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+double percentile(std::vector<double> samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(samples.size())));
+    rank = std::clamp<size_t>(rank, 1, samples.size());
+    return samples[rank - 1];
+}
+
+void writeBenchJson(std::ostream& out, const std::vector<std::pair<BenchScene, RunStats>>& results) {
+    /*
+     * This function writes the results in a stable layout, so CI can diff or parse it without knowing the code
+     */
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& [scene, stats] = results[i];
+        const std::vector<double>& frames = stats.frameMilliseconds;
+        double average = frames.empty() ? 0.0 : std::accumulate(frames.begin(), frames.end(), 0.0) / static_cast<double>(frames.size());
+
+        // device names come from the driver, keep them valid JSON no matter what is in there
+        std::string deviceName = jsonEscape(stats.deviceName);
+
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\n";
+        out << "      \"scene\": \"" << benchSceneName(scene) << "\",\n";
+        out << "      \"device\": {\"name\": \"" << deviceName << "\", \"vendorID\": " << stats.vendorID
+            << ", \"deviceID\": " << stats.deviceID << ", \"driverVersion\": " << stats.driverVersion << "},\n";
+        out << "      \"frames\": " << frames.size() << ",\n";
+        out << "      \"frameTimeMs\": {\"avg\": " << average << ", \"p50\": " << percentile(frames, 50.0)
+            << ", \"p90\": " << percentile(frames, 90.0) << ", \"p99\": " << percentile(frames, 99.0)
+            << ", \"max\": " << percentile(frames, 100.0) << "},\n";
+        out << "      \"gpuFrameMs\": {\"min\": " << stats.gpuFrame.minMilliseconds << ", \"avg\": " << stats.gpuFrame.avgMilliseconds
+            << ", \"p99\": " << stats.gpuFrame.p99Milliseconds << ", \"samples\": " << stats.gpuFrame.samples << "},\n";
+        out << "      \"memory\": {\"reservedBytes\": " << stats.memory.reservedBytes << ", \"usedBytes\": " << stats.memory.usedBytes
+            << ", \"blocks\": " << stats.memory.blockCount << ", \"dedicated\": " << stats.memory.dedicatedCount << "},\n";
+        out << "      \"uploadedBytes\": " << stats.uploadedBytes << ",\n";
+        out << "      \"pipelineCompileMs\": " << stats.pipelineCompileMilliseconds << ",\n";
+        if (!stats.frameHeapAllocations.empty()) {
+            // the second half is the steady state, the first frames still grow pools, arenas and caches
+            const std::vector<double>& allocations = stats.frameHeapAllocations;
+            std::vector<double> steady(allocations.begin() + static_cast<std::ptrdiff_t>(allocations.size() / 2), allocations.end());
+            double total = std::accumulate(allocations.begin(), allocations.end(), 0.0);
+            out << std::setprecision(1);
+            out << "      \"heapAllocationsPerFrame\": {\"avg\": " << total / static_cast<double>(allocations.size())
+                << ", \"p50\": " << percentile(allocations, 50.0) << ", \"max\": " << percentile(allocations, 100.0)
+                << ", \"steadyMax\": " << percentile(steady, 100.0) << "},\n";
+            out << std::setprecision(3);
+        }
+        out << "      \"timeToFirstFrameMs\": " << stats.timeToFirstFrameMilliseconds << ",\n";
+        out << "      \"startupMs\": {\"total\": " << stats.startupMilliseconds();
+        for (const StartupPhase& phase : stats.startupPhases) {
+            out << ", \"" << phase.name << "\": " << phase.milliseconds;
+        }
+        out << "}\n";
+        out << "    }";
+    }
+    out << "\n  ]\n}\n";
+    out.flags(flags);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "gpu_allocator.h"
+#include "gpu_profiler.h"
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+enum class BenchScene {
+    // clears the target every frame, measures the bare frame loop
+    Clear,
+    // streams a few MiB through the staging ring every frame on top of the clear
+    Upload,
+    // tens of thousands of tiny commands a frame, recorded in parallel, a stand in for many small draws
+    ManyItems,
+    // 50k instanced cubes culled and turned into indirect draws by a compute pass, no per instance CPU work
+    GpuDriven,
+    // 1M particles stepped on the async compute queue through the compute job API, the frame waits for each step
+    Particles,
+};
+
+const char* benchSceneName(BenchScene scene);
+std::optional<BenchScene> parseBenchScene(const std::string& name);
+// every scene this build can run, the ones that need shaders are missing from a build without glslc
+std::vector<BenchScene> allBenchScenes();
+bool benchSceneNeedsShaders(BenchScene scene);
+
+// thrown before the device is created when it lacks a feature the scene can not do without,
+// the regression suite skips the case, every other error fails it
+class UnsupportedSceneError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+struct StartupPhase {
+    const char* name;
+    // since the start of the run, phases on worker threads overlap others
+    double startMilliseconds;
+    double milliseconds;
+};
+
+struct RunStats {
+    /*
+     * This struct is what one run of the application measured, filled when a caller hands one in,
+     * the benchmark target turns it into the JSON report
+     */
+    std::string deviceName;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    uint32_t driverVersion = 0;
+    std::vector<StartupPhase> startupPhases;
+    double timeToFirstFrameMilliseconds = 0.0;
+    std::vector<double> frameMilliseconds;
+    // heap allocations on all threads while each frame's drawFrame runs (with --multi-device the other devices'
+    // frames overlap), empty where operator new is not counted
+    std::vector<double> frameHeapAllocations;
+    GpuProfiler::PassStats gpuFrame;
+    GpuMemoryStats memory;
+    uint64_t uploadedBytes = 0;
+    // summed over every pipeline, what a warm pipeline cache saves
+    double pipelineCompileMilliseconds = 0.0;
+
+    // wall clock time until the last init phase finished, not the sum of the phases
+    double startupMilliseconds() const;
+};
+
+// quotes and backslashes escaped, control characters dropped, for strings that come from the driver
+std::string jsonEscape(const std::string& text);
+
+// nearest rank percentile, p in [0, 100], 0 for no samples
+double percentile(std::vector<double> samples, double p);
+
+// one JSON object per scene under "results", first frames are part of the numbers, warm up is up to the scene length
+void writeBenchJson(std::ostream& out, const std::vector<std::pair<BenchScene, RunStats>>& results);
@@ -0,0 +1,230 @@
+#include "bindless_descriptors.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+const VkDescriptorType BINDING_TYPES[3] = {
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+};
+
+const char* KIND_NAMES[3] = {"storage buffer", "sampler", "sampled image"};
+
+}
+
+bool BindlessDescriptors::enableFeatures(const VkPhysicalDeviceVulkan12Features& supported, VkPhysicalDeviceVulkan12Features& enabled) {
+    /*
+     * This function checks for the descriptor indexing features and turns them on if they are all there,
+     * partially working bindless is not worth a second code path
+     */
+    bool complete = supported.descriptorIndexing
+                    && supported.runtimeDescriptorArray
+                    && supported.descriptorBindingPartiallyBound
+                    && supported.descriptorBindingVariableDescriptorCount
+                    && supported.descriptorBindingUpdateUnusedWhilePending
+                    && supported.descriptorBindingStorageBufferUpdateAfterBind
+                    && supported.descriptorBindingSampledImageUpdateAfterBind
+                    && supported.shaderSampledImageArrayNonUniformIndexing
+                    && supported.shaderStorageBufferArrayNonUniformIndexing;
+    if (!complete) {
+        return false;
+    }
+    enabled.descriptorIndexing = VK_TRUE;
+    enabled.runtimeDescriptorArray = VK_TRUE;
+    enabled.descriptorBindingPartiallyBound = VK_TRUE;
+    enabled.descriptorBindingVariableDescriptorCount = VK_TRUE;
+    enabled.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    enabled.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+    enabled.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    enabled.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    enabled.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+    return true;
+}
+
+void BindlessDescriptors::create(VkPhysicalDevice physicalDevice, VkDevice deviceIn, uint32_t framesInFlightIn) {
+    /*
+     * This function sizes the arrays to what the device allows for update-after-bind sets (capped, the whole
+     * array is reserved in the pool) and allocates the one set. The per stage limits count every set of a
+     * pipeline layout, so they are taken minus RESERVED_PER_STAGE_DESCRIPTORS for the sets next to this one
+     */
+    device = deviceIn;
+    framesInFlight = framesInFlightIn;
+
+    VkPhysicalDeviceVulkan12Properties vulkan12Properties{};
+    vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &vulkan12Properties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+    auto perStage = [](uint32_t limit) {
+        return limit > RESERVED_PER_STAGE_DESCRIPTORS ? limit - RESERVED_PER_STAGE_DESCRIPTORS : 0u;
+    };
+    uint32_t buffers = std::min({4096u, vulkan12Properties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+                                 perStage(vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers)});
+    uint32_t samplers = std::min({64u, vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers,
+                                  perStage(vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers)});
+    uint32_t images = std::min({16384u, vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages,
+                                perStage(vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages)});
+    // all three arrays count against one per stage limit, the images give way
+    uint32_t resourceLimit = perStage(vulkan12Properties.maxPerStageUpdateAfterBindResources);
+    if (buffers == 0 || samplers == 0 || buffers + samplers >= resourceLimit) {
+        throw std::runtime_error("failed to fit the bindless descriptor arrays in the device limits!");
+    }
+    images = std::min(images, resourceLimit - buffers - samplers);
+    slots[static_cast<uint32_t>(BindlessKind::StorageBuffer)].capacity = buffers;
+    slots[static_cast<uint32_t>(BindlessKind::Sampler)].capacity = samplers;
+    slots[static_cast<uint32_t>(BindlessKind::SampledImage)].capacity = images;
+
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+    std::array<VkDescriptorBindingFlags, 3> bindingFlags{};
+    std::array<VkDescriptorPoolSize, 3> poolSizes{};
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = BINDING_TYPES[i];
+        bindings[i].descriptorCount = slots[i].capacity;
+        bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+        bindingFlags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+                          | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+        poolSizes[i] = {BINDING_TYPES[i], slots[i].capacity};
+    }
+    // only the last binding can have a variable count
+    bindingFlags.back() |= VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+    flagsInfo.pBindingFlags = bindingFlags.data();
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &flagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create bindless descriptor set layout!");
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create bindless descriptor pool!");
+    }
+
+    uint32_t variableCount = images;
+    VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{};
+    countInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+    countInfo.descriptorSetCount = 1;
+    countInfo.pDescriptorCounts = &variableCount;
+    VkDescriptorSetAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocateInfo.pNext = &countInfo;
+    allocateInfo.descriptorPool = pool;
+    allocateInfo.descriptorSetCount = 1;
+    allocateInfo.pSetLayouts = &layout;
+    if (vkAllocateDescriptorSets(device, &allocateInfo, &set) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate bindless descriptor set!");
+    }
+
+    std::cout << "Bindless descriptors: " << buffers << " storage buffers, " << samplers << " samplers, "
+              << images << " sampled images" << std::endl;
+}
+
+void BindlessDescriptors::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (set == VK_NULL_HANDLE) {
+        return;
+    }
+    // the set goes with the pool
+    vkDestroyDescriptorPool(device, pool, nullptr);
+    vkDestroyDescriptorSetLayout(device, layout, nullptr);
+    set = VK_NULL_HANDLE;
+    for (Slots& kindSlots : slots) {
+        kindSlots = Slots{};
+    }
+}
+
+uint32_t BindlessDescriptors::addStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t index = allocateSlot(BindlessKind::StorageBuffer);
+    VkDescriptorBufferInfo bufferInfo{buffer, offset, range};
+    write(BindlessKind::StorageBuffer, index, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &bufferInfo, nullptr);
+    return index;
+}
+
+uint32_t BindlessDescriptors::addSampler(VkSampler sampler) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t index = allocateSlot(BindlessKind::Sampler);
+    VkDescriptorImageInfo imageInfo{sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED};
+    write(BindlessKind::Sampler, index, VK_DESCRIPTOR_TYPE_SAMPLER, nullptr, &imageInfo);
+    return index;
+}
+
+uint32_t BindlessDescriptors::addSampledImage(VkImageView imageView, VkImageLayout imageLayout) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t index = allocateSlot(BindlessKind::SampledImage);
+    VkDescriptorImageInfo imageInfo{VK_NULL_HANDLE, imageView, imageLayout};
+    write(BindlessKind::SampledImage, index, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, nullptr, &imageInfo);
+    return index;
+}
+
+void BindlessDescriptors::remove(BindlessKind kind, uint32_t index) {
+    /*
+     * This function leaves the descriptor as it is, partially bound means nobody minds as long as no shader reads
+     * it, and frames still in flight may well do so
+     */
+    std::lock_guard<std::mutex> lock(mutex);
+    slots[static_cast<uint32_t>(kind)].retiring.emplace_back(index, frameNumber + framesInFlight);
+}
+
+void BindlessDescriptors::beginFrame(uint64_t frameNumberIn) {
+    std::lock_guard<std::mutex> lock(mutex);
+    frameNumber = frameNumberIn;
+    for (Slots& kindSlots : slots) {
+        while (!kindSlots.retiring.empty() && kindSlots.retiring.front().second <= frameNumber) {
+            kindSlots.freeIndices.push_back(kindSlots.retiring.front().first);
+            kindSlots.retiring.pop_front();
+        }
+    }
+}
+
+void BindlessDescriptors::bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout) const {
+    vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, BINDLESS_SET, 1, &set, 0, nullptr);
+}
+
+uint32_t BindlessDescriptors::allocateSlot(BindlessKind kind) {
+    Slots& kindSlots = slots[static_cast<uint32_t>(kind)];
+    if (!kindSlots.freeIndices.empty()) {
+        uint32_t index = kindSlots.freeIndices.back();
+        kindSlots.freeIndices.pop_back();
+        return index;
+    }
+    if (kindSlots.next == kindSlots.capacity) {
+        throw std::runtime_error(std::string("out of bindless ") + KIND_NAMES[static_cast<uint32_t>(kind)] + " descriptors!");
+    }
+    return kindSlots.next++;
+}
+
+void BindlessDescriptors::write(BindlessKind kind, uint32_t index, VkDescriptorType type,
+                                const VkDescriptorBufferInfo* bufferInfo, const VkDescriptorImageInfo* imageInfo) {
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = set;
+    descriptorWrite.dstBinding = static_cast<uint32_t>(kind);
+    descriptorWrite.dstArrayElement = index;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = type;
+    descriptorWrite.pBufferInfo = bufferInfo;
+    descriptorWrite.pImageInfo = imageInfo;
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
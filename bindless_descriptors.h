@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// the bindings of the bindless set, shaders/bindless.glsl declares the same
+enum class BindlessKind : uint32_t {
+    StorageBuffer = 0,
+    Sampler = 1,
+    SampledImage = 2,
+};
+
+class BindlessDescriptors {
+    /*
+     * This class is the one global descriptor set every pipeline binds as set BINDLESS_SET, with an array per
+     * descriptor kind. Resources are added once and referred to by their index (from push constants or material
+     * data) instead of being bound per draw. The set is update-after-bind and partially bound, so adding and
+     * removing resources never waits for the frames in flight that have it bound, removed indices are only
+     * handed out again once those frames are done. The image array is the variable sized last binding
+     */
+public:
+    static constexpr uint32_t BINDLESS_SET = 1;
+    // what the per stage limits keep free for the other sets of a pipeline layout that includes the bindless set,
+    // and for its color attachments. The gpu-driven draw's set 0 has 7 descriptors, 16 leaves room to grow
+    static constexpr uint32_t RESERVED_PER_STAGE_DESCRIPTORS = 16;
+
+    // turns on the descriptor indexing features the set needs in enabled, if supported has them all
+    static bool enableFeatures(const VkPhysicalDeviceVulkan12Features& supported, VkPhysicalDeviceVulkan12Features& enabled);
+
+    void create(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t framesInFlight);
+    void destroy();
+
+    // thread safe, an index stays valid until it is removed
+    uint32_t addStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+    uint32_t addSampler(VkSampler sampler);
+    uint32_t addSampledImage(VkImageView imageView, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    void remove(BindlessKind kind, uint32_t index);
+
+    // recycles the indices removed far enough back that no frame in flight can still use them
+    void beginFrame(uint64_t frameNumber);
+
+    bool isCreated() const { return set != VK_NULL_HANDLE; }
+    VkDescriptorSetLayout getLayout() const { return layout; }
+    VkDescriptorSet getSet() const { return set; }
+    void bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout) const;
+
+private:
+    struct Slots {
+        uint32_t capacity = 0;
+        uint32_t next = 0;
+        std::vector<uint32_t> freeIndices;
+        // index -> frame number from which it may be reused
+        std::deque<std::pair<uint32_t, uint64_t>> retiring;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    uint32_t framesInFlight = 1;
+    uint64_t frameNumber = 0;
+
+    std::mutex mutex;
+    Slots slots[3];
+
+    uint32_t allocateSlot(BindlessKind kind);
+    void write(BindlessKind kind, uint32_t index, VkDescriptorType type,
+               const VkDescriptorBufferInfo* bufferInfo, const VkDescriptorImageInfo* imageInfo);
+};
@@ -0,0 +1,414 @@
+#include "compute_jobs.h"
+
+#include "cpu_trace.h"
+#include "vk_handles.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+ComputeResource ComputeResource::storageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    ComputeResource resource;
+    resource.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    resource.buffer = buffer;
+    resource.offset = offset;
+    resource.range = range;
+    return resource;
+}
+
+ComputeResource ComputeResource::storageImage(VkImageView view) {
+    ComputeResource resource;
+    resource.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    resource.view = view;
+    return resource;
+}
+
+void ComputeJobs::create(VkDevice deviceIn, const QueueRef& computeQueueIn, uint32_t maxCachedSetsIn) {
+    device = deviceIn;
+    computeQueue = computeQueueIn;
+    maxCachedSets = maxCachedSetsIn;
+
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute timeline semaphore!");
+    }
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = computeQueue.family;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute command pool!");
+    }
+
+    // the cache frees sets one by one when it is full, so the pool needs the free bit
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = maxCachedSets * 4;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = maxCachedSets * 2;
+    VkDescriptorPoolCreateInfo descriptorPoolInfo{};
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptorPoolInfo.maxSets = maxCachedSets;
+    descriptorPoolInfo.poolSizeCount = 2;
+    descriptorPoolInfo.pPoolSizes = poolSizes;
+    if (vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute descriptor pool!");
+    }
+
+    std::cout << "Compute jobs: queue family " << computeQueue.family << ", " << maxCachedSets << " cached descriptor sets"
+              << std::endl;
+}
+
+void ComputeJobs::destroy() {
+    if (!isCreated()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (submittedValue > 0) {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timeline;
+        waitInfo.pValues = &submittedValue;
+        vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    }
+    // the pipelines belong to the compiler, only the layouts are ours
+    for (const Kernel& kernel : kernels) {
+        vkDestroyPipelineLayout(device, kernel.pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, kernel.setLayout, nullptr);
+    }
+    kernels.clear();
+    pending.clear();
+    pendingWaits.clear();
+    setCache.clear();
+    inFlight.clear();
+    freeCommandBuffers.clear();
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroySemaphore(device, timeline, nullptr);
+    descriptorPool = VK_NULL_HANDLE;
+    commandPool = VK_NULL_HANDLE;
+    timeline = VK_NULL_HANDLE;
+    submittedValue = 0;
+    device = VK_NULL_HANDLE;
+}
+
+ComputeKernelHandle ComputeJobs::createKernel(PipelineCompiler& compilerIn, ShaderLibrary& shaders, const std::string& shader,
+                                              std::vector<VkDescriptorType> bindings, uint32_t pushConstantSize) {
+    /*
+     * This function creates the kernel's layouts right away and queues its pipeline on the compiler, the first
+     * submit() with a dispatch of it waits for the compile if it is not done by then
+     */
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindings.size());
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        layoutBindings[i].binding = i;
+        layoutBindings[i].descriptorType = bindings[i];
+        layoutBindings[i].descriptorCount = 1;
+        layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    setLayoutInfo.pBindings = layoutBindings.data();
+    VkDescriptorSetLayout setLayout;
+    if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute descriptor set layout!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.size = pushConstantSize;
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    VkPipelineLayout pipelineLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+        vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+        throw std::runtime_error("failed to create compute pipeline layout!");
+    }
+
+    PipelineHandle pipeline = compilerIn.request("compute " + shader, [&shaders, shader, pipelineLayout](PipelineCache& cache) {
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shaders.load(shader);
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = pipelineLayout;
+        VkPipeline computePipeline;
+        if (cache.createComputePipelines(1, &pipelineInfo, &computePipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline for " + shader + "!");
+        }
+        return computePipeline;
+    }, PipelinePriority::Normal, std::nullopt, {shader});
+
+    std::lock_guard<std::mutex> lock(mutex);
+    compiler = &compilerIn;
+    kernels.push_back({shader, std::move(bindings), pushConstantSize, setLayout, pipelineLayout, pipeline});
+    return static_cast<ComputeKernelHandle>(kernels.size() - 1);
+}
+
+bool ComputeJobs::isReady(ComputeKernelHandle kernel) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return compiler->isReady(kernels.at(kernel).pipeline);
+}
+
+void ComputeJobs::dispatch(ComputeDispatch dispatch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Kernel& kernel = kernels.at(dispatch.kernel);
+    // checked here rather than at submit, so the error points at the caller that got it wrong
+    bool matches = dispatch.resources.size() == kernel.bindings.size() && dispatch.pushConstants.size() == kernel.pushConstantSize;
+    for (size_t i = 0; matches && i < dispatch.resources.size(); i++) {
+        matches = dispatch.resources[i].type == kernel.bindings[i];
+    }
+    if (!matches) {
+        throw std::runtime_error("compute dispatch does not match the bindings of " + kernel.shader + "!");
+    }
+    pending.push_back(std::move(dispatch));
+}
+
+void ComputeJobs::addWait(VkSemaphore semaphore, uint64_t value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingWaits.emplace_back(semaphore, value);
+}
+
+ComputeTicket ComputeJobs::submit() {
+    /*
+     * This function records the queued dispatches in order, binding a pipeline only when the kernel changes,
+     * with a compute to compute barrier in front of every dispatch that comes after the previous one
+     */
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.empty()) {
+        return {submittedValue};
+    }
+    TRACE_SCOPE("ComputeJobs::submit");
+    // taken out first, a dispatch whose kernel failed to compile drops the batch instead of every later one
+    submitting.clear();
+    submitting.swap(pending);
+    const std::vector<ComputeDispatch>& batch = submitting;
+    submittingWaits.clear();
+    submittingWaits.swap(pendingWaits);
+    const std::vector<std::pair<VkSemaphore, uint64_t>>& waits = submittingWaits;
+
+    reclaim();
+    uint64_t value = submittedValue + 1;
+    VkCommandBuffer commandBuffer = acquireCommandBuffer();
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin compute command buffer!");
+    }
+
+    // a pipeline barrier also orders against what was submitted to the queue before, so the first one covers
+    // the earlier batches
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    ComputeKernelHandle boundKernel = UINT32_MAX;
+    for (size_t i = 0; i < batch.size(); i++) {
+        const ComputeDispatch& dispatch = batch[i];
+        const Kernel& kernel = kernels[dispatch.kernel];
+        if (i == 0 || dispatch.afterPrevious) {
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                                 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+        if (dispatch.kernel != boundKernel) {
+            // a rebuild from hot reload is picked up here, the old pipeline stays valid until the compiler retires it
+            VkPipeline pipeline = compiler->get(kernel.pipeline);
+            if (pipeline == VK_NULL_HANDLE) {
+                pipeline = compiler->wait(kernel.pipeline);
+            }
+            if (pipeline == VK_NULL_HANDLE) {
+                vkEndCommandBuffer(commandBuffer);
+                freeCommandBuffers.push_back(commandBuffer);
+                throw std::runtime_error("failed to compile compute kernel " + kernel.shader + "!");
+            }
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+            boundKernel = dispatch.kernel;
+        }
+        VkDescriptorSet set = getSet(dispatch, value);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipelineLayout, 0, 1, &set, 0, nullptr);
+        if (kernel.pushConstantSize > 0) {
+            vkCmdPushConstants(commandBuffer, kernel.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, kernel.pushConstantSize,
+                               dispatch.pushConstants.data());
+        }
+        vkCmdDispatch(commandBuffer, dispatch.groupCount[0], dispatch.groupCount[1], dispatch.groupCount[2]);
+    }
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record compute command buffer!");
+    }
+
+    submission.clear();
+    submission.execute(commandBuffer).signal(timeline, value);
+    for (const auto& [semaphore, waitValue] : waits) {
+        submission.waitFor(semaphore, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, waitValue);
+    }
+    submission.submit(computeQueue.queue);
+
+    submittedValue = value;
+    inFlight.push_back({value, commandBuffer});
+    batches++;
+    dispatches += batch.size();
+    return {value};
+}
+
+bool ComputeJobs::isComplete(ComputeTicket ticket) const {
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &completed);
+    return completed >= ticket.value;
+}
+
+void ComputeJobs::wait(ComputeTicket ticket) const {
+    if (ticket.value == 0) {
+        return;
+    }
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &ticket.value;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+}
+
+void ComputeJobs::printStats() const {
+    if (!isCreated()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "Compute jobs: " << dispatches << " dispatches in " << batches << " batches, descriptor sets "
+              << setCacheHits << " reused / " << setCacheMisses << " written" << std::endl;
+}
+
+VkDescriptorSet ComputeJobs::getSet(const ComputeDispatch& dispatch, uint64_t batchValue) {
+    /*
+     * This function finds the set for the dispatch's resources or writes a new one. A full cache first frees the
+     * sets whose last batch is done, and if every set is still in use waits for the batches in flight
+     */
+    SetKey& key = lookupKey;
+    key.kernel = dispatch.kernel;
+    key.resources.clear();
+    for (const ComputeResource& resource : dispatch.resources) {
+        if (resource.type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE) {
+            key.resources.insert(key.resources.end(), {handleBits(resource.view), 0, 0});
+        }
+        else {
+            key.resources.insert(key.resources.end(), {handleBits(resource.buffer), resource.offset, resource.range});
+        }
+    }
+    auto found = setCache.find(key);
+    if (found != setCache.end()) {
+        found->second.lastUse = batchValue;
+        setCacheHits++;
+        return found->second.set;
+    }
+
+    const Kernel& kernel = kernels[dispatch.kernel];
+    if (setCache.size() >= maxCachedSets) {
+        evictSets();
+    }
+    VkDescriptorSet set;
+    VkResult result = allocateSet(kernel.setLayout, set);
+    if (result != VK_SUCCESS && submittedValue > 0) {
+        // everything is in use by batches on the GPU, the ones of the batch being recorded are not submitted yet
+        wait({submittedValue});
+        evictSets();
+        result = allocateSet(kernel.setLayout, set);
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate compute descriptor set!");
+    }
+
+    std::vector<VkDescriptorBufferInfo> bufferInfos(dispatch.resources.size());
+    std::vector<VkDescriptorImageInfo> imageInfos(dispatch.resources.size());
+    std::vector<VkWriteDescriptorSet> writes(dispatch.resources.size());
+    for (uint32_t i = 0; i < dispatch.resources.size(); i++) {
+        const ComputeResource& resource = dispatch.resources[i];
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = resource.type;
+        if (resource.type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE) {
+            imageInfos[i].imageView = resource.view;
+            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            writes[i].pImageInfo = &imageInfos[i];
+        }
+        else {
+            bufferInfos[i].buffer = resource.buffer;
+            bufferInfos[i].offset = resource.offset;
+            bufferInfos[i].range = resource.range;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    setCache.emplace(key, CachedSet{set, batchValue});
+    setCacheMisses++;
+    return set;
+}
+
+VkResult ComputeJobs::allocateSet(VkDescriptorSetLayout layout, VkDescriptorSet& set) const {
+    VkDescriptorSetAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocateInfo.descriptorPool = descriptorPool;
+    allocateInfo.descriptorSetCount = 1;
+    allocateInfo.pSetLayouts = &layout;
+    return vkAllocateDescriptorSets(device, &allocateInfo, &set);
+}
+
+void ComputeJobs::evictSets() {
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &completed);
+    for (auto it = setCache.begin(); it != setCache.end();) {
+        if (it->second.lastUse <= completed) {
+            vkFreeDescriptorSets(device, descriptorPool, 1, &it->second.set);
+            it = setCache.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void ComputeJobs::reclaim() {
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &completed);
+    // batches finish in submission order, the done ones are always at the front
+    auto pendingStart = std::find_if(inFlight.begin(), inFlight.end(), [completed](const InFlightBatch& batch) {
+        return batch.value > completed;
+    });
+    for (auto it = inFlight.begin(); it != pendingStart; ++it) {
+        freeCommandBuffers.push_back(it->commandBuffer);
+    }
+    inFlight.erase(inFlight.begin(), pendingStart);
+}
+
+VkCommandBuffer ComputeJobs::acquireCommandBuffer() {
+    if (!freeCommandBuffers.empty()) {
+        VkCommandBuffer commandBuffer = freeCommandBuffers.back();
+        freeCommandBuffers.pop_back();
+        return commandBuffer;
+    }
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate compute command buffer!");
+    }
+    return commandBuffer;
+}
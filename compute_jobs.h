@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "pipeline_compiler.h"
+#include "queues.h"
+#include "shader_library.h"
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct ComputeTicket {
+    /*
+     * This struct is the point on the compute timeline semaphore at which a batch of dispatches is done,
+     * 0 is before the first batch and always complete
+     */
+    uint64_t value = 0;
+};
+
+// index into the kernel table, stable for the lifetime of the ComputeJobs
+using ComputeKernelHandle = uint32_t;
+
+struct ComputeResource {
+    /*
+     * This struct is what one binding of a kernel's set 0 points at, in the order of the kernel's bindings.
+     * Storage images have to be in VK_IMAGE_LAYOUT_GENERAL when the batch runs
+     */
+    VkDescriptorType type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize range = VK_WHOLE_SIZE;
+    VkImageView view = VK_NULL_HANDLE;
+
+    static ComputeResource storageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+    static ComputeResource storageImage(VkImageView view);
+};
+
+struct ComputeDispatch {
+    /*
+     * This struct is one queued dispatch, the push constants are copied so the caller's parameters can go
+     * out of scope right after dispatch()
+     */
+    ComputeKernelHandle kernel = 0;
+    std::vector<ComputeResource> resources;
+    std::vector<uint8_t> pushConstants;
+    uint32_t groupCount[3] = {1, 1, 1};
+    // false lets the dispatch overlap the one before it, for when it reads nothing that one writes
+    bool afterPrevious = true;
+
+    template<typename T>
+    void setPushConstants(const T& parameters) {
+        pushConstants.resize(sizeof(T));
+        std::memcpy(pushConstants.data(), &parameters, sizeof(T));
+    }
+};
+
+class ComputeJobs {
+    /*
+     * This class runs compute shaders on the compute queue (a dedicated family where the device has one, so it
+     * overlaps the graphics work) without the caller touching pipelines, layouts or descriptor sets.
+     * A kernel is a compute shader with its bindings in set 0 and its parameters in push constants, its layout
+     * and pipeline are built once (on the pipeline compiler, so hot reload rebuilds it) and every dispatch
+     * reuses them. Descriptor sets are cached by the resources they point at, a dispatch with the same buffers
+     * as before gets the same set without any vkUpdateDescriptorSets.
+     * Dispatches are queued from any thread and submit() records all of them into one command buffer, one
+     * vkQueueSubmit that signals the next value of a timeline semaphore. The ticket it returns is the future of
+     * the batch: poll it on the CPU, wait on it, or hand it to another queue's submit as a wait.
+     * Every batch starts with a barrier against the batches before it on the queue, so a simulation can read what
+     * its last step wrote. Resources written on another queue need VK_SHARING_MODE_CONCURRENT or an ownership
+     * transfer, like anything else shared between queues. Where the compute queue is the graphics queue
+     * submit() has to be called on the thread that submits the frames
+     */
+public:
+    void create(VkDevice device, const QueueRef& computeQueue, uint32_t maxCachedSets = 256);
+    // the device has to be idle
+    void destroy();
+
+    // bindings are the descriptor types of set 0 binding 0, 1, ..., pushConstantSize the bytes of the parameters
+    ComputeKernelHandle createKernel(PipelineCompiler& compiler, ShaderLibrary& shaders, const std::string& shader,
+                                     std::vector<VkDescriptorType> bindings, uint32_t pushConstantSize);
+    // ready once its pipeline is compiled, submit() waits for the pipelines of its dispatches
+    bool isReady(ComputeKernelHandle kernel) const;
+
+    void dispatch(ComputeDispatch dispatch);
+    // a timeline value the next batch waits for before its dispatches run, e.g. an upload ticket
+    void addWait(VkSemaphore semaphore, uint64_t value);
+    // records and submits every queued dispatch, returns the ticket of the last batch if none are queued
+    ComputeTicket submit();
+    bool isComplete(ComputeTicket ticket) const;
+    void wait(ComputeTicket ticket) const;
+
+    bool isCreated() const { return device != VK_NULL_HANDLE; }
+    VkSemaphore getTimelineSemaphore() const { return timeline; }
+    uint32_t getQueueFamily() const { return computeQueue.family; }
+    void printStats() const;
+
+private:
+    struct Kernel {
+        std::string shader;
+        std::vector<VkDescriptorType> bindings;
+        uint32_t pushConstantSize;
+        VkDescriptorSetLayout setLayout;
+        VkPipelineLayout pipelineLayout;
+        PipelineHandle pipeline;
+    };
+
+    struct SetKey {
+        ComputeKernelHandle kernel;
+        // handle, offset and range of every binding (a view is its handle with 0, 0)
+        std::vector<uint64_t> resources;
+
+        bool operator<(const SetKey& other) const {
+            return kernel != other.kernel ? kernel < other.kernel : resources < other.resources;
+        }
+    };
+
+    struct CachedSet {
+        VkDescriptorSet set;
+        // the batch that used it last, it can only be freed once that is done
+        uint64_t lastUse;
+    };
+
+    struct InFlightBatch {
+        uint64_t value;
+        VkCommandBuffer commandBuffer;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    QueueRef computeQueue;
+    PipelineCompiler* compiler = nullptr;
+    uint32_t maxCachedSets = 0;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkSemaphore timeline = VK_NULL_HANDLE;
+    uint64_t submittedValue = 0;
+
+    mutable std::mutex mutex;
+    std::vector<Kernel> kernels;
+    std::vector<ComputeDispatch> pending;
+    std::vector<std::pair<VkSemaphore, uint64_t>> pendingWaits;
+    // swapped with the pending lists by submit() and kept, so neither side loses its capacity
+    std::vector<ComputeDispatch> submitting;
+    std::vector<std::pair<VkSemaphore, uint64_t>> submittingWaits;
+    QueueSubmission submission;
+    // the key getSet() looks up with, reused so a cache hit allocates nothing
+    SetKey lookupKey;
+    std::map<SetKey, CachedSet> setCache;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+    std::vector<InFlightBatch> inFlight;
+
+    uint64_t batches = 0;
+    uint64_t dispatches = 0;
+    uint64_t setCacheHits = 0;
+    uint64_t setCacheMisses = 0;
+
+    VkDescriptorSet getSet(const ComputeDispatch& dispatch, uint64_t batchValue);
+    VkResult allocateSet(VkDescriptorSetLayout layout, VkDescriptorSet& set) const;
+    void evictSets();
+    void reclaim();
+    VkCommandBuffer acquireCommandBuffer();
+};
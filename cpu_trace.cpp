@@ -0,0 +1,165 @@
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> CpuTrace::enabled{false};
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct ThreadRing {
+    // only the owning thread writes, head is published with release so the writer can read the events behind it
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> head{0};
+    std::string name;
+    uint32_t threadId = 0;
+};
+
+struct TraceRegistry {
+    // the mutex is only taken when a thread records its first event and when the trace is written
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    uint32_t eventsPerThread = 1u << 16;
+    uint64_t epoch = 0;
+};
+
+TraceRegistry& registry() {
+    // never destroyed, so threads that outlive main can still finish their last scope
+    static TraceRegistry* instance = new TraceRegistry();
+    return *instance;
+}
+
+ThreadRing& threadRing() {
+    // rings are owned by the registry, so the events of threads that already exited still make it into the trace
+    thread_local ThreadRing* ring = nullptr;
+    if (ring == nullptr) {
+        TraceRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto owned = std::make_unique<ThreadRing>();
+        owned->events.resize(reg.eventsPerThread);
+        owned->threadId = static_cast<uint32_t>(reg.rings.size());
+        ring = owned.get();
+        reg.rings.push_back(std::move(owned));
+    }
+    return *ring;
+}
+
+void writeEscaped(std::ofstream& out, const std::string& text) {
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) >= 0x20) {
+            out << c;
+        }
+    }
+}
+
+}
+
+void CpuTrace::enable(uint32_t eventsPerThread) {
+    /*
+     * This function turns recording on, the ring size only applies to threads that have not recorded yet
+     */
+    TraceRegistry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.eventsPerThread = std::max(eventsPerThread, 1u);
+        if (reg.epoch == 0) {
+            reg.epoch = now();
+        }
+    }
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void CpuTrace::disable() {
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+void CpuTrace::setThreadName(const char* name) {
+    // a ring is only worth allocating on threads that are traced
+    if (!isEnabled()) {
+        return;
+    }
+    ThreadRing& ring = threadRing();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    ring.name = name;
+}
+
+void CpuTrace::record(const char* name, uint64_t beginNanoseconds, uint64_t endNanoseconds) {
+    ThreadRing& ring = threadRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head % ring.events.size()] = {name, beginNanoseconds, endNanoseconds};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+bool CpuTrace::writeChromeTrace(const std::string& path) {
+    /*
+     * This function writes the recorded events as complete ("X") events of the Chrome trace event format,
+     * timestamps are microseconds since enable(). Events a thread overwrote while we were copying are dropped
+     */
+    TraceRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    auto microseconds = [&](uint64_t nanoseconds) {
+        return static_cast<double>(nanoseconds - std::min(nanoseconds, reg.epoch)) / 1000.0;
+    };
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+        out << "\n";
+    };
+
+    for (const auto& ring : reg.rings) {
+        std::string threadName = ring->name.empty() ? "thread " + std::to_string(ring->threadId) : ring->name;
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->threadId << ",\"args\":{\"name\":\"";
+        writeEscaped(out, threadName);
+        out << "\"}}";
+
+        uint64_t capacity = ring->events.size();
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t firstIndex = head > capacity ? head - capacity : 0;
+        std::vector<TraceEvent> copied;
+        copied.reserve(static_cast<size_t>(head - firstIndex));
+        for (uint64_t i = firstIndex; i < head; i++) {
+            copied.push_back(ring->events[i % capacity]);
+        }
+
+        // anything the writer lapped during the copy may be torn
+        uint64_t headAfter = ring->head.load(std::memory_order_acquire);
+        uint64_t firstValid = headAfter > capacity ? headAfter - capacity : 0;
+        for (uint64_t i = std::max(firstIndex, firstValid); i < head; i++) {
+            const TraceEvent& event = copied[static_cast<size_t>(i - firstIndex)];
+            separator();
+            out << "{\"name\":\"";
+            writeEscaped(out, event.name);
+            out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->threadId
+                << ",\"ts\":" << microseconds(event.begin)
+                << ",\"dur\":" << static_cast<double>(event.end - event.begin) / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+class CpuTrace {
+    /*
+     * This class collects CPU timing scopes for a Chrome trace / Perfetto JSON file (chrome://tracing, ui.perfetto.dev).
+     * Every thread writes into its own fixed size ring of events, so recording takes no lock and never allocates
+     * after the first scope on a thread, old events are overwritten when a ring is full.
+     * While disabled a scope is one relaxed atomic load, and builds without VK_TUT_TRACE (Release) compile
+     * the TRACE_SCOPE markers away completely
+     */
+public:
+    static void enable(uint32_t eventsPerThread = 1u << 16);
+    static void disable();
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // shows up as the thread's name in the trace viewer
+    static void setThreadName(const char* name);
+
+    static void record(const char* name, uint64_t beginNanoseconds, uint64_t endNanoseconds);
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // writes what the rings hold, call it once the traced threads are idle, returns false if the file can not be written
+    static bool writeChromeTrace(const std::string& path);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+class CpuTraceScope {
+    /*
+     * This class records the time between its construction and destruction as one trace event.
+     * The name has to outlive the trace, string literals are what it is meant for
+     */
+public:
+    explicit CpuTraceScope(const char* name) : name(name), begin(CpuTrace::isEnabled() ? CpuTrace::now() : 0) {}
+    ~CpuTraceScope() {
+        if (begin != 0) {
+            CpuTrace::record(name, begin, CpuTrace::now());
+        }
+    }
+
+    CpuTraceScope(const CpuTraceScope&) = delete;
+    CpuTraceScope& operator=(const CpuTraceScope&) = delete;
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+
+#define CPU_TRACE_CONCAT_INNER(a, b) a##b
+#define CPU_TRACE_CONCAT(a, b) CPU_TRACE_CONCAT_INNER(a, b)
+
+#ifdef VK_TUT_TRACE
+#define TRACE_SCOPE(name) CpuTraceScope CPU_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) CpuTrace::setThreadName(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
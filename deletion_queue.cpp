@@ -0,0 +1,65 @@
+#include "deletion_queue.h"
+
+#include "cpu_trace.h"
+
+void DeletionQueue::create(VkDevice deviceIn, uint32_t framesInFlight) {
+    device = deviceIn;
+    slots.resize(framesInFlight);
+    currentSlot = 0;
+}
+
+void DeletionQueue::destroy() {
+    flushAll();
+    slots.clear();
+    device = VK_NULL_HANDLE;
+}
+
+void DeletionQueue::beginFrame(uint32_t slot) {
+    std::unique_lock<std::mutex> lock(mutex);
+    currentSlot = slot;
+    flush(slots[slot], lock);
+}
+
+void DeletionQueue::push(std::function<void()> deletion) {
+    std::lock_guard<std::mutex> lock(mutex);
+    slots[currentSlot].deletions.push_back(std::move(deletion));
+}
+
+void DeletionQueue::flushAll() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (SlotQueue& queue : slots) {
+        flush(queue, lock);
+    }
+}
+
+void DeletionQueue::pushEntry(const Entry& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    slots[currentSlot].entries.push_back(entry);
+}
+
+void DeletionQueue::flush(SlotQueue& queue, std::unique_lock<std::mutex>& lock) {
+    /*
+     * This function destroys what the queue holds. The lock is dropped for the destroys, a thread pushing in the
+     * meantime lands in the current slot's fresh queue. Only the main thread flushes, so flushing is never
+     * swapped out twice at once
+     */
+    if (queue.entries.empty() && queue.deletions.empty()) {
+        return;
+    }
+    TRACE_SCOPE("DeletionQueue::flush");
+    std::swap(queue.entries, flushing.entries);
+    std::swap(queue.deletions, flushing.deletions);
+    lock.unlock();
+
+    for (const Entry& entry : flushing.entries) {
+        entry.destroy(device, entry.bits);
+    }
+    for (std::function<void()>& deletion : flushing.deletions) {
+        deletion();
+    }
+    destroyedCount += flushing.entries.size() + flushing.deletions.size();
+    flushing.entries.clear();
+    flushing.deletions.clear();
+
+    lock.lock();
+}
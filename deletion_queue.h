@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "vk_handles.h"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class DeletionQueue {
+    /*
+     * This class destroys objects once no frame in flight can use them any more, without a vkDeviceWaitIdle.
+     * Every frame slot has a queue, what is pushed while a slot's frame is recorded is destroyed the next time
+     * that slot's fence has been waited on, and since a fence covers every submission before it on the queue,
+     * all earlier frames are done with it too. The entries are a function and the handle's bits, a flush walks
+     * them in one batch without allocating.
+     * Only the graphics queue's frames are covered, an object a compute or transfer batch still uses needs its
+     * own wait. Pushing is safe from any thread
+     */
+public:
+    void create(VkDevice device, uint32_t framesInFlight);
+    // destroys everything still queued, the device has to be idle
+    void destroy();
+
+    // flushes the slot's queue from its last use and queues on it from now on, call once its fence signalled
+    void beginFrame(uint32_t slot);
+
+    template<auto Destroy, typename Handle>
+    void push(Handle handle) {
+        if (handle != VK_NULL_HANDLE) {
+            pushEntry({&destroyHandle<Destroy, Handle>, handleBits(handle)});
+        }
+    }
+    template<typename Handle, auto Destroy>
+    void push(UniqueDeviceHandle<Handle, Destroy>&& handle) {
+        push<Destroy>(handle.release());
+    }
+    // for what is more than a single vkDestroy call, e.g. a buffer together with its memory
+    void push(std::function<void()> deletion);
+
+    // flushes every queue right away, the device has to be idle (e.g. after a swap chain recreation)
+    void flushAll();
+
+    uint64_t getDestroyedCount() const { return destroyedCount; }
+
+private:
+    struct Entry {
+        void (*destroy)(VkDevice device, uint64_t bits);
+        uint64_t bits;
+    };
+
+    struct SlotQueue {
+        std::vector<Entry> entries;
+        std::vector<std::function<void()>> deletions;
+    };
+
+    template<auto Destroy, typename Handle>
+    static void destroyHandle(VkDevice device, uint64_t bits) {
+        Destroy(device, handleFromBits<Handle>(bits), nullptr);
+    }
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::mutex mutex;
+    std::vector<SlotQueue> slots;
+    uint32_t currentSlot = 0;
+    // swapped with a slot's queue on flush, so the destroys run outside the lock and no vector is reallocated
+    SlotQueue flushing;
+    uint64_t destroyedCount = 0;
+
+    void pushEntry(const Entry& entry);
+    void flush(SlotQueue& queue, std::unique_lock<std::mutex>& lock);
+};
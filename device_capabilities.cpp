@@ -0,0 +1,174 @@
+#include "device_capabilities.h"
+
+#include <sstream>
+#include <utility>
+
+namespace {
+
+// the name lives in vulkan_beta.h, which needs VK_ENABLE_BETA_EXTENSIONS
+const char* const PORTABILITY_SUBSET_EXTENSION_NAME = "VK_KHR_portability_subset";
+
+}
+
+const ExtensionList& ExtensionList::forInstance() {
+    static const ExtensionList list = [] {
+        ExtensionList instanceList;
+        uint32_t extensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+        for (const VkExtensionProperties& extension : extensions) {
+            instanceList.names.insert(extension.extensionName);
+        }
+        return instanceList;
+    }();
+    return list;
+}
+
+ExtensionList ExtensionList::forLayer(const char* layerName) {
+    ExtensionList layerList;
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, extensions.data());
+    for (const VkExtensionProperties& extension : extensions) {
+        layerList.names.insert(extension.extensionName);
+    }
+    return layerList;
+}
+
+ExtensionList ExtensionList::forDevice(VkPhysicalDevice physicalDevice) {
+    ExtensionList deviceList;
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+    for (const VkExtensionProperties& extension : extensions) {
+        deviceList.names.insert(extension.extensionName);
+    }
+    return deviceList;
+}
+
+DeviceCapabilities DeviceCapabilities::query(VkPhysicalDevice physicalDevice, const ExtensionList& extensions) {
+    /*
+     * This function checks the extensions first and then asks for the features of those that are there in one
+     * vkGetPhysicalDeviceFeatures2, a driver can list an extension and still report its feature off
+     */
+    DeviceCapabilities capabilities;
+    capabilities.portabilitySubset = extensions.has(PORTABILITY_SUBSET_EXTENSION_NAME);
+    capabilities.memoryBudget = extensions.has(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    capabilities.pipelineCreationFeedback = extensions.has(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+
+    VkPhysicalDeviceFeatures2 features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT cacheControlFeatures{};
+    cacheControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT;
+    VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+    synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+    dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+    presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+    presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    // a struct of an extension the device does not have must not be in the chain
+    if (extensions.has(VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME)) {
+        cacheControlFeatures.pNext = features2.pNext;
+        features2.pNext = &cacheControlFeatures;
+    }
+    if (extensions.has(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+        synchronization2Features.pNext = features2.pNext;
+        features2.pNext = &synchronization2Features;
+    }
+    if (extensions.has(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+        dynamicRenderingFeatures.pNext = features2.pNext;
+        features2.pNext = &dynamicRenderingFeatures;
+    }
+    // present wait is only any use with present ids to wait for
+    bool presentExtensions = extensions.has(VK_KHR_PRESENT_ID_EXTENSION_NAME) && extensions.has(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    if (presentExtensions) {
+        presentIdFeatures.pNext = features2.pNext;
+        presentWaitFeatures.pNext = &presentIdFeatures;
+        features2.pNext = &presentWaitFeatures;
+    }
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+    capabilities.pipelineCreationCacheControl = cacheControlFeatures.pipelineCreationCacheControl == VK_TRUE;
+    capabilities.synchronization2 = synchronization2Features.synchronization2 == VK_TRUE;
+    capabilities.dynamicRendering = dynamicRenderingFeatures.dynamicRendering == VK_TRUE;
+    capabilities.presentWait = presentIdFeatures.presentId == VK_TRUE && presentWaitFeatures.presentWait == VK_TRUE;
+    return capabilities;
+}
+
+std::string DeviceCapabilities::describe() const {
+    std::ostringstream text;
+    const char* separator = "";
+    for (auto [present, name] : {std::pair{portabilitySubset, "portability subset"}, std::pair{memoryBudget, "memory budget"},
+                                 std::pair{pipelineCreationFeedback, "creation feedback"},
+                                 std::pair{pipelineCreationCacheControl, "cache control"},
+                                 std::pair{synchronization2, "synchronization2"}, std::pair{dynamicRendering, "dynamic rendering"},
+                                 std::pair{presentWait, "present wait"}}) {
+        if (present) {
+            text << separator << name;
+            separator = ", ";
+        }
+    }
+    return separator[0] == '\0' ? "none" : text.str();
+}
+
+DeviceExtensionRequest::DeviceExtensionRequest(const DeviceCapabilities& enabledIn, std::vector<const char*> requiredExtensions)
+        : enabled(enabledIn), extensions(std::move(requiredExtensions)) {
+    if (enabled.portabilitySubset) {
+        extensions.push_back(PORTABILITY_SUBSET_EXTENSION_NAME);
+    }
+    if (enabled.memoryBudget) {
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    if (enabled.pipelineCreationFeedback) {
+        extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    }
+    if (enabled.pipelineCreationCacheControl) {
+        extensions.push_back(VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME);
+    }
+    if (enabled.synchronization2) {
+        extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+    }
+    if (enabled.dynamicRendering) {
+        extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+    }
+    if (enabled.presentWait) {
+        extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    }
+}
+
+void* DeviceExtensionRequest::chainFeatures(void* next) {
+    if (enabled.pipelineCreationCacheControl) {
+        cacheControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT;
+        cacheControlFeatures.pipelineCreationCacheControl = VK_TRUE;
+        cacheControlFeatures.pNext = next;
+        next = &cacheControlFeatures;
+    }
+    if (enabled.synchronization2) {
+        synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+        synchronization2Features.synchronization2 = VK_TRUE;
+        synchronization2Features.pNext = next;
+        next = &synchronization2Features;
+    }
+    if (enabled.dynamicRendering) {
+        dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+        dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+        dynamicRenderingFeatures.pNext = next;
+        next = &dynamicRenderingFeatures;
+    }
+    if (enabled.presentWait) {
+        presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        presentIdFeatures.presentId = VK_TRUE;
+        presentIdFeatures.pNext = next;
+        presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        presentWaitFeatures.presentWait = VK_TRUE;
+        presentWaitFeatures.pNext = &presentIdFeatures;
+        next = &presentWaitFeatures;
+    }
+    return next;
+}
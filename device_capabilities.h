@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+class ExtensionList {
+    /*
+     * This class is the extensions the loader or a physical device offers, enumerated once and then looked up by
+     * name. The instance list is the same for every application instance of the process, the loader and the
+     * installed drivers do not change while we run
+     */
+public:
+    static const ExtensionList& forInstance();
+    // the instance extensions a layer provides itself, e.g. the validation layer's VK_EXT_validation_features
+    static ExtensionList forLayer(const char* layerName);
+    static ExtensionList forDevice(VkPhysicalDevice physicalDevice);
+
+    bool has(const char* name) const { return names.count(name) > 0; }
+
+private:
+    std::set<std::string> names;
+};
+
+struct DeviceCapabilities {
+    /*
+     * This struct is the optional device extensions the engine has a faster (or, for portability, a required) path
+     * for, each one only true if the device lists it and also reports its feature bit on. Timeline semaphores are
+     * not in here, they are core in Vulkan 1.2 and a device without them is not suitable at all
+     */
+    // not an option, a device that lists VK_KHR_portability_subset (MoltenVK) has to have it enabled
+    bool portabilitySubset = false;
+    // per heap usage and budget, for the memory stats
+    bool memoryBudget = false;
+    // whether a pipeline came out of the pipeline cache, for the cache stats
+    bool pipelineCreationFeedback = false;
+    // pipeline creation that fails instead of compiling when the cache misses
+    bool pipelineCreationCacheControl = false;
+    // the render graph's barriers go through vkCmdPipelineBarrier2
+    bool synchronization2 = false;
+    // drawing without render pass and framebuffer objects
+    bool dynamicRendering = false;
+    // VK_KHR_present_id and VK_KHR_present_wait together, the latency frame mode waits until a frame is on screen
+    bool presentWait = false;
+
+    static DeviceCapabilities query(VkPhysicalDevice physicalDevice, const ExtensionList& extensions);
+    // one line listing what is there, for the device log
+    std::string describe() const;
+};
+
+class DeviceExtensionRequest {
+    /*
+     * This class turns the capabilities createLogicalDevice() decided to use into extension names and the feature
+     * structs that switch them on. It owns the feature structs, so it has to outlive vkCreateDevice
+     */
+public:
+    DeviceExtensionRequest(const DeviceCapabilities& enabled, std::vector<const char*> requiredExtensions);
+
+    DeviceExtensionRequest(const DeviceExtensionRequest&) = delete;
+    DeviceExtensionRequest& operator=(const DeviceExtensionRequest&) = delete;
+
+    const std::vector<const char*>& getExtensions() const { return extensions; }
+    // links the enabled feature structs in front of next and returns the head of the chain
+    void* chainFeatures(void* next);
+
+private:
+    DeviceCapabilities enabled;
+    std::vector<const char*> extensions;
+    VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT cacheControlFeatures{};
+    VkPhysicalDeviceSynchronization2Features synchronization2Features{};
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+};
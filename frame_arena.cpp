@@ -0,0 +1,63 @@
+#include "frame_arena.h"
+
+#include <algorithm>
+
+FrameArena::FrameArena(size_t blockSize) : blockSize(blockSize) {}
+
+void* FrameArena::allocate(size_t size, size_t alignment) {
+    /*
+     * This function bumps the head of the current block, moving on to the next block (or a new one) when the
+     * allocation does not fit
+     */
+    while (true) {
+        if (current < blocks.size()) {
+            Block& block = blocks[current];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+            size_t offset = static_cast<size_t>(((base + head + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base);
+            if (offset + size <= block.size) {
+                head = offset + size;
+                return block.data.get() + offset;
+            }
+            usedBefore += head;
+            current++;
+            head = 0;
+            continue;
+        }
+        // room for the alignment padding too, new[] only promises the default new alignment
+        addBlock(size + alignment);
+    }
+}
+
+void FrameArena::reset() {
+    /*
+     * This function frees everything at once. If the frame spilled into more than one block, they are replaced
+     * by one block that fits all of it, that is the only allocation reset() does
+     */
+    if (blocks.size() > 1) {
+        size_t total = getCapacity();
+        blocks.clear();
+        Block block;
+        block.data = std::make_unique<std::byte[]>(total);
+        block.size = total;
+        blocks.push_back(std::move(block));
+    }
+    current = 0;
+    head = 0;
+    usedBefore = 0;
+}
+
+size_t FrameArena::getCapacity() const {
+    size_t capacity = 0;
+    for (const Block& block : blocks) {
+        capacity += block.size;
+    }
+    return capacity;
+}
+
+void FrameArena::addBlock(size_t minimumSize) {
+    Block block;
+    block.size = std::max(blockSize, minimumSize);
+    block.data = std::make_unique<std::byte[]>(block.size);
+    blocks.push_back(std::move(block));
+    growCount++;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class FrameArena {
+    /*
+     * This class is a bump allocator for CPU data that lives for one frame (draw lists, barrier lists, descriptor
+     * writes). Every frame slot owns one and reset() throws everything away at once when the slot is reused.
+     * A frame that needs more than the arena has gets another block, the next reset() merges the blocks into one
+     * of the combined size, so after the first frames at the high water mark nothing is allocated any more.
+     * Nothing is destructed, only trivially destructible data or containers that are dropped with the frame
+     * belong in here. Not thread safe, one arena is used by one thread at a time
+     */
+public:
+    explicit FrameArena(size_t blockSize = 64 * 1024);
+
+    FrameArena(FrameArena&&) = default;
+    FrameArena& operator=(FrameArena&&) = default;
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t size, size_t alignment);
+    void reset();
+
+    size_t getUsedBytes() const { return usedBefore + head; }
+    size_t getCapacity() const;
+    // how often the arena had to grow, stays constant once the frames fit
+    uint64_t getGrowCount() const { return growCount; }
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size = 0;
+    };
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    // the block bumped from and its head, blocks before it are full
+    size_t current = 0;
+    size_t head = 0;
+    size_t usedBefore = 0;
+    uint64_t growCount = 0;
+
+    void addBlock(size_t minimumSize);
+};
+
+template<typename T>
+class ArenaAllocator {
+    /*
+     * This class lets standard containers allocate from a FrameArena. Deallocation does nothing, a vector that
+     * grows leaves its old storage behind until the reset, so reserve() what is known up front
+     */
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.getArena()) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    FrameArena* getArena() const { return arena; }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.getArena(); }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.getArena(); }
+
+private:
+    FrameArena* arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// a vector in the arena with room for capacity elements
+template<typename T>
+ArenaVector<T> makeArenaVector(FrameArena& arena, size_t capacity = 0) {
+    ArenaVector<T> vector{ArenaAllocator<T>(arena)};
+    vector.reserve(capacity);
+    return vector;
+}
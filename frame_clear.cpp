@@ -0,0 +1,172 @@
+#include "frame_clear.h"
+
+#include <stdexcept>
+
+namespace {
+
+const VkClearColorValue CLEAR_COLOR = {{0.0f, 0.0f, 0.0f, 1.0f}};
+
+}
+
+void FrameClear::create(VkDevice deviceIn, VkFormat formatIn, bool transferDestinationIn, bool dynamicRenderingIn) {
+    /*
+     * This function picks how the frame is cleared, the transfer where the image allows it since it needs no
+     * render pass or framebuffers. Only the load op path needs the rendering commands or a render pass
+     */
+    device = deviceIn;
+    format = formatIn;
+    transferDestination = transferDestinationIn;
+    dynamicRendering = dynamicRenderingIn;
+    if (transferDestination) {
+        return;
+    }
+
+    if (dynamicRendering) {
+        cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+        cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+        if (cmdBeginRendering == nullptr || cmdEndRendering == nullptr) {
+            throw std::runtime_error("failed to load the dynamic rendering commands!");
+        }
+    }
+    else {
+        createRenderPass();
+    }
+}
+
+void FrameClear::destroy() {
+    destroyTargets();
+    if (renderPass != VK_NULL_HANDLE) {
+        vkDestroyRenderPass(device, renderPass, nullptr);
+        renderPass = VK_NULL_HANDLE;
+    }
+}
+
+void FrameClear::createTargets(VkExtent2D extentIn, const std::vector<VkImageView>& viewsIn) {
+    extent = extentIn;
+    views = viewsIn;
+
+    // the transfer clears the image itself, and dynamic rendering takes the views as they are
+    framebuffers.resize(renderPass == VK_NULL_HANDLE ? 0 : views.size());
+    for (size_t i = 0; i < framebuffers.size(); i++) {
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &views[i];
+        framebufferInfo.width = extent.width;
+        framebufferInfo.height = extent.height;
+        framebufferInfo.layers = 1;
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+    }
+}
+
+void FrameClear::destroyTargets() {
+    for (VkFramebuffer framebuffer : framebuffers) {
+        vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+    framebuffers.clear();
+    views.clear();
+}
+
+void FrameClear::record(VkCommandBuffer commandBuffer, VkImage image, uint32_t imageIndex) const {
+    /*
+     * This function records the clear. Either way the image is first transitioned from UNDEFINED into the layout
+     * the clear writes it in, the load op path clears in COLOR_ATTACHMENT_OPTIMAL so its render pass transitions
+     * nothing and needs no external dependencies
+     */
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.levelCount = 1;
+    range.layerCount = 1;
+
+    const ImageState state = getFrameState();
+    VkImageMemoryBarrier toClear{};
+    toClear.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toClear.srcAccessMask = 0;
+    toClear.dstAccessMask = state.access;
+    toClear.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    toClear.newLayout = state.layout;
+    toClear.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toClear.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toClear.image = image;
+    toClear.subresourceRange = range;
+    // the acquire semaphore is waited on in both stages
+    vkCmdPipelineBarrier(commandBuffer, state.stage, state.stage, 0, 0, nullptr, 0, nullptr, 1, &toClear);
+
+    if (transferDestination) {
+        vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &CLEAR_COLOR, 1, &range);
+        return;
+    }
+
+    if (dynamicRendering) {
+        VkRenderingAttachmentInfoKHR colorAttachment{};
+        colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        colorAttachment.imageView = views[imageIndex];
+        colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.clearValue.color = CLEAR_COLOR;
+
+        VkRenderingInfoKHR renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+        renderingInfo.renderArea = {{0, 0}, extent};
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachments = &colorAttachment;
+        cmdBeginRendering(commandBuffer, &renderingInfo);
+        cmdEndRendering(commandBuffer);
+        return;
+    }
+
+    VkClearValue clearValue{};
+    clearValue.color = CLEAR_COLOR;
+    VkRenderPassBeginInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = framebuffers[imageIndex];
+    renderPassInfo.renderArea = {{0, 0}, extent};
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearValue;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdEndRenderPass(commandBuffer);
+}
+
+FrameClear::ImageState FrameClear::getFrameState() const {
+    if (transferDestination) {
+        return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+    }
+    return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+}
+
+void FrameClear::createRenderPass() {
+    /*
+     * This function creates the render pass that does nothing but clear, with a single subpass and no draws
+     */
+    VkAttachmentDescription attachment{};
+    attachment.format = format;
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorReference{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &attachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+class FrameClear {
+    /*
+     * This class clears the frame's color image at the start of every frame. An image with TRANSFER_DST usage is
+     * cleared with vkCmdClearColorImage and left in TRANSFER_DST_OPTIMAL. A swap chain whose surface does not
+     * support that usage (only COLOR_ATTACHMENT is guaranteed) is cleared by the load op of an otherwise empty
+     * rendering instead, dynamic rendering or a render pass with a framebuffer per image, and left in
+     * COLOR_ATTACHMENT_OPTIMAL. getFrameState() is what the frame's later commands find the image in
+     */
+public:
+    struct ImageState {
+        VkPipelineStageFlags stage;
+        VkAccessFlags access;
+        VkImageLayout layout;
+    };
+
+    void create(VkDevice device, VkFormat format, bool transferDestination, bool dynamicRendering);
+    void destroy();
+
+    // takes the views the load op clears and, without dynamic rendering, wraps them in framebuffers, the device
+    // has to be idle
+    void createTargets(VkExtent2D extent, const std::vector<VkImageView>& views);
+    void destroyTargets();
+
+    // the old contents are thrown away, the image may be in any layout before
+    void record(VkCommandBuffer commandBuffer, VkImage image, uint32_t imageIndex) const;
+
+    ImageState getFrameState() const;
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    bool transferDestination = true;
+    bool dynamicRendering = false;
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+    PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkExtent2D extent{};
+    std::vector<VkImageView> views;
+    std::vector<VkFramebuffer> framebuffers;
+
+    void createRenderPass();
+};
@@ -0,0 +1,261 @@
+#include "frame_engine.h"
+
+#include "cpu_trace.h"
+
+#include <stdexcept>
+#include <string>
+
+void FrameEngine::create(VkDevice deviceIn, uint32_t graphicsFamily, uint32_t framesInFlight, uint32_t swapchainImageCount) {
+    /*
+     * This function creates the frame slots, each with its own command pool so a whole frame's command buffers
+     * can be recycled with one vkResetCommandPool instead of resetting or freeing them one by one
+     */
+    device = deviceIn;
+    slots.resize(framesInFlight);
+
+    for (FrameSlot& slot : slots) {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = graphicsFamily;
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &slot.commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create frame command pool!");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = slot.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &slot.commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate frame command buffer!");
+        }
+
+        // created signalled, so the first wait on every slot returns right away
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        if (vkCreateFence(device, &fenceInfo, nullptr, &slot.inFlightFence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create frame fence!");
+        }
+
+        slot.imageAvailableSemaphore = createSemaphore();
+    }
+
+    createRenderFinishedSemaphores(swapchainImageCount);
+    deletionQueue.create(device, framesInFlight);
+}
+
+void FrameEngine::destroy() {
+    deletionQueue.destroy();
+    destroyRenderFinishedSemaphores();
+    for (FrameSlot& slot : slots) {
+        vkDestroySemaphore(device, slot.imageAvailableSemaphore, nullptr);
+        vkDestroyFence(device, slot.inFlightFence, nullptr);
+        // destroying the pool frees its command buffers
+        vkDestroyCommandPool(device, slot.commandPool, nullptr);
+    }
+    slots.clear();
+}
+
+void FrameEngine::onSwapchainRecreated(uint32_t swapchainImageCount) {
+    destroyRenderFinishedSemaphores();
+    createRenderFinishedSemaphores(swapchainImageCount);
+    // the device is idle anyway, nothing queued for deletion is in use
+    deletionQueue.flushAll();
+    // the ids presented to the old swap chain can not be waited on through the new one
+    lastPresentId = 0;
+}
+
+void FrameEngine::enablePresentWait(PFN_vkWaitForPresentKHR waitForPresentIn) {
+    waitForPresent = waitForPresentIn;
+}
+
+bool FrameEngine::waitForLastPresent(const Swapchain& swapchain) {
+    /*
+     * This function keeps the CPU from running ahead of the display. With present wait it returns once the last
+     * frame is visible, so the next frame starts recording with the freshest input it can have. Without it,
+     * the fence of the last frame is the closest we get, the frame may still be queued for presentation then.
+     * The present wait has a timeout, a minimized window or a driver that never completes present ids falls
+     * back to the fence instead of hanging the loop
+     */
+    TRACE_SCOPE("waitForLastPresent");
+    if (waitForPresent != nullptr && lastPresentId != 0) {
+        VkResult result = waitForPresent(device, swapchain.getHandle(), lastPresentId, 100'000'000);
+        if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+            return true;
+        }
+        if (result != VK_TIMEOUT && result != VK_ERROR_OUT_OF_DATE_KHR) {
+            throw std::runtime_error("failed to wait for present! Error code: " + std::to_string(result));
+        }
+    }
+
+    const FrameSlot& previous = slots[(currentSlot + static_cast<uint32_t>(slots.size()) - 1) % static_cast<uint32_t>(slots.size())];
+    vkWaitForFences(device, 1, &previous.inFlightFence, VK_TRUE, UINT64_MAX);
+    return false;
+}
+
+bool FrameEngine::beginFrame(const Swapchain& swapchain, FrameTarget& target) {
+    FrameSlot& slot = waitForSlot();
+
+    uint32_t imageIndex = 0;
+    VkResult result;
+    {
+        TRACE_SCOPE("acquire");
+        result = vkAcquireNextImageKHR(device, swapchain.getHandle(), UINT64_MAX,
+                                       slot.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    }
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // the fence stays signalled, so the slot can be used again after the recreation
+        return false;
+    }
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        throw std::runtime_error("failed to acquire swap chain image! Error code: " + std::to_string(result));
+    }
+
+    // only reset once we know work will be submitted with this fence
+    resetSlot(slot);
+
+    target.slot = &slot;
+    target.slotIndex = currentSlot;
+    target.imageIndex = imageIndex;
+    target.image = swapchain.getImages()[imageIndex];
+    target.imageView = swapchain.getImageViews()[imageIndex];
+    return true;
+}
+
+void FrameEngine::beginFrame(const OffscreenTargets& offscreen, FrameTarget& target) {
+    /*
+     * This function is the headless beginFrame(), there is nothing to acquire, the slot simply renders into
+     * its own offscreen image, which the slot's fence already protects
+     */
+    FrameSlot& slot = waitForSlot();
+    resetSlot(slot);
+
+    uint32_t imageIndex = currentSlot % offscreen.getImageCount();
+    target.slot = &slot;
+    target.slotIndex = currentSlot;
+    target.imageIndex = imageIndex;
+    target.image = offscreen.getImages()[imageIndex];
+    target.imageView = offscreen.getImageViews()[imageIndex];
+}
+
+bool FrameEngine::endFrame(const Swapchain& swapchain, const FrameTarget& target, VkQueue graphicsQueue, VkQueue presentQueue) {
+    FrameSlot& slot = *target.slot;
+    VkSemaphore renderFinishedSemaphore = renderFinishedSemaphores[target.imageIndex];
+
+    // the color output stage is the first to touch the swap chain image, everything before it can start right away
+    {
+        TRACE_SCOPE("submit");
+        submission = extraWaits;
+        extraWaits.clear();
+        submission
+            .execute(slot.commandBuffer)
+            .waitFor(slot.imageAvailableSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT)
+            .signal(renderFinishedSemaphore)
+            .submit(graphicsQueue, slot.inFlightFence);
+    }
+
+    VkSwapchainKHR swapchainHandle = swapchain.getHandle();
+    VkPresentInfoKHR presentInfo{};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &renderFinishedSemaphore;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &swapchainHandle;
+    presentInfo.pImageIndices = &target.imageIndex;
+
+    VkPresentIdKHR presentId{};
+    uint64_t id = nextPresentId;
+    if (waitForPresent != nullptr) {
+        presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentId.swapchainCount = 1;
+        presentId.pPresentIds = &id;
+        presentInfo.pNext = &presentId;
+    }
+
+    VkResult presentResult;
+    {
+        TRACE_SCOPE("present");
+        presentResult = vkQueuePresentKHR(presentQueue, &presentInfo);
+    }
+
+    if (waitForPresent != nullptr && (presentResult == VK_SUCCESS || presentResult == VK_SUBOPTIMAL_KHR)) {
+        lastPresentId = id;
+        nextPresentId++;
+    }
+
+    // move on to the next slot no matter how present went, the submit already happened
+    currentSlot = (currentSlot + 1) % static_cast<uint32_t>(slots.size());
+    frameNumber++;
+
+    if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) {
+        return false;
+    }
+    if (presentResult != VK_SUCCESS) {
+        throw std::runtime_error("failed to present swap chain image! Error code: " + std::to_string(presentResult));
+    }
+    return true;
+}
+
+void FrameEngine::endFrame(const FrameTarget& target, VkQueue graphicsQueue) {
+    /*
+     * This function is the headless endFrame(), it submits without waiting on an acquire or signalling a present
+     */
+    {
+        TRACE_SCOPE("submit");
+        submission = extraWaits;
+        extraWaits.clear();
+        submission
+            .execute(target.slot->commandBuffer)
+            .submit(graphicsQueue, target.slot->inFlightFence);
+    }
+
+    currentSlot = (currentSlot + 1) % static_cast<uint32_t>(slots.size());
+    frameNumber++;
+}
+
+void FrameEngine::addWait(VkSemaphore timelineSemaphore, uint64_t value, VkPipelineStageFlags stage) {
+    extraWaits.waitFor(timelineSemaphore, stage, value);
+}
+
+void FrameEngine::createRenderFinishedSemaphores(uint32_t swapchainImageCount) {
+    renderFinishedSemaphores.resize(swapchainImageCount);
+    for (VkSemaphore& semaphore : renderFinishedSemaphores) {
+        semaphore = createSemaphore();
+    }
+}
+
+void FrameEngine::destroyRenderFinishedSemaphores() {
+    for (VkSemaphore semaphore : renderFinishedSemaphores) {
+        vkDestroySemaphore(device, semaphore, nullptr);
+    }
+    renderFinishedSemaphores.clear();
+}
+
+FrameSlot& FrameEngine::waitForSlot() {
+    FrameSlot& slot = slots[currentSlot];
+
+    // only blocks if the GPU is more than framesInFlight frames behind
+    TRACE_SCOPE("waitForFrameFence");
+    vkWaitForFences(device, 1, &slot.inFlightFence, VK_TRUE, UINT64_MAX);
+    deletionQueue.beginFrame(currentSlot);
+    return slot;
+}
+
+void FrameEngine::resetSlot(FrameSlot& slot) {
+    vkResetFences(device, 1, &slot.inFlightFence);
+    vkResetCommandPool(device, slot.commandPool, 0);
+    slot.arena.reset();
+    slot.frameNumber = frameNumber;
+}
+
+VkSemaphore FrameEngine::createSemaphore() const {
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create frame semaphore!");
+    }
+    return semaphore;
+}
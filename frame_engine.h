@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "deletion_queue.h"
+#include "frame_arena.h"
+#include "queues.h"
+#include "swapchain.h"
+#include "offscreen.h"
+
+#include <vector>
+
+struct FrameSlot {
+    /*
+     * This struct is everything one frame in flight owns. The slot is only reused once its fence says the GPU
+     * is done with it, so the CPU can record the next frame while the GPU still runs this one
+     */
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence inFlightFence = VK_NULL_HANDLE;
+    VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+    uint64_t frameNumber = 0;
+    // CPU scratch for the frame's transient lists, reset with the slot
+    FrameArena arena;
+};
+
+struct FrameTarget {
+    /*
+     * This struct is what beginFrame() hands the recording code: the slot to record into and the acquired image
+     */
+    FrameSlot* slot = nullptr;
+    uint32_t slotIndex = 0;
+    uint32_t imageIndex = 0;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView imageView = VK_NULL_HANDLE;
+};
+
+class FrameEngine {
+    /*
+     * This class runs the acquire/record/submit/present cycle with N frames in flight.
+     * The render finished semaphores belong to the swap chain images rather than the slots, since a semaphore
+     * waited on by vkQueuePresentKHR can only be reused once that image is acquired again
+     */
+public:
+    void create(VkDevice device, uint32_t graphicsFamily, uint32_t framesInFlight, uint32_t swapchainImageCount);
+    void destroy();
+
+    // has to be called after the swap chain was recreated, with the device idle
+    void onSwapchainRecreated(uint32_t swapchainImageCount);
+
+    // tags every present with an id from now on, so waitForLastPresent() can wait on it (VK_KHR_present_wait)
+    void enablePresentWait(PFN_vkWaitForPresentKHR waitForPresent);
+    // blocks until the last presented frame is on screen, or without present wait until the GPU finished it,
+    // returns true if it waited for the present itself
+    bool waitForLastPresent(const Swapchain& swapchain);
+
+    // waits for the next slot, acquires an image and resets the slot's command pool,
+    // returns false if the swap chain is out of date and has to be recreated first
+    bool beginFrame(const Swapchain& swapchain, FrameTarget& target);
+    // makes this frame's submit wait on a timeline semaphore value, e.g. the upload ticket of data it draws with
+    void addWait(VkSemaphore timelineSemaphore, uint64_t value, VkPipelineStageFlags stage);
+    // submits the slot's command buffer on the graphics queue and presents,
+    // returns false if the swap chain is out of date or suboptimal
+    bool endFrame(const Swapchain& swapchain, const FrameTarget& target, VkQueue graphicsQueue, VkQueue presentQueue);
+
+    // headless versions of the two above, the slot renders into its offscreen image and nothing is presented
+    void beginFrame(const OffscreenTargets& offscreen, FrameTarget& target);
+    void endFrame(const FrameTarget& target, VkQueue graphicsQueue);
+
+    // objects the frames in flight may still use are pushed here instead of destroyed
+    DeletionQueue& getDeletionQueue() { return deletionQueue; }
+
+    uint32_t getFramesInFlight() const { return static_cast<uint32_t>(slots.size()); }
+    uint64_t getFrameNumber() const { return frameNumber; }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<FrameSlot> slots;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    QueueSubmission extraWaits;
+    // reused every frame, so the submit allocates nothing once its vectors have grown
+    QueueSubmission submission;
+    DeletionQueue deletionQueue;
+    uint32_t currentSlot = 0;
+    uint64_t frameNumber = 0;
+    PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+    // ids only have to increase per swap chain, 0 means nothing presented on the current one yet
+    uint64_t nextPresentId = 1;
+    uint64_t lastPresentId = 0;
+
+    FrameSlot& waitForSlot();
+    void resetSlot(FrameSlot& slot);
+    void createRenderFinishedSemaphores(uint32_t swapchainImageCount);
+    void destroyRenderFinishedSemaphores();
+    VkSemaphore createSemaphore() const;
+};
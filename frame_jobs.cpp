@@ -0,0 +1,12 @@
+#include "frame_jobs.h"
+
+FrameJobQueue::FrameJobQueue(uint32_t jobCountIn) : jobCount(jobCountIn) {}
+
+std::optional<uint32_t> FrameJobQueue::take() {
+    // threads that come back after the end keep counting up, which is harmless in 32 bits at these job counts
+    uint32_t job = next.fetch_add(1, std::memory_order_relaxed);
+    if (job >= jobCount) {
+        return std::nullopt;
+    }
+    return job;
+}
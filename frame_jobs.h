@@ -0,0 +1,24 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+class FrameJobQueue {
+    /*
+     * This class is the frames of a multi device run, shared by one render thread per GPU. Every thread takes
+     * the next frame whenever it is ready for one, so a faster GPU simply ends up with more of them and no thread
+     * waits on another. Taking a frame is one atomic increment, nothing the threads contend on at frame rates
+     */
+public:
+    explicit FrameJobQueue(uint32_t jobCount);
+
+    // the index of the next frame to render, nothing once all of them are taken
+    std::optional<uint32_t> take();
+
+    uint32_t getJobCount() const { return jobCount; }
+
+private:
+    uint32_t jobCount;
+    std::atomic<uint32_t> next{0};
+};
@@ -0,0 +1,149 @@
+#include "frame_scheduler.h"
+
+#include "cpu_trace.h"
+
+#include <stdexcept>
+#include <thread>
+
+const char* frameModeName(FrameMode mode) {
+    switch (mode) {
+        case FrameMode::OnDemand: return "on-demand";
+        case FrameMode::FixedFps: return "fixed";
+        case FrameMode::Uncapped: return "uncapped";
+        case FrameMode::LowLatency: return "latency";
+    }
+    return "unknown";
+}
+
+std::optional<FrameMode> parseFrameMode(const std::string& name) {
+    /*
+     * This function maps a frame mode name from the command line or environment to a FrameMode
+     */
+    if (name == "on-demand" || name == "ondemand") return FrameMode::OnDemand;
+    if (name == "fixed" || name == "fps") return FrameMode::FixedFps;
+    if (name == "uncapped" || name == "vsync") return FrameMode::Uncapped;
+    if (name == "latency" || name == "low-latency") return FrameMode::LowLatency;
+    return std::nullopt;
+}
+
+FrameScheduler::FrameScheduler(FrameMode mode, double targetFps) : mode(mode) {
+    if (mode == FrameMode::FixedFps && targetFps <= 0.0) {
+        throw std::runtime_error("fixed frame mode needs a target fps greater than zero!");
+    }
+    if (targetFps > 0.0) {
+        framePeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps));
+    }
+    nextFrameTime = Clock::now();
+}
+
+bool FrameScheduler::beginFrame() {
+    /*
+     * This function waits the way the selected mode wants to, processes the pending window events,
+     * and returns true if the caller should render a frame now
+     */
+    TRACE_SCOPE("pollEvents");
+    switch (mode) {
+        case FrameMode::OnDemand:
+            return beginOnDemandFrame();
+        case FrameMode::FixedFps:
+            return beginFixedFpsFrame();
+        case FrameMode::Uncapped:
+            // the present mode blocks us when we get ahead of the display, so just drain events
+            glfwPollEvents();
+            return true;
+        case FrameMode::LowLatency:
+            // events are polled in sampleInput(), after the wait for the last frame, so they are as fresh as possible
+            return true;
+    }
+    return false;
+}
+
+void FrameScheduler::endFrame() {
+    /*
+     * This function is called after a frame was rendered, clearing the redraw request
+     */
+    dirty = false;
+}
+
+FrameScheduler::Clock::time_point FrameScheduler::sampleInput() {
+    /*
+     * This function is called once the frame is about to be recorded. In latency mode this is where the events
+     * are processed, everything the input callbacks change lands in this frame instead of waiting a frame behind it
+     */
+    if (mode == FrameMode::LowLatency) {
+        TRACE_SCOPE("sampleInput");
+        glfwPollEvents();
+    }
+    return Clock::now();
+}
+
+void FrameScheduler::requestRedraw() {
+    dirty = true;
+    // wake the main thread if it is blocked in glfwWaitEvents
+    glfwPostEmptyEvent();
+}
+
+void FrameScheduler::requestRedrawIn(double seconds) {
+    Clock::time_point wakeup = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    if (!wakeupTime.has_value() || wakeup < wakeupTime.value()) {
+        wakeupTime = wakeup;
+    }
+}
+
+bool FrameScheduler::beginOnDemandFrame() {
+    /*
+     * This function blocks in glfwWaitEvents while nothing is dirty, so an idle window costs no CPU
+     */
+    if (dirty) {
+        glfwPollEvents();
+        return true;
+    }
+
+    if (wakeupTime.has_value()) {
+        auto remaining = std::chrono::duration<double>(wakeupTime.value() - Clock::now()).count();
+        if (remaining > 0.0) {
+            glfwWaitEventsTimeout(remaining);
+        }
+        else {
+            glfwPollEvents();
+        }
+        if (Clock::now() >= wakeupTime.value()) {
+            wakeupTime.reset();
+            dirty = true;
+        }
+    }
+    else {
+        glfwWaitEvents();
+    }
+    return dirty;
+}
+
+bool FrameScheduler::beginFixedFpsFrame() {
+    /*
+     * This function sleeps until the next frame deadline, then polls events and renders
+     */
+    sleepUntil(nextFrameTime);
+    glfwPollEvents();
+
+    // step the deadline by whole periods, if we fell far behind, resync instead of rendering a burst of catch up frames
+    Clock::time_point now = Clock::now();
+    nextFrameTime += framePeriod;
+    if (nextFrameTime < now) {
+        nextFrameTime = now + framePeriod;
+    }
+    return true;
+}
+
+void FrameScheduler::sleepUntil(Clock::time_point deadline) const {
+    /*
+     * This function sleeps for most of the remaining time, then spins for the last bit,
+     * since sleep_for alone usually wakes up a millisecond or more late
+     */
+    Clock::time_point now = Clock::now();
+    if (deadline - now > spinMargin) {
+        std::this_thread::sleep_for(deadline - now - spinMargin);
+    }
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+
+enum class FrameMode {
+    OnDemand,   // block in glfwWaitEvents until something marks the frame dirty
+    FixedFps,   // render at a target rate, sleeping between frames
+    Uncapped,   // render as fast as presentation allows, vsync does the throttling
+    LowLatency  // wait for the last frame to reach the screen, then sample input right before recording
+};
+
+const char* frameModeName(FrameMode mode);
+std::optional<FrameMode> parseFrameMode(const std::string& name);
+
+class FrameScheduler {
+    /*
+     * This class decides when mainLoop() renders a frame and how it waits in between,
+     * so an idle window does not keep a core busy spinning on glfwPollEvents()
+     */
+public:
+    using Clock = std::chrono::steady_clock;
+
+    FrameScheduler(FrameMode mode, double targetFps);
+
+    // blocks until the next frame is due (or an event arrives), returns true if a frame should be rendered
+    bool beginFrame();
+    void endFrame();
+    // polls the window events in latency mode (the other modes already did in beginFrame), returns when the input was sampled
+    Clock::time_point sampleInput();
+
+    // marks the next frame as needed, safe to call from any thread
+    void requestRedraw();
+    // asks for a frame after the given delay, e.g. for a blinking cursor or a running animation in on-demand mode
+    void requestRedrawIn(double seconds);
+
+    FrameMode getMode() const { return mode; }
+    bool isLowLatency() const { return mode == FrameMode::LowLatency; }
+
+private:
+    FrameMode mode;
+    Clock::duration framePeriod{};
+    // how long before the deadline we stop sleeping and start spinning, sleep_for overshoots by about this much
+    Clock::duration spinMargin = std::chrono::microseconds(1500);
+    Clock::time_point nextFrameTime{};
+    std::optional<Clock::time_point> wakeupTime;
+    std::atomic<bool> dirty{true};
+
+    bool beginOnDemandFrame();
+    bool beginFixedFpsFrame();
+    void sleepUntil(Clock::time_point deadline) const;
+};
@@ -0,0 +1,440 @@
+#include "gpu_allocator.h"
+
+#include <algorithm>
+#include <bitset>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+void DeviceMemoryAllocator::create(VkPhysicalDevice physicalDeviceIn, VkDevice deviceIn, bool memoryBudget, VkDeviceSize blockSizeIn) {
+    physicalDevice = physicalDeviceIn;
+    device = deviceIn;
+    memoryBudgetSupported = memoryBudget;
+    blockSize = blockSizeIn;
+    heapReservedBytes.fill(0);
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+}
+
+void DeviceMemoryAllocator::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& block : blocks) {
+        if (block->allocationCount > 0) {
+            std::cerr << "Memory allocator: block of type " << block->memoryType << " still has "
+                      << block->allocationCount << " live allocations at shutdown" << std::endl;
+        }
+        // freeing mapped memory implicitly unmaps it
+        vkFreeMemory(device, block->memory, nullptr);
+    }
+    blocks.clear();
+    for (const auto& [memory, size] : dedicatedAllocations) {
+        vkFreeMemory(device, memory, nullptr);
+    }
+    dedicatedAllocations.clear();
+    heapReservedBytes.fill(0);
+}
+
+std::optional<uint32_t> DeviceMemoryAllocator::findMemoryType(uint32_t typeBits, MemoryUsage usage) const {
+    /*
+     * This function scores every allowed memory type that has the required flags for the usage,
+     * one point per preferred flag, minus one per flag we would rather not have
+     */
+    VkMemoryPropertyFlags required = 0;
+    VkMemoryPropertyFlags preferred = 0;
+    VkMemoryPropertyFlags unwanted = 0;
+    switch (usage) {
+        case MemoryUsage::GpuOnly:
+            preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            unwanted = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            break;
+        case MemoryUsage::Upload:
+            required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            // keep the small device local + host visible BAR window for Dynamic
+            unwanted = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            break;
+        case MemoryUsage::Dynamic:
+            // coherent, so per frame writers never have to flush
+            required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            break;
+        case MemoryUsage::Readback:
+            required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            break;
+    }
+
+    std::optional<uint32_t> best;
+    int bestScore = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+        if (!(typeBits & (1u << i)) || (flags & required) != required) {
+            continue;
+        }
+        int score = static_cast<int>(std::bitset<32>(flags & preferred).count())
+                    - static_cast<int>(std::bitset<32>(flags & unwanted).count());
+        if (!best.has_value() || score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+uint32_t DeviceMemoryAllocator::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & required) == required) {
+            return i;
+        }
+    }
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool DeviceMemoryAllocator::isHostVisible(uint32_t memoryType) const {
+    return memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+GpuAllocation DeviceMemoryAllocator::allocate(const VkMemoryRequirements& requirements, MemoryUsage usage, bool linear) {
+    std::optional<uint32_t> memoryType = findMemoryType(requirements.memoryTypeBits, usage);
+    if (!memoryType.has_value()) {
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    // mapped ranges of non coherent memory are flushed in whole atoms, so never let two allocations share one
+    VkDeviceSize alignment = requirements.alignment;
+    VkDeviceSize size = requirements.size;
+    VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[memoryType.value()].propertyFlags;
+    if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        alignment = std::max(alignment, nonCoherentAtomSize);
+        size = alignUp(size, nonCoherentAtomSize);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    GpuAllocation allocation;
+    allocation.memoryType = memoryType.value();
+
+    if (size > blockSize / 2) {
+        allocation.memory = allocateDeviceMemory(size, memoryType.value(), &allocation.mapped);
+        allocation.size = size;
+        allocation.dedicated = true;
+        dedicatedAllocations[allocation.memory] = size;
+        return allocation;
+    }
+
+    for (auto& block : blocks) {
+        if (block->memoryType == memoryType.value() && block->linear == linear
+            && allocateFromBlock(*block, size, alignment, allocation)) {
+            return allocation;
+        }
+    }
+
+    Block* block = createBlock(memoryType.value(), linear, size);
+    if (!allocateFromBlock(*block, size, alignment, allocation)) {
+        throw std::runtime_error("failed to sub-allocate from a fresh memory block!");
+    }
+    return allocation;
+}
+
+void DeviceMemoryAllocator::free(const GpuAllocation& allocation) {
+    if (!allocation.isValid()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (allocation.dedicated) {
+        dedicatedAllocations.erase(allocation.memory);
+        heapReservedBytes[memoryProperties.memoryTypes[allocation.memoryType].heapIndex] -= allocation.size;
+        vkFreeMemory(device, allocation.memory, nullptr);
+        return;
+    }
+
+    for (auto& block : blocks) {
+        if (block->memory == allocation.memory) {
+            releaseToBlock(*block, allocation.offset, allocation.size);
+            return;
+        }
+    }
+    throw std::runtime_error("freed an allocation that does not belong to the allocator!");
+}
+
+GpuAllocation DeviceMemoryAllocator::allocateForBuffer(VkBuffer buffer, MemoryUsage usage) {
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, buffer, &requirements);
+    GpuAllocation allocation = allocate(requirements, usage, true);
+    if (vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        free(allocation);
+        throw std::runtime_error("failed to bind buffer memory!");
+    }
+    return allocation;
+}
+
+GpuAllocation DeviceMemoryAllocator::allocateForImage(VkImage image, MemoryUsage usage) {
+    // images allocated here are assumed to use optimal tiling, linear images should go through allocate() directly
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, image, &requirements);
+    GpuAllocation allocation = allocate(requirements, usage, false);
+    if (vkBindImageMemory(device, image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        free(allocation);
+        throw std::runtime_error("failed to bind image memory!");
+    }
+    return allocation;
+}
+
+GpuMemoryStats DeviceMemoryAllocator::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    GpuMemoryStats stats;
+    for (const auto& block : blocks) {
+        stats.reservedBytes += block->size;
+        stats.usedBytes += block->usedBytes;
+        stats.allocationCount += block->allocationCount;
+        stats.blockCount++;
+        for (const auto& [offset, size] : block->freeRanges) {
+            stats.largestFreeRange = std::max(stats.largestFreeRange, size);
+        }
+    }
+    for (const auto& [memory, size] : dedicatedAllocations) {
+        stats.reservedBytes += size;
+        stats.usedBytes += size;
+        stats.allocationCount++;
+        stats.dedicatedCount++;
+    }
+    return stats;
+}
+
+std::vector<HeapBudget> DeviceMemoryAllocator::getHeapBudgets() const {
+    /*
+     * This function asks the driver for the budgets if it can, its usage also counts memory allocated
+     * around this allocator (swap chain images, driver internals). Without the extension 80% of a heap is taken
+     * as the budget, which leaves room for everything the allocator does not see
+     */
+    std::vector<HeapBudget> budgets(memoryProperties.memoryHeapCount);
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT driverBudget{};
+    driverBudget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    if (memoryBudgetSupported) {
+        VkPhysicalDeviceMemoryProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &driverBudget;
+        vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties2);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+        budgets[heap].size = memoryProperties.memoryHeaps[heap].size;
+        budgets[heap].deviceLocal = (memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        if (memoryBudgetSupported) {
+            budgets[heap].budget = driverBudget.heapBudget[heap];
+            budgets[heap].usage = driverBudget.heapUsage[heap];
+        }
+        else {
+            budgets[heap].budget = budgets[heap].size / 10 * 8;
+            budgets[heap].usage = heapReservedBytes[heap];
+        }
+    }
+    for (const auto& block : blocks) {
+        budgets[memoryProperties.memoryTypes[block->memoryType].heapIndex].unusedBytes += block->size - block->usedBytes;
+    }
+    return budgets;
+}
+
+void DeviceMemoryAllocator::printStats() const {
+    GpuMemoryStats stats = getStats();
+    const double mib = 1024.0 * 1024.0;
+    std::cout << "Memory allocator: " << stats.usedBytes / mib << " MiB used / " << stats.reservedBytes / mib
+              << " MiB reserved in " << stats.blockCount << " blocks + " << stats.dedicatedCount << " dedicated, "
+              << stats.allocationCount << " allocations, fragmentation " << stats.fragmentation() << std::endl;
+    std::vector<HeapBudget> budgets = getHeapBudgets();
+    for (uint32_t heap = 0; heap < budgets.size(); heap++) {
+        std::cout << "    heap " << heap << (budgets[heap].deviceLocal ? " (device local): " : ": ") << budgets[heap].usage / mib
+                  << " MiB of " << budgets[heap].budget / mib << " MiB budget"
+                  << (memoryBudgetSupported ? "" : " (estimated, no VK_EXT_memory_budget)") << std::endl;
+    }
+}
+
+VkDeviceMemory DeviceMemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory! Error code: " + std::to_string(result));
+    }
+
+    *mapped = nullptr;
+    if (isHostVisible(memoryType) && vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+        vkFreeMemory(device, memory, nullptr);
+        throw std::runtime_error("failed to map device memory!");
+    }
+    heapReservedBytes[memoryProperties.memoryTypes[memoryType].heapIndex] += size;
+    return memory;
+}
+
+DeviceMemoryAllocator::Block* DeviceMemoryAllocator::createBlock(uint32_t memoryType, bool linear, VkDeviceSize minimumSize) {
+    auto block = std::make_unique<Block>();
+    block->size = std::max(blockSize, minimumSize);
+    block->memoryType = memoryType;
+    block->linear = linear;
+    void* mapped = nullptr;
+    block->memory = allocateDeviceMemory(block->size, memoryType, &mapped);
+    block->mapped = static_cast<char*>(mapped);
+    block->freeRanges[0] = block->size;
+
+    blocks.push_back(std::move(block));
+    return blocks.back().get();
+}
+
+bool DeviceMemoryAllocator::allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, GpuAllocation& allocation) {
+    /*
+     * This function takes the free range that leaves the least space over (best fit),
+     * and splits off whatever is left in front of and behind the allocation
+     */
+    auto best = block.freeRanges.end();
+    VkDeviceSize bestWaste = 0;
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+        VkDeviceSize alignedOffset = alignUp(it->first, alignment);
+        VkDeviceSize rangeEnd = it->first + it->second;
+        if (alignedOffset + size > rangeEnd) {
+            continue;
+        }
+        VkDeviceSize waste = it->second - size;
+        if (best == block.freeRanges.end() || waste < bestWaste) {
+            best = it;
+            bestWaste = waste;
+        }
+    }
+    if (best == block.freeRanges.end()) {
+        return false;
+    }
+
+    VkDeviceSize rangeOffset = best->first;
+    VkDeviceSize rangeEnd = best->first + best->second;
+    VkDeviceSize alignedOffset = alignUp(rangeOffset, alignment);
+    block.freeRanges.erase(best);
+    if (alignedOffset > rangeOffset) {
+        block.freeRanges[rangeOffset] = alignedOffset - rangeOffset;
+    }
+    if (alignedOffset + size < rangeEnd) {
+        block.freeRanges[alignedOffset + size] = rangeEnd - (alignedOffset + size);
+    }
+
+    block.usedBytes += size;
+    block.allocationCount++;
+
+    allocation.memory = block.memory;
+    allocation.offset = alignedOffset;
+    allocation.size = size;
+    allocation.memoryType = block.memoryType;
+    allocation.mapped = block.mapped ? block.mapped + alignedOffset : nullptr;
+    allocation.dedicated = false;
+    return true;
+}
+
+void DeviceMemoryAllocator::releaseToBlock(Block& block, VkDeviceSize offset, VkDeviceSize size) {
+    /*
+     * This function puts the range back in the free list, merging it with free neighbours on either side
+     */
+    block.usedBytes -= size;
+    block.allocationCount--;
+
+    auto inserted = block.freeRanges.emplace(offset, size).first;
+
+    auto next = std::next(inserted);
+    if (next != block.freeRanges.end() && inserted->first + inserted->second == next->first) {
+        inserted->second += next->second;
+        block.freeRanges.erase(next);
+    }
+    if (inserted != block.freeRanges.begin()) {
+        auto previous = std::prev(inserted);
+        if (previous->first + previous->second == inserted->first) {
+            previous->second += inserted->second;
+            block.freeRanges.erase(inserted);
+        }
+    }
+}
+
+void LinearAllocator::create(DeviceMemoryAllocator& allocator, VkDeviceSize bytesPerFrameIn, uint32_t framesInFlight, VkBufferUsageFlags usage) {
+    bytesPerFrame = bytesPerFrameIn;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = bytesPerFrame * framesInFlight;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(allocator.getDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create linear allocator buffer!");
+    }
+    allocation = allocator.allocateForBuffer(buffer, MemoryUsage::Dynamic);
+}
+
+void LinearAllocator::destroy(DeviceMemoryAllocator& allocator) {
+    vkDestroyBuffer(allocator.getDevice(), buffer, nullptr);
+    allocator.free(allocation);
+    buffer = VK_NULL_HANDLE;
+}
+
+void LinearAllocator::beginFrame(uint32_t frameSlot) {
+    regionStart = bytesPerFrame * frameSlot;
+    head = regionStart;
+}
+
+std::optional<LinearAllocator::Span> LinearAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+    VkDeviceSize offset = alignUp(head, alignment);
+    if (offset + size > regionStart + bytesPerFrame) {
+        return std::nullopt;
+    }
+    head = offset + size;
+
+    Span span;
+    span.buffer = buffer;
+    span.offset = offset;
+    span.mapped = static_cast<char*>(allocation.mapped) + offset;
+    return span;
+}
+
+PoolAllocator::PoolAllocator(DeviceMemoryAllocator& allocator, VkDeviceSize slotSize, VkDeviceSize slotAlignment,
+                             uint32_t memoryTypeBits, MemoryUsage usage, uint32_t slotsPerBlock)
+    : allocator(allocator), slotSize(alignUp(slotSize, slotAlignment)), usage(usage), slotsPerBlock(slotsPerBlock) {
+    blockRequirements.size = this->slotSize * slotsPerBlock;
+    blockRequirements.alignment = slotAlignment;
+    blockRequirements.memoryTypeBits = memoryTypeBits;
+}
+
+PoolAllocator::~PoolAllocator() {
+    for (const GpuAllocation& block : blocks) {
+        allocator.free(block);
+    }
+}
+
+GpuAllocation PoolAllocator::allocate() {
+    if (freeSlots.empty()) {
+        // carve a new block into slots, pushed in reverse so they get handed out front to back
+        GpuAllocation block = allocator.allocate(blockRequirements, usage, true);
+        blocks.push_back(block);
+        for (uint32_t i = slotsPerBlock; i-- > 0;) {
+            GpuAllocation slot = block;
+            slot.offset = block.offset + i * slotSize;
+            slot.size = slotSize;
+            slot.mapped = block.mapped ? static_cast<char*>(block.mapped) + i * slotSize : nullptr;
+            slot.dedicated = false;
+            freeSlots.push_back(slot);
+        }
+    }
+
+    GpuAllocation slot = freeSlots.back();
+    freeSlots.pop_back();
+    usedSlots++;
+    return slot;
+}
+
+void PoolAllocator::free(const GpuAllocation& slot) {
+    freeSlots.push_back(slot);
+    usedSlots--;
+}
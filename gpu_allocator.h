@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+enum class MemoryUsage {
+    GpuOnly,    // device local, never touched by the CPU
+    Upload,     // host visible and coherent, written by the CPU once and read by the GPU (staging)
+    Dynamic,    // host visible and coherent, device local if there is such a type (UMA or resizable BAR), rewritten often
+    Readback    // host visible and cached, written by the GPU and read back by the CPU
+};
+
+struct GpuAllocation {
+    /*
+     * This struct is one sub-allocation, the memory handle is shared with everything else in the same block
+     */
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+    // points at offset inside the persistently mapped block, nullptr for memory the CPU can not see
+    void* mapped = nullptr;
+    bool dedicated = false;
+
+    bool isValid() const { return memory != VK_NULL_HANDLE; }
+};
+
+struct GpuMemoryStats {
+    VkDeviceSize reservedBytes = 0;     // everything allocated with vkAllocateMemory
+    VkDeviceSize usedBytes = 0;         // everything handed out as sub-allocations
+    VkDeviceSize largestFreeRange = 0;
+    uint32_t blockCount = 0;
+    uint32_t dedicatedCount = 0;
+    uint32_t allocationCount = 0;
+
+    // 0 when all free memory is one range, close to 1 when it is scattered into small holes
+    double fragmentation() const {
+        VkDeviceSize freeBytes = reservedBytes - usedBytes;
+        return freeBytes == 0 ? 0.0 : 1.0 - static_cast<double>(largestFreeRange) / static_cast<double>(freeBytes);
+    }
+};
+
+struct HeapBudget {
+    /*
+     * This struct is one memory heap's usage against what this process may use of it
+     */
+    VkDeviceSize size = 0;
+    // the driver's budget with VK_EXT_memory_budget, else a fixed share of the heap
+    VkDeviceSize budget = 0;
+    // the driver's count for this process with VK_EXT_memory_budget, else what this allocator reserved
+    VkDeviceSize usage = 0;
+    // free space inside the allocator's blocks, part of usage but given back by every freed sub-allocation,
+    // empty blocks are kept, so usage alone does not go down when resources are freed
+    VkDeviceSize unusedBytes = 0;
+    bool deviceLocal = false;
+};
+
+class DeviceMemoryAllocator {
+    /*
+     * This class carves large VkDeviceMemory blocks into sub-allocations, so resources do not each cost a
+     * vkAllocateMemory and we stay far below maxMemoryAllocationCount. Every block keeps an offset sorted free list
+     * (best fit, neighbours merge on free). Linear resources (buffers) and optimal tiling images live in separate
+     * blocks, which keeps bufferImageGranularity out of the offset math. Requests bigger than half a block get a
+     * dedicated allocation. Host visible blocks stay mapped for their whole lifetime
+     */
+public:
+    // memoryBudget: VK_EXT_memory_budget is enabled on the device
+    void create(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget, VkDeviceSize blockSize = 64ull * 1024 * 1024);
+    void destroy();
+
+    // picks the best memory type for the usage among those allowed by typeBits, nullopt if none fits
+    std::optional<uint32_t> findMemoryType(uint32_t typeBits, MemoryUsage usage) const;
+    uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required) const;
+
+    GpuAllocation allocate(const VkMemoryRequirements& requirements, MemoryUsage usage, bool linear);
+    void free(const GpuAllocation& allocation);
+
+    // allocate + bind in one go
+    GpuAllocation allocateForBuffer(VkBuffer buffer, MemoryUsage usage);
+    GpuAllocation allocateForImage(VkImage image, MemoryUsage usage);
+
+    GpuMemoryStats getStats() const;
+    // one per heap, queried from the driver on every call if it has VK_EXT_memory_budget
+    std::vector<HeapBudget> getHeapBudgets() const;
+    void printStats() const;
+
+    VkDevice getDevice() const { return device; }
+    const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const { return memoryProperties; }
+    bool isHostVisible(uint32_t memoryType) const;
+
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memoryType = 0;
+        bool linear = true;
+        char* mapped = nullptr;
+        // offset -> size of every free range
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+        VkDeviceSize usedBytes = 0;
+        uint32_t allocationCount = 0;
+    };
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    VkDeviceSize blockSize = 0;
+    VkDeviceSize nonCoherentAtomSize = 1;
+    bool memoryBudgetSupported = false;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Block>> blocks;
+    // dedicated allocations: memory -> size
+    std::map<VkDeviceMemory, VkDeviceSize> dedicatedAllocations;
+    // what vkAllocateMemory handed out per heap, the usage when the driver can not tell
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> heapReservedBytes{};
+
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+    Block* createBlock(uint32_t memoryType, bool linear, VkDeviceSize minimumSize);
+    static bool allocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, GpuAllocation& allocation);
+    static void releaseToBlock(Block& block, VkDeviceSize offset, VkDeviceSize size);
+};
+
+class LinearAllocator {
+    /*
+     * This class is a ring of bump allocators over one host visible buffer for per frame transient data
+     * (uniforms, dynamic vertices). Each frame in flight owns one region, allocation is a pointer bump,
+     * and beginFrame() resets the region once the frame slot's fence said the GPU is done with it
+     */
+public:
+    void create(DeviceMemoryAllocator& allocator, VkDeviceSize bytesPerFrame, uint32_t framesInFlight, VkBufferUsageFlags usage);
+    void destroy(DeviceMemoryAllocator& allocator);
+
+    void beginFrame(uint32_t frameSlot);
+
+    struct Span {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        void* mapped = nullptr;
+    };
+    // nullopt if the frame's region is used up
+    std::optional<Span> allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+    VkBuffer getBuffer() const { return buffer; }
+    VkDeviceSize getFrameUsedBytes() const { return head - regionStart; }
+
+private:
+    VkBuffer buffer = VK_NULL_HANDLE;
+    GpuAllocation allocation;
+    VkDeviceSize bytesPerFrame = 0;
+    VkDeviceSize regionStart = 0;
+    VkDeviceSize head = 0;
+};
+
+class PoolAllocator {
+    /*
+     * This class hands out fixed size slots (say every particle system's buffer) from blocks it gets from the
+     * device allocator, freeing a slot is pushing it on a free list, so there is no fragmentation at all
+     */
+public:
+    PoolAllocator(DeviceMemoryAllocator& allocator, VkDeviceSize slotSize, VkDeviceSize slotAlignment,
+                  uint32_t memoryTypeBits, MemoryUsage usage, uint32_t slotsPerBlock = 64);
+    ~PoolAllocator();
+
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+    GpuAllocation allocate();
+    void free(const GpuAllocation& slot);
+
+    uint32_t getUsedSlots() const { return usedSlots; }
+    uint32_t getReservedSlots() const { return static_cast<uint32_t>(blocks.size()) * slotsPerBlock; }
+
+private:
+    DeviceMemoryAllocator& allocator;
+    VkDeviceSize slotSize;
+    VkMemoryRequirements blockRequirements{};
+    MemoryUsage usage;
+    uint32_t slotsPerBlock;
+    std::vector<GpuAllocation> blocks;
+    std::vector<GpuAllocation> freeSlots;
+    uint32_t usedSlots = 0;
+};
@@ -0,0 +1,1080 @@
+#include "gpu_driven.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace {
+
+void extractFrustumPlanes(const glm::mat4& viewProj, float planes[6][4]) {
+    /*
+     * Gribb/Hartmann: every plane is a sum or difference of two rows of the matrix, for a 0..1 depth range
+     * the near plane is the z row alone. The normals point inside and are normalized, so
+     * dot(normal, point) + w is a signed distance
+     */
+    auto row = [&viewProj](int index, int column) { return viewProj[column][index]; };
+    for (int column = 0; column < 4; column++) {
+        planes[0][column] = row(3, column) + row(0, column);
+        planes[1][column] = row(3, column) - row(0, column);
+        planes[2][column] = row(3, column) + row(1, column);
+        planes[3][column] = row(3, column) - row(1, column);
+        planes[4][column] = row(2, column);
+        planes[5][column] = row(3, column) - row(2, column);
+    }
+    for (int i = 0; i < 6; i++) {
+        float length = std::sqrt(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        for (int column = 0; column < 4; column++) {
+            planes[i][column] /= length;
+        }
+    }
+}
+
+uint32_t previousPowerOfTwo(uint32_t value) {
+    uint32_t power = 1;
+    while (power * 2 <= value) {
+        power *= 2;
+    }
+    return power;
+}
+
+uint32_t hash(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x7feb352d;
+    value ^= value >> 15;
+    value *= 0x846ca68b;
+    value ^= value >> 16;
+    return value;
+}
+
+void globalBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+                   VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+}
+
+void GpuDrivenRenderer::create(VkPhysicalDevice physicalDevice, DeviceMemoryAllocator& allocatorIn, StagingUploader& uploader,
+                               BindlessDescriptors& bindlessIn, ThreadPool& workers, const VkPhysicalDeviceLimits& limits,
+                               const IndirectDrawSupport& supportIn, bool synchronization2, bool dynamicRenderingIn,
+                               const std::vector<uint32_t>& queueFamilies, uint32_t framesInFlight, uint32_t instanceCountIn,
+                               VkFormat colorFormatIn, VkImageLayout colorLayoutIn) {
+    /*
+     * This function creates the mesh, the instances, the materials and the buffers the cull pass writes, and
+     * uploads the static data, frames have to wait on getUploadTicket() until it is on the GPU. The materials
+     * are only created when the bindless set exists
+     */
+    if (!supportIn.drawIndirectFirstInstance) {
+        throw std::runtime_error("GPU driven rendering needs the drawIndirectFirstInstance feature!");
+    }
+    device = allocatorIn.getDevice();
+    allocator = &allocatorIn;
+    bindless = &bindlessIn;
+    bindlessMaterials = bindlessIn.isCreated();
+    support = supportIn;
+    instanceCount = instanceCountIn;
+    colorFormat = colorFormatIn;
+    colorLayout = colorLayoutIn;
+    depthFormat = chooseDepthFormat(physicalDevice);
+    uniformAlignment = std::max<VkDeviceSize>(16, limits.minUniformBufferOffsetAlignment);
+
+    createScene(uploader, workers, queueFamilies);
+    if (bindlessMaterials) {
+        createMaterials(uploader, queueFamilies);
+    }
+
+    // the draws are only ever touched by the graphics queue
+    drawBuffer = createBuffer(instanceCount * sizeof(VkDrawIndexedIndirectCommand),
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                              MemoryUsage::GpuOnly, {}, drawAllocation);
+    countBuffer = createBuffer(sizeof(uint32_t),
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               MemoryUsage::GpuOnly, {}, countAllocation);
+    VkDeviceSize cullDataSize = (sizeof(CullData) + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+    uniforms.create(allocatorIn, cullDataSize, framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+    dynamicRendering = dynamicRenderingIn;
+    if (dynamicRendering) {
+        cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+        cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+        if (cmdBeginRendering == nullptr || cmdEndRendering == nullptr) {
+            throw std::runtime_error("failed to load the dynamic rendering commands!");
+        }
+    }
+    else {
+        createRenderPass();
+    }
+    createLayouts();
+    graph.create(allocatorIn, synchronization2);
+
+    std::cout << "GPU driven: " << instanceCount << " instances, drawn with "
+              << (support.drawIndirectCount ? "vkCmdDrawIndexedIndirectCount"
+                  : support.multiDrawIndirect ? "vkCmdDrawIndexedIndirect (one draw per instance)"
+                  : "one vkCmdDrawIndexedIndirect per instance")
+              << (dynamicRendering ? ", dynamic rendering" : ", render pass")
+              << (bindlessMaterials ? ", bindless materials" : ", flat materials (no descriptor indexing)") << std::endl;
+}
+
+void GpuDrivenRenderer::destroy() {
+    // the barriers of the last frame, before the graph goes with the targets
+    graph.printStats();
+    destroyTargets();
+    graph.destroy();
+
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyPipelineLayout(device, pyramidPipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device, drawPipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device, scenePipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, pyramidSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, sceneSetLayout, nullptr);
+    vkDestroySampler(device, pyramidSampler, nullptr);
+    vkDestroyRenderPass(device, renderPass, nullptr);
+
+    if (bindlessMaterials) {
+        bindless->remove(BindlessKind::StorageBuffer, materialBufferIndex);
+        bindless->remove(BindlessKind::Sampler, textureSamplerIndex);
+    }
+    for (size_t i = 0; i < textureImages.size(); i++) {
+        bindless->remove(BindlessKind::SampledImage, textureIndices[i]);
+        vkDestroyImageView(device, textureViews[i], nullptr);
+        vkDestroyImage(device, textureImages[i], nullptr);
+        allocator->free(textureAllocations[i]);
+    }
+    textureImages.clear();
+    textureAllocations.clear();
+    textureViews.clear();
+    textureIndices.clear();
+    vkDestroySampler(device, textureSampler, nullptr);
+
+    uniforms.destroy(*allocator);
+    for (auto [buffer, allocation] : {std::pair{vertexBuffer, vertexAllocation}, std::pair{indexBuffer, indexAllocation},
+                                      std::pair{sceneBuffers.worldMatrices, sceneBuffers.worldMatricesAllocation},
+                                      std::pair{sceneBuffers.worldBounds, sceneBuffers.worldBoundsAllocation},
+                                      std::pair{sceneBuffers.materials, sceneBuffers.materialsAllocation},
+                                      std::pair{drawBuffer, drawAllocation}, std::pair{countBuffer, countAllocation},
+                                      std::pair{materialBuffer, materialAllocation}}) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        allocator->free(allocation);
+    }
+    scene.destroy();
+    compiler = nullptr;
+}
+
+void GpuDrivenRenderer::createTargets(VkExtent2D extentIn, const std::vector<VkImage>& colorImagesIn,
+                                      const std::vector<VkImageView>& colorViewsIn) {
+    /*
+     * This function creates the depth pyramid and the frame's render graph for the framebuffer size, the depth
+     * buffer is one of the graph's transient images. The pyramid's mip 0 is the depth size rounded down to
+     * powers of two, so every mip after it halves exactly
+     */
+    extent = extentIn;
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    pyramidExtent = {previousPowerOfTwo(extent.width), previousPowerOfTwo(extent.height)};
+    pyramidLevels = 1;
+    while (pyramidLevels < MAX_PYRAMID_LEVELS && (std::max(pyramidExtent.width, pyramidExtent.height) >> pyramidLevels) > 0) {
+        pyramidLevels++;
+    }
+
+    imageInfo.format = VK_FORMAT_R32_SFLOAT;
+    imageInfo.extent = {pyramidExtent.width, pyramidExtent.height, 1};
+    imageInfo.mipLevels = pyramidLevels;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    if (vkCreateImage(device, &imageInfo, nullptr, &pyramidImage) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid image!");
+    }
+    pyramidAllocation = allocator->allocateForImage(pyramidImage, MemoryUsage::GpuOnly);
+
+    // one view over all mips for the cull pass, one per mip for the reduction
+    viewInfo.image = pyramidImage;
+    viewInfo.format = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = pyramidLevels;
+    if (vkCreateImageView(device, &viewInfo, nullptr, &pyramidView) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid view!");
+    }
+    pyramidLevelViews.resize(pyramidLevels);
+    for (uint32_t level = 0; level < pyramidLevels; level++) {
+        viewInfo.subresourceRange.baseMipLevel = level;
+        viewInfo.subresourceRange.levelCount = 1;
+        if (vkCreateImageView(device, &viewInfo, nullptr, &pyramidLevelViews[level]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create depth pyramid mip view!");
+        }
+    }
+
+    colorImages = colorImagesIn;
+    colorViews = colorViewsIn;
+    buildGraph();
+
+    // dynamic rendering takes the views as they are, only the render pass needs them wrapped
+    framebuffers.resize(dynamicRendering ? 0 : colorViews.size());
+    for (size_t i = 0; i < framebuffers.size(); i++) {
+        std::array<VkImageView, 2> attachments = {colorViews[i], depthView};
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        framebufferInfo.pAttachments = attachments.data();
+        framebufferInfo.width = extent.width;
+        framebufferInfo.height = extent.height;
+        framebufferInfo.layers = 1;
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+    }
+
+    pyramidValid = false;
+    writeDescriptorSets();
+}
+
+void GpuDrivenRenderer::destroyTargets() {
+    for (VkFramebuffer framebuffer : framebuffers) {
+        vkDestroyFramebuffer(device, framebuffer, nullptr);
+    }
+    framebuffers.clear();
+    for (VkImageView view : pyramidLevelViews) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    pyramidLevelViews.clear();
+    if (pyramidImage != VK_NULL_HANDLE) {
+        vkDestroyImageView(device, pyramidView, nullptr);
+        vkDestroyImage(device, pyramidImage, nullptr);
+        allocator->free(pyramidAllocation);
+        pyramidImage = VK_NULL_HANDLE;
+    }
+    // the depth buffer is the graph's
+    graph.reset();
+    depthView = VK_NULL_HANDLE;
+    colorImages.clear();
+    colorViews.clear();
+}
+
+void GpuDrivenRenderer::requestPipelines(PipelineCompiler& compilerIn, ShaderLibrary& shaders) {
+    /*
+     * This function queues the three pipelines at critical priority, the shaders are loaded by the build
+     * functions on the compile workers
+     */
+    compiler = &compilerIn;
+    cullPipeline = compiler->request("gpu driven cull", [this, &shaders](PipelineCache& cache) {
+        return buildCullPipeline(cache, shaders);
+    }, PipelinePriority::Critical, std::nullopt, {"cull.comp"});
+    drawPipeline = compiler->request("gpu driven draw", [this, &shaders](PipelineCache& cache) {
+        return buildDrawPipeline(cache, shaders);
+    }, PipelinePriority::Critical, std::nullopt, {"instanced.vert", bindlessMaterials ? "instanced.frag" : "instanced_flat.frag"});
+    pyramidPipeline = compiler->request("depth pyramid", [this, &shaders](PipelineCache& cache) {
+        return buildPyramidPipeline(cache, shaders);
+    }, PipelinePriority::Critical, std::nullopt, {"depth_pyramid.comp"});
+}
+
+void GpuDrivenRenderer::record(VkCommandBuffer commandBuffer, uint32_t frameSlot, uint32_t imageIndex, uint64_t frameNumber,
+                               GpuProfiler& profiler, FrameArena& arena) {
+    /*
+     * This function records the frame's graph, clear count -> cull -> draw -> pyramid. The draw, count and pyramid
+     * resources are shared by all frames in flight, they are all on the graphics queue so the graph's barriers
+     * order them across frames too
+     */
+    if (compiler == nullptr) {
+        return;
+    }
+    VkPipeline cull = compiler->get(cullPipeline.value());
+    VkPipeline draw = compiler->get(drawPipeline.value());
+    VkPipeline pyramid = compiler->get(pyramidPipeline.value());
+    if (cull == VK_NULL_HANDLE || draw == VK_NULL_HANDLE || pyramid == VK_NULL_HANDLE) {
+        return;
+    }
+
+    uniforms.beginFrame(frameSlot);
+    std::optional<LinearAllocator::Span> span = uniforms.allocate(sizeof(CullData), uniformAlignment);
+    if (!span.has_value()) {
+        throw std::runtime_error("cull data does not fit in its frame region!");
+    }
+    CullData cullData{};
+    fillCullData(cullData, frameNumber);
+    std::memcpy(span->mapped, &cullData, sizeof(cullData));
+    uint32_t dynamicOffset = static_cast<uint32_t>(span->offset);
+
+    frame.cull = cull;
+    frame.draw = draw;
+    frame.pyramid = pyramid;
+    frame.dynamicOffset = dynamicOffset;
+    frame.imageIndex = imageIndex;
+    frame.profiler = &profiler;
+    graph.setImportedImage(colorResource, colorImages.at(imageIndex));
+    graph.execute(commandBuffer, arena);
+
+    // what the next frame culls against was seen through this frame's camera
+    std::memcpy(prevViewProj, cullData.viewProj, sizeof(prevViewProj));
+    pyramidValid = true;
+}
+
+void GpuDrivenRenderer::buildGraph() {
+    /*
+     * This function declares the frame to the render graph. The color image is the frame's, cleared before and
+     * copied or presented after in colorLayout, where a transfer or a load op left it. The draws, the count and the pyramid outlive the frame,
+     * the depth buffer is only needed from the draw to the pyramid build and is transient
+     */
+    const VkPipelineStageFlags2 fragmentTests = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+    const ResourceState frameColor = colorLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+            ? ResourceState{VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, colorLayout}
+            : ResourceState{VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, colorLayout};
+    const ResourceState indirectRead{VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT};
+
+    colorResource = graph.importImage("color", VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT, 1, frameColor, frameColor);
+    drawResource = graph.importBuffer("draws", drawBuffer, {});
+    countResource = graph.importBuffer("draw count", countBuffer, {});
+    // starts out UNDEFINED, and the first frame culls without it
+    pyramidResource = graph.importImage("depth pyramid", pyramidImage, VK_IMAGE_ASPECT_COLOR_BIT, pyramidLevels, {});
+    depthResource = graph.createImage("depth", {depthFormat, extent, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                VK_IMAGE_ASPECT_DEPTH_BIT, 1});
+
+    graph.addPass("clear count", [this](VkCommandBuffer commandBuffer) {
+        vkCmdFillBuffer(commandBuffer, countBuffer, 0, sizeof(uint32_t), 0);
+    }).write(countResource, {VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT});
+
+    graph.addPass("cull", [this](VkCommandBuffer commandBuffer) {
+        GpuProfileScope cullScope(*frame.profiler, commandBuffer, "cull");
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, frame.cull);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, scenePipelineLayout, 0, 1, &sceneSet, 1, &frame.dynamicOffset);
+        vkCmdDispatch(commandBuffer, (instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    }).write(countResource, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT})
+      .write(drawResource, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT})
+      .read(pyramidResource, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL});
+
+    graph.addPass("draw", [this](VkCommandBuffer commandBuffer) {
+        GpuProfileScope drawScope(*frame.profiler, commandBuffer, "draw");
+        beginRendering(commandBuffer);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, frame.draw);
+        VkViewport viewport{0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f};
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        VkRect2D scissor{{0, 0}, extent};
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        VkDeviceSize vertexOffset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &vertexOffset);
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipelineLayout, 0, 1, &sceneSet, 1, &frame.dynamicOffset);
+        if (bindlessMaterials) {
+            bindless->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipelineLayout);
+            vkCmdPushConstants(commandBuffer, drawPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(materialBufferIndex), &materialBufferIndex);
+        }
+
+        const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+        if (support.drawIndirectCount) {
+            vkCmdDrawIndexedIndirectCount(commandBuffer, drawBuffer, 0, countBuffer, 0,
+                                          std::min(instanceCount, support.maxDrawIndirectCount), stride);
+        }
+        else {
+            // every instance has its own draw, the culled ones draw 0 instances
+            uint32_t drawsPerCall = support.multiDrawIndirect ? support.maxDrawIndirectCount : 1;
+            for (uint32_t first = 0; first < instanceCount; first += drawsPerCall) {
+                vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, static_cast<VkDeviceSize>(first) * stride,
+                                         std::min(drawsPerCall, instanceCount - first), stride);
+            }
+        }
+
+        endRendering(commandBuffer);
+    }).read(drawResource, indirectRead)
+      .read(countResource, indirectRead)
+      .write(colorResource, {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                             VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                             VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL})
+      .write(depthResource, {fragmentTests, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                             VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL});
+
+    graph.addPass("depth pyramid", [this](VkCommandBuffer commandBuffer) {
+        GpuProfileScope pyramidScope(*frame.profiler, commandBuffer, "depthPyramid");
+        recordPyramid(commandBuffer, frame.pyramid);
+    }).read(depthResource, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL})
+      .write(pyramidResource, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+                               VK_IMAGE_LAYOUT_GENERAL});
+
+    graph.compile();
+    depthView = graph.getImageView(depthResource);
+}
+
+void GpuDrivenRenderer::beginRendering(VkCommandBuffer commandBuffer) const {
+    /*
+     * This function starts drawing into the frame's color image and the depth buffer, the color attachment is
+     * loaded and only depth is cleared. Either way the graph has both in their attachment layouts already
+     */
+    if (!dynamicRendering) {
+        std::array<VkClearValue, 2> clearValues{};
+        clearValues[1].depthStencil = {1.0f, 0};
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = framebuffers.at(frame.imageIndex);
+        renderPassInfo.renderArea = {{0, 0}, extent};
+        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    VkRenderingAttachmentInfoKHR colorAttachment{};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    colorAttachment.imageView = colorViews.at(frame.imageIndex);
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    VkRenderingAttachmentInfoKHR depthAttachment{};
+    depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    depthAttachment.imageView = depthView;
+    depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    // the pyramid build reads it after the draw
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.clearValue.depthStencil = {1.0f, 0};
+
+    VkRenderingInfoKHR renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+    renderingInfo.renderArea = {{0, 0}, extent};
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    renderingInfo.pDepthAttachment = &depthAttachment;
+    cmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+void GpuDrivenRenderer::endRendering(VkCommandBuffer commandBuffer) const {
+    if (dynamicRendering) {
+        cmdEndRendering(commandBuffer);
+    }
+    else {
+        vkCmdEndRenderPass(commandBuffer);
+    }
+}
+
+VkBuffer GpuDrivenRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage,
+                                         const std::vector<uint32_t>& queueFamilies, GpuAllocation& allocation) const {
+    /*
+     * This function creates a buffer with its memory, shared between the queueFamilies if there are several,
+     * the uploader writes the static data on the transfer queue and this saves the ownership transfer
+     */
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    if (queueFamilies.size() > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+        bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
+    else {
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+    VkBuffer buffer;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create GPU driven buffer!");
+    }
+    allocation = allocator->allocateForBuffer(buffer, memoryUsage);
+    return buffer;
+}
+
+void GpuDrivenRenderer::createScene(StagingUploader& uploader, ThreadPool& workers, const std::vector<uint32_t>& queueFamilies) {
+    /*
+     * This function lays the instances out in a cube shaped grid of cubes with some variation in size, orientation
+     * and material, the same every run so benchmark numbers are comparable
+     */
+    // unit cube, vertex i has x, y and z from its bits 0, 1 and 2, faces wind counter clockwise seen from outside
+    const float vertices[8 * 3] = {
+            -0.5f, -0.5f, -0.5f,   0.5f, -0.5f, -0.5f,  -0.5f, 0.5f, -0.5f,   0.5f, 0.5f, -0.5f,
+            -0.5f, -0.5f, 0.5f,    0.5f, -0.5f, 0.5f,   -0.5f, 0.5f, 0.5f,    0.5f, 0.5f, 0.5f,
+    };
+    const uint16_t indices[36] = {
+            4, 5, 7, 4, 7, 6,   // +z
+            0, 2, 3, 0, 3, 1,   // -z
+            1, 3, 7, 1, 7, 5,   // +x
+            0, 4, 6, 0, 6, 2,   // -x
+            2, 6, 7, 2, 7, 3,   // +y
+            0, 1, 5, 0, 5, 4,   // -y
+    };
+    indexCount = 36;
+
+    const float spacing = 2.5f;
+    uint32_t side = 1;
+    while (side * side * side < instanceCount) {
+        side++;
+    }
+    sceneExtent = side * spacing;
+
+    // the sphere around the unit cube, half its diagonal
+    const glm::vec4 cubeBounds(0.0f, 0.0f, 0.0f, 0.8660254f);
+    scene.create(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        uint32_t random = hash(i);
+        float edge = 0.6f + 0.8f * static_cast<float>(random & 0xff) / 255.0f;
+        glm::vec3 position((static_cast<float>(i % side) + 0.5f) * spacing - sceneExtent * 0.5f,
+                           (static_cast<float>(i / side % side) + 0.5f) * spacing - sceneExtent * 0.5f,
+                           (static_cast<float>(i / (side * side)) + 0.5f) * spacing - sceneExtent * 0.5f);
+        float angle = static_cast<float>((random >> 8) & 0xff) / 255.0f * 3.1415927f;
+        glm::vec3 axis = glm::normalize(glm::vec3(static_cast<float>((random >> 16) & 0xff) + 1.0f,
+                                                  static_cast<float>((random >> 24) & 0xff) + 1.0f, 64.0f));
+        scene.add(position, glm::angleAxis(angle, axis), glm::vec3(edge), cubeBounds, hash(i ^ 0x9e3779b9u) % MATERIAL_COUNT);
+    }
+    scene.updateWorld(workers);
+
+    MemoryUsage staticUsage = uploader.getStaticDataUsage();
+    vertexBuffer = createBuffer(sizeof(vertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                staticUsage, queueFamilies, vertexAllocation);
+    indexBuffer = createBuffer(sizeof(indices), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               staticUsage, queueFamilies, indexAllocation);
+    const VkBufferUsageFlags sceneUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    sceneBuffers.worldMatrices = createBuffer(scene.getCapacity() * sizeof(glm::mat4), sceneUsage, staticUsage, queueFamilies,
+                                              sceneBuffers.worldMatricesAllocation);
+    sceneBuffers.worldBounds = createBuffer(scene.getCapacity() * sizeof(glm::vec4), sceneUsage, staticUsage, queueFamilies,
+                                            sceneBuffers.worldBoundsAllocation);
+    sceneBuffers.materials = createBuffer(scene.getCapacity() * sizeof(uint32_t), sceneUsage, staticUsage, queueFamilies,
+                                          sceneBuffers.materialsAllocation);
+
+    // everything goes out in the same batch, the last ticket covers it all
+    uploader.uploadBuffer(vertexBuffer, vertexAllocation, 0, vertices, sizeof(vertices));
+    uploader.uploadBuffer(indexBuffer, indexAllocation, 0, indices, sizeof(indices));
+    uploadTicket = scene.upload(uploader, sceneBuffers);
+}
+
+void GpuDrivenRenderer::createMaterials(StagingUploader& uploader, const std::vector<uint32_t>& queueFamilies) {
+    /*
+     * This function creates a few procedural grey textures and the materials that tint them, and adds them all to
+     * the bindless set. All of it goes out after the scene data, so the last ticket becomes the upload ticket
+     */
+    std::vector<uint8_t> pixels(TEXTURE_SIZE * TEXTURE_SIZE * 4);
+    for (uint32_t texture = 0; texture < TEXTURE_COUNT; texture++) {
+        for (uint32_t y = 0; y < TEXTURE_SIZE; y++) {
+            for (uint32_t x = 0; x < TEXTURE_SIZE; x++) {
+                uint8_t value = 255;
+                if (texture == 0) {
+                    // checker
+                    value = ((x / 8 + y / 8) & 1) ? 255 : 96;
+                }
+                else if (texture == 1) {
+                    // stripes
+                    value = ((x / 4) & 1) ? 255 : 128;
+                }
+                else if (texture == 2) {
+                    // dots
+                    int dx = static_cast<int>(x % 16) - 8;
+                    int dy = static_cast<int>(y % 16) - 8;
+                    value = dx * dx + dy * dy < 16 ? 80 : 255;
+                }
+                else {
+                    // noise
+                    value = static_cast<uint8_t>(128 + (hash(y * TEXTURE_SIZE + x) & 0x7f));
+                }
+                uint8_t* pixel = &pixels[(y * TEXTURE_SIZE + x) * 4];
+                pixel[0] = pixel[1] = pixel[2] = value;
+                pixel[3] = 255;
+            }
+        }
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageInfo.extent = {TEXTURE_SIZE, TEXTURE_SIZE, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        // shared like the buffers, the uploader's layout change then needs no ownership transfer either
+        if (queueFamilies.size() > 1) {
+            imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+            imageInfo.pQueueFamilyIndices = queueFamilies.data();
+        }
+        else {
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImage image;
+        if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create material texture!");
+        }
+        textureImages.push_back(image);
+        textureAllocations.push_back(allocator->allocateForImage(image, MemoryUsage::GpuOnly));
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        VkImageView view;
+        if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create material texture view!");
+        }
+        textureViews.push_back(view);
+        textureIndices.push_back(bindless->addSampledImage(view));
+
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {TEXTURE_SIZE, TEXTURE_SIZE, 1};
+        uploader.uploadImage(image, region, pixels.data(), pixels.size(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create material sampler!");
+    }
+    textureSamplerIndex = bindless->addSampler(textureSampler);
+
+    std::vector<Material> materials(MATERIAL_COUNT);
+    for (uint32_t i = 0; i < MATERIAL_COUNT; i++) {
+        uint32_t random = hash(i + 1);
+        materials[i].tint[0] = 0.4f + 0.6f * static_cast<float>(random & 0xff) / 255.0f;
+        materials[i].tint[1] = 0.4f + 0.6f * static_cast<float>((random >> 8) & 0xff) / 255.0f;
+        materials[i].tint[2] = 0.4f + 0.6f * static_cast<float>((random >> 16) & 0xff) / 255.0f;
+        materials[i].tint[3] = 1.0f;
+        materials[i].textureIndex = textureIndices[i % TEXTURE_COUNT];
+        materials[i].samplerIndex = textureSamplerIndex;
+    }
+    VkDeviceSize materialBytes = materials.size() * sizeof(Material);
+    materialBuffer = createBuffer(materialBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                  uploader.getStaticDataUsage(), queueFamilies, materialAllocation);
+    uploadTicket = uploader.uploadBuffer(materialBuffer, materialAllocation, 0, materials.data(), materialBytes);
+    materialBufferIndex = bindless->addStorageBuffer(materialBuffer);
+}
+
+void GpuDrivenRenderer::createRenderPass() {
+    /*
+     * This function creates the render pass the instances are drawn in. The graph moves both attachments into
+     * their attachment layouts before the pass and out of them after, so the pass itself transitions nothing and
+     * needs no external dependencies
+     */
+    std::array<VkAttachmentDescription, 2> attachments{};
+    attachments[0].format = colorFormat;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachments[1].format = depthFormat;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorReference{0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkAttachmentReference depthReference{1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    subpass.pDepthStencilAttachment = &depthReference;
+
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+}
+
+void GpuDrivenRenderer::createLayouts() {
+    /*
+     * This function creates the descriptor and pipeline layouts, the draw adds the bindless set to the cull's,
+     * and the pool the sets come from, sized for the deepest pyramid
+     */
+    std::array<VkDescriptorSetLayoutBinding, 7> sceneBindings{};
+    const VkDescriptorType sceneTypes[7] = {
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,   // cull data
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,           // world bounds
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,           // draws
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,           // draw count
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,   // depth pyramid
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,           // world matrices
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,           // material indices
+    };
+    const VkShaderStageFlags sceneStages[7] = {
+            VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            VK_SHADER_STAGE_VERTEX_BIT,
+            VK_SHADER_STAGE_VERTEX_BIT,
+    };
+    for (uint32_t i = 0; i < sceneBindings.size(); i++) {
+        sceneBindings[i].binding = i;
+        sceneBindings[i].descriptorType = sceneTypes[i];
+        sceneBindings[i].descriptorCount = 1;
+        sceneBindings[i].stageFlags = sceneStages[i];
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(sceneBindings.size());
+    setLayoutInfo.pBindings = sceneBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &sceneSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create scene descriptor set layout!");
+    }
+
+    std::array<VkDescriptorSetLayoutBinding, 2> pyramidBindings{};
+    pyramidBindings[0] = {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+    pyramidBindings[1] = {1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr};
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(pyramidBindings.size());
+    setLayoutInfo.pBindings = pyramidBindings.data();
+    if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &pyramidSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid descriptor set layout!");
+    }
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &sceneSetLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &scenePipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create scene pipeline layout!");
+    }
+
+    // without the bindless set the draw layout is the scene layout over again, only without a push constant
+    std::array<VkDescriptorSetLayout, 2> drawSetLayouts = {sceneSetLayout, bindlessMaterials ? bindless->getLayout() : VK_NULL_HANDLE};
+    static_assert(BindlessDescriptors::BINDLESS_SET == 1, "the draw layout puts the bindless set right after the scene set");
+    // the bindless index of the material buffer
+    VkPushConstantRange materialRange{VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t)};
+    pipelineLayoutInfo.setLayoutCount = bindlessMaterials ? static_cast<uint32_t>(drawSetLayouts.size()) : 1;
+    pipelineLayoutInfo.pSetLayouts = drawSetLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = bindlessMaterials ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = &materialRange;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &drawPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create draw pipeline layout!");
+    }
+
+    // source and destination size of the mip being built
+    VkPushConstantRange sizesRange{VK_SHADER_STAGE_COMPUTE_BIT, 0, 4 * sizeof(uint32_t)};
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &pyramidSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &sizesRange;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pyramidPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid pipeline layout!");
+    }
+
+    std::array<VkDescriptorPoolSize, 4> poolSizes = {{
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 + MAX_PYRAMID_LEVELS},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_PYRAMID_LEVELS},
+    }};
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = 1 + MAX_PYRAMID_LEVELS;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+
+    // nearest, so a texel of the pyramid is never blended with a nearer neighbour
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &pyramidSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid sampler!");
+    }
+}
+
+void GpuDrivenRenderer::writeDescriptorSets() {
+    /*
+     * This function allocates and writes every set from scratch, it runs whenever the targets are recreated
+     */
+    vkResetDescriptorPool(device, descriptorPool, 0);
+
+    VkDescriptorSetAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocateInfo.descriptorPool = descriptorPool;
+    allocateInfo.descriptorSetCount = 1;
+    allocateInfo.pSetLayouts = &sceneSetLayout;
+    if (vkAllocateDescriptorSets(device, &allocateInfo, &sceneSet) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate scene descriptor set!");
+    }
+    std::vector<VkDescriptorSetLayout> pyramidLayouts(pyramidLevels, pyramidSetLayout);
+    pyramidSets.resize(pyramidLevels);
+    allocateInfo.descriptorSetCount = pyramidLevels;
+    allocateInfo.pSetLayouts = pyramidLayouts.data();
+    if (vkAllocateDescriptorSets(device, &allocateInfo, pyramidSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate depth pyramid descriptor sets!");
+    }
+
+    // indexed by binding, 4 is the pyramid
+    std::array<VkDescriptorBufferInfo, 7> bufferInfos = {{
+            {uniforms.getBuffer(), 0, sizeof(CullData)},
+            {sceneBuffers.worldBounds, 0, VK_WHOLE_SIZE},
+            {drawBuffer, 0, VK_WHOLE_SIZE},
+            {countBuffer, 0, VK_WHOLE_SIZE},
+            {},
+            {sceneBuffers.worldMatrices, 0, VK_WHOLE_SIZE},
+            {sceneBuffers.materials, 0, VK_WHOLE_SIZE},
+    }};
+    VkDescriptorImageInfo pyramidInfo{pyramidSampler, pyramidView, VK_IMAGE_LAYOUT_GENERAL};
+
+    // image infos are referenced by the writes, so they can not move while the vector grows
+    std::vector<VkDescriptorImageInfo> imageInfos;
+    imageInfos.reserve(2 * pyramidLevels);
+    std::vector<VkWriteDescriptorSet> writes;
+    auto addWrite = [&writes](VkDescriptorSet set, uint32_t binding, VkDescriptorType type,
+                              const VkDescriptorBufferInfo* bufferInfo, const VkDescriptorImageInfo* imageInfo) {
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set;
+        write.dstBinding = binding;
+        write.descriptorCount = 1;
+        write.descriptorType = type;
+        write.pBufferInfo = bufferInfo;
+        write.pImageInfo = imageInfo;
+        writes.push_back(write);
+    };
+    addWrite(sceneSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &bufferInfos[0], nullptr);
+    for (uint32_t binding : {1u, 2u, 3u, 5u, 6u}) {
+        addWrite(sceneSet, binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &bufferInfos[binding], nullptr);
+    }
+    addWrite(sceneSet, 4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nullptr, &pyramidInfo);
+
+    // mip 0 reads the depth buffer, every other mip the one above it
+    for (uint32_t level = 0; level < pyramidLevels; level++) {
+        if (level == 0) {
+            imageInfos.push_back({pyramidSampler, depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL});
+        }
+        else {
+            imageInfos.push_back({pyramidSampler, pyramidLevelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL});
+        }
+        addWrite(pyramidSets[level], 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nullptr, &imageInfos.back());
+        imageInfos.push_back({VK_NULL_HANDLE, pyramidLevelViews[level], VK_IMAGE_LAYOUT_GENERAL});
+        addWrite(pyramidSets[level], 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, nullptr, &imageInfos.back());
+    }
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void GpuDrivenRenderer::fillCullData(CullData& data, uint64_t frameNumber) const {
+    /*
+     * This function moves the camera on a fixed orbit around the grid, driven by the frame number rather than
+     * the clock so every run renders the same frames
+     */
+    float angle = static_cast<float>(frameNumber % 100000) * 0.004f;
+    float radius = sceneExtent * 0.75f;
+    glm::vec3 eye(std::cos(angle) * radius, sceneExtent * 0.2f, std::sin(angle) * radius);
+    float aspect = static_cast<float>(extent.width) / static_cast<float>(extent.height);
+    // Vulkan clip space: depth 0..1 and y down, so y is flipped to keep +y up on screen
+    glm::mat4 projection = glm::perspectiveRH_ZO(1.0471976f, aspect, 0.1f, sceneExtent * 3.0f);
+    projection[1][1] = -projection[1][1];
+    glm::mat4 viewProj = projection * glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    std::memcpy(data.viewProj, glm::value_ptr(viewProj), sizeof(data.viewProj));
+    std::memcpy(data.prevViewProj, prevViewProj, sizeof(data.prevViewProj));
+    extractFrustumPlanes(viewProj, data.frustum);
+    data.pyramidSize[0] = static_cast<float>(pyramidExtent.width);
+    data.pyramidSize[1] = static_cast<float>(pyramidExtent.height);
+    data.params[0] = instanceCount;
+    data.params[1] = indexCount;
+    data.params[2] = (pyramidValid ? CULL_OCCLUSION : 0) | (support.drawIndirectCount ? CULL_COMPACT : 0);
+    data.params[3] = std::min(instanceCount, support.maxDrawIndirectCount);
+}
+
+void GpuDrivenRenderer::recordPyramid(VkCommandBuffer commandBuffer, VkPipeline pipeline) {
+    /*
+     * This function reduces the depth buffer into the pyramid one mip at a time, each mip waits for the one before.
+     * The graph already ordered the whole pass after this frame's cull, no barriers between mips are its business
+     */
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    VkExtent2D source = extent;
+    for (uint32_t level = 0; level < pyramidLevels; level++) {
+        VkExtent2D destination = {std::max(pyramidExtent.width >> level, 1u), std::max(pyramidExtent.height >> level, 1u)};
+        uint32_t sizes[4] = {source.width, source.height, destination.width, destination.height};
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipelineLayout, 0, 1, &pyramidSets[level], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sizes), sizes);
+        vkCmdDispatch(commandBuffer, (destination.width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                      (destination.height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+
+        // the next mip reads this one, and the next frame's cull reads them all
+        globalBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        source = destination;
+    }
+}
+
+VkPipeline GpuDrivenRenderer::buildCullPipeline(PipelineCache& cache, ShaderLibrary& shaders) const {
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaders.load("cull.comp");
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = scenePipelineLayout;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (cache.createComputePipelines(1, &pipelineInfo, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create cull pipeline!");
+    }
+    return pipeline;
+}
+
+VkPipeline GpuDrivenRenderer::buildDrawPipeline(PipelineCache& cache, ShaderLibrary& shaders) const {
+    std::array<VkPipelineShaderStageCreateInfo, 2> stages{};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = shaders.load("instanced.vert");
+    stages[0].pName = "main";
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = shaders.load(bindlessMaterials ? "instanced.frag" : "instanced_flat.frag");
+    stages[1].pName = "main";
+
+    VkVertexInputBindingDescription binding{0, 3 * sizeof(float), VK_VERTEX_INPUT_RATE_VERTEX};
+    VkVertexInputAttributeDescription position{0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0};
+    VkPipelineVertexInputStateCreateInfo vertexInput{};
+    vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInput.vertexBindingDescriptionCount = 1;
+    vertexInput.pVertexBindingDescriptions = &binding;
+    vertexInput.vertexAttributeDescriptionCount = 1;
+    vertexInput.pVertexAttributeDescriptions = &position;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    // viewport and scissor are dynamic, so a resize does not need new pipelines
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    // the projection flips y, which turns the mesh's counter clockwise faces into counter clockwise in Vulkan's terms
+    VkPipelineRasterizationStateCreateInfo rasterization{};
+    rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterization.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterization.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisample{};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+    VkPipelineColorBlendAttachmentState blendAttachment{};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    VkPipelineColorBlendStateCreateInfo colorBlend{};
+    colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlend.attachmentCount = 1;
+    colorBlend.pAttachments = &blendAttachment;
+
+    std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicState.pDynamicStates = dynamicStates.data();
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+    pipelineInfo.pStages = stages.data();
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterization;
+    pipelineInfo.pMultisampleState = &multisample;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlend;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = drawPipelineLayout;
+    // with dynamic rendering the pipeline only has to match the attachment formats, not a render pass object
+    VkPipelineRenderingCreateInfoKHR renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &colorFormat;
+    renderingInfo.depthAttachmentFormat = depthFormat;
+    if (dynamicRendering) {
+        pipelineInfo.pNext = &renderingInfo;
+    }
+    else {
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+    }
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (cache.createGraphicsPipelines(1, &pipelineInfo, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instanced draw pipeline!");
+    }
+    return pipeline;
+}
+
+VkPipeline GpuDrivenRenderer::buildPyramidPipeline(PipelineCache& cache, ShaderLibrary& shaders) const {
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaders.load("depth_pyramid.comp");
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pyramidPipelineLayout;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (cache.createComputePipelines(1, &pipelineInfo, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth pyramid pipeline!");
+    }
+    return pipeline;
+}
+
+VkFormat GpuDrivenRenderer::chooseDepthFormat(VkPhysicalDevice physicalDevice) {
+    /*
+     * This function picks a depth format that can be both rendered to and sampled, D16 always can
+     */
+    const VkFormatFeatureFlags wanted = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+    for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM}) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+        if ((properties.optimalTilingFeatures & wanted) == wanted) {
+            return format;
+        }
+    }
+    throw std::runtime_error("failed to find a depth format that can be sampled!");
+}
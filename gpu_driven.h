@@ -0,0 +1,212 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "bindless_descriptors.h"
+#include "gpu_allocator.h"
+#include "gpu_profiler.h"
+#include "pipeline_compiler.h"
+#include "render_graph.h"
+#include "scene_storage.h"
+#include "shader_library.h"
+#include "staging_uploader.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+struct IndirectDrawSupport {
+    /*
+     * This struct is what the device can do for the GPU driven path, each missing feature falls back a step
+     */
+    // draw count read from a buffer (vkCmdDrawIndexedIndirectCount), else every instance keeps its own draw
+    bool drawIndirectCount = false;
+    // more than one draw per indirect call, else one vkCmdDrawIndexedIndirect per instance
+    bool multiDrawIndirect = false;
+    // the draws pick their instance through firstInstance, this one has no fallback
+    bool drawIndirectFirstInstance = false;
+    uint32_t maxDrawIndirectCount = 1;
+};
+
+class GpuDrivenRenderer {
+    /*
+     * This class draws a large number of instances of one mesh without any per instance CPU work. Every frame
+     * a compute pass culls the instances in a storage buffer against the frustum and against the depth pyramid
+     * (hierarchical Z) of the previous frame, and writes a VkDrawIndexedIndirectCommand per survivor, the draw
+     * is then a single vkCmdDrawIndexedIndirectCount. After the draw the depth buffer is reduced into the pyramid
+     * that the next frame culls against. Occluded instances are tested with the previous camera, so something
+     * that just came into view shows up a frame late. The instances are a SceneStorage whose world matrices,
+     * bounds and material indices are uploaded as separate arrays, the cull pass only ever reads the bounds.
+     * Materials and their textures live in the bindless set. Without descriptor indexing there is no bindless set,
+     * the instances are then drawn in a flat tint per material (instanced_flat.frag) and everything else is the same.
+     * With VK_KHR_dynamic_rendering the draw names its attachments when it begins rendering, so there is no render
+     * pass and no framebuffer to recreate on a resize, and the draw pipeline only depends on the attachment formats.
+     * Without it the same draw goes through a render pass with a framebuffer per color image
+     */
+public:
+    void create(VkPhysicalDevice physicalDevice, DeviceMemoryAllocator& allocator, StagingUploader& uploader,
+                BindlessDescriptors& bindless, ThreadPool& workers, const VkPhysicalDeviceLimits& limits,
+                const IndirectDrawSupport& support, bool synchronization2, bool dynamicRendering,
+                const std::vector<uint32_t>& queueFamilies, uint32_t framesInFlight, uint32_t instanceCount, VkFormat colorFormat,
+                VkImageLayout colorLayout);
+    void destroy();
+
+    // (re)creates the depth pyramid, the render graph with its depth buffer and, without dynamic rendering,
+    // a framebuffer per color view, the device has to be idle
+    void createTargets(VkExtent2D extent, const std::vector<VkImage>& colorImages, const std::vector<VkImageView>& colorViews);
+    void destroyTargets();
+
+    // queues the pipelines on the compiler, the pass is skipped until all of them are ready
+    void requestPipelines(PipelineCompiler& compiler, ShaderLibrary& shaders);
+
+    // records cull, draw and pyramid build, the color image has to be in the colorLayout create() was given and
+    // is left in it, TRANSFER_DST_OPTIMAL or COLOR_ATTACHMENT_OPTIMAL
+    void record(VkCommandBuffer commandBuffer, uint32_t frameSlot, uint32_t imageIndex, uint64_t frameNumber, GpuProfiler& profiler,
+                FrameArena& arena);
+
+    // the upload of the mesh and instance data, frames have to wait for it until it is complete
+    UploadTicket getUploadTicket() const { return uploadTicket; }
+    uint32_t getInstanceCount() const { return instanceCount; }
+
+private:
+    struct CullData {
+        /*
+         * This struct mirrors the CullData uniform block in shaders/cull_data.glsl (std140)
+         */
+        float viewProj[16];
+        float prevViewProj[16];
+        float frustum[6][4];
+        float pyramidSize[4];
+        // instance count, index count, CULL_* flags, max draw count
+        uint32_t params[4];
+    };
+    static_assert(sizeof(CullData) == 256, "CullData has to match the std140 layout of the shader");
+
+    struct Material {
+        /*
+         * This struct mirrors Material in shaders/instanced.frag (std430), the indices are bindless ones
+         */
+        float tint[4];
+        uint32_t textureIndex;
+        uint32_t samplerIndex;
+        uint32_t padding[2];
+    };
+    static_assert(sizeof(Material) == 32, "Material has to match the std430 layout of the shader");
+
+    static constexpr uint32_t CULL_OCCLUSION = 1;
+    static constexpr uint32_t CULL_COMPACT = 2;
+    static constexpr uint32_t CULL_GROUP_SIZE = 64;
+    static constexpr uint32_t PYRAMID_GROUP_SIZE = 8;
+    static constexpr uint32_t MAX_PYRAMID_LEVELS = 16;
+    static constexpr uint32_t MATERIAL_COUNT = 16;
+    static constexpr uint32_t TEXTURE_COUNT = 4;
+    static constexpr uint32_t TEXTURE_SIZE = 64;
+
+    VkDevice device = VK_NULL_HANDLE;
+    DeviceMemoryAllocator* allocator = nullptr;
+    BindlessDescriptors* bindless = nullptr;
+    IndirectDrawSupport support;
+    uint32_t instanceCount = 0;
+    uint32_t indexCount = 0;
+    float sceneExtent = 0.0f;
+    VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+    VkImageLayout colorLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    VkDeviceSize uniformAlignment = 256;
+
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    GpuAllocation vertexAllocation;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    GpuAllocation indexAllocation;
+    SceneStorage scene;
+    SceneGpuBuffers sceneBuffers;
+    // written by the cull pass, read by the draw
+    VkBuffer drawBuffer = VK_NULL_HANDLE;
+    GpuAllocation drawAllocation;
+    VkBuffer countBuffer = VK_NULL_HANDLE;
+    GpuAllocation countAllocation;
+    LinearAllocator uniforms;
+    UploadTicket uploadTicket;
+
+    // materials and textures, referenced through the bindless set, none of them without it
+    bool bindlessMaterials = false;
+    VkBuffer materialBuffer = VK_NULL_HANDLE;
+    GpuAllocation materialAllocation;
+    uint32_t materialBufferIndex = 0;
+    std::vector<VkImage> textureImages;
+    std::vector<GpuAllocation> textureAllocations;
+    std::vector<VkImageView> textureViews;
+    std::vector<uint32_t> textureIndices;
+    VkSampler textureSampler = VK_NULL_HANDLE;
+    uint32_t textureSamplerIndex = 0;
+
+    // dynamic rendering if the device has it, else the render pass
+    bool dynamicRendering = false;
+    PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+    PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkSampler pyramidSampler = VK_NULL_HANDLE;
+    VkDescriptorSetLayout sceneSetLayout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout pyramidSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout scenePipelineLayout = VK_NULL_HANDLE;
+    // the scene set plus the bindless set if there is one
+    VkPipelineLayout drawPipelineLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pyramidPipelineLayout = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    PipelineCompiler* compiler = nullptr;
+    std::optional<PipelineHandle> cullPipeline;
+    std::optional<PipelineHandle> drawPipeline;
+    std::optional<PipelineHandle> pyramidPipeline;
+
+    // everything below depends on the framebuffer size
+    VkExtent2D extent{};
+    std::vector<VkImage> colorImages;
+    std::vector<VkImageView> colorViews;
+    // the graph's transient depth buffer
+    VkImageView depthView = VK_NULL_HANDLE;
+    VkImage pyramidImage = VK_NULL_HANDLE;
+    GpuAllocation pyramidAllocation;
+    VkImageView pyramidView = VK_NULL_HANDLE;
+    VkExtent2D pyramidExtent{};
+    uint32_t pyramidLevels = 0;
+    std::vector<VkImageView> pyramidLevelViews;
+    std::vector<VkFramebuffer> framebuffers;
+    VkDescriptorSet sceneSet = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> pyramidSets;
+    // the pyramid holds nothing to cull against until the first frame built it
+    bool pyramidValid = false;
+    RenderGraph graph;
+    RenderGraphResource colorResource = 0;
+    RenderGraphResource drawResource = 0;
+    RenderGraphResource countResource = 0;
+    RenderGraphResource pyramidResource = 0;
+    RenderGraphResource depthResource = 0;
+    // what the graph's passes record with, set by record() right before it executes the graph
+    struct {
+        VkPipeline cull = VK_NULL_HANDLE;
+        VkPipeline draw = VK_NULL_HANDLE;
+        VkPipeline pyramid = VK_NULL_HANDLE;
+        uint32_t dynamicOffset = 0;
+        uint32_t imageIndex = 0;
+        GpuProfiler* profiler = nullptr;
+    } frame;
+    float prevViewProj[16]{};
+
+    VkBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage,
+                          const std::vector<uint32_t>& queueFamilies, GpuAllocation& allocation) const;
+    void createScene(StagingUploader& uploader, ThreadPool& workers, const std::vector<uint32_t>& queueFamilies);
+    void createMaterials(StagingUploader& uploader, const std::vector<uint32_t>& queueFamilies);
+    void createRenderPass();
+    void buildGraph();
+    void beginRendering(VkCommandBuffer commandBuffer) const;
+    void endRendering(VkCommandBuffer commandBuffer) const;
+    void createLayouts();
+    void writeDescriptorSets();
+    void fillCullData(CullData& data, uint64_t frameNumber) const;
+    void recordPyramid(VkCommandBuffer commandBuffer, VkPipeline pipeline);
+    VkPipeline buildCullPipeline(PipelineCache& cache, ShaderLibrary& shaders) const;
+    VkPipeline buildDrawPipeline(PipelineCache& cache, ShaderLibrary& shaders) const;
+    VkPipeline buildPyramidPipeline(PipelineCache& cache, ShaderLibrary& shaders) const;
+    static VkFormat chooseDepthFormat(VkPhysicalDevice physicalDevice);
+};
@@ -0,0 +1,191 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+static constexpr uint32_t INVALID_SCOPE = ~0u;
+
+void GpuProfiler::create(VkDevice deviceIn, const VkPhysicalDeviceLimits& limits, uint32_t timestampValidBits,
+                         uint32_t framesInFlight, uint32_t maxScopesPerFrame) {
+    device = deviceIn;
+
+    // a queue with 0 valid bits can not write timestamps at all, the profiler then records nothing
+    enabled = timestampValidBits > 0 && limits.timestampPeriod > 0.0f;
+    if (!enabled) {
+        std::cout << "GPU profiler: disabled, the graphics queue does not support timestamps" << std::endl;
+        return;
+    }
+
+    nanosecondsPerTick = limits.timestampPeriod;
+    timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+    queriesPerFrame = maxScopesPerFrame * 2;
+
+    frames.resize(framesInFlight);
+    timestamps.resize(queriesPerFrame);
+    for (FrameQueries& frame : frames) {
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = queriesPerFrame;
+        if (vkCreateQueryPool(device, &poolInfo, nullptr, &frame.pool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+        frame.scopes.reserve(maxScopesPerFrame);
+    }
+}
+
+void GpuProfiler::destroy() {
+    for (FrameQueries& frame : frames) {
+        vkDestroyQueryPool(device, frame.pool, nullptr);
+    }
+    frames.clear();
+    current = nullptr;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot) {
+    if (!enabled) {
+        return;
+    }
+
+    current = &frames[frameSlot];
+    if (current->hasResults) {
+        collect(*current);
+    }
+
+    current->scopes.clear();
+    current->usedQueries = 0;
+    vkCmdResetQueryPool(commandBuffer, current->pool, 0, queriesPerFrame);
+    frameScope = beginScope(commandBuffer, "frame");
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer commandBuffer) {
+    if (!enabled) {
+        return;
+    }
+    endScope(commandBuffer, frameScope);
+    current->hasResults = true;
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name) {
+    if (!enabled || current == nullptr || current->usedQueries + 2 > queriesPerFrame) {
+        return INVALID_SCOPE;
+    }
+
+    uint32_t query = current->usedQueries;
+    current->usedQueries += 2;
+    current->scopes.push_back({name, query});
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->pool, query);
+    return static_cast<uint32_t>(current->scopes.size() - 1);
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t scope) {
+    if (scope == INVALID_SCOPE) {
+        return;
+    }
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->pool,
+                        current->scopes[scope].beginQuery + 1);
+}
+
+GpuProfiler::PassStats GpuProfiler::getStats(const std::string& name) const {
+    PassStats stats;
+    size_t found = findPass(name.c_str());
+    if (found == passes.size() || passes[found].history.samples.empty()) {
+        return stats;
+    }
+
+    std::vector<double> sorted = passes[found].history.samples;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double sample : sorted) {
+        sum += sample;
+    }
+    stats.minMilliseconds = sorted.front();
+    stats.avgMilliseconds = sum / static_cast<double>(sorted.size());
+    stats.p99Milliseconds = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    stats.samples = passes[found].history.total;
+    return stats;
+}
+
+void GpuProfiler::printSummary() const {
+    // without timestamps there can still be CPU samples
+    if (passes.empty()) {
+        return;
+    }
+    std::cout << "GPU profiler (last " << HISTORY_SIZE << " frames, ms):" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for (const Pass& pass : passes) {
+        PassStats stats = getStats(pass.name);
+        std::cout << "    " << std::left << std::setw(20) << pass.name << std::right
+                  << " min " << std::setw(8) << stats.minMilliseconds
+                  << " avg " << std::setw(8) << stats.avgMilliseconds
+                  << " p99 " << std::setw(8) << stats.p99Milliseconds
+                  << " (" << stats.samples << " samples)" << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+void GpuProfiler::collect(FrameQueries& frame) {
+    /*
+     * This function reads the slot's timestamps, the slot's fence has signalled so they are all available
+     */
+    frame.hasResults = false;
+    if (frame.usedQueries == 0) {
+        return;
+    }
+
+    VkResult result = vkGetQueryPoolResults(device, frame.pool, 0, frame.usedQueries,
+                                            frame.usedQueries * sizeof(uint64_t), timestamps.data(),
+                                            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return;
+    }
+
+    for (const Scope& scope : frame.scopes) {
+        uint64_t begin = timestamps[scope.beginQuery] & timestampMask;
+        uint64_t end = timestamps[scope.beginQuery + 1] & timestampMask;
+        // the counter wraps after timestampValidBits bits
+        uint64_t ticks = (end - begin) & timestampMask;
+        addSample(scope.name, static_cast<double>(ticks) * nanosecondsPerTick / 1e6);
+    }
+}
+
+void GpuProfiler::addCpuSample(const char* name, double milliseconds) {
+    addSample(name, milliseconds);
+}
+
+size_t GpuProfiler::findPass(const char* name) const {
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (passes[i].key == name) {
+            return i;
+        }
+    }
+    for (size_t i = 0; i < passes.size(); i++) {
+        if (passes[i].name == name) {
+            return i;
+        }
+    }
+    return passes.size();
+}
+
+void GpuProfiler::addSample(const char* name, double milliseconds) {
+    /*
+     * This function runs for every scope and CPU sample of every frame, looking the pass up builds no string so
+     * it does not allocate once the pass and its window exist
+     */
+    size_t found = findPass(name);
+    if (found == passes.size()) {
+        passes.push_back(Pass{name, name, History{}});
+        passes.back().history.samples.reserve(HISTORY_SIZE);
+    }
+    History& pass = passes[found].history;
+    if (pass.samples.size() < HISTORY_SIZE) {
+        pass.samples.push_back(milliseconds);
+    }
+    else {
+        pass.samples[pass.next] = milliseconds;
+    }
+    pass.next = (pass.next + 1) % HISTORY_SIZE;
+    pass.total++;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class GpuProfiler {
+    /*
+     * This class times passes on the GPU with timestamp queries. Every frame slot has its own query pool, and the
+     * results of a slot are read in beginFrame() when the slot comes around again, its fence has been waited on by
+     * then, so reading never stalls and the numbers are always framesInFlight frames old. Each pass keeps a window
+     * of recent samples for the min/avg/p99 summary
+     */
+public:
+    void create(VkDevice device, const VkPhysicalDeviceLimits& limits, uint32_t timestampValidBits,
+                uint32_t framesInFlight, uint32_t maxScopesPerFrame = 64);
+    void destroy();
+
+    // reads the slot's results from its last use and resets its queries, call right after vkBeginCommandBuffer
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameSlot);
+    // marks the whole frame, so the summary has a total next to the passes
+    void endFrame(VkCommandBuffer commandBuffer);
+
+    // returns the scope index to pass to endScope
+    uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name);
+    void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+    // adds a sample measured on the CPU, e.g. input to present latency, it is summarized next to the passes
+    // and kept even when the queue has no timestamps
+    void addCpuSample(const char* name, double milliseconds);
+
+    bool isEnabled() const { return enabled; }
+
+    struct PassStats {
+        double minMilliseconds = 0.0;
+        double avgMilliseconds = 0.0;
+        double p99Milliseconds = 0.0;
+        uint64_t samples = 0;
+    };
+    PassStats getStats(const std::string& name) const;
+    void printSummary() const;
+
+private:
+    struct Scope {
+        const char* name;
+        uint32_t beginQuery;
+    };
+
+    struct FrameQueries {
+        VkQueryPool pool = VK_NULL_HANDLE;
+        std::vector<Scope> scopes;
+        uint32_t usedQueries = 0;
+        bool hasResults = false;
+    };
+
+    struct History {
+        std::vector<double> samples;
+        size_t next = 0;
+        uint64_t total = 0;
+    };
+
+    // the names are string literals, so a pass is found by the pointer it was first added with and only
+    // compared by content when another translation unit's copy of the literal comes along
+    struct Pass {
+        const char* key;
+        std::string name;
+        History history;
+    };
+
+    static constexpr size_t HISTORY_SIZE = 512;
+
+    VkDevice device = VK_NULL_HANDLE;
+    bool enabled = false;
+    double nanosecondsPerTick = 1.0;
+    uint64_t timestampMask = ~0ull;
+    uint32_t queriesPerFrame = 0;
+    std::vector<FrameQueries> frames;
+    // where collect() reads the results to, sized for a whole frame once
+    std::vector<uint64_t> timestamps;
+    FrameQueries* current = nullptr;
+    uint32_t frameScope = 0;
+    // in the order the passes were first seen, which is the order of the summary
+    std::vector<Pass> passes;
+
+    void collect(FrameQueries& frame);
+    // the index into passes, passes.size() if there is no such pass yet
+    size_t findPass(const char* name) const;
+    void addSample(const char* name, double milliseconds);
+};
+
+class GpuProfileScope {
+    /*
+     * This class times everything recorded into the command buffer during its lifetime
+     */
+public:
+    GpuProfileScope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name)
+        : profiler(profiler), commandBuffer(commandBuffer), scope(profiler.beginScope(commandBuffer, name)) {}
+    ~GpuProfileScope() { profiler.endScope(commandBuffer, scope); }
+
+    GpuProfileScope(const GpuProfileScope&) = delete;
+    GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+private:
+    GpuProfiler& profiler;
+    VkCommandBuffer commandBuffer;
+    uint32_t scope;
+};
@@ -1,11 +1,64 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "frame_scheduler.h"
+#include "queues.h"
+#include "swapchain.h"
+#include "frame_engine.h"
+#include "pipeline_cache.h"
+#include "pipeline_compiler.h"
+#include "gpu_allocator.h"
+#include "staging_uploader.h"
+#include "gpu_profiler.h"
+#include "cpu_trace.h"
+#include "frame_clear.h"
+#include "offscreen.h"
+#include "benchmark.h"
+#include "parallel_recorder.h"
+#include "shader_library.h"
+#include "bindless_descriptors.h"
+#include "thread_pool.h"
+#include "gpu_driven.h"
+#include "asset_streamer.h"
+#include "residency_manager.h"
+#include "device_capabilities.h"
+#include "frame_jobs.h"
+#include "compute_jobs.h"
+#include "vk_handles.h"
+#include "alloc_counter.h"
+#include "regression.h"
+
 #include <iostream>
 #include <stdexcept>
 #include <cstdlib>
+#include <cstring>
+#include <string>
 #include <vector>
 #include <optional>
+#include <set>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <cstdio>
+#include <future>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <thread>
+
+// the build points this at the SPIR-V it compiled, see CMakeLists.txt
+#ifndef VK_TUT_SHADER_DIR
+#define VK_TUT_SHADER_DIR "shaders"
+#endif
+// and these at the shader sources and the compiler it used, for hot reload
+#ifndef VK_TUT_SHADER_SOURCE_DIR
+#define VK_TUT_SHADER_SOURCE_DIR "shaders"
+#endif
+#ifndef VK_TUT_GLSLC
+#define VK_TUT_GLSLC "glslc"
+#endif
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
@@ -15,70 +68,1071 @@ const std::vector<const char*> validationLayers = {
         "VK_LAYER_KHRONOS_validation"
 };
 
-// if we are in debug, enable validation layers, otherwise disable them
+// device extensions a physical device must support to present, headless runs do not need them
+const std::vector<const char*> presentDeviceExtensions = {
+        VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+
+// layer profiles select which instance layers (and validation features) are loaded at runtime
+enum class LayerProfile {
+    None,           // no layers at all, what production binaries should ship with
+    Validation,     // standard khronos validation
+    Synchronization,// validation + synchronization validation
+    GpuAssisted     // validation + GPU-assisted validation (slow, catches out of bounds descriptor access)
+};
+
+// if we are in debug, default to validation layers, otherwise default to no layers
 #ifdef NDEBUG
-const bool enableValidationLayers = false;
+const LayerProfile defaultLayerProfile = LayerProfile::None;
 #else
-const bool enableValidationLayers = true;
+const LayerProfile defaultLayerProfile = LayerProfile::Validation;
 #endif
 
-struct QueueFamilyIndices {
+static const char* layerProfileName(LayerProfile profile) {
+    switch (profile) {
+        case LayerProfile::None: return "none";
+        case LayerProfile::Validation: return "validation";
+        case LayerProfile::Synchronization: return "sync";
+        case LayerProfile::GpuAssisted: return "gpu-assisted";
+    }
+    return "unknown";
+}
+
+static std::optional<LayerProfile> parseLayerProfile(const std::string& name) {
+    /*
+     * This function maps a profile name from the command line or environment to a LayerProfile
+     */
+    if (name == "none" || name == "off") return LayerProfile::None;
+    if (name == "validation" || name == "on") return LayerProfile::Validation;
+    if (name == "sync" || name == "synchronization") return LayerProfile::Synchronization;
+    if (name == "gpu-assisted" || name == "gpu") return LayerProfile::GpuAssisted;
+    return std::nullopt;
+}
+
+struct DeviceOverride {
     /*
-     * This struct is used to store the queue families that are supported by the device
+     * This struct forces pickPhysicalDevice() onto a specific GPU, either by its enumeration index
+     * or by its PCI vendor ID (and optionally device ID)
      */
-    std::optional<uint32_t> graphicsFamily;
+    std::optional<uint32_t> index;
+    std::optional<uint32_t> vendorID;
+    std::optional<uint32_t> deviceID;
 
-    bool isComplete() {
+    bool isSet() const {
+        return index.has_value() || vendorID.has_value();
+    }
+
+    bool matches(uint32_t deviceIndex, const VkPhysicalDeviceProperties& properties) const {
+        if (index.has_value()) {
+            return index.value() == deviceIndex;
+        }
+        if (vendorID.has_value() && vendorID.value() != properties.vendorID) {
+            return false;
+        }
+        return !deviceID.has_value() || deviceID.value() == properties.deviceID;
+    }
+
+    static DeviceOverride parse(const std::string& value) {
         /*
-         * This function checks if the queue families are complete
+         * This function parses "<index>" or "<vendorID>:<deviceID>" / "<vendorID>:" with the IDs in hex,
+         * e.g. "1", "10de:2684" or "1002:"
          */
-        return graphicsFamily.has_value();
+        DeviceOverride deviceOverride;
+        try {
+            size_t colon = value.find(':');
+            if (colon == std::string::npos) {
+                deviceOverride.index = static_cast<uint32_t>(std::stoul(value));
+            }
+            else {
+                deviceOverride.vendorID = static_cast<uint32_t>(std::stoul(value.substr(0, colon), nullptr, 16));
+                if (colon + 1 < value.size()) {
+                    deviceOverride.deviceID = static_cast<uint32_t>(std::stoul(value.substr(colon + 1), nullptr, 16));
+                }
+            }
+        } catch (const std::exception&) {
+            throw std::runtime_error("invalid device override: " + value);
+        }
+        return deviceOverride;
+    }
+};
+
+struct AppConfig {
+    /*
+     * This struct holds the runtime options of the application, filled from the environment and the command line
+     * (the command line wins if both are set)
+     */
+    LayerProfile layerProfile = defaultLayerProfile;
+    FrameMode frameMode = FrameMode::OnDemand;
+    double targetFps = 60.0;
+    DeviceOverride deviceOverride;
+    SwapchainConfig swapchain;
+    uint32_t framesInFlight = 2;
+    std::string pipelineCachePath = "pipeline_cache.bin";
+    uint32_t pipelineThreads = ThreadPool::defaultWorkerCount();
+    // threads recording secondary command buffers, the main thread is one of them
+    uint32_t recordThreads = ThreadPool::defaultWorkerCount() + 1;
+    // empty means no CPU trace is recorded
+    std::string tracePath;
+    // headless runs have no window or surface and render into offscreen images
+    bool headless = false;
+    // stop after this many frames, 0 runs until the window is closed (headless runs default to 600)
+    uint32_t frameLimit = 0;
+    BenchScene scene = BenchScene::Clear;
+    // where the compiled shaders (<name>.spv) are loaded from
+    std::string shaderDirectory = VK_TUT_SHADER_DIR;
+    // compile the shaders from their sources through the cache and rebuild pipelines when a source changes
+    bool hotReload = false;
+    std::string shaderSourceDirectory = VK_TUT_SHADER_SOURCE_DIR;
+    std::string shaderCachePath = "shader_cache";
+    // asset container streamed in at startup, empty streams nothing
+    std::string assetPath;
+    // caps the device local budget the streamed textures are kept under, 0 takes the driver's budget
+    uint32_t vramBudgetMiB = 0;
+    // draw without render pass and framebuffer objects where the device has VK_KHR_dynamic_rendering
+    bool dynamicRendering = true;
+    // one device and render thread per GPU, sharing the frames to render, implies headless
+    bool multiDevice = false;
+
+    static AppConfig fromArgs(int argc, char** argv) {
+        AppConfig config;
+
+        // VK_TUT_LAYERS=none|validation|sync|gpu-assisted
+        if (const char* env = std::getenv("VK_TUT_LAYERS")) {
+            config.layerProfile = requireLayerProfile(env);
+        }
+        // VK_TUT_FRAME_MODE=on-demand|fixed|uncapped|latency
+        if (const char* env = std::getenv("VK_TUT_FRAME_MODE")) {
+            config.frameMode = requireFrameMode(env);
+        }
+        // VK_TUT_FPS=<target fps for the fixed frame mode>
+        if (const char* env = std::getenv("VK_TUT_FPS")) {
+            config.targetFps = requireNumber("VK_TUT_FPS", env);
+        }
+        // VK_TUT_PRESENT_MODE=mailbox|fifo|fifo-relaxed|immediate
+        if (const char* env = std::getenv("VK_TUT_PRESENT_MODE")) {
+            config.swapchain.presentPolicy = requirePresentPolicy(env);
+        }
+        // VK_TUT_SWAPCHAIN_IMAGES=<desired number of swap chain images>
+        if (const char* env = std::getenv("VK_TUT_SWAPCHAIN_IMAGES")) {
+            config.swapchain.imageCount = requireCount("VK_TUT_SWAPCHAIN_IMAGES", env);
+        }
+        // VK_TUT_FRAMES_IN_FLIGHT=<number of frames the CPU may run ahead of the GPU>
+        if (const char* env = std::getenv("VK_TUT_FRAMES_IN_FLIGHT")) {
+            config.framesInFlight = requireCount("VK_TUT_FRAMES_IN_FLIGHT", env);
+        }
+        // VK_TUT_PIPELINE_CACHE=<path of the pipeline cache file>
+        if (const char* env = std::getenv("VK_TUT_PIPELINE_CACHE")) {
+            config.pipelineCachePath = env;
+        }
+        // VK_TUT_PIPELINE_THREADS=<number of pipeline compile threads>
+        if (const char* env = std::getenv("VK_TUT_PIPELINE_THREADS")) {
+            config.pipelineThreads = requireCount("VK_TUT_PIPELINE_THREADS", env);
+        }
+        // VK_TUT_RECORD_THREADS=<number of command recording threads>
+        if (const char* env = std::getenv("VK_TUT_RECORD_THREADS")) {
+            config.recordThreads = requireCount("VK_TUT_RECORD_THREADS", env);
+        }
+        // VK_TUT_TRACE=<path of the Chrome trace JSON to write at exit>
+        if (const char* env = std::getenv("VK_TUT_TRACE")) {
+            config.tracePath = env;
+        }
+        // VK_TUT_HEADLESS=1 renders offscreen without a window
+        if (const char* env = std::getenv("VK_TUT_HEADLESS")) {
+            config.headless = std::string(env) != "0";
+        }
+        // VK_TUT_FRAMES=<number of frames to render before exiting>
+        if (const char* env = std::getenv("VK_TUT_FRAMES")) {
+            config.frameLimit = requireCount("VK_TUT_FRAMES", env);
+        }
+        // VK_TUT_SCENE=clear|upload|many-items|gpu-driven|particles
+        if (const char* env = std::getenv("VK_TUT_SCENE")) {
+            config.scene = requireBenchScene(env);
+        }
+        // VK_TUT_SHADER_DIR=<directory of the compiled shaders>
+        if (const char* env = std::getenv("VK_TUT_SHADER_DIR")) {
+            config.shaderDirectory = env;
+        }
+        // VK_TUT_HOT_RELOAD=1 compiles and watches the shader sources
+        if (const char* env = std::getenv("VK_TUT_HOT_RELOAD")) {
+            config.hotReload = std::string(env) != "0";
+        }
+        // VK_TUT_SHADER_SOURCE=<directory of the shader sources>
+        if (const char* env = std::getenv("VK_TUT_SHADER_SOURCE")) {
+            config.shaderSourceDirectory = env;
+        }
+        // VK_TUT_SHADER_CACHE=<directory of the compiled shader cache>
+        if (const char* env = std::getenv("VK_TUT_SHADER_CACHE")) {
+            config.shaderCachePath = env;
+        }
+        // VK_TUT_ASSETS=<path of an asset container to stream in>
+        if (const char* env = std::getenv("VK_TUT_ASSETS")) {
+            config.assetPath = env;
+        }
+        // VK_TUT_VRAM_BUDGET=<budget cap in MiB for the streamed textures>
+        if (const char* env = std::getenv("VK_TUT_VRAM_BUDGET")) {
+            config.vramBudgetMiB = requireCount("VK_TUT_VRAM_BUDGET", env);
+        }
+        // VK_TUT_DYNAMIC_RENDERING=0 keeps the render pass path even where dynamic rendering is supported
+        if (const char* env = std::getenv("VK_TUT_DYNAMIC_RENDERING")) {
+            config.dynamicRendering = std::string(env) != "0";
+        }
+        // VK_TUT_MULTI_DEVICE=1 renders the headless frames on every GPU at once
+        if (const char* env = std::getenv("VK_TUT_MULTI_DEVICE")) {
+            config.multiDevice = std::string(env) != "0";
+        }
+        // VK_TUT_DEVICE=<index>|<vendorID>:<deviceID>
+        if (const char* env = std::getenv("VK_TUT_DEVICE")) {
+            config.deviceOverride = DeviceOverride::parse(env);
+        }
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (auto value = flagValue(arg, "--layers=")) {
+                config.layerProfile = requireLayerProfile(value.value());
+            }
+            else if (auto value = flagValue(arg, "--frame-mode=")) {
+                config.frameMode = requireFrameMode(value.value());
+            }
+            else if (auto value = flagValue(arg, "--fps=")) {
+                config.targetFps = requireNumber("--fps", value.value());
+            }
+            else if (auto value = flagValue(arg, "--present-mode=")) {
+                config.swapchain.presentPolicy = requirePresentPolicy(value.value());
+            }
+            else if (auto value = flagValue(arg, "--swapchain-images=")) {
+                config.swapchain.imageCount = requireCount("--swapchain-images", value.value());
+            }
+            else if (auto value = flagValue(arg, "--frames-in-flight=")) {
+                config.framesInFlight = requireCount("--frames-in-flight", value.value());
+            }
+            else if (auto value = flagValue(arg, "--pipeline-cache=")) {
+                config.pipelineCachePath = value.value();
+            }
+            else if (auto value = flagValue(arg, "--pipeline-threads=")) {
+                config.pipelineThreads = requireCount("--pipeline-threads", value.value());
+            }
+            else if (auto value = flagValue(arg, "--record-threads=")) {
+                config.recordThreads = requireCount("--record-threads", value.value());
+            }
+            else if (auto value = flagValue(arg, "--trace=")) {
+                config.tracePath = value.value();
+            }
+            else if (arg == "--headless") {
+                config.headless = true;
+            }
+            else if (auto value = flagValue(arg, "--frames=")) {
+                config.frameLimit = requireCount("--frames", value.value());
+            }
+            else if (auto value = flagValue(arg, "--scene=")) {
+                config.scene = requireBenchScene(value.value());
+            }
+            else if (auto value = flagValue(arg, "--shader-dir=")) {
+                config.shaderDirectory = value.value();
+            }
+            else if (arg == "--hot-reload") {
+                config.hotReload = true;
+            }
+            else if (auto value = flagValue(arg, "--shader-source=")) {
+                config.shaderSourceDirectory = value.value();
+            }
+            else if (auto value = flagValue(arg, "--shader-cache=")) {
+                config.shaderCachePath = value.value();
+            }
+            else if (auto value = flagValue(arg, "--assets=")) {
+                config.assetPath = value.value();
+            }
+            else if (auto value = flagValue(arg, "--vram-budget=")) {
+                config.vramBudgetMiB = requireCount("--vram-budget", value.value());
+            }
+            else if (arg == "--no-dynamic-rendering") {
+                config.dynamicRendering = false;
+            }
+            else if (arg == "--multi-device") {
+                config.multiDevice = true;
+            }
+            else if (auto value = flagValue(arg, "--device=")) {
+                config.deviceOverride = DeviceOverride::parse(value.value());
+            }
+        }
+
+        // the devices render offscreen, there is one window at most
+        if (config.multiDevice) {
+            config.headless = true;
+        }
+        if (config.headless && config.frameLimit == 0) {
+            config.frameLimit = 600;
+        }
+        return config;
+    }
+
+    static BenchScene requireBenchScene(const std::string& name) {
+        std::optional<BenchScene> scene = parseBenchScene(name);
+        if (!scene.has_value()) {
+            throw std::runtime_error("unknown scene: " + name);
+        }
+        return scene.value();
+    }
+
+private:
+    static std::optional<std::string> flagValue(const std::string& arg, const std::string& flag) {
+        // returns the part after the '=' if arg is of the form --flag=value
+        if (arg.rfind(flag, 0) == 0) {
+            return arg.substr(flag.size());
+        }
+        return std::nullopt;
+    }
+
+    static LayerProfile requireLayerProfile(const std::string& name) {
+        std::optional<LayerProfile> profile = parseLayerProfile(name);
+        if (!profile.has_value()) {
+            throw std::runtime_error("unknown layer profile: " + name);
+        }
+        return profile.value();
+    }
+
+    static FrameMode requireFrameMode(const std::string& name) {
+        std::optional<FrameMode> mode = parseFrameMode(name);
+        if (!mode.has_value()) {
+            throw std::runtime_error("unknown frame mode: " + name);
+        }
+        return mode.value();
+    }
+
+    static PresentPolicy requirePresentPolicy(const std::string& name) {
+        std::optional<PresentPolicy> policy = parsePresentPolicy(name);
+        if (!policy.has_value()) {
+            throw std::runtime_error("unknown present mode: " + name);
+        }
+        return policy.value();
+    }
+
+    static uint32_t requireCount(const std::string& option, const std::string& value) {
+        // all of the value has to be a whole number, stoul alone would take "3abc" as 3 (and "-1" as a huge count)
+        unsigned long number = 0;
+        size_t used = 0;
+        try {
+            if (!value.empty() && value.find_first_not_of("0123456789") == std::string::npos) {
+                number = std::stoul(value, &used);
+            }
+        } catch (const std::out_of_range&) {
+            used = 0;
+        }
+        if (used == 0 || used != value.size() || number > UINT32_MAX) {
+            throw std::runtime_error("invalid count for " + option + ": " + value);
+        }
+        if (number < 1) {
+            throw std::runtime_error(option + " has to be at least 1: " + value);
+        }
+        return static_cast<uint32_t>(number);
+    }
+
+    static double requireNumber(const std::string& option, const std::string& value) {
+        try {
+            return std::stod(value);
+        } catch (const std::exception&) {
+            throw std::runtime_error("invalid number for " + option + ": " + value);
+        }
     }
 };
 
 class HelloTriangleApplication {
 public:
+    // runStats is filled with what the run measured if given, the benchmark target uses it. A headless run
+    // with frameJobs renders frames as long as it can take them, instead of the frame limit
+    explicit HelloTriangleApplication(AppConfig config, RunStats* runStats = nullptr, FrameJobQueue* frameJobs = nullptr)
+        : config(config), frameScheduler(config.frameMode, config.targetFps), runStats(runStats), frameJobs(frameJobs) {}
+
     void run() {
-        initWindow();
-        initVulkan();
+#ifdef VK_TUT_NO_SHADERS
+        if (benchSceneNeedsShaders(config.scene)) {
+            throw UnsupportedSceneError(std::string("the ") + benchSceneName(config.scene) + " scene needs shaders, this build has none (no glslc)!");
+        }
+#endif
+        startupStart = std::chrono::steady_clock::now();
+        init();
         mainLoop();
         cleanup();
     }
 
 private:
+    AppConfig config;
+    FrameScheduler frameScheduler;
     GLFWwindow* window{};
-    VkInstance instance{};
-    VkDevice device {};
+    // cleanup() resets these last, in this order reversed, if init throws they are still released on the way out
+    UniqueInstance instance;
+    UniqueDevice device;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkQueue graphicsQueue{};
+    VkPhysicalDeviceProperties physicalDeviceProperties{};
+    UniqueSurface surface;
+    QueueFamilyIndices queueFamilyIndices;
+    DeviceQueues queues;
+    Swapchain swapchain;
+    FrameClear frameClear;
+    bool framebufferResized = false;
+    FrameEngine frameEngine;
+    // latency mode: when the input of the last presented frame was sampled, cleared when it can not be measured
+    std::optional<FrameScheduler::Clock::time_point> lastInputTime;
+    PipelineCache pipelineCache;
+    // the optional extensions createLogicalDevice() turned on, a subset of what the device has
+    DeviceCapabilities enabledCapabilities;
+    std::unique_ptr<PipelineCompiler> pipelineCompiler;
+    DeviceMemoryAllocator memoryAllocator;
+    StagingUploader uploader;
+    GpuProfiler gpuProfiler;
+    OffscreenTargets offscreenTargets;
+    ParallelRecorder parallelRecorder;
+    ShaderLibrary shaderLibrary;
+    // the global descriptor set materials index into, only created where descriptor indexing is supported
+    BindlessDescriptors bindless;
+    bool bindlessSupported = false;
+    // general CPU workers for batch jobs like scene transform updates
+    std::unique_ptr<ThreadPool> workerPool;
+    // compute shader dispatches on the compute queue, for any scene that has GPU work besides its frames
+    ComputeJobs computeJobs;
+    AssetStreamer assetStreamer;
+    // drops and restores streamed texture mips to stay inside the memory budget
+    ResidencyManager residency;
+    // what createLogicalDevice could enable for indirect drawing
+    IndirectDrawSupport indirectDrawSupport;
+    GpuDrivenRenderer gpuDriven;
+    RunStats* runStats = nullptr;
+    FrameJobQueue* frameJobs = nullptr;
+    // the index of the frame job being rendered, the scene shows that frame rather than this device's own next one
+    std::optional<uint64_t> jobFrame;
+    std::chrono::steady_clock::time_point startupStart;
+    // init phases can finish on worker threads
+    std::mutex startupMutex;
+    std::vector<StartupPhase> startupPhases;
+    std::optional<double> timeToFirstFrame;
+    // enumerated once per device, pickPhysicalDevice and createLogicalDevice both look at them
+    std::map<VkPhysicalDevice, ExtensionList> deviceExtensionCache;
+    // filled by isDeviceSuitable, what is missing here never makes a device unsuitable
+    std::map<VkPhysicalDevice, DeviceCapabilities> deviceCapabilities;
+    // the upload scene streams into this, one region per frame in flight
+    VkBuffer sceneBuffer = VK_NULL_HANDLE;
+    GpuAllocation sceneBufferAllocation;
+    std::vector<uint8_t> sceneUploadData;
+    static constexpr uint32_t SCENE_ITEM_COUNT = 50000;
+    static constexpr VkDeviceSize SCENE_ITEM_BYTES = 64;
+    static constexpr uint32_t GPU_DRIVEN_INSTANCE_COUNT = 50000;
+    // the particles scene's simulation, its buffer is sceneBuffer
+    struct ParticleStep {
+        /*
+         * This struct mirrors the Step push constants in shaders/particles.comp
+         */
+        float deltaTime;
+        uint32_t count;
+        uint32_t reset;
+        uint32_t padding;
+    };
+    static constexpr uint32_t PARTICLE_COUNT = 1u << 20;
+    static constexpr VkDeviceSize PARTICLE_BYTES = 32;
+    std::optional<ComputeKernelHandle> particleKernel;
+    bool particlesReset = true;
+    uint64_t lastParticleFrame = 0;
 
     void initWindow() {
         /*
-         * This function initializes the GLFW window
+         * This function creates the GLFW window, glfwInit() has to have run on this (the main) thread already
          */
-        glfwInit();
-
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
         window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+
+        // the window asks for a redraw when it gets exposed, so the on-demand frame mode repaints it
+        glfwSetWindowUserPointer(window, this);
+        glfwSetWindowRefreshCallback(window, windowRefreshCallback);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    }
+
+    static void windowRefreshCallback(GLFWwindow* refreshedWindow) {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(refreshedWindow));
+        app->frameScheduler.requestRedraw();
+    }
+
+    static void framebufferResizeCallback(GLFWwindow* resizedWindow, int /*width*/, int /*height*/) {
+        // the swap chain is recreated on the next frame, not every resize event of a drag
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(resizedWindow));
+        app->framebufferResized = true;
+        app->frameScheduler.requestRedraw();
+    }
+
+    void init() {
+        /*
+         * This function creates the window and everything Vulkan, independent steps run side by side:
+         *
+         *   main:   glfwInit -> initWindow ----------+-> createSurface -> pickPhysicalDevice -> createLogicalDevice
+         *   worker:          createInstance ---------+
+         *   then in parallel with createPipelineCache on a worker (cache file read, compile pool start):
+         *   main:   createMemoryAllocator -> createUploader -> createRenderTargets -> createFrameEngine -> createComputeJobs
+         *           -> createBindlessDescriptors -> createWorkerPool -> createSceneResources -> createAssetStreamer
+         *
+         * GLFW wants its window created on the main thread, so it is the instance that moves to a worker.
+         * Everything joins before the first frame, the scene's pipelines are requested once the compiler exists
+         */
+        if (!config.headless) {
+            // glfwGetRequiredInstanceExtensions needs an initialized GLFW, which has to happen on the main thread
+            timePhase("glfwInit", [] {
+                if (glfwInit() != GLFW_TRUE) {
+                    throw std::runtime_error("failed to initialize GLFW!");
+                }
+            });
+        }
+
+        std::future<void> instanceReady = std::async(std::launch::async, [this] {
+            TRACE_THREAD_NAME("init worker");
+            timePhase("createInstance", [this] { createInstance(); });
+        });
+        if (!config.headless) {
+            timePhase("initWindow", [this] { initWindow(); });
+        }
+        instanceReady.get();
+
+        if (!config.headless) {
+            timePhase("createSurface", [this] { createSurface(); });
+        }
+        timePhase("pickPhysicalDevice", [this] { pickPhysicalDevice(); });
+        timePhase("createLogicalDevice", [this] { createLogicalDevice(); });
+
+        // the pipeline cache only needs the device, and its file read overlaps the rest of the device setup
+        std::future<void> pipelineCacheReady = std::async(std::launch::async, [this] {
+            TRACE_THREAD_NAME("init worker");
+            timePhase("createPipelineCache", [this] { createPipelineCache(); });
+        });
+        timePhase("createMemoryAllocator", [this] { createMemoryAllocator(); });
+        timePhase("createUploader", [this] { createUploader(); });
+        timePhase("createRenderTargets", [this] { createRenderTargets(); });
+        timePhase("createFrameEngine", [this] { createFrameEngine(); });
+        timePhase("createComputeJobs", [this] { computeJobs.create(device, queues.compute); });
+        timePhase("createParallelRecorder", [this] { createParallelRecorder(); });
+        if (bindlessSupported) {
+            timePhase("createBindlessDescriptors", [this] { createBindlessDescriptors(); });
+        }
+        timePhase("createWorkerPool", [this] { workerPool = std::make_unique<ThreadPool>(ThreadPool::defaultWorkerCount()); });
+        timePhase("createSceneResources", [this] { createSceneResources(); });
+        if (!config.assetPath.empty()) {
+            timePhase("createAssetStreamer", [this] { createAssetStreamer(); });
+        }
+        pipelineCacheReady.get();
+        timePhase("requestScenePipelines", [this] { requestScenePipelines(); });
+    }
+
+    template<typename Step>
+    void timePhase(const char* name, Step&& step) {
+        /*
+         * This function runs one init step and remembers when it started and how long it took,
+         * relative to the start of run()
+         */
+        TRACE_SCOPE(name);
+        auto start = std::chrono::steady_clock::now();
+        step();
+        auto end = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(startupMutex);
+        startupPhases.push_back({name, millisecondsSinceStartup(start), std::chrono::duration<double, std::milli>(end - start).count()});
+    }
+
+    double millisecondsSinceStartup(std::chrono::steady_clock::time_point point) const {
+        return std::chrono::duration<double, std::milli>(point - startupStart).count();
+    }
+
+    void printStartupReport() const {
+        /*
+         * This function prints when each init phase ran, phases on worker threads overlap the ones around them
+         */
+        std::vector<StartupPhase> phases = startupPhases;
+        std::sort(phases.begin(), phases.end(), [](const StartupPhase& a, const StartupPhase& b) {
+            return a.startMilliseconds < b.startMilliseconds;
+        });
+        std::ios::fmtflags flags = std::cout.flags();
+        std::streamsize precision = std::cout.precision();
+        std::cout << "Startup phases:" << std::endl;
+        for (const StartupPhase& phase : phases) {
+            std::cout << "    " << std::left << std::setw(24) << phase.name << std::right << std::fixed << std::setprecision(2)
+                      << "at " << std::setw(8) << phase.startMilliseconds << " ms, took "
+                      << std::setw(8) << phase.milliseconds << " ms" << std::endl;
+        }
+        // 150 ms is what we aim for on a warm driver
+        std::cout << "Time to first frame: " << timeToFirstFrame.value_or(0.0) << " ms (target 150 ms)" << std::endl;
+        std::cout.flags(flags);
+        std::cout.precision(precision);
+    }
+
+    void createSurface() {
+        /*
+         * This function creates the window surface, it has to exist before picking a device since present support
+         * is a property of the queue family and the surface together
+         */
+        VkSurfaceKHR createdSurface;
+        if (glfwCreateWindowSurface(instance, window, nullptr, &createdSurface) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create window surface!");
+        }
+        surface = UniqueSurface(instance, createdSurface);
+    }
+
+    void createMemoryAllocator() {
+        /*
+         * This function sets up the device memory allocator, every buffer and image gets its memory from it
+         */
+        memoryAllocator.create(physicalDevice, device, enabledCapabilities.memoryBudget);
+    }
+
+    void createUploader() {
+        /*
+         * This function creates the staging ring, its copies run on the transfer queue
+         */
+        uploader.create(device, memoryAllocator, physicalDeviceProperties.limits, queues.transfer);
+    }
+
+    void createPipelineCache() {
+        /*
+         * This function loads the pipeline cache from disk, it has to exist before the first pipeline is created
+         */
+        pipelineCache.create(device, physicalDeviceProperties, config.pipelineCachePath,
+                            enabledCapabilities.pipelineCreationFeedback);
+
+        // pipelines get requested from here on and compile in the background while the first frames render
+        pipelineCompiler = std::make_unique<PipelineCompiler>(device, pipelineCache, config.pipelineThreads);
+    }
+
+    void createRenderTargets() {
+        /*
+         * This function creates the swap chain for the current framebuffer size, or the offscreen images of
+         * a headless run, one per frame in flight
+         */
+        if (config.headless) {
+            offscreenTargets.create(memoryAllocator, VK_FORMAT_B8G8R8A8_UNORM, getFramebufferExtent(), config.framesInFlight);
+            // the offscreen images are always made with TRANSFER_DST usage
+            frameClear.create(device, offscreenTargets.getImageFormat(), true, enabledCapabilities.dynamicRendering);
+            frameClear.createTargets(offscreenTargets.getExtent(), offscreenTargets.getImageViews());
+            return;
+        }
+        swapchain.create(physicalDevice, device, surface, queueFamilyIndices, config.swapchain, getFramebufferExtent());
+        frameClear.create(device, swapchain.getImageFormat(), swapchain.supportsTransferDestination(), enabledCapabilities.dynamicRendering);
+        frameClear.createTargets(swapchain.getExtent(), swapchain.getImageViews());
     }
 
-    void initVulkan() {
+    void recreateSwapChain() {
         /*
-         * This function initializes the Vulkan library, and creates the Vulkan instance
+         * This function rebuilds the swap chain after a resize, a minimized window has a 0x0 framebuffer
+         * and no swap chain can be made for it, so wait until it comes back
          */
-        createInstance();
-        pickPhysicalDevice();
-        createLogicalDevice();
+        VkExtent2D extent = getFramebufferExtent();
+        while ((extent.width == 0 || extent.height == 0) && !glfwWindowShouldClose(window)) {
+            glfwWaitEvents();
+            extent = getFramebufferExtent();
+        }
+
+        vkDeviceWaitIdle(device);
+        swapchain.recreate(extent);
+        frameEngine.onSwapchainRecreated(swapchain.getImageCount());
+        frameClear.destroyTargets();
+        frameClear.createTargets(swapchain.getExtent(), swapchain.getImageViews());
+        lastInputTime.reset();
+        if (config.scene == BenchScene::GpuDriven) {
+            gpuDriven.destroyTargets();
+            gpuDriven.createTargets(swapchain.getExtent(), swapchain.getImages(), swapchain.getImageViews());
+        }
+    }
+
+    void createFrameEngine() {
+        /*
+         * This function creates the per frame in flight command pools and sync objects
+         */
+        // headless frames present nothing, so they get no render finished semaphores
+        frameEngine.create(device, queues.graphics.family, config.framesInFlight, config.headless ? 0 : swapchain.getImageCount());
+        std::cout << "Frames in flight: " << frameEngine.getFramesInFlight() << std::endl;
+        if (enabledCapabilities.presentWait) {
+            auto waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+            if (waitForPresent == nullptr) {
+                throw std::runtime_error("failed to load vkWaitForPresentKHR!");
+            }
+            frameEngine.enablePresentWait(waitForPresent);
+        }
+        if (frameScheduler.isLowLatency()) {
+            std::cout << "Latency mode: waiting for " << (enabledCapabilities.presentWait ? "present" : "the frame fence, no present wait")
+                      << " before sampling input" << std::endl;
+        }
+
+        // one query pool per frame slot, read back when the slot comes around again
+        gpuProfiler.create(device, physicalDeviceProperties.limits, queueFamilyIndices.graphicsTimestampBits, frameEngine.getFramesInFlight());
+    }
+
+    void createParallelRecorder() {
+        /*
+         * This function starts the recording workers, each with a command pool per frame in flight
+         */
+        parallelRecorder.create(device, queues.graphics.family, frameEngine.getFramesInFlight(), config.recordThreads);
+    }
+
+    void createBindlessDescriptors() {
+        /*
+         * This function creates the global descriptor set that resources are referred to by index through
+         */
+        bindless.create(physicalDevice, device, frameEngine.getFramesInFlight());
+    }
+
+    void createAssetStreamer() {
+        /*
+         * This function starts the asset I/O threads and queues everything in the asset file, the frames keep
+         * going while it streams in and the textures get bindless indices as they become resident. The residency
+         * manager then keeps the textures inside the memory budget
+         */
+        std::vector<uint32_t> queueFamilies = {queues.graphics.family};
+        if (queues.transfer.family != queues.graphics.family) {
+            queueFamilies.push_back(queues.transfer.family);
+        }
+        assetStreamer.create(physicalDevice, memoryAllocator, uploader, bindless.isCreated() ? &bindless : nullptr, queueFamilies,
+                             config.framesInFlight);
+        ResidencyConfig residencyConfig;
+        residencyConfig.budgetCap = static_cast<VkDeviceSize>(config.vramBudgetMiB) * 1024 * 1024;
+        residency.create(memoryAllocator, assetStreamer, residencyConfig);
+        std::vector<AssetId> ids = assetStreamer.requestAll(config.assetPath, 0.0f);
+        std::cout << "Streaming " << ids.size() << " assets from " << config.assetPath << std::endl;
+    }
+
+    void createSceneResources() {
+        /*
+         * This function creates what the selected scene draws with, the clear scene needs nothing
+         */
+        if (sceneUsesShaders()) {
+            std::optional<ShaderSourceConfig> shaderSources;
+            if (config.hotReload) {
+                shaderSources = ShaderSourceConfig{config.shaderSourceDirectory, config.shaderCachePath, VK_TUT_GLSLC};
+            }
+            shaderLibrary.create(device, config.shaderDirectory, shaderSources);
+            shaderLibrary.startWatching();
+        }
+        if (config.scene == BenchScene::GpuDriven) {
+            // the static data is uploaded on the transfer queue and read on the graphics queue
+            std::vector<uint32_t> queueFamilies = {queues.graphics.family};
+            if (queues.transfer.family != queues.graphics.family) {
+                queueFamilies.push_back(queues.transfer.family);
+            }
+            VkFormat colorFormat = config.headless ? offscreenTargets.getImageFormat() : swapchain.getImageFormat();
+            gpuDriven.create(physicalDevice, memoryAllocator, uploader, bindless, *workerPool, physicalDeviceProperties.limits,
+                             indirectDrawSupport, enabledCapabilities.synchronization2, enabledCapabilities.dynamicRendering, queueFamilies,
+                             frameEngine.getFramesInFlight(), GPU_DRIVEN_INSTANCE_COUNT, colorFormat, frameClear.getFrameState().layout);
+            if (config.headless) {
+                gpuDriven.createTargets(offscreenTargets.getExtent(), offscreenTargets.getImages(), offscreenTargets.getImageViews());
+            }
+            else {
+                gpuDriven.createTargets(swapchain.getExtent(), swapchain.getImages(), swapchain.getImageViews());
+            }
+            return;
+        }
+
+        VkDeviceSize bufferSize = 0;
+        if (config.scene == BenchScene::Upload) {
+            const VkDeviceSize bytesPerFrame = 4ull * 1024 * 1024;
+            sceneUploadData.resize(bytesPerFrame);
+            for (size_t i = 0; i < sceneUploadData.size(); i++) {
+                sceneUploadData[i] = static_cast<uint8_t>(i * 31);
+            }
+            bufferSize = bytesPerFrame * frameEngine.getFramesInFlight();
+        }
+        else if (config.scene == BenchScene::ManyItems) {
+            bufferSize = SCENE_ITEM_COUNT * SCENE_ITEM_BYTES;
+        }
+        else if (config.scene == BenchScene::Particles) {
+            // only ever touched on the compute queue, so exclusive to it, and the first step fills it
+            bufferSize = PARTICLE_COUNT * PARTICLE_BYTES;
+        }
+        else {
+            return;
+        }
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = bufferSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &sceneBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create scene buffer!");
+        }
+        sceneBufferAllocation = memoryAllocator.allocateForBuffer(sceneBuffer, uploader.getStaticDataUsage());
+    }
+
+    void requestScenePipelines() {
+        /*
+         * This function queues the pipelines of the selected scene, they compile while the first frames render
+         */
+        if (config.scene == BenchScene::GpuDriven) {
+            gpuDriven.requestPipelines(*pipelineCompiler, shaderLibrary);
+        }
+        if (config.scene == BenchScene::Particles) {
+            particleKernel = computeJobs.createKernel(*pipelineCompiler, shaderLibrary, "particles.comp",
+                                                      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER}, sizeof(ParticleStep));
+        }
+    }
+
+    bool sceneUsesShaders() const {
+        return benchSceneNeedsShaders(config.scene);
+    }
+
+    void recordSceneCommands(VkCommandBuffer commandBuffer, const FrameTarget& target) {
+        /*
+         * This function records the scene's own commands into the frame
+         */
+        if (config.scene == BenchScene::GpuDriven) {
+            gpuDriven.record(commandBuffer, target.slotIndex, target.imageIndex, sceneFrameNumber(), gpuProfiler, target.slot->arena);
+            return;
+        }
+        if (config.scene != BenchScene::ManyItems) {
+            return;
+        }
+
+        // the previous frame filled the same buffer
+        VkBufferMemoryBarrier fillAfterFill{};
+        fillAfterFill.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        fillAfterFill.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        fillAfterFill.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        fillAfterFill.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        fillAfterFill.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        fillAfterFill.buffer = sceneBuffer;
+        fillAfterFill.offset = 0;
+        fillAfterFill.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 1, &fillAfterFill, 0, nullptr);
+
+        // one small fill per item, the command count is what this scene is about
+        GpuProfileScope itemsScope(gpuProfiler, commandBuffer, "items");
+        parallelRecorder.record(commandBuffer, SCENE_ITEM_COUNT, [this](VkCommandBuffer chunkBuffer, uint32_t first, uint32_t count) {
+            for (uint32_t item = first; item < first + count; item++) {
+                vkCmdFillBuffer(chunkBuffer, sceneBuffer, item * SCENE_ITEM_BYTES, SCENE_ITEM_BYTES, item);
+            }
+        });
+    }
+
+    void updateScene(const FrameTarget& target) {
+        /*
+         * This function does the per frame CPU work of the scene before its commands are recorded
+         */
+        if (sceneUsesShaders()) {
+            // rebuilt pipelines are swapped in when ready, until then the frames keep drawing with the old ones
+            for (const std::string& shader : shaderLibrary.takeChanged()) {
+                pipelineCompiler->rebuildUsing(shader);
+            }
+            pipelineCompiler->retireShaderModules(shaderLibrary.takeRetired());
+            pipelineCompiler->releaseRetired(frameEngine.getDeletionQueue());
+        }
+        if (config.scene == BenchScene::Upload) {
+            // the region of this slot was last written by the frame that used the slot before,
+            // and the slot's fence covers that upload since the frame waited on its ticket
+            VkDeviceSize offset = target.slotIndex * static_cast<VkDeviceSize>(sceneUploadData.size());
+            uploader.uploadBuffer(sceneBuffer, sceneBufferAllocation, offset, sceneUploadData.data(), sceneUploadData.size());
+        }
+
+        if (config.scene == BenchScene::Particles) {
+            // with frame jobs the frames the other devices took are skipped, the step covers them as well
+            uint64_t frame = sceneFrameNumber();
+            uint64_t steps = particlesReset ? 1 : std::max<uint64_t>(frame - lastParticleFrame, 1);
+            lastParticleFrame = frame;
+            ParticleStep step{static_cast<float>(steps) / 60.0f, PARTICLE_COUNT, particlesReset ? 1u : 0u, 0};
+            particlesReset = false;
+            ComputeDispatch dispatch;
+            dispatch.kernel = particleKernel.value();
+            dispatch.resources = {ComputeResource::storageBuffer(sceneBuffer)};
+            dispatch.setPushConstants(step);
+            dispatch.groupCount[0] = (PARTICLE_COUNT + 255) / 256;
+            computeJobs.dispatch(std::move(dispatch));
+            ComputeTicket ticket = computeJobs.submit();
+            // a renderer drawing the particles would wait at the vertex stage, this scene only clears
+            frameEngine.addWait(computeJobs.getTimelineSemaphore(), ticket.value, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        }
+
+        // one transfer submit a frame for everything uploaded since the last one, whoever draws with the data
+        // waits on its ticket
+        UploadTicket ticket = uploader.flush();
+        if (config.scene == BenchScene::Upload && ticket.value != 0) {
+            frameEngine.addWait(uploader.getTimelineSemaphore(), ticket.value, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        }
+        // the instances, the mesh and the materials were uploaded once, frames wait for them until the CPU sees them arrive
+        if (config.scene == BenchScene::GpuDriven && !uploader.isComplete(gpuDriven.getUploadTicket())) {
+            frameEngine.addWait(uploader.getTimelineSemaphore(), gpuDriven.getUploadTicket().value,
+                                VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+                                | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        }
+    }
+
+    // what the scene animates by, the same on every device for the same frame job
+    uint64_t sceneFrameNumber() const {
+        return jobFrame.value_or(frameEngine.getFrameNumber());
+    }
+
+    VkExtent2D getFramebufferExtent() const {
+        if (config.headless) {
+            return {WIDTH, HEIGHT};
+        }
+        int width = 0;
+        int height = 0;
+        glfwGetFramebufferSize(window, &width, &height);
+        return {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
     }
 
     void mainLoop() {
         /*
          * This function is the main loop of the application
          */
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
+        if (config.headless && frameJobs != nullptr) {
+            // the other devices take from the same queue, whoever is free renders the next frame
+            std::cout << "Headless: rendering frame jobs of scene " << benchSceneName(config.scene) << " on "
+                      << physicalDeviceProperties.deviceName << std::endl;
+            while (std::optional<uint32_t> job = frameJobs->take()) {
+                TRACE_SCOPE("mainLoop");
+                jobFrame = job.value();
+                timeFrame();
+            }
+            jobFrame.reset();
+        }
+        else if (config.headless) {
+            // nothing to wait for or poll, render the frames back to back
+            std::cout << "Headless: rendering " << config.frameLimit << " frames of scene " << benchSceneName(config.scene) << std::endl;
+            while (frameEngine.getFrameNumber() < config.frameLimit) {
+                TRACE_SCOPE("mainLoop");
+                timeFrame();
+            }
+        }
+        else {
+            std::cout << "Frame mode: " << frameModeName(frameScheduler.getMode()) << std::endl;
+            while (!glfwWindowShouldClose(window) && (config.frameLimit == 0 || frameEngine.getFrameNumber() < config.frameLimit)) {
+                TRACE_SCOPE("mainLoop");
+                // the scheduler does the waiting and event polling, so we only draw when a frame is due
+                if (frameScheduler.beginFrame()) {
+                    timeFrame();
+                    frameScheduler.endFrame();
+                }
+            }
+        }
+
+        // wait for the frames in flight to finish before cleanup destroys what they use
+        vkDeviceWaitIdle(device);
+    }
+
+    void timeFrame() {
+        // only the time spent in drawFrame counts, waiting for the next frame to be due is not frame time
+        auto start = std::chrono::steady_clock::now();
+        // the count is global, so the recording workers and the pool threads the frame hands work to are in it
+        uint64_t allocationsBefore = heapAllocationCount();
+        drawFrame();
+        uint64_t allocations = heapAllocationCount() - allocationsBefore;
+        auto end = std::chrono::steady_clock::now();
+        if (runStats != nullptr) {
+            runStats->frameMilliseconds.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            if (isCountingHeapAllocations()) {
+                runStats->frameHeapAllocations.push_back(static_cast<double>(allocations));
+            }
+        }
+
+        // the first frame is submitted once drawFrame returns, that is the end of startup
+        if (!timeToFirstFrame.has_value()) {
+            timeToFirstFrame = millisecondsSinceStartup(end);
+            printStartupReport();
+        }
+    }
+
+    void drawFrame() {
+        /*
+         * This function records and submits a single frame. The wait for a free frame slot happens inside
+         * beginFrame(), so with N frames in flight the CPU only blocks when it is N frames ahead of the GPU
+         */
+        TRACE_SCOPE("drawFrame");
+        if (config.headless) {
+            FrameTarget target;
+            frameEngine.beginFrame(offscreenTargets, target);
+            parallelRecorder.beginFrame(target.slotIndex);
+            bindless.beginFrame(frameEngine.getFrameNumber());
+            assetStreamer.poll(frameEngine.getFrameNumber());
+            residency.update(frameEngine.getFrameNumber());
+            updateScene(target);
+            recordCommandBuffer(target);
+            frameEngine.endFrame(target, queues.graphics.queue);
+            return;
+        }
+
+        if (framebufferResized) {
+            framebufferResized = false;
+            recreateSwapChain();
+        }
+
+        if (frameScheduler.isLowLatency()) {
+            // nothing is queued behind the last frame, so the input sampled below is shown in the very next present
+            bool presented = frameEngine.waitForLastPresent(swapchain);
+            if (lastInputTime.has_value()) {
+                double latency = std::chrono::duration<double, std::milli>(FrameScheduler::Clock::now() - lastInputTime.value()).count();
+                gpuProfiler.addCpuSample(presented ? "input to present" : "input to GPU done", latency);
+                lastInputTime.reset();
+            }
+        }
+
+        FrameTarget target;
+        if (!frameEngine.beginFrame(swapchain, target)) {
+            recreateSwapChain();
+            return;
+        }
+
+        FrameScheduler::Clock::time_point inputTime = frameScheduler.sampleInput();
+        parallelRecorder.beginFrame(target.slotIndex);
+        bindless.beginFrame(frameEngine.getFrameNumber());
+        assetStreamer.poll(frameEngine.getFrameNumber());
+        residency.update(frameEngine.getFrameNumber());
+        updateScene(target);
+        recordCommandBuffer(target);
+
+        bool presented = frameEngine.endFrame(swapchain, target, queues.graphics.queue, queues.present.queue);
+        if (frameScheduler.isLowLatency()) {
+            lastInputTime = inputTime;
+        }
+        if (!presented || framebufferResized) {
+            framebufferResized = false;
+            recreateSwapChain();
+        }
+    }
+
+    void recordCommandBuffer(const FrameTarget& target) {
+        /*
+         * This function records the frame's commands, for now it clears the swap chain image
+         * and transitions it for presentation
+         */
+        TRACE_SCOPE("record");
+        VkCommandBuffer commandBuffer = target.slot->commandBuffer;
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+        gpuProfiler.beginFrame(commandBuffer, target.slotIndex);
+
+        {
+            GpuProfileScope clearScope(gpuProfiler, commandBuffer, "clear");
+            frameClear.record(commandBuffer, target.image, target.imageIndex);
+        }
+
+        recordSceneCommands(commandBuffer, target);
+
+        // the scenes leave the image the way the clear did
+        FrameClear::ImageState frameState = frameClear.getFrameState();
+        VkImageMemoryBarrier toPresent{};
+        toPresent.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        toPresent.srcAccessMask = frameState.access;
+        toPresent.dstAccessMask = 0;
+        toPresent.oldLayout = frameState.layout;
+        // offscreen images are left ready to be copied out
+        toPresent.newLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        toPresent.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toPresent.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toPresent.image = target.image;
+        toPresent.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        toPresent.subresourceRange.levelCount = 1;
+        toPresent.subresourceRange.layerCount = 1;
+        vkCmdPipelineBarrier(commandBuffer, frameState.stage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &toPresent);
+
+        gpuProfiler.endFrame(commandBuffer);
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
         }
     }
 
@@ -86,13 +1140,86 @@ private:
         /*
          * This function cleans up all the resources used by the application
          */
-        vkDestroyDevice(device, nullptr);
+        if (runStats != nullptr) {
+            collectRunStats();
+        }
 
-        vkDestroyInstance(instance, nullptr);
+        if (sceneBuffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, sceneBuffer, nullptr);
+            memoryAllocator.free(sceneBufferAllocation);
+        }
+        if (sceneUsesShaders()) {
+            // pipelines still compiling use the layouts and shader modules
+            pipelineCompiler->waitIdle();
+            if (config.scene == BenchScene::GpuDriven) {
+                gpuDriven.destroy();
+            }
+            shaderLibrary.destroy();
+        }
+        computeJobs.printStats();
+        computeJobs.destroy();
+        residency.printStats();
+        residency.destroy();
+        assetStreamer.printStats();
+        assetStreamer.destroy();
+        bindless.destroy();
+        workerPool.reset();
+
+        parallelRecorder.printStats();
+        parallelRecorder.destroy();
+
+        gpuProfiler.printSummary();
+        gpuProfiler.destroy();
+        frameEngine.destroy();
+        frameClear.destroy();
+        if (config.headless) {
+            offscreenTargets.destroy();
+        }
+        else {
+            swapchain.destroy();
+        }
 
-        glfwDestroyWindow(window);
+        // let the background compiles finish, so what they produced ends up in the saved cache
+        pipelineCompiler->waitIdle();
+        pipelineCompiler->printStats();
+        pipelineCompiler->destroyPipelines();
+        pipelineCompiler.reset();
 
-        glfwTerminate();
+        pipelineCache.printStats();
+        pipelineCache.save();
+        pipelineCache.destroy();
+
+        uploader.printStats();
+        uploader.destroy();
+
+        memoryAllocator.printStats();
+        memoryAllocator.destroy();
+
+        device.reset();
+        surface.reset();
+        instance.reset();
+
+        if (window != nullptr) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+    }
+
+    void collectRunStats() {
+        /*
+         * This function hands what this run measured to the caller, while everything still exists
+         */
+        runStats->deviceName = physicalDeviceProperties.deviceName;
+        runStats->vendorID = physicalDeviceProperties.vendorID;
+        runStats->deviceID = physicalDeviceProperties.deviceID;
+        runStats->driverVersion = physicalDeviceProperties.driverVersion;
+        runStats->startupPhases = startupPhases;
+        runStats->timeToFirstFrameMilliseconds = timeToFirstFrame.value_or(0.0);
+        runStats->gpuFrame = gpuProfiler.getStats("frame");
+        runStats->memory = memoryAllocator.getStats();
+        UploadStats uploadStats = uploader.getStats();
+        runStats->uploadedBytes = uploadStats.stagedBytes + uploadStats.directBytes;
+        runStats->pipelineCompileMilliseconds = pipelineCompiler->getCompileMilliseconds();
     }
 
     void createLogicalDevice() {
@@ -100,34 +1227,69 @@ private:
          * This function creates the logical device that will be used by the application
          */
         // get the queue family indices
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        // one queue per distinct family, graphics > compute > transfer in priority
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> familyProperties(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, familyProperties.data());
+        DeviceQueuePlan queuePlan(queueFamilyIndices, familyProperties);
 
-        // create the queueCreateInfo struct
-        VkDeviceQueueCreateInfo queueCreateInfo{};
-        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
-        queueCreateInfo.queueCount = 1;
-        float queuePriority = 1.0f;
-        queueCreateInfo.pQueuePriorities = &queuePriority;
+        VkPhysicalDeviceVulkan12Features supported12Features{};
+        supported12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 supportedFeatures{};
+        supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures.pNext = &supported12Features;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
 
+        // the GPU driven scene writes its draws on the GPU, every indirect feature the device lacks has a slower fallback
         VkPhysicalDeviceFeatures deviceFeatures{};
+        deviceFeatures.multiDrawIndirect = supportedFeatures.features.multiDrawIndirect;
+        deviceFeatures.drawIndirectFirstInstance = supportedFeatures.features.drawIndirectFirstInstance;
+        // streamed textures are stored block compressed, whichever families the device has are usable
+        deviceFeatures.textureCompressionBC = supportedFeatures.features.textureCompressionBC;
+        deviceFeatures.textureCompressionETC2 = supportedFeatures.features.textureCompressionETC2;
+        deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.features.textureCompressionASTC_LDR;
 
-        // make sure to add VK_KHR_portability_subset to the device extensions
-        const std::vector<const char*> deviceExtensions = {
-                VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-                "VK_KHR_portability_subset"
-        };
+        // timeline semaphores are what the uploader hands out tickets on
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        vulkan12Features.timelineSemaphore = VK_TRUE;
+        vulkan12Features.drawIndirectCount = supported12Features.drawIndirectCount;
+        // descriptor indexing for the bindless set, all or nothing
+        bindlessSupported = BindlessDescriptors::enableFeatures(supported12Features, vulkan12Features);
+
+        indirectDrawSupport.drawIndirectCount = vulkan12Features.drawIndirectCount;
+        indirectDrawSupport.multiDrawIndirect = deviceFeatures.multiDrawIndirect;
+        indirectDrawSupport.drawIndirectFirstInstance = deviceFeatures.drawIndirectFirstInstance;
+        indirectDrawSupport.maxDrawIndirectCount = deviceFeatures.multiDrawIndirect ? physicalDeviceProperties.limits.maxDrawIndirectCount : 1;
+        if (config.scene == BenchScene::GpuDriven && !indirectDrawSupport.drawIndirectFirstInstance) {
+            throw UnsupportedSceneError("the gpu-driven scene needs the drawIndirectFirstInstance feature!");
+        }
+
+        // every optional extension the device has is turned on, creation feedback only feeds the cache stats,
+        // cache control lets pipeline creation fail on a cache miss instead of compiling
+        enabledCapabilities = deviceCapabilities.at(physicalDevice);
+        enabledCapabilities.dynamicRendering = enabledCapabilities.dynamicRendering && config.dynamicRendering;
+        // only the latency frame mode waits on presents, and headless runs present nothing
+        enabledCapabilities.presentWait = enabledCapabilities.presentWait && !config.headless && config.frameMode == FrameMode::LowLatency;
+        DeviceExtensionRequest extensionRequest(enabledCapabilities, getRequiredDeviceExtensions());
+        vulkan12Features.pNext = extensionRequest.chainFeatures(nullptr);
+        const std::vector<const char*>& deviceExtensions = extensionRequest.getExtensions();
+        std::cout << "Device extensions: " << enabledCapabilities.describe() << std::endl;
 
         // create the deviceCreateInfo struct
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        createInfo.pQueueCreateInfos = &queueCreateInfo;
-        createInfo.queueCreateInfoCount = 1;
+        createInfo.pNext = &vulkan12Features;
+        createInfo.pQueueCreateInfos = queuePlan.getCreateInfos().data();
+        createInfo.queueCreateInfoCount = static_cast<uint32_t>(queuePlan.getCreateInfos().size());
         createInfo.pEnabledFeatures = &deviceFeatures;
         createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
         createInfo.ppEnabledExtensionNames = deviceExtensions.data();
-        // if we are in debug, enable validation layers, otherwise disable them
-        if (enableValidationLayers) {
+        // device layers are deprecated, but older implementations still expect them to match the instance layers
+        if (enableValidationLayers()) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
             createInfo.ppEnabledLayerNames = validationLayers.data();
         }
@@ -136,11 +1298,17 @@ private:
         }
 
          // create the logical device
-        if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+        VkDevice createdDevice;
+        if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &createdDevice) != VK_SUCCESS) {
             throw std::runtime_error("failed to create logical device!");
         }
+        device = UniqueDevice(createdDevice);
 
-        vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+        queues = queuePlan.getQueues(device);
+        std::cout << "Queue families: graphics " << queues.graphics.family << ", present " << queues.present.family
+                  << ", compute " << queues.compute.family << (queueFamilyIndices.hasDedicatedCompute() ? " (dedicated)" : "")
+                  << ", transfer " << queues.transfer.family << (queueFamilyIndices.hasDedicatedTransfer() ? " (dedicated)" : "")
+                  << std::endl;
     }
 
 
@@ -160,18 +1328,118 @@ private:
         std::vector<VkPhysicalDevice> devices(deviceCount);
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
-        // check if any device is suitable, set the first suitable one as the physical device
-        for (const auto& device_candidate : devices) {
-            if (isDeviceSuitable(device_candidate)) {
-                physicalDevice = device_candidate;
-                break;
+        // score every suitable device, the override (if any) wins over the score
+        int64_t bestScore = -1;
+        bool overrideMatched = false;
+        std::cout << "Physical devices:" << std::endl;
+        for (uint32_t i = 0; i < deviceCount; i++) {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(devices[i], &properties);
+
+            bool suitable = isDeviceSuitable(devices[i]);
+            int64_t score = suitable ? rateDeviceSuitability(devices[i]) : -1;
+            logPhysicalDevice(i, properties, suitable, score);
+
+            if (!suitable) {
+                continue;
+            }
+            if (config.deviceOverride.isSet()) {
+                if (!overrideMatched && config.deviceOverride.matches(i, properties)) {
+                    physicalDevice = devices[i];
+                    bestScore = score;
+                    overrideMatched = true;
+                }
+            }
+            else if (score > bestScore) {
+                physicalDevice = devices[i];
+                bestScore = score;
             }
         }
 
+        if (config.deviceOverride.isSet() && !overrideMatched) {
+            throw std::runtime_error("no suitable GPU matches the device override!");
+        }
+
         // if no suitable device is found, throw an error
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+        std::cout << "Picked physical device: " << physicalDeviceProperties.deviceName
+                  << " (score " << bestScore << (overrideMatched ? ", forced by override" : "") << ")" << std::endl;
+    }
+
+    static int64_t rateDeviceSuitability(VkPhysicalDevice device_candidate) {
+        /*
+         * This function gives a suitable device a score, the device with the highest score gets picked.
+         * The device type dominates, so a discrete GPU always beats an integrated one, the rest breaks ties
+         */
+        VkPhysicalDeviceProperties properties;
+        VkPhysicalDeviceFeatures features;
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceProperties(device_candidate, &properties);
+        vkGetPhysicalDeviceFeatures(device_candidate, &features);
+        vkGetPhysicalDeviceMemoryProperties(device_candidate, &memoryProperties);
+
+        int64_t score = 0;
+        switch (properties.deviceType) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 100000; break;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 50000; break;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 20000; break;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU: score += 1000; break;
+            default: break;
+        }
+
+        // one point per 64 MiB of the largest device local heap
+        VkDeviceSize largestDeviceLocalHeap = 0;
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+            if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                largestDeviceLocalHeap = std::max(largestDeviceLocalHeap, memoryProperties.memoryHeaps[i].size);
+            }
+        }
+        score += static_cast<int64_t>(largestDeviceLocalHeap / (64ull * 1024 * 1024));
+
+        // maximum possible size of textures affects graphics quality
+        score += properties.limits.maxImageDimension2D / 16;
+
+        // we want timestamps on every graphics and compute queue for profiling
+        if (properties.limits.timestampComputeAndGraphics) {
+            score += 1000;
+        }
+        if (features.samplerAnisotropy) {
+            score += 100;
+        }
+        return score;
+    }
+
+    static void logPhysicalDevice(uint32_t index, const VkPhysicalDeviceProperties& properties, bool suitable, int64_t score) {
+        /*
+         * This function logs one physical device with its IDs, so they can be copied into the device override
+         */
+        std::ios_base::fmtflags flags = std::cout.flags();
+        std::cout << "    [" << index << "] " << properties.deviceName
+                  << " (" << physicalDeviceTypeName(properties.deviceType)
+                  << ", " << std::hex << std::setfill('0') << std::setw(4) << properties.vendorID
+                  << ":" << std::setw(4) << properties.deviceID << std::dec << std::setfill(' ')
+                  << ", driver " << properties.driverVersion << ")";
+        std::cout.flags(flags);
+        if (suitable) {
+            std::cout << " score " << score << std::endl;
+        }
+        else {
+            std::cout << " not suitable" << std::endl;
+        }
+    }
+
+    static const char* physicalDeviceTypeName(VkPhysicalDeviceType type) {
+        switch (type) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+            case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+            default: return "other";
+        }
     }
 
     bool isDeviceSuitable(VkPhysicalDevice device_candidate) {
@@ -179,7 +1447,63 @@ private:
          * This function checks if the device is suitable for the application
          */
         QueueFamilyIndices indices = findQueueFamilies(device_candidate);
-        return indices.isComplete();
+        if (!indices.isComplete() || !checkDeviceExtensionSupport(device_candidate) || !checkDeviceFeatureSupport(device_candidate)) {
+            return false;
+        }
+        deviceCapabilities[device_candidate] = DeviceCapabilities::query(device_candidate, getDeviceExtensions(device_candidate));
+
+        // the swap chain extension being there does not mean it works with our surface
+        return surface == VK_NULL_HANDLE || SwapchainSupportDetails::query(device_candidate, surface).isAdequate();
+    }
+
+    std::vector<const char*> getRequiredDeviceExtensions() const {
+        if (config.headless) {
+            return {};
+        }
+        return presentDeviceExtensions;
+    }
+
+    const ExtensionList& getDeviceExtensions(VkPhysicalDevice device_candidate) {
+        /*
+         * This function enumerates the device's extensions the first time it is asked about them
+         */
+        auto cached = deviceExtensionCache.find(device_candidate);
+        if (cached != deviceExtensionCache.end()) {
+            return cached->second;
+        }
+        return deviceExtensionCache.emplace(device_candidate, ExtensionList::forDevice(device_candidate)).first->second;
+    }
+
+    bool checkDeviceExtensionSupport(VkPhysicalDevice device_candidate) {
+        /*
+         * This function checks if the device supports all the extensions in getRequiredDeviceExtensions()
+         */
+        const ExtensionList& availableExtensions = getDeviceExtensions(device_candidate);
+        for (const char* extension : getRequiredDeviceExtensions()) {
+            if (!availableExtensions.has(extension)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool checkDeviceFeatureSupport(VkPhysicalDevice device_candidate) {
+        /*
+         * This function checks the Vulkan 1.2 features we can not do without
+         */
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device_candidate, &properties);
+        if (properties.apiVersion < VK_API_VERSION_1_2) {
+            return false;
+        }
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &vulkan12Features;
+        vkGetPhysicalDeviceFeatures2(device_candidate, &features2);
+        return vulkan12Features.timelineSemaphore;
     }
 
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device_candidate) {
@@ -193,19 +1517,53 @@ private:
         std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
         vkGetPhysicalDeviceQueueFamilyProperties(device_candidate, &queueFamilyCount, queueFamilies.data());
 
-        // iterate over the queue families and check if they support graphics
-        int i = 0;
-        for (const auto& queueFamily : queueFamilies) {
+        // present support can only be asked for once there is a surface
+        indices.presentRequired = surface != VK_NULL_HANDLE;
+
+        // iterate over the queue families and pick one for each role
+        for (uint32_t i = 0; i < queueFamilyCount; i++) {
+            VkQueueFlags flags = queueFamilies[i].queueFlags;
+
             // check if the queue family supports graphics
-            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+            if ((flags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily.has_value()) {
                 indices.graphicsFamily = i;
             }
-            // if the device supports graphics, and the queue family is complete, break
-            if (indices.isComplete()) {
-                break;
+
+            // prefer presenting from the graphics family, then no ownership transfer is needed before present
+            if (indices.presentRequired) {
+                VkBool32 presentSupport = VK_FALSE;
+                vkGetPhysicalDeviceSurfaceSupportKHR(device_candidate, i, surface, &presentSupport);
+                if (presentSupport && (!indices.presentFamily.has_value() || indices.graphicsFamily == i)) {
+                    indices.presentFamily = i;
+                }
             }
 
-            i++;
+            // a compute family without graphics is the async compute queue
+            if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !indices.computeFamily.has_value()) {
+                indices.computeFamily = i;
+            }
+
+            // a transfer only family is usually the DMA engine, the best place for uploads
+            if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+                && !indices.transferFamily.has_value()) {
+                indices.transferFamily = i;
+            }
+        }
+
+        // fall back for anything the device has no dedicated family for, graphics and compute families
+        // always support transfer, and graphics families always support compute
+        if (!indices.computeFamily.has_value()) {
+            indices.computeFamily = indices.graphicsFamily;
+        }
+        if (!indices.transferFamily.has_value()) {
+            indices.transferFamily = indices.computeFamily;
+        }
+
+        // the profiler skips queues that can not write timestamps
+        if (indices.graphicsFamily.has_value()) {
+            indices.graphicsTimestampBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+            indices.computeTimestampBits = queueFamilies[indices.computeFamily.value()].timestampValidBits;
+            indices.transferTimestampBits = queueFamilies[indices.transferFamily.value()].timestampValidBits;
         }
         return indices;
     }
@@ -216,7 +1574,7 @@ private:
          */
 
         // check if the desired validation layers are available, if not, throw an error
-        if (enableValidationLayers && !checkValidationLayerSupport()) {
+        if (enableValidationLayers() && !checkValidationLayerSupport()) {
             throw std::runtime_error("validation layers requested, but not available!");
         }
 
@@ -232,9 +1590,8 @@ private:
         // create the instance create info, which is a struct used to specify some details about the instance
         VkInstanceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.flags = VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
         createInfo.pApplicationInfo = &appInfo;
-        if (enableValidationLayers) {
+        if (enableValidationLayers()) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
             createInfo.ppEnabledLayerNames = validationLayers.data();
         }
@@ -242,25 +1599,86 @@ private:
             createInfo.enabledLayerCount = 0;
         }
 
-        // get the required extensions from GLFW and add them to the instance create info
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-        std::vector<const char*> enabledExtensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
-        // add the VK_KHR_portability_enumeration extension to the list of extensions, which is required for portability on macOS
-        enabledExtensions.push_back("VK_KHR_portability_enumeration");
+        // the sync and gpu-assisted profiles are the validation layer with extra features switched on
+        std::vector<VkValidationFeatureEnableEXT> validationFeatureEnables;
+        if (config.layerProfile == LayerProfile::Synchronization) {
+            validationFeatureEnables.push_back(VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT);
+        }
+        else if (config.layerProfile == LayerProfile::GpuAssisted) {
+            validationFeatureEnables.push_back(VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_EXT);
+            validationFeatureEnables.push_back(VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_RESERVE_BINDING_SLOT_EXT);
+        }
+
+        // get the required extensions from GLFW and add them to the instance create info, headless runs have no surface
+        std::vector<const char*> enabledExtensions;
+        if (!config.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            enabledExtensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
+        // portability drivers (MoltenVK) are only enumerated with VK_KHR_portability_enumeration, a loader that
+        // does not know the extension would fail the instance, so it is only asked for where it exists
+        if (ExtensionList::forInstance().has(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)) {
+            enabledExtensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+            createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+        }
+        // the validation features struct is exposed by the validation layer through VK_EXT_validation_features,
+        // a layer build without it runs with plain validation rather than failing the instance
+        if (!validationFeatureEnables.empty()) {
+            bool validationFeatures = ExtensionList::forInstance().has(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+            for (const char* layer : validationLayers) {
+                validationFeatures = validationFeatures || ExtensionList::forLayer(layer).has(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+            }
+            if (validationFeatures) {
+                enabledExtensions.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+            }
+            else {
+                std::cerr << "The validation layer has no " << VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME << ", the "
+                          << layerProfileName(config.layerProfile) << " checks are off" << std::endl;
+                validationFeatureEnables.clear();
+            }
+        }
+        VkValidationFeaturesEXT validationFeatures{};
+        validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+        validationFeatures.enabledValidationFeatureCount = static_cast<uint32_t>(validationFeatureEnables.size());
+        validationFeatures.pEnabledValidationFeatures = validationFeatureEnables.data();
+        if (!validationFeatureEnables.empty()) {
+            createInfo.pNext = &validationFeatures;
+        }
 
         createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
         createInfo.ppEnabledExtensionNames = enabledExtensions.data();
-        createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-        createInfo.ppEnabledLayerNames = validationLayers.data();
 
         // create the instance
-        VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+        VkInstance createdInstance;
+        VkResult result = vkCreateInstance(&createInfo, nullptr, &createdInstance);
 
         if (result != VK_SUCCESS) {
             throw std::runtime_error("failed to create instance! Error code: " + std::to_string(result));
         }
+        instance = UniqueInstance(createdInstance);
+
+        logEnabledLayers(createInfo);
+    }
+
+    bool enableValidationLayers() const {
+        /*
+         * This function returns true if the selected layer profile loads the validation layer
+         */
+        return config.layerProfile != LayerProfile::None;
+    }
+
+    void logEnabledLayers(const VkInstanceCreateInfo& createInfo) const {
+        /*
+         * This function logs the layer profile and the layers that were actually loaded into the instance,
+         * so a release binary can be checked for not running with validation
+         */
+        std::cout << "Layer profile: " << layerProfileName(config.layerProfile) << std::endl;
+        std::cout << "Instance layers loaded: " << createInfo.enabledLayerCount << std::endl;
+        for (uint32_t i = 0; i < createInfo.enabledLayerCount; i++) {
+            std::cout << "    " << createInfo.ppEnabledLayerNames[i] << std::endl;
+        }
     }
 
     static bool checkValidationLayerSupport() {
@@ -268,10 +1686,14 @@ private:
          * This function checks if the validation layers specified in the validationLayers vector are available
          * If they are not, it returns false, otherwise it returns true
          */
-        uint32_t layerCount;
-        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-        std::vector<VkLayerProperties> availableLayers(layerCount);
-        vkEnumerateInstanceLayerProperties(&layerCount,availableLayers.data());
+        // the installed layers do not change while we run, so every application instance of the process shares one list
+        static const std::vector<VkLayerProperties> availableLayers = [] {
+            uint32_t layerCount;
+            vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+            std::vector<VkLayerProperties> layers(layerCount);
+            vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+            return layers;
+        }();
 
         for (const char* layerName : validationLayers) {
             bool layerFound = false;
@@ -292,17 +1714,365 @@ private:
 
 };
 
-int main() {
-    std::cout << "Validation layers enabled: " << enableValidationLayers << std::endl;
+void startCpuTrace(const AppConfig& config) {
+    /*
+     * This function turns the CPU trace on if a trace file was asked for
+     */
+    if (config.tracePath.empty()) {
+        return;
+    }
+#ifdef VK_TUT_TRACE
+    CpuTrace::enable();
+    TRACE_THREAD_NAME("main");
+#else
+    std::cerr << "CPU tracing is compiled out of this build, " << config.tracePath << " will not be written" << std::endl;
+#endif
+}
 
-    HelloTriangleApplication app;
+void finishCpuTrace(const AppConfig& config) {
+    if (!CpuTrace::isEnabled()) {
+        return;
+    }
+    CpuTrace::disable();
+    if (CpuTrace::writeChromeTrace(config.tracePath)) {
+        std::cout << "CPU trace written to " << config.tracePath << std::endl;
+    }
+    else {
+        std::cerr << "failed to write CPU trace to " << config.tracePath << std::endl;
+    }
+}
 
-    try {
+uint32_t countPhysicalDevices() {
+    /*
+     * This function asks a throwaway instance how many GPUs there are, each device of a multi device run then
+     * creates its own instance like a single device run does
+     */
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.apiVersion = VK_API_VERSION_1_2;
+    VkInstanceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+    std::vector<const char*> extensions;
+    if (ExtensionList::forInstance().has(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)) {
+        extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+        createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+    }
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
+    VkInstance instance;
+    if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance!");
+    }
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    vkDestroyInstance(instance, nullptr);
+    return deviceCount;
+}
+
+void runMultiDevice(const AppConfig& config) {
+    /*
+     * This function renders the frame limit's worth of headless frames on every GPU at once. Each GPU gets the
+     * whole application on a thread of its own (instance, device, allocator, pipelines), the devices share
+     * nothing but the queue of frames, so the throughput grows with the GPU count until the CPU runs out. A GPU
+     * that is not suitable fails before it takes a frame and the others render its share, one that fails later
+     * fails the run
+     */
+    uint32_t deviceCount = countPhysicalDevices();
+    if (deviceCount == 0) {
+        throw std::runtime_error("failed to find GPUs with Vulkan support!");
+    }
+    FrameJobQueue jobs(config.frameLimit);
+    std::vector<RunStats> stats(deviceCount);
+    std::vector<std::string> errors(deviceCount);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        AppConfig deviceConfig = config;
+        deviceConfig.deviceOverride = DeviceOverride{};
+        deviceConfig.deviceOverride.index = i;
+        // the CPU is shared, every device gets its share of the compile and record threads
+        deviceConfig.pipelineThreads = std::max(1u, config.pipelineThreads / deviceCount);
+        deviceConfig.recordThreads = std::max(1u, config.recordThreads / deviceCount);
+        // pipeline caches are per device, and the devices would overwrite each other's file
+        if (!config.pipelineCachePath.empty()) {
+            size_t dot = config.pipelineCachePath.find_last_of('.');
+            size_t slash = config.pipelineCachePath.find_last_of("/\\");
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+                dot = config.pipelineCachePath.size();
+            }
+            deviceConfig.pipelineCachePath = config.pipelineCachePath.substr(0, dot) + "-gpu" + std::to_string(i)
+                                             + config.pipelineCachePath.substr(dot);
+        }
+        // nobody edits shaders during a batch run, and the devices would race on the shader cache directory
+        deviceConfig.hotReload = false;
+        threads.emplace_back([deviceConfig, i, &jobs, &stats, &errors] {
+            TRACE_THREAD_NAME(("device " + std::to_string(i)).c_str());
+            try {
+                HelloTriangleApplication app(deviceConfig, &stats[i], &jobs);
+                app.run();
+            } catch (const std::exception& e) {
+                errors[i] = e.what();
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t rendered = 0;
+    std::ios_base::fmtflags flags = std::cout.flags();
+    std::cout << "Multi device:" << std::endl;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        if (!errors[i].empty()) {
+            std::cout << "  " << i << ": dropped out, " << errors[i] << std::endl;
+            continue;
+        }
+        rendered += stats[i].frameMilliseconds.size();
+        std::cout << "  " << i << ": " << stats[i].deviceName << ", " << stats[i].frameMilliseconds.size() << " frames" << std::endl;
+    }
+    std::cout << "  " << rendered << " of " << jobs.getJobCount() << " frames in " << std::fixed << std::setprecision(2)
+              << seconds << " s including startup, " << std::setprecision(1) << (seconds > 0.0 ? rendered / seconds : 0.0)
+              << " frames per second" << std::endl;
+    std::cout.flags(flags);
+    if (rendered < jobs.getJobCount()) {
+        throw std::runtime_error("failed to render every frame, no device was left!");
+    }
+}
+
+#ifdef VK_TUT_BENCH
+struct RegressionOptions {
+    std::string baselineDirectory = "bench_baselines";
+    bool updateBaselines = false;
+    RegressionThresholds thresholds;
+};
+
+int runRegressionSuite(const AppConfig& config, const RegressionOptions& options) {
+    /*
+     * This function runs the fixed regression cases and compares them with the baseline of this GPU and driver.
+     * Without a baseline (or with --update-baselines) the results become the baseline and the run passes. The
+     * cold and warm pipeline cache cases share a cache file of their own, deleted before the cold run, which
+     * saves it for the warm one. A case the device or the build does not support (UnsupportedSceneError) is
+     * reported as skipped and not compared, one that fails in any other way fails the suite, and is never written into a baseline
+     */
+    const std::string cachePath = "regression_pipeline_cache.bin";
+    GpuBaseline current;
+    bool deviceKnown = false;
+    std::vector<std::string> failedCases;
+    for (const RegressionCase& regressionCase : regressionSuite()) {
+        AppConfig caseConfig = config;
+        caseConfig.scene = regressionCase.scene;
+        if (regressionCase.cacheStart != PipelineCacheStart::Default) {
+            caseConfig.pipelineCachePath = cachePath;
+        }
+        if (regressionCase.cacheStart == PipelineCacheStart::Cold) {
+            std::remove(cachePath.c_str());
+        }
+        std::cout << "Regression case " << regressionCase.name << std::endl;
+        RunStats stats;
+        try {
+            HelloTriangleApplication app(caseConfig, &stats);
+            app.run();
+        } catch (const UnsupportedSceneError& e) {
+            std::cout << "Regression case " << regressionCase.name << " skipped, not supported: " << e.what() << std::endl;
+            current.skippedCases.insert(regressionCase.name);
+            continue;
+        } catch (const std::exception& e) {
+            std::cout << "Regression case " << regressionCase.name << " failed: " << e.what() << std::endl;
+            failedCases.push_back(regressionCase.name);
+            continue;
+        }
+        if (!deviceKnown) {
+            current.deviceName = stats.deviceName;
+            current.vendorID = stats.vendorID;
+            current.deviceID = stats.deviceID;
+            current.driverVersion = stats.driverVersion;
+            deviceKnown = true;
+        }
+        current.cases[regressionCase.name] = RegressionMetrics::fromRunStats(stats);
+    }
+    if (!deviceKnown) {
+        throw std::runtime_error("failed to run any regression case!");
+    }
+
+    std::filesystem::path baselinePath = std::filesystem::path(options.baselineDirectory)
+                                         / baselineFileName(current.vendorID, current.deviceID, current.driverVersion);
+    std::optional<GpuBaseline> baseline;
+    if (!options.updateBaselines) {
+        std::ifstream in(baselinePath);
+        if (in) {
+            baseline = readBaseline(in);
+            if (!baseline.has_value()) {
+                throw std::runtime_error("failed to read regression baseline " + baselinePath.string());
+            }
+        }
+    }
+
+    if (!baseline.has_value() && !failedCases.empty()) {
+        std::cout << failedCases.size() << " regression cases failed, no baseline written" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!baseline.has_value()) {
+        std::filesystem::create_directories(options.baselineDirectory);
+        std::ofstream out(baselinePath, std::ios::trunc);
+        writeBaseline(out, current);
+        if (!out) {
+            throw std::runtime_error("failed to write regression baseline " + baselinePath.string());
+        }
+        std::cout << "Regression baseline for " << current.deviceName << " written to " << baselinePath.string() << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<RegressionFailure> failures = compareToBaseline(baseline.value(), current, options.thresholds);
+    printRegressionReport(std::cout, baseline.value(), current, failures);
+    auto cold = current.cases.find("pipeline-cache-cold");
+    auto warm = current.cases.find("pipeline-cache-warm");
+    if (cold != current.cases.end() && warm != current.cases.end()) {
+        std::cout << "Pipeline cache: " << cold->second.pipelineCompileMilliseconds << " ms of compile time cold, "
+                  << warm->second.pipelineCompileMilliseconds << " ms warm" << std::endl;
+    }
+    for (const std::string& name : failedCases) {
+        // a failed case the baseline has is already a "missing" failure
+        if (baseline->cases.count(name) == 0) {
+            failures.push_back({name, "missing", 0.0, 0.0, 0.0});
+        }
+    }
+    if (!failures.empty()) {
+        std::cout << failures.size() << " regressions against " << baselinePath.string() << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "No regressions against " << baselinePath.string() << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int runBenchmark(int argc, char** argv) {
+    /*
+     * This function is the initial_engine_bench entry point: every scene gets a fresh headless run of the
+     * application (so startup is measured each time) and the results go out as one JSON document,
+     * to --bench-output=<path> if given, otherwise to stdout. While the scenes run std::cout goes to stderr, so
+     * the application's own log never ends up in the JSON
+     */
+    AppConfig config = AppConfig::fromArgs(argc, argv);
+    config.headless = true;
+    if (config.frameLimit == 0) {
+        config.frameLimit = 600;
+    }
+
+    std::vector<BenchScene> scenes = allBenchScenes();
+    std::string outputPath;
+    bool regression = false;
+    RegressionOptions regressionOptions;
+    // thresholds are given in percent over the baseline
+    auto percentArgument = [](const std::string& arg, const std::string& prefix) {
+        return std::stod(arg.substr(prefix.size())) / 100.0;
+    };
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--scenes=", 0) == 0) {
+            scenes.clear();
+            std::string list = arg.substr(std::string("--scenes=").size()) + ",";
+            for (size_t start = 0, end; (end = list.find(',', start)) != std::string::npos; start = end + 1) {
+                std::string name = list.substr(start, end - start);
+                std::optional<BenchScene> scene = parseBenchScene(name);
+                if (!scene.has_value()) {
+                    throw std::runtime_error("unknown scene: " + name);
+                }
+                scenes.push_back(scene.value());
+            }
+        }
+        else if (arg.rfind("--bench-output=", 0) == 0) {
+            outputPath = arg.substr(std::string("--bench-output=").size());
+        }
+        else if (arg == "--regression") {
+            regression = true;
+        }
+        else if (arg.rfind("--baseline-dir=", 0) == 0) {
+            regressionOptions.baselineDirectory = arg.substr(std::string("--baseline-dir=").size());
+        }
+        else if (arg == "--update-baselines") {
+            regressionOptions.updateBaselines = true;
+        }
+        else if (arg.rfind("--max-p99-regression=", 0) == 0) {
+            regressionOptions.thresholds.frameP99 = percentArgument(arg, "--max-p99-regression=");
+        }
+        else if (arg.rfind("--max-startup-regression=", 0) == 0) {
+            regressionOptions.thresholds.startup = percentArgument(arg, "--max-startup-regression=");
+        }
+        else if (arg.rfind("--max-compile-regression=", 0) == 0) {
+            regressionOptions.thresholds.pipelineCompile = percentArgument(arg, "--max-compile-regression=");
+        }
+        else if (arg.rfind("--max-memory-regression=", 0) == 0) {
+            regressionOptions.thresholds.memory = percentArgument(arg, "--max-memory-regression=");
+        }
+    }
+
+    if (regression) {
+        startCpuTrace(config);
+        int result = runRegressionSuite(config, regressionOptions);
+        finishCpuTrace(config);
+        return result;
+    }
+
+    struct LogToStderr {
+        std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+        ~LogToStderr() { std::cout.rdbuf(stdoutBuffer); }
+    } logToStderr;
+    startCpuTrace(config);
+    std::vector<std::pair<BenchScene, RunStats>> results;
+    for (BenchScene scene : scenes) {
+        AppConfig sceneConfig = config;
+        sceneConfig.scene = scene;
+        RunStats stats;
+        HelloTriangleApplication app(sceneConfig, &stats);
         app.run();
+        results.emplace_back(scene, std::move(stats));
+    }
+    finishCpuTrace(config);
+
+    if (outputPath.empty()) {
+        std::ostream json(logToStderr.stdoutBuffer);
+        writeBenchJson(json, results);
+        json.flush();
+        return EXIT_SUCCESS;
+    }
+    std::ofstream out(outputPath, std::ios::trunc);
+    writeBenchJson(out, results);
+    if (!out) {
+        throw std::runtime_error("failed to write benchmark results to " + outputPath);
+    }
+    std::cout << "Benchmark results written to " << outputPath << std::endl;
+    return EXIT_SUCCESS;
+}
+#endif
+
+int main(int argc, char** argv) {
+#ifdef VK_TUT_BENCH
+    try {
+        return runBenchmark(argc, argv);
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
+#else
+    AppConfig config;
+    try {
+        config = AppConfig::fromArgs(argc, argv);
+        startCpuTrace(config);
+        if (config.multiDevice) {
+            runMultiDevice(config);
+        }
+        else {
+            HelloTriangleApplication app(config);
+            app.run();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        finishCpuTrace(config);
+        return EXIT_FAILURE;
+    }
+    finishCpuTrace(config);
 
     return EXIT_SUCCESS;
+#endif
 }
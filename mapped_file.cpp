@@ -0,0 +1,70 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <utility>
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)), path(std::move(other.path)) {
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+        path = std::move(other.path);
+    }
+    return *this;
+}
+
+void MappedFile::open(const std::string& pathIn) {
+    /*
+     * This function maps the file, the descriptor is closed right away since the mapping keeps the file alive
+     */
+    close();
+    int descriptor = ::open(pathIn.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("failed to open " + pathIn + "!");
+    }
+    struct stat status{};
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        ::close(descriptor);
+        throw std::runtime_error("failed to map " + pathIn + ", it is empty or unreadable!");
+    }
+    void* mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("failed to map " + pathIn + "!");
+    }
+    data = static_cast<const uint8_t*>(mapping);
+    size = static_cast<size_t>(status.st_size);
+    path = pathIn;
+}
+
+void MappedFile::close() {
+    if (data != nullptr) {
+        munmap(const_cast<uint8_t*>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const {
+    if (data == nullptr || offset >= size) {
+        return;
+    }
+    // madvise wants a page aligned start
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = offset / pageSize * pageSize;
+    size_t end = offset + length < size ? offset + length : size;
+    madvise(const_cast<uint8_t*>(data) + start, end - start, MADV_WILLNEED);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile {
+    /*
+     * This class maps a whole file read only into the address space, pages are read from disk the first time
+     * they are touched. Move only, the mapping goes away with the object
+     */
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void open(const std::string& path);
+    void close();
+
+    // asks the OS to start reading a range in the background, the pages are needed soon
+    void prefetch(size_t offset, size_t size) const;
+
+    bool isOpen() const { return data != nullptr; }
+    const uint8_t* getData() const { return data; }
+    size_t getSize() const { return size; }
+    const std::string& getPath() const { return path; }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    std::string path;
+};
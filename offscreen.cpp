@@ -0,0 +1,60 @@
+#include "offscreen.h"
+
+#include <stdexcept>
+
+void OffscreenTargets::create(DeviceMemoryAllocator& allocatorIn, VkFormat formatIn, VkExtent2D extentIn, uint32_t imageCount) {
+    /*
+     * This function creates the images with the same usage a swap chain image gets, plus TRANSFER_SRC for readback
+     */
+    allocator = &allocatorIn;
+    device = allocatorIn.getDevice();
+    format = formatIn;
+    extent = extentIn;
+
+    images.resize(imageCount);
+    allocations.resize(imageCount);
+    imageViews.resize(imageCount);
+    for (uint32_t i = 0; i < imageCount; i++) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = format;
+        imageInfo.extent = {extent.width, extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (vkCreateImage(device, &imageInfo, nullptr, &images[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create offscreen image!");
+        }
+        allocations[i] = allocator->allocateForImage(images[i], MemoryUsage::GpuOnly);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = images[i];
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = format;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(device, &viewInfo, nullptr, &imageViews[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create offscreen image view!");
+        }
+    }
+}
+
+void OffscreenTargets::destroy() {
+    for (size_t i = 0; i < images.size(); i++) {
+        vkDestroyImageView(device, imageViews[i], nullptr);
+        vkDestroyImage(device, images[i], nullptr);
+        allocator->free(allocations[i]);
+    }
+    imageViews.clear();
+    allocations.clear();
+    images.clear();
+}
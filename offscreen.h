@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "gpu_allocator.h"
+
+#include <vector>
+
+class OffscreenTargets {
+    /*
+     * This class is what headless runs render into instead of a swap chain: a ring of device local color images,
+     * one per frame in flight so a frame never writes an image the GPU may still be reading.
+     * The images can be copied out (TRANSFER_SRC), e.g. to check the output of a benchmark run
+     */
+public:
+    void create(DeviceMemoryAllocator& allocator, VkFormat format, VkExtent2D extent, uint32_t imageCount);
+    void destroy();
+
+    VkFormat getImageFormat() const { return format; }
+    VkExtent2D getExtent() const { return extent; }
+    uint32_t getImageCount() const { return static_cast<uint32_t>(images.size()); }
+    const std::vector<VkImage>& getImages() const { return images; }
+    const std::vector<VkImageView>& getImageViews() const { return imageViews; }
+
+private:
+    DeviceMemoryAllocator* allocator = nullptr;
+    VkDevice device = VK_NULL_HANDLE;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+    std::vector<VkImage> images;
+    std::vector<GpuAllocation> allocations;
+    std::vector<VkImageView> imageViews;
+};
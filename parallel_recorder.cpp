@@ -0,0 +1,240 @@
+#include "parallel_recorder.h"
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+void ParallelRecorder::create(VkDevice deviceIn, uint32_t queueFamily, uint32_t framesInFlight, uint32_t workerCount) {
+    /*
+     * This function creates the pools of every worker and starts all workers but the first, which is the caller
+     */
+    device = deviceIn;
+    workerCount = std::max(workerCount, 1u);
+    for (uint32_t w = 0; w < workerCount; w++) {
+        auto worker = std::make_unique<Worker>();
+        worker->slots.resize(framesInFlight);
+        for (WorkerPools& slot : worker->slots) {
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamily;
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &slot.pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create recording command pool!");
+            }
+        }
+        workers.push_back(std::move(worker));
+    }
+    for (uint32_t w = 1; w < workerCount; w++) {
+        workers[w]->thread = std::thread(&ParallelRecorder::workerLoop, this, w);
+    }
+}
+
+void ParallelRecorder::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+        // destroying a pool frees its secondaries
+        for (WorkerPools& slot : worker->slots) {
+            vkDestroyCommandPool(device, slot.pool, nullptr);
+        }
+    }
+    workers.clear();
+}
+
+void ParallelRecorder::beginFrame(uint32_t frameSlot) {
+    /*
+     * This function recycles everything the slot's pools recorded when the slot was last used, the workers are idle
+     * between record() calls, so the main thread can reset pools it does not own
+     */
+    currentSlot = frameSlot;
+    for (auto& worker : workers) {
+        WorkerPools& slot = worker->slots[currentSlot];
+        vkResetCommandPool(device, slot.pool, 0);
+        slot.used = 0;
+    }
+}
+
+void ParallelRecorder::record(VkCommandBuffer primary, uint32_t itemCount, const RecordFunction& recordItems,
+                              const VkCommandBufferInheritanceInfo* inheritance) {
+    if (itemCount == 0) {
+        return;
+    }
+
+    // inside a render pass the primary was begun for secondaries only, so it can not take the commands itself
+    if (inheritance == nullptr && (workers.size() == 1 || itemCount < MIN_PARALLEL_ITEMS)) {
+        recordItems(primary, 0, itemCount);
+        stats.inlineRecords++;
+        return;
+    }
+
+    TRACE_SCOPE("parallelRecord");
+    uint32_t workerCount = static_cast<uint32_t>(workers.size());
+    uint32_t targetChunks = workerCount * CHUNKS_PER_WORKER;
+    job.recordItems = &recordItems;
+    job.inheritance = inheritance;
+    job.itemCount = itemCount;
+    job.chunkSize = std::max(1u, (itemCount + targetChunks - 1) / targetChunks);
+    uint32_t chunkCount = (itemCount + job.chunkSize - 1) / job.chunkSize;
+    job.chunkBuffers.assign(chunkCount, VK_NULL_HANDLE);
+
+    // neighbouring chunks go to the same worker, they tend to touch neighbouring data
+    for (uint32_t w = 0; w < workerCount; w++) {
+        std::lock_guard<std::mutex> lock(workers[w]->dequeMutex);
+        workers[w]->chunks.clear();
+        for (uint32_t chunk = w * chunkCount / workerCount; chunk < (w + 1) * chunkCount / workerCount; chunk++) {
+            workers[w]->chunks.push_back(chunk);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        failure = nullptr;
+        busyWorkers = workerCount - 1;
+        jobGeneration++;
+    }
+    jobAvailable.notify_all();
+
+    try {
+        runChunks(0);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failure = std::current_exception();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobDone.wait(lock, [this] { return busyWorkers == 0; });
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    vkCmdExecuteCommands(primary, chunkCount, job.chunkBuffers.data());
+    stats.parallelRecords++;
+    stats.chunks += chunkCount;
+    stats.steals = steals.load(std::memory_order_relaxed);
+}
+
+void ParallelRecorder::printStats() const {
+    std::cout << "Parallel recording: " << workers.size() << " workers, " << stats.parallelRecords << " parallel lists in "
+              << stats.chunks << " chunks, " << stats.steals << " steals, " << stats.inlineRecords << " inline lists" << std::endl;
+}
+
+void ParallelRecorder::workerLoop(uint32_t workerIndex) {
+    TRACE_THREAD_NAME("record worker");
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = jobGeneration;
+        }
+
+        try {
+            runChunks(workerIndex);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            failure = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+            if (busyWorkers == 0) {
+                jobDone.notify_all();
+            }
+        }
+    }
+}
+
+void ParallelRecorder::runChunks(uint32_t workerIndex) {
+    uint32_t chunk = 0;
+    while (takeChunk(workerIndex, chunk)) {
+        recordChunk(workerIndex, chunk);
+    }
+}
+
+bool ParallelRecorder::takeChunk(uint32_t workerIndex, uint32_t& chunk) {
+    /*
+     * This function pops the next chunk off the front of the worker's own deque, or steals one off the back of
+     * someone else's, the back is the work its owner would have got to last
+     */
+    {
+        Worker& own = *workers[workerIndex];
+        std::lock_guard<std::mutex> lock(own.dequeMutex);
+        if (!own.chunks.empty()) {
+            chunk = own.chunks.front();
+            own.chunks.pop_front();
+            return true;
+        }
+    }
+
+    uint32_t workerCount = static_cast<uint32_t>(workers.size());
+    for (uint32_t offset = 1; offset < workerCount; offset++) {
+        Worker& victim = *workers[(workerIndex + offset) % workerCount];
+        std::lock_guard<std::mutex> lock(victim.dequeMutex);
+        if (!victim.chunks.empty()) {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParallelRecorder::recordChunk(uint32_t workerIndex, uint32_t chunk) {
+    TRACE_SCOPE("recordChunk");
+    VkCommandBuffer commandBuffer = acquireSecondary(workerIndex);
+
+    VkCommandBufferInheritanceInfo noInheritance{};
+    noInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (job.inheritance != nullptr) {
+        beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    }
+    beginInfo.pInheritanceInfo = job.inheritance != nullptr ? job.inheritance : &noInheritance;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording secondary command buffer!");
+    }
+
+    uint32_t first = chunk * job.chunkSize;
+    uint32_t count = std::min(job.chunkSize, job.itemCount - first);
+    (*job.recordItems)(commandBuffer, first, count);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record secondary command buffer!");
+    }
+    // every chunk has its own entry, and the main thread only reads them after all workers checked back in
+    job.chunkBuffers[chunk] = commandBuffer;
+}
+
+VkCommandBuffer ParallelRecorder::acquireSecondary(uint32_t workerIndex) {
+    WorkerPools& slot = workers[workerIndex]->slots[currentSlot];
+    if (slot.used == slot.secondaries.size()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = slot.pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate secondary command buffer!");
+        }
+        slot.secondaries.push_back(commandBuffer);
+    }
+    return slot.secondaries[slot.used++];
+}
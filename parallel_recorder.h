@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct RecordStats {
+    uint64_t parallelRecords = 0;
+    uint64_t inlineRecords = 0;
+    uint64_t chunks = 0;
+    uint64_t steals = 0;
+};
+
+class ParallelRecorder {
+    /*
+     * This class records a list of items (draws, dispatches, ...) into secondary command buffers on several threads
+     * and executes them from the primary in item order, so the result does not depend on which thread recorded what.
+     * The list is cut into chunks that are dealt out to per worker deques, a worker that runs dry steals chunks from
+     * the back of the others, which evens out slices that turned out more expensive than the rest.
+     * Every worker (the calling thread is worker 0) owns one command pool per frame in flight, beginFrame() resets the
+     * slot's pools as a whole and their secondaries are reused, nothing is freed one by one
+     */
+public:
+    // first and count select the items of the chunk, the command buffer is already begun
+    using RecordFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count)>;
+
+    void create(VkDevice device, uint32_t queueFamily, uint32_t framesInFlight, uint32_t workerCount);
+    void destroy();
+
+    // call once per frame before record(), after the slot's fence was waited on
+    void beginFrame(uint32_t frameSlot);
+
+    // records itemCount items and appends them to primary, small lists are recorded straight into the primary.
+    // Pass the inheritance info when recording inside a render pass, it is then continued by the secondaries
+    void record(VkCommandBuffer primary, uint32_t itemCount, const RecordFunction& recordItems,
+                const VkCommandBufferInheritanceInfo* inheritance = nullptr);
+
+    uint32_t getWorkerCount() const { return static_cast<uint32_t>(workers.size()); }
+    RecordStats getStats() const { return stats; }
+    void printStats() const;
+
+    // below this many items a list is recorded on the calling thread, the hand off costs more than it saves
+    static constexpr uint32_t MIN_PARALLEL_ITEMS = 512;
+    // chunks per worker, enough for stealing to have something to balance with
+    static constexpr uint32_t CHUNKS_PER_WORKER = 4;
+
+private:
+    struct WorkerPools {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        // grows to the most secondaries this pool ever needed in one frame, then is reused
+        std::vector<VkCommandBuffer> secondaries;
+        uint32_t used = 0;
+    };
+
+    struct Worker {
+        std::vector<WorkerPools> slots;
+        std::mutex dequeMutex;
+        std::deque<uint32_t> chunks;
+        std::thread thread;
+    };
+
+    struct Job {
+        const RecordFunction* recordItems = nullptr;
+        const VkCommandBufferInheritanceInfo* inheritance = nullptr;
+        uint32_t itemCount = 0;
+        uint32_t chunkSize = 0;
+        std::vector<VkCommandBuffer> chunkBuffers;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<std::unique_ptr<Worker>> workers;
+    uint32_t currentSlot = 0;
+    Job job;
+    RecordStats stats;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobDone;
+    uint64_t jobGeneration = 0;
+    uint32_t busyWorkers = 0;
+    bool stopping = false;
+    std::exception_ptr failure;
+    std::atomic<uint64_t> steals{0};
+
+    void workerLoop(uint32_t workerIndex);
+    void runChunks(uint32_t workerIndex);
+    bool takeChunk(uint32_t workerIndex, uint32_t& chunk);
+    void recordChunk(uint32_t workerIndex, uint32_t chunk);
+    VkCommandBuffer acquireSecondary(uint32_t workerIndex);
+};
@@ -0,0 +1,252 @@
+#include "pipeline_cache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+void PipelineCache::create(VkDevice deviceIn, const VkPhysicalDeviceProperties& propertiesIn, const std::string& pathIn,
+                           bool creationFeedbackSupportedIn) {
+    device = deviceIn;
+    properties = propertiesIn;
+    path = pathIn;
+    creationFeedbackSupported = creationFeedbackSupportedIn;
+
+    auto start = std::chrono::steady_clock::now();
+    std::string rejectReason;
+    std::vector<char> initialData = loadInitialData(rejectReason);
+
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = initialData.size();
+    createInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+    VkResult result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+    if (result != VK_SUCCESS && !initialData.empty()) {
+        // the driver did not like the data after all, an empty cache is always fine
+        rejectReason = "driver rejected the data";
+        initialData.clear();
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+
+    loadedBytes = initialData.size();
+    loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Pipeline cache: ";
+    if (loadedBytes > 0) {
+        std::cout << "loaded " << loadedBytes << " bytes from " << path;
+    }
+    else {
+        std::cout << "starting empty (" << rejectReason << ")";
+    }
+    std::cout << " in " << loadMilliseconds << " ms" << std::endl;
+}
+
+void PipelineCache::destroy() {
+    if (cache != VK_NULL_HANDLE) {
+        vkDestroyPipelineCache(device, cache, nullptr);
+        cache = VK_NULL_HANDLE;
+    }
+}
+
+void PipelineCache::save() const {
+    /*
+     * This function writes the cache next to the old file and renames it over, so a crash mid write
+     * leaves the previous cache intact instead of a truncated one
+     */
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+        return;
+    }
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS) {
+        std::cerr << "Pipeline cache: failed to read cache data, not saving" << std::endl;
+        return;
+    }
+    data.resize(dataSize);
+
+    FileHeader header{};
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.dataHash = hashData(data.data(), data.size());
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Pipeline cache: failed to open " << tempPath << " for writing" << std::endl;
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!file) {
+            std::cerr << "Pipeline cache: failed to write " << tempPath << std::endl;
+            return;
+        }
+    }
+    // replaces the old file in one step on POSIX, a crash leaves either the old or the new cache. Windows does
+    // not rename over an existing file, only there is the old one removed first
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0
+        && (std::remove(path.c_str()) != 0 || std::rename(tempPath.c_str(), path.c_str()) != 0)) {
+        std::cerr << "Pipeline cache: failed to move " << tempPath << " to " << path << std::endl;
+        return;
+    }
+    std::cout << "Pipeline cache: saved " << data.size() << " bytes to " << path << std::endl;
+}
+
+VkResult PipelineCache::createGraphicsPipelines(uint32_t count, const VkGraphicsPipelineCreateInfo* createInfos, VkPipeline* pipelines) {
+    if (!creationFeedbackSupported) {
+        return vkCreateGraphicsPipelines(device, cache, count, createInfos, nullptr, pipelines);
+    }
+
+    // chain a feedback struct in front of each create info's own pNext chain
+    std::vector<VkGraphicsPipelineCreateInfo> chainedInfos(createInfos, createInfos + count);
+    std::vector<VkPipelineCreationFeedbackEXT> feedbacks(count);
+    std::vector<VkPipelineCreationFeedbackCreateInfoEXT> feedbackInfos(count);
+    for (uint32_t i = 0; i < count; i++) {
+        feedbackInfos[i].sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedbackInfos[i].pNext = chainedInfos[i].pNext;
+        feedbackInfos[i].pPipelineCreationFeedback = &feedbacks[i];
+        chainedInfos[i].pNext = &feedbackInfos[i];
+    }
+
+    VkResult result = vkCreateGraphicsPipelines(device, cache, count, chainedInfos.data(), nullptr, pipelines);
+    for (const auto& feedback : feedbacks) {
+        recordFeedback(feedback);
+    }
+    return result;
+}
+
+VkResult PipelineCache::createComputePipelines(uint32_t count, const VkComputePipelineCreateInfo* createInfos, VkPipeline* pipelines) {
+    if (!creationFeedbackSupported) {
+        return vkCreateComputePipelines(device, cache, count, createInfos, nullptr, pipelines);
+    }
+
+    std::vector<VkComputePipelineCreateInfo> chainedInfos(createInfos, createInfos + count);
+    std::vector<VkPipelineCreationFeedbackEXT> feedbacks(count);
+    std::vector<VkPipelineCreationFeedbackCreateInfoEXT> feedbackInfos(count);
+    for (uint32_t i = 0; i < count; i++) {
+        feedbackInfos[i].sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedbackInfos[i].pNext = chainedInfos[i].pNext;
+        feedbackInfos[i].pPipelineCreationFeedback = &feedbacks[i];
+        chainedInfos[i].pNext = &feedbackInfos[i];
+    }
+
+    VkResult result = vkCreateComputePipelines(device, cache, count, chainedInfos.data(), nullptr, pipelines);
+    for (const auto& feedback : feedbacks) {
+        recordFeedback(feedback);
+    }
+    return result;
+}
+
+void PipelineCache::printStats() const {
+    uint32_t hits = cacheHits.load();
+    uint32_t total = hits + cacheMisses.load();
+    std::cout << "Pipeline cache: " << hits << "/" << total << " pipeline cache hits";
+    if (total > 0) {
+        std::cout << " (" << (100.0 * hits / total) << "%)";
+    }
+    if (!creationFeedbackSupported) {
+        std::cout << " (hit rate unknown, no VK_EXT_pipeline_creation_feedback)";
+    }
+    std::cout << std::endl;
+}
+
+std::vector<char> PipelineCache::loadInitialData(std::string& rejectReason) const {
+    /*
+     * This function reads the cache file and returns the driver data if everything in our header matches
+     * this device and driver, otherwise it returns nothing and says why
+     */
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        rejectReason = "no cache file";
+        return {};
+    }
+    auto fileSize = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+
+    FileHeader header{};
+    if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        rejectReason = "file too small";
+        return {};
+    }
+    if (header.magic != FILE_MAGIC || header.version != FILE_VERSION) {
+        rejectReason = "not a pipeline cache file";
+        return {};
+    }
+    if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID) {
+        rejectReason = "cache is from another GPU";
+        return {};
+    }
+    if (header.driverVersion != properties.driverVersion
+        || std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        rejectReason = "cache is from another driver version";
+        return {};
+    }
+    if (header.dataSize != fileSize - sizeof(header)) {
+        rejectReason = "file truncated";
+        return {};
+    }
+
+    std::vector<char> data(header.dataSize);
+    if (!file.read(data.data(), static_cast<std::streamsize>(data.size()))
+        || hashData(data.data(), data.size()) != header.dataHash) {
+        rejectReason = "file corrupt";
+        return {};
+    }
+    if (!validateDriverHeader(data)) {
+        rejectReason = "driver cache header does not match";
+        return {};
+    }
+    return data;
+}
+
+bool PipelineCache::validateDriverHeader(const std::vector<char>& data) const {
+    /*
+     * This function checks the VkPipelineCacheHeaderVersionOne the driver put at the start of its own data
+     */
+    VkPipelineCacheHeaderVersionOne driverHeader{};
+    if (data.size() < sizeof(driverHeader)) {
+        return false;
+    }
+    std::memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+    return driverHeader.headerSize >= sizeof(driverHeader)
+           && driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+           && driverHeader.vendorID == properties.vendorID
+           && driverHeader.deviceID == properties.deviceID
+           && std::memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::recordFeedback(const VkPipelineCreationFeedbackEXT& feedback) {
+    if (!(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+        return;
+    }
+    if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+        cacheHits++;
+    }
+    else {
+        cacheMisses++;
+    }
+}
+
+uint64_t PipelineCache::hashData(const char* data, size_t size) {
+    // FNV-1a, only here to catch corrupt files, not tampering
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class PipelineCache {
+    /*
+     * This class wraps the VkPipelineCache that every pipeline is created through. It is loaded from disk on startup
+     * and written back on shutdown, the file is keyed by pipelineCacheUUID, vendor/device ID and driver version,
+     * anything that does not match (a driver update, another GPU, a truncated file) is thrown away and the cache
+     * starts empty instead of being handed to the driver
+     */
+public:
+    void create(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& path, bool creationFeedbackSupported);
+    void destroy();
+    void save() const;
+
+    VkPipelineCache getHandle() const { return cache; }
+
+    // creates graphics pipelines through the cache, and counts cache hits through VK_EXT_pipeline_creation_feedback
+    // if the device has it, callable from several threads at once
+    VkResult createGraphicsPipelines(uint32_t count, const VkGraphicsPipelineCreateInfo* createInfos, VkPipeline* pipelines);
+    VkResult createComputePipelines(uint32_t count, const VkComputePipelineCreateInfo* createInfos, VkPipeline* pipelines);
+
+    void printStats() const;
+
+private:
+    struct FileHeader {
+        /*
+         * This struct goes in front of the driver's cache data in the file, the driver data has its own header
+         * too, but checking ours first means a foreign file is never even passed to vkCreatePipelineCache
+         */
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+
+    static constexpr uint32_t FILE_MAGIC = 0x50434B56; // "VKCP"
+    static constexpr uint32_t FILE_VERSION = 1;
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties{};
+    std::string path;
+    bool creationFeedbackSupported = false;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+
+    size_t loadedBytes = 0;
+    double loadMilliseconds = 0.0;
+    std::atomic<uint32_t> cacheHits{0};
+    std::atomic<uint32_t> cacheMisses{0};
+
+    std::vector<char> loadInitialData(std::string& rejectReason) const;
+    bool validateDriverHeader(const std::vector<char>& data) const;
+    void recordFeedback(const VkPipelineCreationFeedbackEXT& feedback);
+    static uint64_t hashData(const char* data, size_t size);
+};
@@ -0,0 +1,273 @@
+#include "pipeline_compiler.h"
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+PipelineCompiler::PipelineCompiler(VkDevice device, PipelineCache& cache, uint32_t workerCount)
+    : device(device), cache(cache), pool(workerCount) {}
+
+PipelineCompiler::~PipelineCompiler() {
+    pool.waitIdle();
+}
+
+PipelineHandle PipelineCompiler::request(std::string name, PipelineBuildFunction build, PipelinePriority priority,
+                                         std::optional<PipelineHandle> placeholder, std::vector<std::string> shaders) {
+    /*
+     * This function queues a pipeline for compilation and returns its handle right away
+     */
+    auto newEntry = std::make_unique<Entry>();
+    newEntry->name = std::move(name);
+    newEntry->build = std::move(build);
+    newEntry->placeholder = placeholder;
+    newEntry->shaders = std::move(shaders);
+
+    Entry* queued = newEntry.get();
+    PipelineHandle handle;
+    {
+        std::lock_guard<std::mutex> lock(entriesMutex);
+        handle = static_cast<PipelineHandle>(entries.size());
+        entries.push_back(std::move(newEntry));
+    }
+
+    pool.submit(static_cast<int>(priority), [this, queued] { compile(*queued); });
+    return handle;
+}
+
+void PipelineCompiler::prioritize(PipelineHandle handle) {
+    /*
+     * This function queues the pipeline again at critical priority, whichever of the two jobs runs first
+     * compiles it and the other one finds it already taken
+     */
+    Entry& prioritized = entry(handle);
+    if (prioritized.state.load() == State::Pending) {
+        pool.submit(static_cast<int>(PipelinePriority::Critical), [this, &prioritized] { compile(prioritized); });
+    }
+}
+
+VkPipeline PipelineCompiler::get(PipelineHandle handle) const {
+    const Entry& requested = entry(handle);
+    if (requested.state.load() == State::Ready) {
+        return requested.pipeline.load();
+    }
+    if (requested.placeholder.has_value()) {
+        const Entry& placeholder = entry(requested.placeholder.value());
+        if (placeholder.state.load() == State::Ready) {
+            return placeholder.pipeline.load();
+        }
+    }
+    return VK_NULL_HANDLE;
+}
+
+bool PipelineCompiler::isReady(PipelineHandle handle) const {
+    return entry(handle).state.load() == State::Ready;
+}
+
+VkPipeline PipelineCompiler::wait(PipelineHandle handle) {
+    Entry& waited = entry(handle);
+    // compiling it here beats sleeping while it sits in the queue
+    compile(waited);
+
+    std::unique_lock<std::mutex> lock(readyMutex);
+    readyChanged.wait(lock, [&waited] {
+        State state = waited.state.load();
+        return state == State::Ready || state == State::Failed;
+    });
+    if (waited.state.load() == State::Failed) {
+        throw std::runtime_error("failed to create pipeline " + waited.name + "!");
+    }
+    return waited.pipeline.load();
+}
+
+void PipelineCompiler::waitIdle() {
+    pool.waitIdle();
+}
+
+uint32_t PipelineCompiler::rebuildUsing(const std::string& shaderName) {
+    /*
+     * This function queues the rebuilds at normal priority, behind anything critical that is still waiting.
+     * Pipelines that are not ready yet need nothing, their build loads the new module when it runs
+     */
+    std::vector<Entry*> stale;
+    {
+        std::lock_guard<std::mutex> lock(entriesMutex);
+        for (const auto& candidate : entries) {
+            if (candidate->state.load() == State::Ready
+                && std::find(candidate->shaders.begin(), candidate->shaders.end(), shaderName) != candidate->shaders.end()) {
+                stale.push_back(candidate.get());
+            }
+        }
+    }
+    for (Entry* rebuilt : stale) {
+        uint32_t generation = ++rebuilt->generation;
+        pool.submit(static_cast<int>(PipelinePriority::Normal), [this, rebuilt, generation] { rebuild(*rebuilt, generation); });
+    }
+    return static_cast<uint32_t>(stale.size());
+}
+
+void PipelineCompiler::retireShaderModules(const std::vector<VkShaderModule>& modules) {
+    if (modules.empty()) {
+        return;
+    }
+    uint64_t firstSafeBuild;
+    {
+        std::lock_guard<std::mutex> lock(buildsMutex);
+        firstSafeBuild = nextBuild;
+    }
+    std::lock_guard<std::mutex> lock(retiredMutex);
+    for (VkShaderModule module : modules) {
+        retiredModules.push_back({module, firstSafeBuild});
+    }
+}
+
+void PipelineCompiler::releaseRetired(DeletionQueue& deletions) {
+    /*
+     * This function queues the pipelines replaced since the last call for deletion, the queue destroys them once
+     * the frames that may have recorded them are done. A retired shader module goes too once the builds that
+     * were running when it was retired are all done, no frame uses a module so that is all it waits for
+     */
+    uint64_t oldestRunningBuild;
+    {
+        std::lock_guard<std::mutex> lock(buildsMutex);
+        oldestRunningBuild = runningBuilds.empty() ? nextBuild : *runningBuilds.begin();
+    }
+    std::lock_guard<std::mutex> lock(retiredMutex);
+    for (VkPipeline old : retired) {
+        deletions.push<vkDestroyPipeline>(old);
+    }
+    retired.clear();
+    auto released = std::stable_partition(retiredModules.begin(), retiredModules.end(), [oldestRunningBuild](const RetiredModule& retiredModule) {
+        return retiredModule.firstSafeBuild > oldestRunningBuild;
+    });
+    for (auto it = released; it != retiredModules.end(); ++it) {
+        deletions.push<vkDestroyShaderModule>(it->module);
+    }
+    retiredModules.erase(released, retiredModules.end());
+}
+
+void PipelineCompiler::destroyPipelines() {
+    {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        for (VkPipeline old : retired) {
+            vkDestroyPipeline(device, old, nullptr);
+        }
+        retired.clear();
+        for (const RetiredModule& retiredModule : retiredModules) {
+            vkDestroyShaderModule(device, retiredModule.module, nullptr);
+        }
+        retiredModules.clear();
+    }
+    std::lock_guard<std::mutex> lock(entriesMutex);
+    for (auto& destroyed : entries) {
+        VkPipeline pipeline = destroyed->pipeline.exchange(VK_NULL_HANDLE);
+        if (pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device, pipeline, nullptr);
+        }
+    }
+    entries.clear();
+}
+
+void PipelineCompiler::printStats() const {
+    std::lock_guard<std::mutex> lock(entriesMutex);
+    double totalMilliseconds = 0.0;
+    uint32_t failed = 0;
+    for (const auto& compiled : entries) {
+        totalMilliseconds += compiled->compileMilliseconds;
+        if (compiled->state.load() == State::Failed) {
+            failed++;
+        }
+    }
+    std::cout << "Pipeline compiler: " << entries.size() << " pipelines (" << failed << " failed) on "
+              << pool.getWorkerCount() << " threads, " << totalMilliseconds << " ms of compile time";
+    if (rebuildCount.load() > 0) {
+        std::cout << ", " << rebuildCount.load() << " rebuilt after shader reloads";
+    }
+    std::cout << std::endl;
+}
+
+double PipelineCompiler::getCompileMilliseconds() const {
+    std::lock_guard<std::mutex> lock(entriesMutex);
+    double totalMilliseconds = 0.0;
+    for (const auto& compiled : entries) {
+        totalMilliseconds += compiled->compileMilliseconds;
+    }
+    return totalMilliseconds;
+}
+
+PipelineCompiler::Entry& PipelineCompiler::entry(PipelineHandle handle) const {
+    std::lock_guard<std::mutex> lock(entriesMutex);
+    return *entries.at(handle);
+}
+
+void PipelineCompiler::compile(Entry& compiled) {
+    /*
+     * This function builds the pipeline if nobody else has started on it yet
+     */
+    State expected = State::Pending;
+    if (!compiled.state.compare_exchange_strong(expected, State::Compiling)) {
+        return;
+    }
+
+    TRACE_SCOPE("compilePipeline");
+    auto start = std::chrono::steady_clock::now();
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    uint64_t build = beginBuild();
+    try {
+        pipeline = compiled.build(cache);
+    } catch (const std::exception& e) {
+        std::cerr << "Pipeline " << compiled.name << ": " << e.what() << std::endl;
+    }
+    endBuild(build);
+    compiled.compileMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        compiled.pipeline.store(pipeline);
+        compiled.state.store(pipeline != VK_NULL_HANDLE ? State::Ready : State::Failed);
+    }
+    readyChanged.notify_all();
+}
+
+void PipelineCompiler::rebuild(Entry& rebuilt, uint32_t generation) {
+    /*
+     * This function builds a replacement for a ready pipeline and swaps it in, a failed build keeps the old one
+     */
+    if (rebuilt.generation.load() != generation) {
+        return;
+    }
+    TRACE_SCOPE("rebuildPipeline");
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    uint64_t build = beginBuild();
+    try {
+        pipeline = rebuilt.build(cache);
+    } catch (const std::exception& e) {
+        std::cerr << "Pipeline " << rebuilt.name << " (rebuild): " << e.what() << std::endl;
+    }
+    endBuild(build);
+    if (pipeline == VK_NULL_HANDLE) {
+        return;
+    }
+    if (rebuilt.generation.load() != generation) {
+        // a newer shader is already being built into it, this one was never handed out
+        vkDestroyPipeline(device, pipeline, nullptr);
+        return;
+    }
+    VkPipeline old = rebuilt.pipeline.exchange(pipeline);
+    rebuildCount++;
+    std::lock_guard<std::mutex> lock(retiredMutex);
+    retired.push_back(old);
+}
+
+uint64_t PipelineCompiler::beginBuild() {
+    std::lock_guard<std::mutex> lock(buildsMutex);
+    uint64_t build = nextBuild++;
+    runningBuilds.insert(build);
+    return build;
+}
+
+void PipelineCompiler::endBuild(uint64_t build) {
+    std::lock_guard<std::mutex> lock(buildsMutex);
+    runningBuilds.erase(build);
+}
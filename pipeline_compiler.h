@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "deletion_queue.h"
+#include "pipeline_cache.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+enum class PipelinePriority : int {
+    Background = 0,  // permutations that may be needed at some point
+    Normal = 1,
+    Critical = 2     // needed for the first frame
+};
+
+// builds one pipeline through the cache, called on a worker thread, so it must only touch its own captured state
+using PipelineBuildFunction = std::function<VkPipeline(PipelineCache& cache)>;
+
+// index into the compiler's pipeline table, stable for the compiler's lifetime
+using PipelineHandle = uint32_t;
+
+class PipelineCompiler {
+    /*
+     * This class compiles pipelines on a worker pool so startup does not stall on one vkCreate*Pipelines after the
+     * other. The pipeline cache is internally synchronized, so all workers create through the same one.
+     * Until a pipeline is ready, get() hands out its placeholder (a cheap pipeline requested earlier at critical
+     * priority) so the renderer can draw something right away, and prioritize() moves a pipeline that is suddenly
+     * needed to the front of the queue.
+     * rebuildUsing() recompiles every pipeline built from a reloaded shader in the background, get() keeps returning
+     * the old pipeline until the new one is ready, and the old one is destroyed once no frame in flight can use it
+     */
+public:
+    PipelineCompiler(VkDevice device, PipelineCache& cache, uint32_t workerCount);
+    ~PipelineCompiler();
+
+    PipelineCompiler(const PipelineCompiler&) = delete;
+    PipelineCompiler& operator=(const PipelineCompiler&) = delete;
+
+    // shaders names the ShaderLibrary shaders build loads, for rebuildUsing()
+    PipelineHandle request(std::string name, PipelineBuildFunction build, PipelinePriority priority,
+                           std::optional<PipelineHandle> placeholder = std::nullopt, std::vector<std::string> shaders = {});
+    void prioritize(PipelineHandle handle);
+
+    // the pipeline if it is ready, else the placeholder's pipeline if that is ready, else VK_NULL_HANDLE
+    VkPipeline get(PipelineHandle handle) const;
+    bool isReady(PipelineHandle handle) const;
+    // compiles the pipeline on the calling thread if no worker has picked it up yet, then waits for it
+    VkPipeline wait(PipelineHandle handle);
+    void waitIdle();
+
+    // queues a rebuild of every ready pipeline whose shaders include shaderName, returns how many
+    uint32_t rebuildUsing(const std::string& shaderName);
+    // takes over the shader modules reloads replaced (ShaderLibrary::takeRetired()), releaseRetired() destroys each
+    // once every build that was running when it came in has finished, one of them may have loaded it
+    void retireShaderModules(const std::vector<VkShaderModule>& modules);
+    // once a frame on the main thread, hands the pipelines replaced by rebuilds and the shader modules no build
+    // can still use to the frames' deletion queue
+    void releaseRetired(DeletionQueue& deletions);
+
+    // destroys every compiled pipeline, the compiler has to be idle
+    void destroyPipelines();
+
+    uint32_t getWorkerCount() const { return pool.getWorkerCount(); }
+    // the compile time of every pipeline so far, call it while idle
+    void printStats() const;
+    double getCompileMilliseconds() const;
+
+private:
+    enum class State : int { Pending, Compiling, Ready, Failed };
+
+    struct Entry {
+        std::string name;
+        PipelineBuildFunction build;
+        std::optional<PipelineHandle> placeholder;
+        std::vector<std::string> shaders;
+        std::atomic<State> state{State::Pending};
+        std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+        double compileMilliseconds = 0.0;
+        // bumped by every rebuild, a rebuild that finishes after a newer one was queued is thrown away
+        std::atomic<uint32_t> generation{0};
+    };
+
+    VkDevice device;
+    PipelineCache& cache;
+    // entries are never removed, the unique_ptrs keep their addresses stable while the vector grows
+    mutable std::mutex entriesMutex;
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::mutex readyMutex;
+    std::condition_variable readyChanged;
+    struct RetiredModule {
+        VkShaderModule module;
+        // the first build that cannot have loaded it
+        uint64_t firstSafeBuild;
+    };
+
+    std::mutex retiredMutex;
+    // replaced by a rebuild on a worker, frames recorded before the swap may still use them
+    std::vector<VkPipeline> retired;
+    std::vector<RetiredModule> retiredModules;
+    // every compile and rebuild gets a number when it starts, the running ones are kept to know the oldest
+    std::mutex buildsMutex;
+    std::set<uint64_t> runningBuilds;
+    uint64_t nextBuild = 0;
+    std::atomic<uint32_t> rebuildCount{0};
+    ThreadPool pool;
+
+    Entry& entry(PipelineHandle handle) const;
+    void compile(Entry& entry);
+    void rebuild(Entry& entry, uint32_t generation);
+    uint64_t beginBuild();
+    void endBuild(uint64_t build);
+};
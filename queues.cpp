@@ -0,0 +1,202 @@
+#include "queues.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+DeviceQueuePlan::DeviceQueuePlan(const QueueFamilyIndices& indices, const std::vector<VkQueueFamilyProperties>& familyProperties) {
+    auto queueCount = [&](uint32_t family) { return familyProperties[family].queueCount; };
+    auto timestampBits = [&](uint32_t family) { return familyProperties[family].timestampValidBits; };
+
+    uint32_t graphicsFamily = indices.graphicsFamily.value();
+    roles.graphics = addQueue(graphicsFamily, 1.0f, queueCount(graphicsFamily), timestampBits(graphicsFamily));
+
+    // present almost always lives in the graphics family, then it simply uses the graphics queue
+    uint32_t presentFamily = indices.presentFamily.value_or(graphicsFamily);
+    roles.present = presentFamily == graphicsFamily ? roles.graphics
+                                                    : addQueue(presentFamily, 1.0f, queueCount(presentFamily), timestampBits(presentFamily));
+
+    // without a dedicated family, compute and transfer go through the graphics queue
+    uint32_t computeFamily = indices.computeFamily.value();
+    roles.compute = computeFamily == graphicsFamily ? roles.graphics
+                                                    : addQueue(computeFamily, 0.75f, queueCount(computeFamily), timestampBits(computeFamily));
+
+    uint32_t transferFamily = indices.transferFamily.value();
+    roles.transfer = transferFamily == graphicsFamily ? roles.graphics
+                                                      : addQueue(transferFamily, 0.5f, queueCount(transferFamily), timestampBits(transferFamily));
+
+    for (const auto& [family, familyPriorities] : priorities) {
+        VkDeviceQueueCreateInfo queueCreateInfo{};
+        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfo.queueFamilyIndex = family;
+        queueCreateInfo.queueCount = static_cast<uint32_t>(familyPriorities.size());
+        queueCreateInfo.pQueuePriorities = familyPriorities.data();
+        createInfos.push_back(queueCreateInfo);
+    }
+}
+
+QueueRef DeviceQueuePlan::addQueue(uint32_t family, float priority, uint32_t familyQueueCount, uint32_t timestampBits) {
+    /*
+     * This function reserves a new queue in the family, or shares the last one if the family has no queues left
+     */
+    std::vector<float>& familyPriorities = priorities[family];
+    QueueRef ref;
+    ref.family = family;
+    ref.timestampValidBits = timestampBits;
+    if (familyPriorities.size() < familyQueueCount) {
+        ref.index = static_cast<uint32_t>(familyPriorities.size());
+        familyPriorities.push_back(priority);
+    }
+    else {
+        ref.index = static_cast<uint32_t>(familyPriorities.size() - 1);
+        familyPriorities.back() = std::max(familyPriorities.back(), priority);
+    }
+    return ref;
+}
+
+DeviceQueues DeviceQueuePlan::getQueues(VkDevice device) const {
+    DeviceQueues queues = roles;
+    for (QueueRef* ref : {&queues.graphics, &queues.present, &queues.compute, &queues.transfer}) {
+        vkGetDeviceQueue(device, ref->family, ref->index, &ref->queue);
+    }
+    return queues;
+}
+
+static VkBufferMemoryBarrier makeBufferBarrier(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                                               uint32_t srcFamily, uint32_t dstFamily,
+                                               VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    return barrier;
+}
+
+static VkImageMemoryBarrier makeImageBarrier(VkImage image, const VkImageSubresourceRange& range,
+                                             VkImageLayout oldLayout, VkImageLayout newLayout,
+                                             uint32_t srcFamily, uint32_t dstFamily,
+                                             VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+    return barrier;
+}
+
+void QueueOwnershipTransfer::releaseBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                                           VkPipelineStageFlags srcStage, VkAccessFlags srcAccess) const {
+    if (!isNeeded()) {
+        return;
+    }
+    // the dst access mask is ignored for a release, visibility is done by the acquire
+    VkBufferMemoryBarrier barrier = makeBufferBarrier(buffer, offset, size, srcFamily, dstFamily, srcAccess, 0);
+    vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void QueueOwnershipTransfer::acquireBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                                           VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const {
+    if (!isNeeded()) {
+        return;
+    }
+    // the src access mask is ignored for an acquire, availability was done by the release
+    VkBufferMemoryBarrier barrier = makeBufferBarrier(buffer, offset, size, srcFamily, dstFamily, 0, dstAccess);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void QueueOwnershipTransfer::releaseImage(VkCommandBuffer commandBuffer, VkImage image, const VkImageSubresourceRange& range,
+                                          VkImageLayout oldLayout, VkImageLayout newLayout,
+                                          VkPipelineStageFlags srcStage, VkAccessFlags srcAccess) const {
+    if (!isNeeded()) {
+        return;
+    }
+    VkImageMemoryBarrier barrier = makeImageBarrier(image, range, oldLayout, newLayout, srcFamily, dstFamily, srcAccess, 0);
+    vkCmdPipelineBarrier(commandBuffer, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void QueueOwnershipTransfer::acquireImage(VkCommandBuffer commandBuffer, VkImage image, const VkImageSubresourceRange& range,
+                                          VkImageLayout oldLayout, VkImageLayout newLayout,
+                                          VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const {
+    if (!isNeeded()) {
+        // same family, only the layout transition is left, chained to the stage the semaphore wait blocks
+        if (oldLayout != newLayout) {
+            VkImageMemoryBarrier barrier = makeImageBarrier(image, range, oldLayout, newLayout,
+                                                            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, 0, dstAccess);
+            vkCmdPipelineBarrier(commandBuffer, dstStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+        return;
+    }
+    VkImageMemoryBarrier barrier = makeImageBarrier(image, range, oldLayout, newLayout, srcFamily, dstFamily, 0, dstAccess);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+QueueSubmission& QueueSubmission::execute(VkCommandBuffer commandBuffer) {
+    commandBuffers.push_back(commandBuffer);
+    return *this;
+}
+
+QueueSubmission& QueueSubmission::waitFor(VkSemaphore semaphore, VkPipelineStageFlags stage, uint64_t timelineValue) {
+    waitSemaphores.push_back(semaphore);
+    waitStages.push_back(stage);
+    waitValues.push_back(timelineValue);
+    return *this;
+}
+
+QueueSubmission& QueueSubmission::signal(VkSemaphore semaphore, uint64_t timelineValue) {
+    signalSemaphores.push_back(semaphore);
+    signalValues.push_back(timelineValue);
+    return *this;
+}
+
+void QueueSubmission::clear() {
+    commandBuffers.clear();
+    waitSemaphores.clear();
+    waitStages.clear();
+    waitValues.clear();
+    signalSemaphores.clear();
+    signalValues.clear();
+}
+
+void QueueSubmission::submit(VkQueue queue, VkFence fence) const {
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+    submitInfo.pCommandBuffers = commandBuffers.data();
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+    // the values of binary semaphores are ignored, so one array for both kinds is fine
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
+    bool hasTimelineValues = std::any_of(waitValues.begin(), waitValues.end(), [](uint64_t value) { return value != 0; })
+                             || std::any_of(signalValues.begin(), signalValues.end(), [](uint64_t value) { return value != 0; });
+    if (hasTimelineValues) {
+        submitInfo.pNext = &timelineInfo;
+    }
+
+    VkResult result = vkQueueSubmit(queue, 1, &submitInfo, fence);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit to queue! Error code: " + std::to_string(result));
+    }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <optional>
+#include <vector>
+
+struct QueueFamilyIndices {
+    /*
+     * This struct is used to store the queue families that are supported by the device.
+     * The compute and transfer families prefer dedicated families (no graphics bit) so that work on them can
+     * overlap with graphics, and fall back to the graphics family on devices that have none
+     */
+    std::optional<uint32_t> graphicsFamily;
+    std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> computeFamily;
+    std::optional<uint32_t> transferFamily;
+    // present is only needed when there is a surface to present to
+    bool presentRequired = false;
+    // timestampValidBits of the picked families, 0 means timestamps can not be written on that queue
+    uint32_t graphicsTimestampBits = 0;
+    uint32_t computeTimestampBits = 0;
+    uint32_t transferTimestampBits = 0;
+
+    bool isComplete() const {
+        /*
+         * This function checks if the queue families are complete
+         */
+        return graphicsFamily.has_value() && computeFamily.has_value() && transferFamily.has_value()
+               && (presentFamily.has_value() || !presentRequired);
+    }
+
+    bool hasDedicatedCompute() const {
+        return computeFamily.has_value() && computeFamily != graphicsFamily;
+    }
+
+    bool hasDedicatedTransfer() const {
+        return transferFamily.has_value() && transferFamily != graphicsFamily && transferFamily != computeFamily;
+    }
+};
+
+struct QueueRef {
+    /*
+     * This struct is a queue handle together with the family and index it was created from,
+     * the family is what ownership transfers are expressed in
+     */
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t family = 0;
+    uint32_t index = 0;
+    uint32_t timestampValidBits = 0;
+};
+
+struct DeviceQueues {
+    /*
+     * This struct holds the queues of the logical device, roles without a dedicated family share the graphics queue
+     */
+    QueueRef graphics;
+    QueueRef present;
+    QueueRef compute;
+    QueueRef transfer;
+};
+
+class DeviceQueuePlan {
+    /*
+     * This class works out the VkDeviceQueueCreateInfos for createLogicalDevice() and where each queue role ends up,
+     * graphics gets the highest priority, then compute, then transfer
+     */
+public:
+    DeviceQueuePlan(const QueueFamilyIndices& indices, const std::vector<VkQueueFamilyProperties>& familyProperties);
+    DeviceQueuePlan(const DeviceQueuePlan&) = delete;
+    DeviceQueuePlan& operator=(const DeviceQueuePlan&) = delete;
+
+    // the create infos point into this object, so it has to outlive vkCreateDevice
+    const std::vector<VkDeviceQueueCreateInfo>& getCreateInfos() const { return createInfos; }
+    // fills the queue handles once the device exists
+    DeviceQueues getQueues(VkDevice device) const;
+
+private:
+    std::map<uint32_t, std::vector<float>> priorities;
+    std::vector<VkDeviceQueueCreateInfo> createInfos;
+    DeviceQueues roles;
+
+    QueueRef addQueue(uint32_t family, float priority, uint32_t familyQueueCount, uint32_t timestampBits);
+};
+
+class QueueOwnershipTransfer {
+    /*
+     * This class records the release/acquire barrier pair that moves a resource with VK_SHARING_MODE_EXCLUSIVE from
+     * one queue family to another. The release goes into a command buffer on the source queue, the acquire into one
+     * on the destination queue, and the acquire submit has to wait on a semaphore signalled by the release submit.
+     * When both families are the same no ownership transfer is needed and only the acquire side records a barrier
+     * (for layout transitions), since the semaphore already orders the memory accesses
+     */
+public:
+    QueueOwnershipTransfer(uint32_t srcFamily, uint32_t dstFamily) : srcFamily(srcFamily), dstFamily(dstFamily) {}
+
+    bool isNeeded() const { return srcFamily != dstFamily; }
+
+    void releaseBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                       VkPipelineStageFlags srcStage, VkAccessFlags srcAccess) const;
+    void acquireBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                       VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const;
+
+    // the layouts have to be the same on both sides, the transition happens once between release and acquire
+    void releaseImage(VkCommandBuffer commandBuffer, VkImage image, const VkImageSubresourceRange& range,
+                      VkImageLayout oldLayout, VkImageLayout newLayout,
+                      VkPipelineStageFlags srcStage, VkAccessFlags srcAccess) const;
+    void acquireImage(VkCommandBuffer commandBuffer, VkImage image, const VkImageSubresourceRange& range,
+                      VkImageLayout oldLayout, VkImageLayout newLayout,
+                      VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) const;
+
+private:
+    uint32_t srcFamily;
+    uint32_t dstFamily;
+};
+
+struct QueueSubmission {
+    /*
+     * This struct collects one vkQueueSubmit, with the semaphores that hand work from one queue to the next.
+     * Timeline semaphores take the value to wait for / signal, binary semaphores leave it at 0
+     */
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues;
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<uint64_t> signalValues;
+
+    QueueSubmission& execute(VkCommandBuffer commandBuffer);
+    QueueSubmission& waitFor(VkSemaphore semaphore, VkPipelineStageFlags stage, uint64_t timelineValue = 0);
+    QueueSubmission& signal(VkSemaphore semaphore, uint64_t timelineValue = 0);
+    void submit(VkQueue queue, VkFence fence = VK_NULL_HANDLE) const;
+    // empties it for the next submit, the vectors keep their capacity
+    void clear();
+};
@@ -0,0 +1,309 @@
+#include "regression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <tuple>
+
+namespace {
+
+class JsonReader {
+    /*
+     * This class reads the small subset of JSON the baselines are written in: objects, strings and numbers,
+     * anything else is skipped over. It works on the whole text, baselines are a few hundred bytes
+     */
+public:
+    explicit JsonReader(std::string text) : text(std::move(text)) {}
+
+    // calls member for every key, member has to read or skip the value, false on malformed input
+    bool readObject(const std::function<bool(const std::string& key)>& member) {
+        if (!consume('{')) {
+            return false;
+        }
+        if (consume('}')) {
+            return true;
+        }
+        do {
+            std::optional<std::string> key = readString();
+            if (!key.has_value() || !consume(':') || !member(key.value())) {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}');
+    }
+
+    std::optional<std::string> readString() {
+        if (!consume('"')) {
+            return std::nullopt;
+        }
+        std::string value;
+        while (position < text.size() && text[position] != '"') {
+            if (text[position] == '\\' && position + 1 < text.size()) {
+                position++;
+            }
+            value += text[position++];
+        }
+        if (position >= text.size()) {
+            return std::nullopt;
+        }
+        position++;
+        return value;
+    }
+
+    std::optional<double> readNumber() {
+        skipWhitespace();
+        const char* start = text.c_str() + position;
+        char* end = nullptr;
+        double value = std::strtod(start, &end);
+        if (end == start) {
+            return std::nullopt;
+        }
+        position += static_cast<size_t>(end - start);
+        return value;
+    }
+
+    bool skipValue() {
+        skipWhitespace();
+        if (position >= text.size()) {
+            return false;
+        }
+        char c = text[position];
+        if (c == '{') {
+            return readObject([this](const std::string&) { return skipValue(); });
+        }
+        if (c == '"') {
+            return readString().has_value();
+        }
+        if (c == '[') {
+            position++;
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                if (!skipValue()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(']');
+        }
+        for (const char* literal : {"true", "false", "null"}) {
+            if (text.compare(position, std::strlen(literal), literal) == 0) {
+                position += std::strlen(literal);
+                return true;
+            }
+        }
+        return readNumber().has_value();
+    }
+
+private:
+    std::string text;
+    size_t position = 0;
+
+    void skipWhitespace() {
+        while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+            position++;
+        }
+    }
+
+    bool consume(char c) {
+        skipWhitespace();
+        if (position < text.size() && text[position] == c) {
+            position++;
+            return true;
+        }
+        return false;
+    }
+};
+
+bool readMetric(JsonReader& reader, double& value) {
+    std::optional<double> number = reader.readNumber();
+    if (!number.has_value()) {
+        return false;
+    }
+    value = number.value();
+    return true;
+}
+
+// the limit a metric may reach before it counts as a regression
+double limitFor(double baseline, double fraction, double slack) {
+    return baseline + std::max(baseline * fraction, slack);
+}
+
+}
+
+std::vector<RegressionCase> regressionSuite() {
+    return {
+        {"idle", BenchScene::Clear, PipelineCacheStart::Default},
+        {"many-small-draws", BenchScene::ManyItems, PipelineCacheStart::Default},
+        {"upload-streaming", BenchScene::Upload, PipelineCacheStart::Default},
+        {"pipeline-cache-cold", BenchScene::GpuDriven, PipelineCacheStart::Cold},
+        {"pipeline-cache-warm", BenchScene::GpuDriven, PipelineCacheStart::Warm},
+    };
+}
+
+RegressionMetrics RegressionMetrics::fromRunStats(const RunStats& stats) {
+    RegressionMetrics metrics;
+    metrics.frameP99Milliseconds = percentile(stats.frameMilliseconds, 99.0);
+    metrics.startupMilliseconds = stats.startupMilliseconds();
+    metrics.pipelineCompileMilliseconds = stats.pipelineCompileMilliseconds;
+    metrics.reservedBytes = static_cast<double>(stats.memory.reservedBytes);
+    return metrics;
+}
+
+std::string baselineFileName(uint32_t vendorID, uint32_t deviceID, uint32_t driverVersion) {
+    std::ostringstream name;
+    name << std::hex << std::setfill('0') << std::setw(4) << vendorID << "-" << std::setw(4) << deviceID << "-"
+         << std::setw(8) << driverVersion << ".json";
+    return name.str();
+}
+
+void writeBaseline(std::ostream& out, const GpuBaseline& baseline) {
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"device\": {\"name\": \"" << jsonEscape(baseline.deviceName) << "\", \"vendorID\": " << baseline.vendorID
+        << ", \"deviceID\": " << baseline.deviceID << ", \"driverVersion\": " << baseline.driverVersion << "},\n";
+    out << "  \"cases\": {";
+    bool first = true;
+    for (const auto& [name, metrics] : baseline.cases) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "    \"" << jsonEscape(name) << "\": {\"frameP99Ms\": " << metrics.frameP99Milliseconds
+            << ", \"startupMs\": " << metrics.startupMilliseconds
+            << ", \"pipelineCompileMs\": " << metrics.pipelineCompileMilliseconds
+            << ", \"reservedBytes\": " << std::setprecision(0) << metrics.reservedBytes << std::setprecision(3) << "}";
+    }
+    out << "\n  }\n}\n";
+    out.flags(flags);
+}
+
+std::optional<GpuBaseline> readBaseline(std::istream& in) {
+    /*
+     * This function reads the device and the cases, metrics it does not know (from a newer writer) are skipped
+     * and ones it misses stay 0
+     */
+    std::string text{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    JsonReader reader(std::move(text));
+    GpuBaseline baseline;
+    bool valid = reader.readObject([&](const std::string& key) {
+        if (key == "device") {
+            return reader.readObject([&](const std::string& field) {
+                if (field == "name") {
+                    std::optional<std::string> name = reader.readString();
+                    baseline.deviceName = name.value_or("");
+                    return name.has_value();
+                }
+                double value = 0.0;
+                if (field != "vendorID" && field != "deviceID" && field != "driverVersion") {
+                    return reader.skipValue();
+                }
+                if (!readMetric(reader, value)) {
+                    return false;
+                }
+                uint32_t& target = field == "vendorID" ? baseline.vendorID : field == "deviceID" ? baseline.deviceID : baseline.driverVersion;
+                target = static_cast<uint32_t>(value);
+                return true;
+            });
+        }
+        if (key == "cases") {
+            return reader.readObject([&](const std::string& name) {
+                RegressionMetrics& metrics = baseline.cases[name];
+                return reader.readObject([&](const std::string& metric) {
+                    if (metric == "frameP99Ms") return readMetric(reader, metrics.frameP99Milliseconds);
+                    if (metric == "startupMs") return readMetric(reader, metrics.startupMilliseconds);
+                    if (metric == "pipelineCompileMs") return readMetric(reader, metrics.pipelineCompileMilliseconds);
+                    if (metric == "reservedBytes") return readMetric(reader, metrics.reservedBytes);
+                    return reader.skipValue();
+                });
+            });
+        }
+        return reader.skipValue();
+    });
+    if (!valid) {
+        return std::nullopt;
+    }
+    return baseline;
+}
+
+std::vector<RegressionFailure> compareToBaseline(const GpuBaseline& baseline, const GpuBaseline& current,
+                                                 const RegressionThresholds& thresholds) {
+    /*
+     * This function checks the frame p99, startup and pipeline compile times and the reserved device memory.
+     * Only getting worse fails, a case that got faster is left for --update-baselines to pick up. A case that
+     * did not run at all (it failed, or the suite lost it) is a failure too, a crash must not pass the gate. One
+     * the run skipped as unsupported is not, a build without shaders still gates its other cases against the
+     * baseline a full build wrote for the same GPU
+     */
+    std::vector<RegressionFailure> failures;
+    for (const auto& [name, metrics] : baseline.cases) {
+        if (current.cases.count(name) == 0 && current.skippedCases.count(name) == 0) {
+            failures.push_back({name, "missing", 0.0, 0.0, 0.0});
+        }
+    }
+    for (const auto& [name, metrics] : current.cases) {
+        auto found = baseline.cases.find(name);
+        if (found == baseline.cases.end()) {
+            continue;
+        }
+        const RegressionMetrics& base = found->second;
+        auto check = [&](const char* metric, double baseValue, double currentValue, double limit) {
+            if (currentValue > limit) {
+                failures.push_back({name, metric, baseValue, currentValue, limit});
+            }
+        };
+        double slack = thresholds.minimumSlackMilliseconds;
+        check("frameP99Ms", base.frameP99Milliseconds, metrics.frameP99Milliseconds,
+              limitFor(base.frameP99Milliseconds, thresholds.frameP99, slack));
+        check("startupMs", base.startupMilliseconds, metrics.startupMilliseconds,
+              limitFor(base.startupMilliseconds, thresholds.startup, slack));
+        check("pipelineCompileMs", base.pipelineCompileMilliseconds, metrics.pipelineCompileMilliseconds,
+              limitFor(base.pipelineCompileMilliseconds, thresholds.pipelineCompile, slack));
+        check("reservedBytes", base.reservedBytes, metrics.reservedBytes,
+              limitFor(base.reservedBytes, thresholds.memory, 0.0));
+    }
+    return failures;
+}
+
+void printRegressionReport(std::ostream& out, const GpuBaseline& baseline, const GpuBaseline& current,
+                           const std::vector<RegressionFailure>& failures) {
+    std::ios::fmtflags flags = out.flags();
+    out << "Regression suite on " << current.deviceName << " (" << baselineFileName(current.vendorID, current.deviceID, current.driverVersion)
+        << "):" << std::endl;
+    for (const auto& [name, metrics] : baseline.cases) {
+        if (current.cases.count(name) == 0 && current.skippedCases.count(name) == 0) {
+            out << "  " << name << ": missing from this run  REGRESSION" << std::endl;
+        }
+    }
+    for (const std::string& name : current.skippedCases) {
+        out << "  " << name << ": skipped, not supported" << std::endl;
+    }
+    for (const auto& [name, metrics] : current.cases) {
+        auto found = baseline.cases.find(name);
+        if (found == baseline.cases.end()) {
+            out << "  " << name << ": no baseline" << std::endl;
+            continue;
+        }
+        out << "  " << name << ":" << std::endl;
+        const RegressionMetrics& base = found->second;
+        for (auto [metric, baseValue, currentValue] : {std::tuple{"frameP99Ms", base.frameP99Milliseconds, metrics.frameP99Milliseconds},
+                                                       std::tuple{"startupMs", base.startupMilliseconds, metrics.startupMilliseconds},
+                                                       std::tuple{"pipelineCompileMs", base.pipelineCompileMilliseconds, metrics.pipelineCompileMilliseconds},
+                                                       std::tuple{"reservedBytes", base.reservedBytes, metrics.reservedBytes}}) {
+            bool failed = false;
+            for (const RegressionFailure& failure : failures) {
+                failed = failed || (failure.caseName == name && failure.metric == metric);
+            }
+            double change = baseValue > 0.0 ? (currentValue - baseValue) / baseValue * 100.0 : 0.0;
+            out << "    " << std::left << std::setw(18) << metric << std::right << std::fixed << std::setprecision(3)
+                << std::setw(16) << baseValue << " -> " << std::setw(16) << currentValue
+                << std::showpos << std::setprecision(1) << std::setw(8) << change << "%" << std::noshowpos
+                << (failed ? "  REGRESSION" : "") << std::endl;
+        }
+    }
+    out.flags(flags);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "benchmark.h"
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+enum class PipelineCacheStart {
+    Default,    // whatever cache file the run would use anyway
+    Cold,       // the suite's cache file is deleted first, every pipeline is compiled from scratch
+    Warm        // the file the cold run saved, pipelines come out of the driver cache
+};
+
+struct RegressionCase {
+    /*
+     * This struct is one fixed run of the regression suite, the name is what its baseline is stored under
+     */
+    const char* name;
+    BenchScene scene;
+    PipelineCacheStart cacheStart;
+};
+
+// idle loop, many small draws, heavy upload streaming, and the pipeline cache cold then warm, in that order
+std::vector<RegressionCase> regressionSuite();
+
+struct RegressionMetrics {
+    /*
+     * This struct is what the suite compares against the baseline for one case
+     */
+    double frameP99Milliseconds = 0.0;
+    double startupMilliseconds = 0.0;
+    double pipelineCompileMilliseconds = 0.0;
+    double reservedBytes = 0.0;
+
+    static RegressionMetrics fromRunStats(const RunStats& stats);
+};
+
+struct RegressionThresholds {
+    /*
+     * This struct is how much worse than the baseline a case may get, as a fraction of the baseline. Timings
+     * also get an absolute slack, a 0.2 ms p99 is all noise at 20%
+     */
+    double frameP99 = 0.15;
+    double startup = 0.20;
+    // the summed compile time of all pipelines, what a cold or broken pipeline cache shows up in
+    double pipelineCompile = 0.20;
+    double memory = 0.10;
+    double minimumSlackMilliseconds = 0.5;
+};
+
+struct GpuBaseline {
+    /*
+     * This struct is the stored results of one GPU, driver updates change the numbers so the driver is part of the key
+     */
+    std::string deviceName;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    uint32_t driverVersion = 0;
+    std::map<std::string, RegressionMetrics> cases;
+    // the cases a run skipped because the device or the build does not support them, never written to a baseline
+    std::set<std::string> skippedCases;
+};
+
+// <vendorID>-<deviceID>-<driverVersion>.json in hex, one file per GPU and driver
+std::string baselineFileName(uint32_t vendorID, uint32_t deviceID, uint32_t driverVersion);
+
+void writeBaseline(std::ostream& out, const GpuBaseline& baseline);
+// reads what writeBaseline wrote, nullopt if it is not a baseline
+std::optional<GpuBaseline> readBaseline(std::istream& in);
+
+struct RegressionFailure {
+    // metric is "missing" for a case the baseline has and the run does not, the values are 0 then
+    std::string caseName;
+    std::string metric;
+    double baseline;
+    double current;
+    double limit;
+};
+
+// every metric of every case that is past its threshold and every case of the baseline the run is missing,
+// cases the baseline does not have are not compared and neither are the ones the run skipped as unsupported
+std::vector<RegressionFailure> compareToBaseline(const GpuBaseline& baseline, const GpuBaseline& current,
+                                                 const RegressionThresholds& thresholds);
+// one line per case and metric with the baseline, the current value and the change, failures marked
+void printRegressionReport(std::ostream& out, const GpuBaseline& baseline, const GpuBaseline& current,
+                           const std::vector<RegressionFailure>& failures);
@@ -0,0 +1,554 @@
+#include "render_graph.h"
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bool overlaps(uint32_t firstA, uint32_t lastA, uint32_t firstB, uint32_t lastB) {
+    return firstA <= lastB && firstB <= lastA;
+}
+
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(RenderGraphResource resource, const ResourceState& state) {
+    graph.passes[pass].uses.push_back({resource, state, false});
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(RenderGraphResource resource, const ResourceState& state) {
+    graph.passes[pass].uses.push_back({resource, state, true});
+    return *this;
+}
+
+void RenderGraph::create(DeviceMemoryAllocator& allocatorIn, bool synchronization2) {
+    allocator = &allocatorIn;
+    device = allocatorIn.getDevice();
+    cmdPipelineBarrier2 = nullptr;
+    if (synchronization2) {
+        cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR"));
+    }
+}
+
+void RenderGraph::destroy() {
+    reset();
+    allocator = nullptr;
+}
+
+void RenderGraph::reset() {
+    for (Resource& resource : resources) {
+        if (!resource.imported && resource.image != VK_NULL_HANDLE) {
+            vkDestroyImageView(device, resource.view, nullptr);
+            vkDestroyImage(device, resource.image, nullptr);
+        }
+    }
+    for (const GpuAllocation& memory : transientMemory) {
+        allocator->free(memory);
+    }
+    transientMemory.clear();
+    resources.clear();
+    passes.clear();
+    order.clear();
+    transientBytes = 0;
+    unaliasedBytes = 0;
+    compiled = false;
+}
+
+RenderGraphResource RenderGraph::importImage(const std::string& name, VkImage image, VkImageAspectFlags aspect, uint32_t mipLevels,
+                                             const ResourceState& initial, std::optional<ResourceState> final) {
+    Resource resource;
+    resource.name = name;
+    resource.imported = true;
+    resource.isImage = true;
+    resource.image = image;
+    resource.aspect = aspect;
+    resource.mipLevels = mipLevels;
+    resource.final = final;
+    resources.push_back(resource);
+    RenderGraphResource handle = static_cast<RenderGraphResource>(resources.size() - 1);
+    resetState(handle, initial);
+    return handle;
+}
+
+RenderGraphResource RenderGraph::importBuffer(const std::string& name, VkBuffer buffer, const ResourceState& initial) {
+    Resource resource;
+    resource.name = name;
+    resource.imported = true;
+    resource.buffer = buffer;
+    resources.push_back(resource);
+    RenderGraphResource handle = static_cast<RenderGraphResource>(resources.size() - 1);
+    resetState(handle, initial);
+    return handle;
+}
+
+RenderGraphResource RenderGraph::createImage(const std::string& name, const TransientImageDesc& desc) {
+    Resource resource;
+    resource.name = name;
+    resource.isImage = true;
+    resource.aspect = desc.aspect;
+    resource.mipLevels = desc.mipLevels;
+    resource.desc = desc;
+    resources.push_back(resource);
+    return static_cast<RenderGraphResource>(resources.size() - 1);
+}
+
+void RenderGraph::setImportedImage(RenderGraphResource resource, VkImage image) {
+    resources.at(resource).image = image;
+}
+
+void RenderGraph::resetState(RenderGraphResource resource, const ResourceState& state) {
+    // whatever put it into this state was a write the first use has to wait for
+    Tracking& tracking = resources.at(resource).tracking;
+    tracking = Tracking{};
+    tracking.layout = state.layout;
+    tracking.writeStages = state.stages;
+    tracking.writeAccess = state.access;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const std::string& name, std::function<void(VkCommandBuffer commandBuffer)> record) {
+    passes.push_back({name, std::move(record), {}});
+    return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+void RenderGraph::compile() {
+    /*
+     * This function merges the uses of one resource within a pass, orders and culls the passes, and creates
+     * the transient images with their (shared) memory
+     */
+    for (Pass& pass : passes) {
+        std::vector<Use> merged;
+        for (const Use& use : pass.uses) {
+            auto same = std::find_if(merged.begin(), merged.end(), [&use](const Use& other) { return other.resource == use.resource; });
+            if (same == merged.end()) {
+                merged.push_back(use);
+                continue;
+            }
+            if (resources[use.resource].isImage && same->state.layout != use.state.layout) {
+                throw std::runtime_error("render graph pass " + pass.name + " uses " + resources[use.resource].name + " in two layouts!");
+            }
+            same->state.stages |= use.state.stages;
+            same->state.access |= use.state.access;
+            same->write = same->write || use.write;
+        }
+        pass.uses = std::move(merged);
+    }
+
+    cullPasses();
+    sortPasses();
+    allocateTransients();
+    compiled = true;
+}
+
+void RenderGraph::cullPasses() {
+    /*
+     * This function keeps the passes that write an imported resource, and then every pass that writes something
+     * a kept pass reads, in declaration order that is everything it could depend on
+     */
+    std::vector<bool> kept(passes.size(), false);
+    std::vector<uint32_t> pending;
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        for (const Use& use : passes[i].uses) {
+            if (use.write && resources[use.resource].imported) {
+                kept[i] = true;
+            }
+        }
+        if (kept[i]) {
+            pending.push_back(i);
+        }
+    }
+    while (!pending.empty()) {
+        uint32_t reader = pending.back();
+        pending.pop_back();
+        for (const Use& use : passes[reader].uses) {
+            for (uint32_t writer = 0; writer < reader; writer++) {
+                if (kept[writer]) {
+                    continue;
+                }
+                for (const Use& written : passes[writer].uses) {
+                    if (written.write && written.resource == use.resource) {
+                        kept[writer] = true;
+                        pending.push_back(writer);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    order.clear();
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (kept[i]) {
+            order.push_back(i);
+        }
+    }
+}
+
+void RenderGraph::sortPasses() {
+    /*
+     * This function orders the kept passes topologically. A pass depends on the last earlier writer of everything
+     * it uses, and a write also on the earlier readers since that writer. Of the passes that are ready, the one whose
+     * last dependency was scheduled longest ago goes next, which puts independent work between a producer and
+     * its consumer instead of having the consumer wait right behind it
+     */
+    std::vector<std::vector<uint32_t>> dependencies(passes.size());
+    std::vector<std::optional<uint32_t>> lastWriter(resources.size());
+    std::vector<std::vector<uint32_t>> readersSinceWrite(resources.size());
+    for (uint32_t pass : order) {
+        for (const Use& use : passes[pass].uses) {
+            if (lastWriter[use.resource].has_value()) {
+                dependencies[pass].push_back(lastWriter[use.resource].value());
+            }
+            if (use.write) {
+                for (uint32_t reader : readersSinceWrite[use.resource]) {
+                    if (reader != pass) {
+                        dependencies[pass].push_back(reader);
+                    }
+                }
+                readersSinceWrite[use.resource].clear();
+                lastWriter[use.resource] = pass;
+            }
+            else {
+                readersSinceWrite[use.resource].push_back(pass);
+            }
+        }
+    }
+
+    std::vector<int64_t> position(passes.size(), -1);
+    std::vector<uint32_t> sorted;
+    std::vector<uint32_t> remaining = order;
+    while (!remaining.empty()) {
+        auto best = remaining.end();
+        int64_t bestReadyAt = 0;
+        for (auto it = remaining.begin(); it != remaining.end(); ++it) {
+            int64_t readyAt = -1;
+            bool ready = true;
+            for (uint32_t dependency : dependencies[*it]) {
+                if (position[dependency] < 0) {
+                    ready = false;
+                    break;
+                }
+                readyAt = std::max(readyAt, position[dependency]);
+            }
+            // remaining is in declaration order, so ties go to the pass declared first
+            if (ready && (best == remaining.end() || readyAt < bestReadyAt)) {
+                best = it;
+                bestReadyAt = readyAt;
+            }
+        }
+        if (best == remaining.end()) {
+            throw std::runtime_error("render graph has a dependency cycle!");
+        }
+        position[*best] = static_cast<int64_t>(sorted.size());
+        sorted.push_back(*best);
+        remaining.erase(best);
+    }
+    order = std::move(sorted);
+}
+
+void RenderGraph::allocateTransients() {
+    /*
+     * This function places the transient images in as few bytes as it can. Largest first, each goes to the lowest
+     * offset that does not overlap an image alive at the same time, images whose memory types do not mix go to
+     * a separate allocation. Every frame a transient first waits for everything that shares its bytes, the
+     * images before it in this frame and the last ones of the previous frame
+     */
+    std::vector<RenderGraphResource> transients;
+    for (uint32_t position = 0; position < order.size(); position++) {
+        for (const Use& use : passes[order[position]].uses) {
+            Resource& resource = resources[use.resource];
+            if (!resource.imported) {
+                resource.firstUse = std::min(resource.firstUse, position);
+                resource.lastUse = std::max(resource.lastUse, position);
+            }
+        }
+    }
+    for (RenderGraphResource i = 0; i < resources.size(); i++) {
+        if (!resources[i].imported && resources[i].firstUse != UINT32_MAX) {
+            transients.push_back(i);
+        }
+    }
+
+    std::vector<VkMemoryRequirements> requirements(resources.size());
+    for (RenderGraphResource i : transients) {
+        Resource& resource = resources[i];
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = resource.desc.format;
+        imageInfo.extent = {resource.desc.extent.width, resource.desc.extent.height, 1};
+        imageInfo.mipLevels = resource.desc.mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = resource.desc.usage;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (vkCreateImage(device, &imageInfo, nullptr, &resource.image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create render graph image " + resource.name + "!");
+        }
+        vkGetImageMemoryRequirements(device, resource.image, &requirements[i]);
+        unaliasedBytes += requirements[i].size;
+    }
+
+    struct MemoryGroup {
+        uint32_t typeBits = ~0u;
+        VkDeviceSize alignment = 1;
+        VkDeviceSize size = 0;
+        std::vector<RenderGraphResource> members;
+    };
+    std::vector<MemoryGroup> groups;
+    std::vector<RenderGraphResource> bySize = transients;
+    std::stable_sort(bySize.begin(), bySize.end(), [&requirements](RenderGraphResource a, RenderGraphResource b) {
+        return requirements[a].size > requirements[b].size;
+    });
+    for (RenderGraphResource i : bySize) {
+        Resource& resource = resources[i];
+        const VkMemoryRequirements& required = requirements[i];
+        auto group = std::find_if(groups.begin(), groups.end(), [&required](const MemoryGroup& candidate) {
+            return (candidate.typeBits & required.memoryTypeBits) != 0;
+        });
+        if (group == groups.end()) {
+            groups.emplace_back();
+            group = groups.end() - 1;
+        }
+
+        std::vector<VkDeviceSize> candidates = {0};
+        for (RenderGraphResource member : group->members) {
+            const Resource& placed = resources[member];
+            if (overlaps(resource.firstUse, resource.lastUse, placed.firstUse, placed.lastUse)) {
+                candidates.push_back(alignUp(placed.memoryOffset + placed.memorySize, required.alignment));
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        for (VkDeviceSize offset : candidates) {
+            bool free = std::none_of(group->members.begin(), group->members.end(), [&](RenderGraphResource member) {
+                const Resource& placed = resources[member];
+                return overlaps(resource.firstUse, resource.lastUse, placed.firstUse, placed.lastUse)
+                       && offset < placed.memoryOffset + placed.memorySize && placed.memoryOffset < offset + required.size;
+            });
+            if (free) {
+                resource.memoryOffset = offset;
+                break;
+            }
+        }
+        resource.memoryGroup = static_cast<uint32_t>(group - groups.begin());
+        resource.memorySize = required.size;
+        group->typeBits &= required.memoryTypeBits;
+        group->alignment = std::max(group->alignment, required.alignment);
+        group->size = std::max(group->size, resource.memoryOffset + required.size);
+        group->members.push_back(i);
+    }
+
+    for (const MemoryGroup& group : groups) {
+        VkMemoryRequirements groupRequirements{group.size, group.alignment, group.typeBits};
+        GpuAllocation memory = allocator->allocate(groupRequirements, MemoryUsage::GpuOnly, false);
+        transientMemory.push_back(memory);
+        transientBytes += group.size;
+
+        for (RenderGraphResource i : group.members) {
+            Resource& resource = resources[i];
+            if (vkBindImageMemory(device, resource.image, memory.memory, memory.offset + resource.memoryOffset) != VK_SUCCESS) {
+                throw std::runtime_error("failed to bind render graph image " + resource.name + "!");
+            }
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = resource.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = resource.desc.format;
+            viewInfo.subresourceRange.aspectMask = resource.desc.aspect;
+            viewInfo.subresourceRange.levelCount = resource.desc.mipLevels;
+            viewInfo.subresourceRange.layerCount = 1;
+            if (vkCreateImageView(device, &viewInfo, nullptr, &resource.view) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create render graph image view " + resource.name + "!");
+            }
+
+            // everything on the same bytes, this image included, may still be in use by the previous frame
+            for (RenderGraphResource other : group.members) {
+                const Resource& sharing = resources[other];
+                if (resource.memoryOffset < sharing.memoryOffset + sharing.memorySize
+                    && sharing.memoryOffset < resource.memoryOffset + resource.memorySize) {
+                    for (uint32_t pass : order) {
+                        for (const Use& use : passes[pass].uses) {
+                            if (use.resource == other) {
+                                resource.frameStart.writeStages |= use.state.stages;
+                                resource.frameStart.writeAccess |= use.write ? use.state.access : VK_ACCESS_2_NONE;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, FrameArena& arena) {
+    /*
+     * This function records the passes in the compiled order, each after one batched barrier for everything it
+     * uses. A layout change is an image barrier, any other hazard goes into the single global memory barrier
+     */
+    if (!compiled) {
+        throw std::runtime_error("render graph executed before it was compiled!");
+    }
+    TRACE_SCOPE("RenderGraph::execute");
+    barrierCalls = 0;
+    imageBarriers = 0;
+    for (Resource& resource : resources) {
+        if (!resource.imported) {
+            resource.tracking = resource.frameStart;
+        }
+    }
+
+    auto access = [this](const Use& use, VkMemoryBarrier2& memoryBarrier, ArenaVector<VkImageMemoryBarrier2>& images) {
+        Resource& resource = resources[use.resource];
+        Tracking& tracking = resource.tracking;
+        bool transition = resource.isImage && tracking.layout != use.state.layout;
+        if (transition) {
+            VkImageMemoryBarrier2 barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+            barrier.srcStageMask = tracking.writeStages | tracking.readStages;
+            barrier.srcAccessMask = tracking.writeAccess;
+            barrier.dstStageMask = use.state.stages;
+            barrier.dstAccessMask = use.state.access;
+            barrier.oldLayout = tracking.layout;
+            barrier.newLayout = use.state.layout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = resource.image;
+            barrier.subresourceRange.aspectMask = resource.aspect;
+            barrier.subresourceRange.levelCount = resource.mipLevels;
+            barrier.subresourceRange.layerCount = 1;
+            images.push_back(barrier);
+        }
+        else if (use.write) {
+            // after the last write and after every read since, the write itself needs no visibility
+            if ((tracking.writeStages | tracking.readStages) != VK_PIPELINE_STAGE_2_NONE) {
+                memoryBarrier.srcStageMask |= tracking.writeStages | tracking.readStages;
+                memoryBarrier.srcAccessMask |= tracking.writeAccess;
+                memoryBarrier.dstStageMask |= use.state.stages;
+                memoryBarrier.dstAccessMask |= use.state.access;
+            }
+        }
+        else {
+            bool visible = (use.state.stages & ~tracking.visibleStages) == 0 && (use.state.access & ~tracking.visibleAccess) == 0;
+            if (tracking.writeStages != VK_PIPELINE_STAGE_2_NONE && !visible) {
+                memoryBarrier.srcStageMask |= tracking.writeStages;
+                memoryBarrier.srcAccessMask |= tracking.writeAccess;
+                memoryBarrier.dstStageMask |= use.state.stages;
+                memoryBarrier.dstAccessMask |= use.state.access;
+                tracking.visibleStages |= use.state.stages;
+                tracking.visibleAccess |= use.state.access;
+            }
+            tracking.readStages |= use.state.stages;
+            return;
+        }
+
+        // a transition is a write as far as later accesses are concerned
+        tracking.layout = use.state.layout;
+        tracking.writeStages = use.state.stages;
+        tracking.writeAccess = use.write ? use.state.access : VK_ACCESS_2_NONE;
+        tracking.readStages = use.write ? VK_PIPELINE_STAGE_2_NONE : use.state.stages;
+        tracking.visibleStages = use.state.stages;
+        tracking.visibleAccess = use.state.access;
+    };
+
+    // a pass has at most one use per resource after compile() merged them, so this never grows
+    ArenaVector<VkImageMemoryBarrier2> images = makeArenaVector<VkImageMemoryBarrier2>(arena, resources.size());
+    for (uint32_t pass : order) {
+        VkMemoryBarrier2 memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+        images.clear();
+        for (const Use& use : passes[pass].uses) {
+            access(use, memoryBarrier, images);
+        }
+        flushBarriers(commandBuffer, memoryBarrier, images, arena);
+        passes[pass].record(commandBuffer);
+    }
+
+    // what comes after the graph is taken as a write, it waits for everything
+    VkMemoryBarrier2 memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    images.clear();
+    for (RenderGraphResource i = 0; i < resources.size(); i++) {
+        if (resources[i].final.has_value()) {
+            access({i, resources[i].final.value(), true}, memoryBarrier, images);
+        }
+    }
+    flushBarriers(commandBuffer, memoryBarrier, images, arena);
+}
+
+void RenderGraph::flushBarriers(VkCommandBuffer commandBuffer, const VkMemoryBarrier2& memoryBarrier,
+                                const ArenaVector<VkImageMemoryBarrier2>& images, FrameArena& arena) {
+    bool hasMemoryBarrier = memoryBarrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE;
+    if (!hasMemoryBarrier && images.empty()) {
+        return;
+    }
+    barrierCalls++;
+    imageBarriers += static_cast<uint32_t>(images.size());
+
+    if (cmdPipelineBarrier2 != nullptr) {
+        VkDependencyInfo dependency{};
+        dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependency.memoryBarrierCount = hasMemoryBarrier ? 1 : 0;
+        dependency.pMemoryBarriers = &memoryBarrier;
+        dependency.imageMemoryBarrierCount = static_cast<uint32_t>(images.size());
+        dependency.pImageMemoryBarriers = images.data();
+        cmdPipelineBarrier2(commandBuffer, &dependency);
+        return;
+    }
+
+    // the same barriers through the original API, every bit used has the same value in both, NONE is TOP / BOTTOM
+    VkPipelineStageFlags srcStages = static_cast<VkPipelineStageFlags>(memoryBarrier.srcStageMask);
+    VkPipelineStageFlags dstStages = static_cast<VkPipelineStageFlags>(memoryBarrier.dstStageMask);
+    VkMemoryBarrier legacyMemory{};
+    legacyMemory.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    legacyMemory.srcAccessMask = static_cast<VkAccessFlags>(memoryBarrier.srcAccessMask);
+    legacyMemory.dstAccessMask = static_cast<VkAccessFlags>(memoryBarrier.dstAccessMask);
+    ArenaVector<VkImageMemoryBarrier> legacyImages = makeArenaVector<VkImageMemoryBarrier>(arena, images.size());
+    legacyImages.resize(images.size());
+    for (size_t i = 0; i < images.size(); i++) {
+        srcStages |= static_cast<VkPipelineStageFlags>(images[i].srcStageMask);
+        dstStages |= static_cast<VkPipelineStageFlags>(images[i].dstStageMask);
+        legacyImages[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        legacyImages[i].srcAccessMask = static_cast<VkAccessFlags>(images[i].srcAccessMask);
+        legacyImages[i].dstAccessMask = static_cast<VkAccessFlags>(images[i].dstAccessMask);
+        legacyImages[i].oldLayout = images[i].oldLayout;
+        legacyImages[i].newLayout = images[i].newLayout;
+        legacyImages[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        legacyImages[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        legacyImages[i].image = images[i].image;
+        legacyImages[i].subresourceRange = images[i].subresourceRange;
+    }
+    if (srcStages == 0) {
+        srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    }
+    if (dstStages == 0) {
+        dstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    }
+    vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, hasMemoryBarrier ? 1 : 0, &legacyMemory, 0, nullptr,
+                         static_cast<uint32_t>(legacyImages.size()), legacyImages.data());
+}
+
+VkImage RenderGraph::getImage(RenderGraphResource resource) const {
+    return resources.at(resource).image;
+}
+
+VkImageView RenderGraph::getImageView(RenderGraphResource resource) const {
+    return resources.at(resource).view;
+}
+
+void RenderGraph::printStats() const {
+    std::cout << "Render graph:";
+    for (uint32_t pass : order) {
+        std::cout << " " << passes[pass].name;
+    }
+    std::cout << " (" << passes.size() - order.size() << " culled), " << barrierCalls << " barrier batches with "
+              << imageBarriers << " image barriers a frame, " << (cmdPipelineBarrier2 != nullptr ? "synchronization2" : "legacy barriers")
+              << ", transient memory " << transientBytes / 1024 << " KiB (" << unaliasedBytes / 1024 << " KiB unaliased)" << std::endl;
+}
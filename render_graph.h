@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "frame_arena.h"
+#include "gpu_allocator.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// index into the graph's resource table, stable until reset()
+using RenderGraphResource = uint32_t;
+
+struct ResourceState {
+    /*
+     * This struct is how a pass touches a resource. Only stage and access bits that also exist in the original
+     * synchronization API may be used, so the barriers still work without synchronization2
+     */
+    VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access = VK_ACCESS_2_NONE;
+    // images only
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+struct TransientImageDesc {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+    VkImageUsageFlags usage = 0;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    uint32_t mipLevels = 1;
+};
+
+class RenderGraph {
+    /*
+     * This class records a frame as passes that declare what they read and write, instead of passes that place
+     * their own barriers. compile() orders the passes by their dependencies, drops passes nothing depends on, and
+     * gives the transient images (those only used inside a frame) memory, letting images whose lifetimes do not
+     * overlap share the same range. execute() puts every barrier a pass needs into one vkCmdPipelineBarrier2 in
+     * front of it, image layout transitions and buffer hazards alike, and emits nothing where a previous barrier
+     * already made the data visible.
+     * Imported resources live outside the graph, their state carries over from one execute() to the next unless
+     * they are given a final state. Barriers inside a pass (between the mips of a reduction, say) stay the pass's job.
+     * The graph is built once and executed every frame, reset() and a new build follow a resize
+     */
+public:
+    class PassBuilder {
+    public:
+        PassBuilder& read(RenderGraphResource resource, const ResourceState& state);
+        PassBuilder& write(RenderGraphResource resource, const ResourceState& state);
+
+    private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+        RenderGraph& graph;
+        uint32_t pass;
+    };
+
+    // without synchronization2 the barriers go through vkCmdPipelineBarrier, with the same batching
+    void create(DeviceMemoryAllocator& allocator, bool synchronization2);
+    // the device has to be idle
+    void destroy();
+    // drops every pass and resource and frees the transient images, the device has to be idle
+    void reset();
+
+    // initial is the state the resource is in before the first execute(), with a final state every execute()
+    // ends by moving it there and the next one starts from it again
+    RenderGraphResource importImage(const std::string& name, VkImage image, VkImageAspectFlags aspect, uint32_t mipLevels,
+                                    const ResourceState& initial, std::optional<ResourceState> final = std::nullopt);
+    RenderGraphResource importBuffer(const std::string& name, VkBuffer buffer, const ResourceState& initial);
+    // created by compile(), its contents do not survive from one pass that writes it to the next frame
+    RenderGraphResource createImage(const std::string& name, const TransientImageDesc& desc);
+    // switches an imported image between executes, for the swap chain image of the frame
+    void setImportedImage(RenderGraphResource resource, VkImage image);
+    // forgets what an imported resource went through, e.g. after it was recreated
+    void resetState(RenderGraphResource resource, const ResourceState& state);
+
+    PassBuilder addPass(const std::string& name, std::function<void(VkCommandBuffer commandBuffer)> record);
+
+    void compile();
+    // the barrier lists are built in the frame's arena
+    void execute(VkCommandBuffer commandBuffer, FrameArena& arena);
+
+    VkImage getImage(RenderGraphResource resource) const;
+    // transient images only, over all of their mips
+    VkImageView getImageView(RenderGraphResource resource) const;
+    // the order compile() picked, the culled passes and the transient memory with and without aliasing
+    void printStats() const;
+
+private:
+    struct Use {
+        RenderGraphResource resource;
+        ResourceState state;
+        bool write;
+    };
+
+    struct Pass {
+        std::string name;
+        std::function<void(VkCommandBuffer)> record;
+        std::vector<Use> uses;
+    };
+
+    struct Tracking {
+        /*
+         * This struct is what the graph knows about a resource between accesses
+         */
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+        // the stages that read since the last write, a write has to wait for them
+        VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE;
+        // the stages and accesses the last write was made visible to, reads covered by them need no barrier
+        VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 visibleAccess = VK_ACCESS_2_NONE;
+    };
+
+    struct Resource {
+        std::string name;
+        bool imported = false;
+        bool isImage = false;
+        VkImage image = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkImageAspectFlags aspect = 0;
+        uint32_t mipLevels = 1;
+        std::optional<ResourceState> final;
+        Tracking tracking;
+
+        // transient images
+        TransientImageDesc desc;
+        VkImageView view = VK_NULL_HANDLE;
+        // the state every frame starts in, waiting on everything that shares its memory
+        Tracking frameStart;
+        uint32_t memoryGroup = 0;
+        VkDeviceSize memoryOffset = 0;
+        VkDeviceSize memorySize = 0;
+        uint32_t firstUse = UINT32_MAX;
+        uint32_t lastUse = 0;
+    };
+
+    DeviceMemoryAllocator* allocator = nullptr;
+    VkDevice device = VK_NULL_HANDLE;
+    PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    // compiled, indices into passes
+    std::vector<uint32_t> order;
+    std::vector<GpuAllocation> transientMemory;
+    VkDeviceSize transientBytes = 0;
+    VkDeviceSize unaliasedBytes = 0;
+    bool compiled = false;
+
+    // of the last execute()
+    uint32_t barrierCalls = 0;
+    uint32_t imageBarriers = 0;
+
+    void sortPasses();
+    void cullPasses();
+    void allocateTransients();
+    void flushBarriers(VkCommandBuffer commandBuffer, const VkMemoryBarrier2& memoryBarrier,
+                       const ArenaVector<VkImageMemoryBarrier2>& images, FrameArena& arena);
+};
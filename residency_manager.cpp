@@ -0,0 +1,134 @@
+#include "residency_manager.h"
+
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+void ResidencyManager::create(DeviceMemoryAllocator& allocatorIn, AssetStreamer& streamerIn, const ResidencyConfig& configIn) {
+    allocator = &allocatorIn;
+    streamer = &streamerIn;
+    config = configIn;
+    nextPoll = 0;
+    peakPressure = 0.0;
+    pressurePolls = 0;
+}
+
+void ResidencyManager::destroy() {
+    allocator = nullptr;
+    streamer = nullptr;
+}
+
+void ResidencyManager::update(uint64_t frameNumber) {
+    /*
+     * This function compares the fullest device local heap against the watermarks. While mip changes are still
+     * in flight it waits, until the old images are freed the usage still has them and the same excess would be
+     * shed twice
+     */
+    if (!isCreated() || frameNumber < nextPoll) {
+        return;
+    }
+    nextPoll = frameNumber + config.pollInterval;
+    if (streamer->getPendingMipChanges() > 0) {
+        return;
+    }
+    TRACE_SCOPE("ResidencyManager::update");
+
+    double pressure = 0.0;
+    VkDeviceSize usage = 0;
+    VkDeviceSize budget = 0;
+    for (const HeapBudget& heap : allocator->getHeapBudgets()) {
+        VkDeviceSize heapBudget = config.budgetCap > 0 ? std::min(heap.budget, config.budgetCap) : heap.budget;
+        if (!heap.deviceLocal || heapBudget == 0) {
+            continue;
+        }
+        // what is actually in use, a freed mip only comes back as free space inside a block
+        VkDeviceSize heapUsage = heap.usage - std::min(heap.usage, heap.unusedBytes);
+        double heapPressure = static_cast<double>(heapUsage) / static_cast<double>(heapBudget);
+        if (heapPressure > pressure) {
+            pressure = heapPressure;
+            usage = heapUsage;
+            budget = heapBudget;
+        }
+    }
+    peakPressure = std::max(peakPressure, pressure);
+
+    VkDeviceSize target = static_cast<VkDeviceSize>(static_cast<double>(budget) * config.lowWatermark);
+    if (pressure > config.highWatermark) {
+        pressurePolls++;
+        streamer->setLoadMipBias(1);
+        shed(usage - target, budget > usage ? budget - usage : 0);
+    }
+    else if (pressure < config.lowWatermark) {
+        streamer->setLoadMipBias(0);
+        restore(target - usage);
+    }
+}
+
+void ResidencyManager::printStats() const {
+    if (!isCreated()) {
+        return;
+    }
+    std::ios_base::fmtflags flags = std::cout.flags();
+    std::cout << "Residency: peak " << std::fixed << std::setprecision(1) << peakPressure * 100.0
+              << "% of the device local budget, over the high watermark at " << pressurePolls << " polls" << std::endl;
+    std::cout.flags(flags);
+}
+
+void ResidencyManager::shed(VkDeviceSize excess, VkDeviceSize headroom) {
+    /*
+     * This function drops one mip per texture, smallest on screen first, until the freed size covers the excess.
+     * What is left over is shed at the next poll, one mip at a time keeps the change gradual. A smaller texture
+     * is built before the old one can go, so the replacements of one poll have to fit in the headroom left
+     * under the budget, except for the first one, or nothing would ever be shed on a full heap
+     */
+    std::vector<TextureResidency> textures = streamer->getTextureResidency();
+    std::stable_sort(textures.begin(), textures.end(), [](const TextureResidency& a, const TextureResidency& b) {
+        return a.priority < b.priority;
+    });
+    VkDeviceSize freed = 0;
+    VkDeviceSize replacements = 0;
+    for (const TextureResidency& texture : textures) {
+        if (freed >= excess) {
+            break;
+        }
+        if (texture.changing || texture.firstMip + 1 >= texture.mipSizes.size()) {
+            continue;
+        }
+        VkDeviceSize replacement = 0;
+        for (size_t mip = texture.firstMip + 1; mip < texture.mipSizes.size(); mip++) {
+            replacement += texture.mipSizes[mip];
+        }
+        if (replacements > 0 && replacements + replacement > headroom) {
+            continue;
+        }
+        if (streamer->setFirstMip(texture.id, texture.firstMip + 1)) {
+            freed += texture.mipSizes[texture.firstMip];
+            replacements += replacement;
+        }
+    }
+}
+
+void ResidencyManager::restore(VkDeviceSize headroom) {
+    /*
+     * This function gives one mip back per texture, largest on screen first, as long as the headroom covers it.
+     * A mip that does not fit is skipped, a smaller one further down may still
+     */
+    std::vector<TextureResidency> textures = streamer->getTextureResidency();
+    std::stable_sort(textures.begin(), textures.end(), [](const TextureResidency& a, const TextureResidency& b) {
+        return a.priority > b.priority;
+    });
+    for (const TextureResidency& texture : textures) {
+        if (texture.changing || texture.firstMip == 0) {
+            continue;
+        }
+        VkDeviceSize cost = texture.mipSizes[texture.firstMip - 1];
+        if (cost > headroom) {
+            continue;
+        }
+        if (streamer->setFirstMip(texture.id, texture.firstMip - 1)) {
+            headroom -= cost;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "asset_streamer.h"
+#include "gpu_allocator.h"
+
+#include <cstdint>
+
+struct ResidencyConfig {
+    /*
+     * This struct is when the residency manager trades texture detail for memory, as shares of the device local
+     * budget. Between the two watermarks nothing changes, so one mip more or less does not flip back and forth
+     */
+    // above this the least important textures lose their top mip
+    double highWatermark = 0.9;
+    // below this the most important ones get it back, as long as that stays below it too
+    double lowWatermark = 0.75;
+    // frames between two looks at the budget, a change takes a few frames to show in the usage anyway
+    uint32_t pollInterval = 30;
+    // 0 takes the driver's budget, else the budget is capped at this, to try the manager on a large GPU
+    VkDeviceSize budgetCap = 0;
+};
+
+class ResidencyManager {
+    /*
+     * This class keeps the streamed textures inside the device local memory budget. Under pressure it drops the
+     * top mip of the textures with the smallest screen size, which frees about three quarters of each of them,
+     * and makes new textures load without it. With headroom back it restores mips to the textures with the
+     * largest screen size first. A texture is never dropped completely, its bindless index is in materials, so
+     * its last mip is the floor.
+     * The budget comes from VK_EXT_memory_budget where the device has it, which includes what other processes
+     * use, else from the allocator's own count against a fixed share of the heap. Either way the free space
+     * inside the allocator's blocks is taken off the usage, the blocks stay allocated when textures shrink
+     */
+public:
+    void create(DeviceMemoryAllocator& allocator, AssetStreamer& streamer, const ResidencyConfig& config);
+    void destroy();
+
+    // once a frame on the main thread, after the streamer's poll()
+    void update(uint64_t frameNumber);
+
+    bool isCreated() const { return streamer != nullptr; }
+    void printStats() const;
+
+private:
+    DeviceMemoryAllocator* allocator = nullptr;
+    AssetStreamer* streamer = nullptr;
+    ResidencyConfig config;
+    uint64_t nextPoll = 0;
+    double peakPressure = 0.0;
+    // polls that found the budget above the high watermark, the mips that changed are in the streamer's stats
+    uint32_t pressurePolls = 0;
+
+    void shed(VkDeviceSize excess, VkDeviceSize headroom);
+    void restore(VkDeviceSize headroom);
+};
@@ -0,0 +1,209 @@
+#include "scene_storage.h"
+
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+void SceneStorage::create(uint32_t capacityIn) {
+    /*
+     * This function reserves every array for capacity objects, so adding never reallocates and pointers
+     * handed out by the getters stay put as long as nothing is removed
+     */
+    capacity = capacityIn;
+    slots.reserve(capacity);
+    freeSlots.reserve(capacity);
+    positions.reserve(capacity);
+    rotations.reserve(capacity);
+    scales.reserve(capacity);
+    localBounds.reserve(capacity);
+    denseToSlot.reserve(capacity);
+    worldMatrices.reserve(capacity);
+    worldBounds.reserve(capacity);
+    materials.reserve(capacity);
+    dirtyChunks.assign((capacity + DIRTY_CHUNK_SIZE - 1) / DIRTY_CHUNK_SIZE, 0);
+    anyDirty = false;
+}
+
+void SceneStorage::destroy() {
+    *this = SceneStorage{};
+}
+
+SceneHandle SceneStorage::add(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale,
+                              const glm::vec4& objectBounds, uint32_t material) {
+    if (getCount() == capacity) {
+        throw std::runtime_error("scene storage is full!");
+    }
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else {
+        slot = static_cast<uint32_t>(slots.size());
+        slots.emplace_back();
+    }
+    uint32_t dense = getCount();
+    slots[slot].dense = dense;
+
+    positions.emplace_back(position, 1.0f);
+    rotations.push_back(rotation);
+    scales.emplace_back(scale, 0.0f);
+    localBounds.push_back(objectBounds);
+    denseToSlot.push_back(slot);
+    // filled in by updateWorld()
+    worldMatrices.emplace_back(1.0f);
+    worldBounds.emplace_back(0.0f);
+    materials.push_back(material);
+    markDirty(dense);
+    return {slot, slots[slot].generation};
+}
+
+void SceneStorage::remove(SceneHandle handle) {
+    /*
+     * This function moves the last object into the hole, which only dirties the chunk of the hole, the
+     * GPU arrays shrink along with the count
+     */
+    uint32_t dense = denseIndex(handle);
+    uint32_t last = getCount() - 1;
+    if (dense != last) {
+        positions[dense] = positions[last];
+        rotations[dense] = rotations[last];
+        scales[dense] = scales[last];
+        localBounds[dense] = localBounds[last];
+        worldMatrices[dense] = worldMatrices[last];
+        worldBounds[dense] = worldBounds[last];
+        materials[dense] = materials[last];
+        denseToSlot[dense] = denseToSlot[last];
+        slots[denseToSlot[dense]].dense = dense;
+        markDirty(dense);
+    }
+    positions.pop_back();
+    rotations.pop_back();
+    scales.pop_back();
+    localBounds.pop_back();
+    worldMatrices.pop_back();
+    worldBounds.pop_back();
+    materials.pop_back();
+    denseToSlot.pop_back();
+
+    slots[handle.slot].generation++;
+    freeSlots.push_back(handle.slot);
+}
+
+bool SceneStorage::isAlive(SceneHandle handle) const {
+    return handle.slot < slots.size() && slots[handle.slot].generation == handle.generation;
+}
+
+void SceneStorage::setTransform(SceneHandle handle, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+    uint32_t dense = denseIndex(handle);
+    positions[dense] = glm::vec4(position, 1.0f);
+    rotations[dense] = rotation;
+    scales[dense] = glm::vec4(scale, 0.0f);
+    markDirty(dense);
+}
+
+void SceneStorage::setMaterial(SceneHandle handle, uint32_t material) {
+    uint32_t dense = denseIndex(handle);
+    materials[dense] = material;
+    markDirty(dense);
+}
+
+void SceneStorage::updateWorld(ThreadPool& pool) {
+    /*
+     * This function hands the dirty ranges to the pool in pieces of a few chunks, the pieces write disjoint
+     * parts of the world arrays so they need no locking
+     */
+    TRACE_SCOPE("SceneStorage::updateWorld");
+    if (!anyDirty) {
+        return;
+    }
+    const uint32_t piece = 16 * DIRTY_CHUNK_SIZE;
+    std::vector<SceneRange> pieces;
+    for (const SceneRange& range : getDirtyRanges()) {
+        for (uint32_t first = range.first; first < range.first + range.count; first += piece) {
+            pieces.push_back({first, std::min(piece, range.first + range.count - first)});
+        }
+    }
+    pool.parallelFor(static_cast<uint32_t>(pieces.size()), 1, [this, &pieces](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++) {
+            updateRange(pieces[i].first, pieces[i].count);
+        }
+    });
+}
+
+std::vector<SceneRange> SceneStorage::getDirtyRanges() const {
+    std::vector<SceneRange> ranges;
+    if (!anyDirty) {
+        return ranges;
+    }
+    uint32_t count = getCount();
+    uint32_t chunkCount = (count + DIRTY_CHUNK_SIZE - 1) / DIRTY_CHUNK_SIZE;
+    for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+        if (dirtyChunks[chunk] == 0) {
+            continue;
+        }
+        uint32_t first = chunk * DIRTY_CHUNK_SIZE;
+        uint32_t end = std::min(first + DIRTY_CHUNK_SIZE, count);
+        if (!ranges.empty() && ranges.back().first + ranges.back().count == first) {
+            ranges.back().count = end - ranges.back().first;
+        }
+        else {
+            ranges.push_back({first, end - first});
+        }
+    }
+    return ranges;
+}
+
+UploadTicket SceneStorage::upload(StagingUploader& uploader, const SceneGpuBuffers& buffers) {
+    /*
+     * This function copies every dirty range of the three GPU facing arrays, one copy per range and array
+     */
+    UploadTicket ticket;
+    for (const SceneRange& range : getDirtyRanges()) {
+        ticket = uploader.uploadBuffer(buffers.worldMatrices, buffers.worldMatricesAllocation, range.first * sizeof(glm::mat4),
+                                       &worldMatrices[range.first], range.count * sizeof(glm::mat4));
+        ticket = uploader.uploadBuffer(buffers.worldBounds, buffers.worldBoundsAllocation, range.first * sizeof(glm::vec4),
+                                       &worldBounds[range.first], range.count * sizeof(glm::vec4));
+        ticket = uploader.uploadBuffer(buffers.materials, buffers.materialsAllocation, range.first * sizeof(uint32_t),
+                                       &materials[range.first], range.count * sizeof(uint32_t));
+    }
+    std::fill(dirtyChunks.begin(), dirtyChunks.end(), 0);
+    anyDirty = false;
+    return ticket;
+}
+
+uint32_t SceneStorage::denseIndex(SceneHandle handle) const {
+    if (!isAlive(handle)) {
+        throw std::runtime_error("scene handle refers to a destroyed object!");
+    }
+    return slots[handle.slot].dense;
+}
+
+void SceneStorage::markDirty(uint32_t dense) {
+    dirtyChunks[dense / DIRTY_CHUNK_SIZE] = 1;
+    anyDirty = true;
+}
+
+void SceneStorage::updateRange(uint32_t first, uint32_t count) {
+    /*
+     * This function builds world = translate * rotate * scale column by column, every column is one vec4
+     * multiply, and moves the bounding sphere along: the center through the matrix, the radius by the
+     * largest scale
+     */
+    for (uint32_t i = first; i < first + count; i++) {
+        glm::mat3 rotation = glm::mat3_cast(rotations[i]);
+        const glm::vec4& scale = scales[i];
+        glm::mat4& world = worldMatrices[i];
+        world[0] = glm::vec4(rotation[0], 0.0f) * scale.x;
+        world[1] = glm::vec4(rotation[1], 0.0f) * scale.y;
+        world[2] = glm::vec4(rotation[2], 0.0f) * scale.z;
+        world[3] = positions[i];
+
+        const glm::vec4& bounds = localBounds[i];
+        glm::vec4 center = world * glm::vec4(bounds.x, bounds.y, bounds.z, 1.0f);
+        float maxScale = std::max({std::abs(scale.x), std::abs(scale.y), std::abs(scale.z)});
+        worldBounds[i] = glm::vec4(center.x, center.y, center.z, bounds.w * maxScale);
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "gpu_allocator.h"
+#include "staging_uploader.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <vector>
+
+// CMake turns on GLM_FORCE_DEFAULT_ALIGNED_GENTYPES, the arrays below rely on it for SIMD loads
+static_assert(alignof(glm::vec4) == 16 && alignof(glm::mat4) == 16, "glm has to be built with aligned gentypes");
+
+struct SceneHandle {
+    /*
+     * This struct names an object in a SceneStorage. The generation goes up every time the slot is reused,
+     * so a handle to a destroyed object never silently refers to the one that took its place
+     */
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const SceneHandle& other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const SceneHandle& other) const { return !(*this == other); }
+};
+
+struct SceneRange {
+    // dense indices, the same in every array and on the GPU
+    uint32_t first;
+    uint32_t count;
+};
+
+struct SceneGpuBuffers {
+    /*
+     * This struct is the GPU side of a SceneStorage, one storage buffer per uploaded array with room for the
+     * storage's capacity. Object i is at i * stride in each, so a dirty range is one copy per buffer
+     */
+    VkBuffer worldMatrices = VK_NULL_HANDLE;
+    GpuAllocation worldMatricesAllocation;
+    VkBuffer worldBounds = VK_NULL_HANDLE;
+    GpuAllocation worldBoundsAllocation;
+    VkBuffer materials = VK_NULL_HANDLE;
+    GpuAllocation materialsAllocation;
+};
+
+class SceneStorage {
+    /*
+     * This class holds the objects of a scene as a structure of arrays, every array is indexed by the same dense
+     * index and has no holes: destroying an object moves the last one into its place. Handles go through a slot
+     * table to the dense index, which is how they survive the moves. Writes only mark their chunk dirty,
+     * updateWorld() then rebuilds the world matrices and bounds of the dirty chunks on the worker pool and
+     * upload() copies the dirty ranges of the GPU facing arrays into the matching ranges of the GPU buffers
+     */
+public:
+    // objects per dirty chunk, 64 world matrices are 4 KiB
+    static constexpr uint32_t DIRTY_CHUNK_SIZE = 64;
+
+    void create(uint32_t capacity);
+    void destroy();
+
+    SceneHandle add(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale,
+                    const glm::vec4& localBounds, uint32_t material);
+    void remove(SceneHandle handle);
+    bool isAlive(SceneHandle handle) const;
+
+    void setTransform(SceneHandle handle, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+    void setMaterial(SceneHandle handle, uint32_t material);
+
+    // recomputes world matrices and bounds of every dirty chunk, split over the pool's workers
+    void updateWorld(ThreadPool& pool);
+    // the dirty chunks merged into runs, clamped to the object count
+    std::vector<SceneRange> getDirtyRanges() const;
+    // uploads the dirty ranges and clears them, the buffers must not be in use by the GPU
+    UploadTicket upload(StagingUploader& uploader, const SceneGpuBuffers& buffers);
+
+    uint32_t getCount() const { return static_cast<uint32_t>(worldMatrices.size()); }
+    uint32_t getCapacity() const { return capacity; }
+    const glm::mat4* getWorldMatrices() const { return worldMatrices.data(); }
+    const glm::vec4* getWorldBounds() const { return worldBounds.data(); }
+    const uint32_t* getMaterials() const { return materials.data(); }
+
+private:
+    struct Slot {
+        uint32_t dense = 0;
+        uint32_t generation = 0;
+    };
+
+    uint32_t capacity = 0;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+
+    // local transform, w of position and scale unused so every element is one 16 byte load
+    std::vector<glm::vec4> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec4> scales;
+    // xyz center and w radius of the bounding sphere in object space
+    std::vector<glm::vec4> localBounds;
+    std::vector<uint32_t> denseToSlot;
+    // what the GPU reads
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<glm::vec4> worldBounds;
+    std::vector<uint32_t> materials;
+
+    std::vector<uint8_t> dirtyChunks;
+    bool anyDirty = false;
+
+    uint32_t denseIndex(SceneHandle handle) const;
+    void markDirty(uint32_t dense);
+    void updateRange(uint32_t first, uint32_t count);
+};
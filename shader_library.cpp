@@ -0,0 +1,388 @@
+#include "shader_library.h"
+#include "cpu_trace.h"
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+// posix_spawn hands the child this process's environment
+extern char** environ;
+
+namespace {
+
+// part of every cache key, a change here has to miss the cache like a change to the source
+const char* const COMPILE_FLAGS[] = {"--target-env=vulkan1.2", "-O"};
+const auto WATCH_INTERVAL = std::chrono::milliseconds(250);
+
+std::vector<uint32_t> readSpirv(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("failed to open shader " + path + "!");
+    }
+    std::streamsize size = file.tellg();
+    if (size <= 0 || size % 4 != 0) {
+        throw std::runtime_error("shader " + path + " is not SPIR-V!");
+    }
+    // SPIR-V is a stream of 32 bit words, a uint32_t vector keeps pCode aligned
+    std::vector<uint32_t> code(static_cast<size_t>(size) / 4);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(code.data()), size);
+    return code;
+}
+
+std::string readText(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("failed to open shader source " + path.string() + "!");
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+void hashBytes(uint64_t& hash, const std::string& bytes) {
+    // FNV-1a, the key only has to change when the bytes do
+    for (char byte : bytes) {
+        hash ^= static_cast<uint8_t>(byte);
+        hash *= 1099511628211ull;
+    }
+    hash ^= 0xff;
+    hash *= 1099511628211ull;
+}
+
+int runProcess(const std::string& program, const std::vector<std::string>& arguments, std::string& output) {
+    /*
+     * This function runs program with arguments as they are, no shell sees them, so paths with quotes, $ or
+     * backticks in them are just paths. Its stdout and stderr both go to output. Returns the exit status, -1 if
+     * the program could not be started
+     */
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(program.c_str()));
+    for (const std::string& argument : arguments) {
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    int pipeEnds[2];
+    if (pipe(pipeEnds) != 0) {
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeEnds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipeEnds[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipeEnds[0]);
+    posix_spawn_file_actions_addclose(&actions, pipeEnds[1]);
+    pid_t child;
+    int spawnError = posix_spawnp(&child, program.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipeEnds[1]);
+    if (spawnError != 0) {
+        close(pipeEnds[0]);
+        return -1;
+    }
+
+    char buffer[256];
+    while (true) {
+        ssize_t count = read(pipeEnds[0], buffer, sizeof(buffer));
+        if (count > 0) {
+            output.append(buffer, static_cast<size_t>(count));
+        }
+        else if (count == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    close(pipeEnds[0]);
+
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    // a child the exec failed in exits 127, like a shell reports a missing command
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+std::optional<std::string> includedName(const std::string& line) {
+    // #include "name", the only form the shaders use
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+        return std::nullopt;
+    }
+    size_t open = line.find('"', start + 8);
+    size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+    if (close == std::string::npos) {
+        return std::nullopt;
+    }
+    return line.substr(open + 1, close - open - 1);
+}
+
+}
+
+void ShaderLibrary::create(VkDevice deviceIn, const std::string& directoryIn, std::optional<ShaderSourceConfig> sourcesIn) {
+    device = deviceIn;
+    directory = directoryIn;
+    sources = std::move(sourcesIn);
+    stopping = false;
+    if (sources.has_value()) {
+        std::filesystem::create_directories(sources->cacheDirectory);
+    }
+}
+
+void ShaderLibrary::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    watcherWake.notify_all();
+    if (watcher.joinable()) {
+        watcher.join();
+    }
+    if (sources.has_value() && (cacheHits.load() > 0 || compileCount.load() > 0)) {
+        std::cout << "Shader cache: " << cacheHits.load() << " hits, " << compileCount.load() << " compiles" << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [name, module] : modules) {
+        vkDestroyShaderModule(device, module, nullptr);
+    }
+    for (VkShaderModule module : retiredModules) {
+        vkDestroyShaderModule(device, module, nullptr);
+    }
+    modules.clear();
+    retiredModules.clear();
+    compiled.clear();
+    changed.clear();
+}
+
+VkShaderModule ShaderLibrary::load(const std::string& name) {
+    /*
+     * This function creates the module outside the lock, a compile on one worker must not hold up the others
+     */
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto loaded = modules.find(name);
+        if (loaded != modules.end()) {
+            return loaded->second;
+        }
+    }
+
+    std::optional<std::filesystem::path> source = findSource(name);
+    CompiledShader shader;
+    if (source.has_value()) {
+        shader = compileSource(name, source.value());
+    }
+    else {
+        shader.code = readSpirv(directory + "/" + name + ".spv");
+    }
+    VkShaderModule module = createModule(name, shader.code);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [loaded, inserted] = modules.emplace(name, module);
+    if (!inserted) {
+        // another worker got there first
+        vkDestroyShaderModule(device, module, nullptr);
+        return loaded->second;
+    }
+    if (source.has_value()) {
+        shader.code.clear();
+        compiled[name] = std::move(shader);
+    }
+    return module;
+}
+
+void ShaderLibrary::startWatching() {
+    if (!sources.has_value() || watcher.joinable()) {
+        return;
+    }
+    watcher = std::thread(&ShaderLibrary::watchLoop, this);
+}
+
+std::vector<std::string> ShaderLibrary::takeChanged() {
+    std::vector<std::string> taken;
+    std::lock_guard<std::mutex> lock(mutex);
+    taken.swap(changed);
+    return taken;
+}
+
+std::vector<VkShaderModule> ShaderLibrary::takeRetired() {
+    std::vector<VkShaderModule> taken;
+    std::lock_guard<std::mutex> lock(mutex);
+    taken.swap(retiredModules);
+    return taken;
+}
+
+std::optional<std::filesystem::path> ShaderLibrary::findSource(const std::string& name) const {
+    if (!sources.has_value()) {
+        return std::nullopt;
+    }
+    for (const std::string& candidate : {name, name + ".hlsl"}) {
+        std::filesystem::path path = std::filesystem::path(sources->sourceDirectory) / candidate;
+        if (std::filesystem::is_regular_file(path)) {
+            return path;
+        }
+    }
+    return std::nullopt;
+}
+
+ShaderLibrary::CompiledShader ShaderLibrary::compileSource(const std::string& name, const std::filesystem::path& source) {
+    /*
+     * This function hashes the source with everything it includes, loads <cache>/<name>-<hash>.spv if an
+     * earlier run (or an earlier reload) compiled that exact content, and runs the compiler otherwise.
+     * HLSL sources are named <name>.hlsl, the stage comes from the name's extension (shadow.vert.hlsl)
+     */
+    TRACE_SCOPE("ShaderLibrary::compileSource");
+    bool hlsl = source.extension() == ".hlsl";
+    std::vector<std::string> arguments(std::begin(COMPILE_FLAGS), std::end(COMPILE_FLAGS));
+    arguments.insert(arguments.end(), {"-I", sources->sourceDirectory});
+    if (hlsl) {
+        arguments.insert(arguments.end(), {"-x", "hlsl", "-fshader-stage=" + std::filesystem::path(name).extension().string().substr(1),
+                                           "-fentry-point=main"});
+    }
+
+    CompiledShader shader;
+    shader.hash = 14695981039346656037ull;
+    for (const std::string& argument : arguments) {
+        hashBytes(shader.hash, argument);
+    }
+    // depth first over the includes, each file once, hashing the path too so moving an include misses
+    std::vector<std::filesystem::path> pending = {source};
+    std::set<std::filesystem::path> seen;
+    while (!pending.empty()) {
+        std::filesystem::path file = pending.back();
+        pending.pop_back();
+        if (!seen.insert(file).second) {
+            continue;
+        }
+        shader.writeTimes.push_back(std::filesystem::last_write_time(file));
+        shader.files.push_back(file);
+        std::string text = readText(file);
+        hashBytes(shader.hash, std::filesystem::relative(file, sources->sourceDirectory).generic_string());
+        hashBytes(shader.hash, text);
+
+        std::istringstream lines(text);
+        for (std::string line; std::getline(lines, line);) {
+            if (std::optional<std::string> included = includedName(line)) {
+                std::filesystem::path local = file.parent_path() / included.value();
+                pending.push_back(std::filesystem::exists(local) ? local : std::filesystem::path(sources->sourceDirectory) / included.value());
+            }
+        }
+    }
+
+    std::ostringstream key;
+    key << std::hex << std::setw(16) << std::setfill('0') << shader.hash;
+    std::filesystem::path cached = std::filesystem::path(sources->cacheDirectory) / (name + "-" + key.str() + ".spv");
+    if (std::filesystem::is_regular_file(cached)) {
+        cacheHits++;
+        shader.code = readSpirv(cached.string());
+        return shader;
+    }
+
+    // written next to its final name and renamed, so a run reading the cache never sees half a file
+    std::ostringstream temporaryName;
+    temporaryName << cached.string() << ".tmp" << std::this_thread::get_id();
+    arguments.insert(arguments.end(), {source.string(), "-o", temporaryName.str()});
+    std::string output;
+    int status = runProcess(sources->compiler, arguments, output);
+    if (status < 0 || status == 127) {
+        std::filesystem::remove(temporaryName.str());
+        throw std::runtime_error("failed to run shader compiler " + sources->compiler + "!");
+    }
+    if (status != 0) {
+        std::filesystem::remove(temporaryName.str());
+        throw std::runtime_error("failed to compile shader " + name + ":\n" + output);
+    }
+    std::filesystem::rename(temporaryName.str(), cached);
+    compileCount++;
+    shader.code = readSpirv(cached.string());
+    return shader;
+}
+
+VkShaderModule ShaderLibrary::createModule(const std::string& name, const std::vector<uint32_t>& code) const {
+    VkShaderModuleCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = code.size() * sizeof(uint32_t);
+    createInfo.pCode = code.data();
+    VkShaderModule module;
+    if (vkCreateShaderModule(device, &createInfo, nullptr, &module) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shader module " + name + "!");
+    }
+    return module;
+}
+
+void ShaderLibrary::watchLoop() {
+    /*
+     * This function is the watcher thread. A shader whose files changed is recompiled right here, off the frame
+     * and off the pipeline workers, and only replaces its module if it compiled and its content hash moved, so
+     * saving an unchanged file or a broken edit keeps the running pipelines as they are
+     */
+    TRACE_THREAD_NAME("shader watcher");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!watcherWake.wait_for(lock, WATCH_INTERVAL, [this] { return stopping; })) {
+        std::vector<std::string> stale;
+        for (const auto& [name, shader] : compiled) {
+            for (size_t i = 0; i < shader.files.size(); i++) {
+                std::error_code error;
+                std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(shader.files[i], error);
+                // an editor saving through a temporary file briefly has no file at the path, check again next time
+                if (!error && writeTime != shader.writeTimes[i]) {
+                    stale.push_back(name);
+                    break;
+                }
+            }
+        }
+        if (stale.empty()) {
+            continue;
+        }
+
+        lock.unlock();
+        for (const std::string& name : stale) {
+            std::optional<std::filesystem::path> source = findSource(name);
+            if (!source.has_value()) {
+                continue;
+            }
+            VkShaderModule module = VK_NULL_HANDLE;
+            CompiledShader shader;
+            try {
+                shader = compileSource(name, source.value());
+                std::lock_guard<std::mutex> compiledLock(mutex);
+                if (shader.hash != compiled[name].hash) {
+                    module = createModule(name, shader.code);
+                }
+            }
+            catch (const std::exception& error) {
+                std::cerr << error.what() << std::endl;
+                // take the new times anyway so a broken shader is not recompiled every interval
+                std::lock_guard<std::mutex> compiledLock(mutex);
+                CompiledShader& previous = compiled[name];
+                for (size_t i = 0; i < previous.files.size(); i++) {
+                    std::error_code timeError;
+                    previous.writeTimes[i] = std::filesystem::last_write_time(previous.files[i], timeError);
+                }
+                continue;
+            }
+
+            std::lock_guard<std::mutex> compiledLock(mutex);
+            shader.code.clear();
+            compiled[name] = std::move(shader);
+            if (module != VK_NULL_HANDLE) {
+                retiredModules.push_back(modules[name]);
+                modules[name] = module;
+                changed.push_back(name);
+                std::cout << "Reloaded shader " << name << std::endl;
+            }
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ShaderSourceConfig {
+    // where <name> (GLSL, e.g. cull.comp) or <name>.hlsl and their includes are read from
+    std::string sourceDirectory;
+    // compiled SPIR-V, one file per source content hash, shared by every run
+    std::string cacheDirectory;
+    // a glslc compatible compiler
+    std::string compiler;
+};
+
+class ShaderLibrary {
+    /*
+     * This class loads the SPIR-V the build compiled into the shader directory (<directory>/<name>.spv) and keeps
+     * every module until destroy(), or until takeRetired() once a reload replaced it. Loading is done by the
+     * pipeline build functions on the compile workers, so load() may be called from several threads at once.
+     * With a source config, shaders that have a source are compiled from it instead, through an on disk cache keyed
+     * by the hash of the source, its includes and the compiler flags, so only changed shaders are ever compiled.
+     * startWatching() then recompiles a shader whenever one of its files changes and hands its name out through
+     * takeChanged(), for the pipelines using it to be rebuilt
+     */
+public:
+    void create(VkDevice device, const std::string& directory, std::optional<ShaderSourceConfig> sources = std::nullopt);
+    void destroy();
+
+    // the module of name, loaded the first time it is asked for, the latest one after a reload
+    VkShaderModule load(const std::string& name);
+
+    // polls the sources of every shader loaded from source on a background thread, stopped by destroy()
+    void startWatching();
+    // the shaders that were reloaded since the last call, main thread
+    std::vector<std::string> takeChanged();
+    // the modules those reloads replaced, main thread. A build that loaded one before the reload may still be
+    // creating its pipeline from it, PipelineCompiler::retireShaderModules() waits for such builds
+    std::vector<VkShaderModule> takeRetired();
+
+private:
+    struct CompiledShader {
+        std::vector<uint32_t> code;
+        uint64_t hash = 0;
+        // the source and every file it includes, with the times they were last written when hashed
+        std::vector<std::filesystem::path> files;
+        std::vector<std::filesystem::file_time_type> writeTimes;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    std::string directory;
+    std::optional<ShaderSourceConfig> sources;
+    std::mutex mutex;
+    std::map<std::string, VkShaderModule> modules;
+    // replaced by a reload, until takeRetired() hands them on, destroy() frees the ones never taken
+    std::vector<VkShaderModule> retiredModules;
+    std::map<std::string, CompiledShader> compiled;
+    std::vector<std::string> changed;
+
+    std::thread watcher;
+    std::condition_variable watcherWake;
+    bool stopping = false;
+    std::atomic<uint32_t> cacheHits{0};
+    std::atomic<uint32_t> compileCount{0};
+
+    std::optional<std::filesystem::path> findSource(const std::string& name) const;
+    CompiledShader compileSource(const std::string& name, const std::filesystem::path& source);
+    VkShaderModule createModule(const std::string& name, const std::vector<uint32_t>& code) const;
+    void watchLoop();
+};
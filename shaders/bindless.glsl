@@ -0,0 +1,14 @@
+// the global bindless set, mirrors BindlessDescriptors (set BINDLESS_SET, binding = BindlessKind)
+// the including shader enables GL_EXT_nonuniform_qualifier, extensions have to come before any declaration
+
+#define BINDLESS_SET 1
+
+// storage buffers are declared by the shaders that read them, with their own block type:
+// layout(std430, set = BINDLESS_SET, binding = 0) readonly buffer Name { ... } bindlessName[];
+layout(set = BINDLESS_SET, binding = 1) uniform sampler bindlessSamplers[];
+layout(set = BINDLESS_SET, binding = 2) uniform texture2D bindlessTextures[];
+
+// indices that can differ between invocations have to go through nonuniformEXT
+vec4 sampleBindless(uint textureIndex, uint samplerIndex, vec2 uv) {
+    return texture(sampler2D(bindlessTextures[nonuniformEXT(textureIndex)], bindlessSamplers[nonuniformEXT(samplerIndex)]), uv);
+}
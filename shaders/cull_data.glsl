@@ -0,0 +1,21 @@
+// shared by the cull compute shader and the instanced vertex shader, mirrors GpuDrivenRenderer::CullData (std140)
+
+layout(set = 0, binding = 0) uniform CullData {
+    mat4 viewProj;
+    // the camera the depth pyramid was rendered with
+    mat4 prevViewProj;
+    // left, right, bottom, top, near, far, xyz normal pointing inside
+    vec4 frustum[6];
+    // xy size of pyramid mip 0 in texels
+    vec4 pyramidSize;
+    // x instance count, y index count of the mesh, z CULL_* flags, w max draw count
+    uvec4 params;
+} cull;
+
+// the world bounding sphere of every instance, xyz center and w radius, the rest of the instance is in other arrays
+layout(std430, set = 0, binding = 1) readonly buffer WorldBounds {
+    vec4 worldBounds[];
+};
+
+const uint CULL_OCCLUSION = 1u;
+const uint CULL_COMPACT = 2u;
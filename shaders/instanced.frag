@@ -0,0 +1,41 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "bindless.glsl"
+
+struct Material {
+    vec4 tint;
+    uint textureIndex;
+    uint samplerIndex;
+    uvec2 padding;
+};
+
+layout(std430, set = BINDLESS_SET, binding = 0) readonly buffer Materials {
+    Material materials[];
+} bindlessMaterials[];
+
+layout(push_constant) uniform DrawConstants {
+    // bindless index of the material buffer
+    uint materialBuffer;
+} draw;
+
+layout(location = 0) in vec3 worldPosition;
+layout(location = 1) in vec3 localPosition;
+layout(location = 2) flat in uint material;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    // flat face normal from the position derivatives, the cube mesh has no normals
+    vec3 normal = normalize(cross(dFdx(worldPosition), dFdy(worldPosition)));
+    float light = 0.35 + 0.65 * abs(dot(normal, normalize(vec3(0.4, 0.8, 0.45))));
+
+    // the face's texture coordinates are the local position along the two axes the local normal is not on
+    vec3 axis = abs(cross(dFdx(localPosition), dFdy(localPosition)));
+    vec2 uv = axis.x > axis.y && axis.x > axis.z ? localPosition.zy : axis.y > axis.z ? localPosition.xz : localPosition.xy;
+    Material m = bindlessMaterials[draw.materialBuffer].materials[material];
+    vec4 texel = sampleBindless(m.textureIndex, m.samplerIndex, uv + 0.5);
+
+    outColor = vec4(m.tint.rgb * texel.rgb * light, 1.0);
+}
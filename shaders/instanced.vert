@@ -0,0 +1,27 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// the draws come from the cull shader, firstInstance is the instance index
+
+#include "cull_data.glsl"
+
+// SceneStorage's world matrices and material indices, by instance
+layout(std430, set = 0, binding = 5) readonly buffer WorldMatrices {
+    mat4 worldMatrices[];
+};
+layout(std430, set = 0, binding = 6) readonly buffer MaterialIndices {
+    uint materialIndices[];
+};
+
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) out vec3 worldPosition;
+layout(location = 1) out vec3 localPosition;
+layout(location = 2) flat out uint material;
+
+void main() {
+    worldPosition = (worldMatrices[gl_InstanceIndex] * vec4(inPosition, 1.0)).xyz;
+    localPosition = inPosition;
+    material = materialIndices[gl_InstanceIndex];
+    gl_Position = cull.viewProj * vec4(worldPosition, 1.0);
+}
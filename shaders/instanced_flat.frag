@@ -0,0 +1,29 @@
+#version 450
+
+// the draw without the bindless set, for devices that lack descriptor indexing: no textures, the material index
+// picks a tint the same way GpuDrivenRenderer::createMaterials does
+
+layout(location = 0) in vec3 worldPosition;
+layout(location = 1) in vec3 localPosition;
+layout(location = 2) flat in uint material;
+
+layout(location = 0) out vec4 outColor;
+
+uint hash(uint value) {
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+void main() {
+    // flat face normal from the position derivatives, the cube mesh has no normals
+    vec3 normal = normalize(cross(dFdx(worldPosition), dFdy(worldPosition)));
+    float light = 0.35 + 0.65 * abs(dot(normal, normalize(vec3(0.4, 0.8, 0.45))));
+
+    uint random = hash(material + 1u);
+    vec3 tint = 0.4 + 0.6 * vec3(uvec3(random, random >> 8, random >> 16) & 0xffu) / 255.0;
+    outColor = vec4(tint * light, 1.0);
+}
@@ -0,0 +1,355 @@
+#include "staging_uploader.h"
+#include "cpu_trace.h"
+#include "vk_handles.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+void StagingUploader::create(VkDevice deviceIn, DeviceMemoryAllocator& allocatorIn, const VkPhysicalDeviceLimits& limits,
+                             const QueueRef& transferQueueIn, VkDeviceSize ringSizeIn) {
+    device = deviceIn;
+    allocator = &allocatorIn;
+    transferQueue = transferQueueIn;
+    ringSize = ringSizeIn;
+
+    // image copies want their source offset aligned to the texel block size, 16 covers every format we upload
+    optimalCopyAlignment = std::max<VkDeviceSize>(16, limits.optimalBufferCopyOffsetAlignment);
+
+    // direct writes pay off when all device local memory is host visible (UMA), or when a host visible device
+    // local heap is big enough to be more than the 256 MiB legacy BAR window (resizable BAR)
+    const VkPhysicalDeviceMemoryProperties& memoryProperties = allocator->getMemoryProperties();
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+        VkMemoryPropertyFlags wanted = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        if ((flags & wanted) == wanted
+            && memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size > 256ull * 1024 * 1024) {
+            directWritesPreferred = true;
+        }
+    }
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = ringSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &ringBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create staging ring buffer!");
+    }
+    ringAllocation = allocator->allocateForBuffer(ringBuffer, MemoryUsage::Upload);
+
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload timeline semaphore!");
+    }
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = transferQueue.family;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload command pool!");
+    }
+
+    std::cout << "Uploader: " << ringSize / (1024 * 1024) << " MiB staging ring on queue family " << transferQueue.family
+              << (directWritesPreferred ? ", direct writes to host visible device memory" : "") << std::endl;
+}
+
+void StagingUploader::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (submittedValue > 0) {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timeline;
+        waitInfo.pValues = &submittedValue;
+        vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    }
+    inFlight.clear();
+    freeCommandBuffers.clear();
+
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroySemaphore(device, timeline, nullptr);
+    vkDestroyBuffer(device, ringBuffer, nullptr);
+    allocator->free(ringAllocation);
+}
+
+UploadTicket StagingUploader::uploadBuffer(VkBuffer buffer, const GpuAllocation& allocation, VkDeviceSize offset,
+                                           const void* data, VkDeviceSize size, std::optional<uint32_t> releaseToFamily) {
+    // no staging for memory the CPU can write itself
+    if (allocation.mapped != nullptr && isCoherent(allocation)) {
+        std::memcpy(static_cast<char*>(allocation.mapped) + offset, data, size);
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.directBytes += size;
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    VkDeviceSize ringOffset = allocateRing(size, 4);
+    std::memcpy(static_cast<char*>(ringAllocation.mapped) + ringOffset, data, size);
+
+    // copies into the same buffer become regions of one vkCmdCopyBuffer
+    pendingBufferCopies.push_back({buffer, {ringOffset, offset, size}, static_cast<uint32_t>(pendingBufferCopies.size())});
+    if (releaseToFamily.has_value() && releaseToFamily.value() != transferQueue.family) {
+        pendingBufferReleases.push_back({buffer, offset, size, releaseToFamily.value()});
+    }
+    stats.stagedBytes += size;
+    stats.copies++;
+    return {submittedValue + 1};
+}
+
+UploadTicket StagingUploader::uploadImage(VkImage image, VkBufferImageCopy region, const void* data, VkDeviceSize size,
+                                          VkImageLayout finalLayout, std::optional<uint32_t> releaseToFamily) {
+    std::lock_guard<std::mutex> lock(mutex);
+    VkDeviceSize ringOffset = allocateRing(size, optimalCopyAlignment);
+    std::memcpy(static_cast<char*>(ringAllocation.mapped) + ringOffset, data, size);
+
+    region.bufferOffset = ringOffset;
+    if (releaseToFamily.has_value() && releaseToFamily.value() == transferQueue.family) {
+        releaseToFamily.reset();
+    }
+    pendingImageCopies.push_back({image, region, finalLayout, releaseToFamily});
+    stats.stagedBytes += size;
+    stats.copies++;
+    return {submittedValue + 1};
+}
+
+UploadTicket StagingUploader::flush() {
+    TRACE_SCOPE("uploadFlush");
+    std::lock_guard<std::mutex> lock(mutex);
+    return flushLocked();
+}
+
+bool StagingUploader::isComplete(UploadTicket ticket) const {
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &completed);
+    return completed >= ticket.value;
+}
+
+void StagingUploader::wait(UploadTicket ticket) {
+    if (ticket.value == 0) {
+        return;
+    }
+    {
+        // a ticket of the batch still being collected would never be signaled
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ticket.value > submittedValue) {
+            flushLocked();
+        }
+    }
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &ticket.value;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+}
+
+UploadStats StagingUploader::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void StagingUploader::printStats() const {
+    UploadStats current = getStats();
+    const double mib = 1024.0 * 1024.0;
+    std::cout << "Uploader: " << current.stagedBytes / mib << " MiB staged in " << current.copies << " copies / "
+              << current.batches << " batches, " << current.directBytes / mib << " MiB written directly, "
+              << current.ringStalls << " ring stalls" << std::endl;
+}
+
+VkDeviceSize StagingUploader::allocateRing(VkDeviceSize size, VkDeviceSize alignment) {
+    /*
+     * This function takes size bytes from the ring and returns their offset in the ring buffer. An allocation
+     * never wraps, if it does not fit before the end the rest of the lap is skipped. When the ring is full it
+     * first reclaims finished batches, then waits for the oldest one, and as a last resort flushes what is pending.
+     * A ring with nothing in flight or pending is empty and starts over at the next lap
+     */
+    if (size > ringSize) {
+        throw std::runtime_error("upload of " + std::to_string(size) + " bytes does not fit in the staging ring!");
+    }
+
+    while (true) {
+        uint64_t start = (writePosition + alignment - 1) / alignment * alignment;
+        if (start % ringSize + size > ringSize) {
+            start += ringSize - start % ringSize;
+        }
+        if (start + size - readPosition <= ringSize) {
+            writePosition = start + size;
+            return start % ringSize;
+        }
+
+        reclaim();
+        if (start + size - readPosition <= ringSize) {
+            continue;
+        }
+
+        if (inFlight.empty() && !hasPendingWork()) {
+            // only the skipped end of the lap is in the way, nothing to wait for
+            writePosition = (writePosition + ringSize - 1) / ringSize * ringSize;
+            readPosition = writePosition;
+            continue;
+        }
+        stats.ringStalls++;
+        if (inFlight.empty()) {
+            // everything in the ring is our own pending data, submit it so it can be waited on
+            flushLocked();
+        }
+        uint64_t oldest = inFlight.front().value;
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timeline;
+        waitInfo.pValues = &oldest;
+        vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+        reclaim();
+    }
+}
+
+void StagingUploader::reclaim() {
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &completed);
+    while (!inFlight.empty() && inFlight.front().value <= completed) {
+        readPosition = inFlight.front().ringEnd;
+        freeCommandBuffers.push_back(inFlight.front().commandBuffer);
+        inFlight.erase(inFlight.begin());
+    }
+}
+
+UploadTicket StagingUploader::flushLocked() {
+    if (!hasPendingWork()) {
+        return {submittedValue};
+    }
+
+    reclaim();
+    VkCommandBuffer commandBuffer = acquireCommandBuffer();
+    recordBatch(commandBuffer);
+
+    uint64_t value = submittedValue + 1;
+    submission.clear();
+    submission
+        .execute(commandBuffer)
+        .signal(timeline, value)
+        .submit(transferQueue.queue);
+
+    submittedValue = value;
+    inFlight.push_back({value, writePosition, commandBuffer});
+    stats.batches++;
+    return {value};
+}
+
+void StagingUploader::recordBatch(VkCommandBuffer commandBuffer) {
+    /*
+     * This function records every pending copy, buffers first as one vkCmdCopyBuffer per destination,
+     * then images with their layout transitions around the copy
+     */
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin upload command buffer!");
+    }
+
+    std::sort(pendingBufferCopies.begin(), pendingBufferCopies.end(), [](const PendingBufferCopy& a, const PendingBufferCopy& b) {
+        return a.buffer != b.buffer ? handleBits(a.buffer) < handleBits(b.buffer) : a.sequence < b.sequence;
+    });
+    for (size_t first = 0; first < pendingBufferCopies.size();) {
+        VkBuffer buffer = pendingBufferCopies[first].buffer;
+        copyRegions.clear();
+        size_t last = first;
+        while (last < pendingBufferCopies.size() && pendingBufferCopies[last].buffer == buffer) {
+            copyRegions.push_back(pendingBufferCopies[last].region);
+            last++;
+        }
+        vkCmdCopyBuffer(commandBuffer, ringBuffer, buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+        first = last;
+    }
+    for (const auto& release : pendingBufferReleases) {
+        QueueOwnershipTransfer(transferQueue.family, release.family)
+            .releaseBuffer(commandBuffer, release.buffer, release.offset, release.size,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+    }
+
+    for (const auto& copy : pendingImageCopies) {
+        VkImageSubresourceRange range{};
+        range.aspectMask = copy.region.imageSubresource.aspectMask;
+        range.baseMipLevel = copy.region.imageSubresource.mipLevel;
+        range.levelCount = 1;
+        range.baseArrayLayer = copy.region.imageSubresource.baseArrayLayer;
+        range.layerCount = copy.region.imageSubresource.layerCount;
+
+        VkImageMemoryBarrier toTransfer{};
+        toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        toTransfer.srcAccessMask = 0;
+        toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.image = copy.image;
+        toTransfer.subresourceRange = range;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &toTransfer);
+
+        vkCmdCopyBufferToImage(commandBuffer, ringBuffer, copy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy.region);
+
+        if (copy.releaseToFamily.has_value()) {
+            QueueOwnershipTransfer(transferQueue.family, copy.releaseToFamily.value())
+                .releaseImage(commandBuffer, copy.image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy.finalLayout,
+                              VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        }
+        else {
+            // the consumer's semaphore wait makes the write visible, the barrier only has to do the transition
+            VkImageMemoryBarrier toFinal = toTransfer;
+            toFinal.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            toFinal.dstAccessMask = 0;
+            toFinal.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            toFinal.newLayout = copy.finalLayout;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &toFinal);
+        }
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record upload command buffer!");
+    }
+
+    pendingBufferCopies.clear();
+    pendingBufferReleases.clear();
+    pendingImageCopies.clear();
+}
+
+VkCommandBuffer StagingUploader::acquireCommandBuffer() {
+    VkCommandBuffer commandBuffer;
+    if (!freeCommandBuffers.empty()) {
+        commandBuffer = freeCommandBuffers.back();
+        freeCommandBuffers.pop_back();
+        return commandBuffer;
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate upload command buffer!");
+    }
+    return commandBuffer;
+}
+
+bool StagingUploader::hasPendingWork() const {
+    return !pendingBufferCopies.empty() || !pendingImageCopies.empty();
+}
+
+bool StagingUploader::isCoherent(const GpuAllocation& allocation) const {
+    return allocator->getMemoryProperties().memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "gpu_allocator.h"
+#include "queues.h"
+
+#include <mutex>
+#include <optional>
+#include <vector>
+
+struct UploadTicket {
+    /*
+     * This struct is the point on the uploader's timeline semaphore at which an upload is on the GPU,
+     * 0 means the data was written straight into the destination and there is nothing to wait for
+     */
+    uint64_t value = 0;
+};
+
+struct UploadStats {
+    VkDeviceSize stagedBytes = 0;
+    VkDeviceSize directBytes = 0;
+    uint64_t batches = 0;
+    uint64_t copies = 0;
+    uint64_t ringStalls = 0;
+};
+
+class StagingUploader {
+    /*
+     * This class streams buffer and image data to the GPU through a persistently mapped staging ring.
+     * Uploads are memcpy'd into the ring right away and their copies collected, flush() (once per frame) records
+     * them all into one command buffer on the transfer queue and signals the next value of a timeline semaphore.
+     * Every upload hands back a ticket with that value, so a consumer waits on exactly the batch it needs with
+     * QueueSubmission::waitFor(getTimelineSemaphore(), stage, ticket.value) instead of on the whole queue.
+     * Ring space is reclaimed as the timeline passes each batch. Destinations that are already host visible
+     * (UMA, resizable BAR) skip the staging copy and are written directly
+     */
+public:
+    void create(VkDevice device, DeviceMemoryAllocator& allocator, const VkPhysicalDeviceLimits& limits,
+                const QueueRef& transferQueue, VkDeviceSize ringSize = 32ull * 1024 * 1024);
+    void destroy();
+
+    // releaseToFamily releases an exclusive resource from the transfer family to the consumer's family,
+    // who then has to record the matching acquire (see QueueOwnershipTransfer) after waiting on the ticket
+    UploadTicket uploadBuffer(VkBuffer buffer, const GpuAllocation& allocation, VkDeviceSize offset,
+                              const void* data, VkDeviceSize size, std::optional<uint32_t> releaseToFamily = std::nullopt);
+    // region.bufferOffset is filled in by the uploader, the image ends up in finalLayout
+    UploadTicket uploadImage(VkImage image, VkBufferImageCopy region, const void* data, VkDeviceSize size,
+                             VkImageLayout finalLayout, std::optional<uint32_t> releaseToFamily = std::nullopt);
+
+    // submits everything uploaded since the last flush, returns the ticket of the last batch
+    UploadTicket flush();
+    bool isComplete(UploadTicket ticket) const;
+    // flushes first if the ticket's batch has not been submitted yet
+    void wait(UploadTicket ticket);
+
+    VkSemaphore getTimelineSemaphore() const { return timeline; }
+    // GpuOnly on discrete GPUs, Dynamic where device local memory is host visible anyway, for static resources
+    MemoryUsage getStaticDataUsage() const { return directWritesPreferred ? MemoryUsage::Dynamic : MemoryUsage::GpuOnly; }
+    bool prefersDirectWrites() const { return directWritesPreferred; }
+
+    UploadStats getStats() const;
+    void printStats() const;
+
+private:
+    struct PendingImageCopy {
+        VkImage image;
+        VkBufferImageCopy region;
+        VkImageLayout finalLayout;
+        std::optional<uint32_t> releaseToFamily;
+    };
+
+    struct PendingBufferCopy {
+        VkBuffer buffer;
+        VkBufferCopy region;
+        // keeps the copies into one buffer in the order they were made when sorting by buffer
+        uint32_t sequence;
+    };
+
+    struct PendingBufferRelease {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        uint32_t family;
+    };
+
+    struct InFlightBatch {
+        uint64_t value;
+        // monotonic ring position the batch's data ends at, everything before it is free once the batch is done
+        uint64_t ringEnd;
+        VkCommandBuffer commandBuffer;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    DeviceMemoryAllocator* allocator = nullptr;
+    QueueRef transferQueue;
+    VkDeviceSize optimalCopyAlignment = 16;
+    bool directWritesPreferred = false;
+
+    VkBuffer ringBuffer = VK_NULL_HANDLE;
+    GpuAllocation ringAllocation;
+    VkDeviceSize ringSize = 0;
+    // monotonic positions, the physical offset is position % ringSize
+    uint64_t writePosition = 0;
+    uint64_t readPosition = 0;
+
+    VkSemaphore timeline = VK_NULL_HANDLE;
+    uint64_t submittedValue = 0;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+    // oldest first, only a handful are in flight so taking one off the front is cheap
+    std::vector<InFlightBatch> inFlight;
+    // QueueSubmission of the flushes, reused so a flush allocates nothing once it has grown
+    QueueSubmission submission;
+
+    // flat and sorted by buffer when recorded, rather than a map whose nodes are allocated every batch
+    std::vector<PendingBufferCopy> pendingBufferCopies;
+    std::vector<VkBufferCopy> copyRegions;
+    std::vector<PendingBufferRelease> pendingBufferReleases;
+    std::vector<PendingImageCopy> pendingImageCopies;
+
+    mutable std::mutex mutex;
+    UploadStats stats;
+
+    VkDeviceSize allocateRing(VkDeviceSize size, VkDeviceSize alignment);
+    void reclaim();
+    UploadTicket flushLocked();
+    void recordBatch(VkCommandBuffer commandBuffer);
+    VkCommandBuffer acquireCommandBuffer();
+    bool hasPendingWork() const;
+    bool isCoherent(const GpuAllocation& allocation) const;
+};
@@ -0,0 +1,236 @@
+#include "swapchain.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+const char* presentPolicyName(PresentPolicy policy) {
+    switch (policy) {
+        case PresentPolicy::LowLatency: return "mailbox";
+        case PresentPolicy::PowerSaving: return "fifo";
+        case PresentPolicy::RelaxedVsync: return "fifo-relaxed";
+        case PresentPolicy::Tearing: return "immediate";
+    }
+    return "unknown";
+}
+
+std::optional<PresentPolicy> parsePresentPolicy(const std::string& name) {
+    /*
+     * This function maps a present mode name from the command line or environment to a PresentPolicy
+     */
+    if (name == "mailbox" || name == "low-latency") return PresentPolicy::LowLatency;
+    if (name == "fifo" || name == "power-saving" || name == "vsync") return PresentPolicy::PowerSaving;
+    if (name == "fifo-relaxed" || name == "relaxed") return PresentPolicy::RelaxedVsync;
+    if (name == "immediate" || name == "tearing") return PresentPolicy::Tearing;
+    return std::nullopt;
+}
+
+const char* presentModeName(VkPresentModeKHR presentMode) {
+    switch (presentMode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "IMMEDIATE";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "MAILBOX";
+        case VK_PRESENT_MODE_FIFO_KHR: return "FIFO";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+        default: return "other";
+    }
+}
+
+SwapchainSupportDetails SwapchainSupportDetails::query(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
+    SwapchainSupportDetails details;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &details.capabilities);
+
+    uint32_t formatCount = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+    details.formats.resize(formatCount);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, details.formats.data());
+
+    uint32_t presentModeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
+    details.presentModes.resize(presentModeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, details.presentModes.data());
+
+    return details;
+}
+
+void Swapchain::create(VkPhysicalDevice physicalDeviceIn, VkDevice deviceIn, VkSurfaceKHR surfaceIn,
+                       const QueueFamilyIndices& indicesIn, const SwapchainConfig& configIn, VkExtent2D framebufferExtent) {
+    physicalDevice = physicalDeviceIn;
+    device = deviceIn;
+    surface = surfaceIn;
+    indices = indicesIn;
+    config = configIn;
+
+    build(framebufferExtent, VK_NULL_HANDLE);
+
+    std::cout << "Swap chain: " << images.size() << " images " << extent.width << "x" << extent.height
+              << ", present mode " << presentModeName(presentMode)
+              << " (policy " << presentPolicyName(config.presentPolicy) << ")" << std::endl;
+}
+
+void Swapchain::recreate(VkExtent2D framebufferExtent) {
+    /*
+     * This function rebuilds the swap chain for a new framebuffer size. The old swap chain is handed over as
+     * oldSwapchain so the driver can reuse its resources, the caller has to make sure the GPU is done with it
+     */
+    VkSwapchainKHR oldSwapchain = swapchain;
+    destroyImageViews();
+    build(framebufferExtent, oldSwapchain);
+    vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+}
+
+void Swapchain::destroy() {
+    destroyImageViews();
+    if (swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(device, swapchain, nullptr);
+        swapchain = VK_NULL_HANDLE;
+    }
+    images.clear();
+}
+
+void Swapchain::build(VkExtent2D framebufferExtent, VkSwapchainKHR oldSwapchain) {
+    /*
+     * This function creates the VkSwapchainKHR from the current surface support and gets its images
+     */
+    SwapchainSupportDetails support = SwapchainSupportDetails::query(physicalDevice, surface);
+    surfaceFormat = chooseSurfaceFormat(support.formats);
+    presentMode = choosePresentMode(support.presentModes, config.presentPolicy);
+    extent = chooseExtent(support.capabilities, framebufferExtent);
+    uint32_t imageCount = chooseImageCount(support.capabilities, config.imageCount);
+
+    VkSwapchainCreateInfoKHR createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    createInfo.surface = surface;
+    createInfo.minImageCount = imageCount;
+    createInfo.imageFormat = surfaceFormat.format;
+    createInfo.imageColorSpace = surfaceFormat.colorSpace;
+    createInfo.imageExtent = extent;
+    createInfo.imageArrayLayers = 1;
+    // only COLOR_ATTACHMENT is guaranteed, without TRANSFER_DST the frame is cleared by a load op instead
+    transferDestination = (support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (transferDestination ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0);
+
+    // if graphics and present are different families, share the images instead of transferring ownership every frame
+    uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value_or(indices.graphicsFamily.value())};
+    if (queueFamilyIndices[0] != queueFamilyIndices[1]) {
+        createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+        createInfo.queueFamilyIndexCount = 2;
+        createInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+    else {
+        createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+
+    createInfo.preTransform = support.capabilities.currentTransform;
+    createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    createInfo.presentMode = presentMode;
+    createInfo.clipped = VK_TRUE;
+    createInfo.oldSwapchain = oldSwapchain;
+
+    if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create swap chain!");
+    }
+
+    // the driver may create more images than we asked for
+    vkGetSwapchainImagesKHR(device, swapchain, &imageCount, nullptr);
+    images.resize(imageCount);
+    vkGetSwapchainImagesKHR(device, swapchain, &imageCount, images.data());
+
+    createImageViews();
+}
+
+void Swapchain::createImageViews() {
+    imageViews.resize(images.size());
+    for (size_t i = 0; i < images.size(); i++) {
+        VkImageViewCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        createInfo.image = images[i];
+        createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        createInfo.format = surfaceFormat.format;
+        createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        createInfo.subresourceRange.baseMipLevel = 0;
+        createInfo.subresourceRange.levelCount = 1;
+        createInfo.subresourceRange.baseArrayLayer = 0;
+        createInfo.subresourceRange.layerCount = 1;
+
+        if (vkCreateImageView(device, &createInfo, nullptr, &imageViews[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create swap chain image views!");
+        }
+    }
+}
+
+void Swapchain::destroyImageViews() {
+    for (VkImageView imageView : imageViews) {
+        vkDestroyImageView(device, imageView, nullptr);
+    }
+    imageViews.clear();
+}
+
+VkSurfaceFormatKHR Swapchain::chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+    /*
+     * This function prefers an 8 bit sRGB format, otherwise takes whatever the surface lists first
+     */
+    for (const auto& availableFormat : availableFormats) {
+        if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            return availableFormat;
+        }
+    }
+    return availableFormats[0];
+}
+
+VkPresentModeKHR Swapchain::choosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes, PresentPolicy policy) {
+    /*
+     * This function walks the preference list of the policy and takes the first mode the surface supports,
+     * FIFO is the last resort since it is the only mode every surface has to support. Only the tearing policy
+     * ever picks IMMEDIATE, a low latency surface without MAILBOX gets FIFO rather than tearing
+     */
+    std::vector<VkPresentModeKHR> preferred;
+    switch (policy) {
+        case PresentPolicy::LowLatency:
+            preferred = {VK_PRESENT_MODE_MAILBOX_KHR};
+            break;
+        case PresentPolicy::PowerSaving:
+            break;
+        case PresentPolicy::RelaxedVsync:
+            preferred = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+            break;
+        case PresentPolicy::Tearing:
+            preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+            break;
+    }
+
+    for (VkPresentModeKHR mode : preferred) {
+        if (std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end()) {
+            return mode;
+        }
+    }
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+VkExtent2D Swapchain::chooseExtent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D framebufferExtent) {
+    /*
+     * This function uses the surface's extent if it has one, otherwise the framebuffer size clamped to the limits
+     */
+    if (capabilities.currentExtent.width != UINT32_MAX) {
+        return capabilities.currentExtent;
+    }
+
+    VkExtent2D actualExtent = framebufferExtent;
+    actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+    actualExtent.height = std::clamp(actualExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+    return actualExtent;
+}
+
+uint32_t Swapchain::chooseImageCount(const VkSurfaceCapabilitiesKHR& capabilities, uint32_t desiredCount) {
+    /*
+     * This function clamps the configured image count to the surface limits (a maxImageCount of 0 means no limit)
+     */
+    uint32_t imageCount = std::max(desiredCount, capabilities.minImageCount);
+    if (capabilities.maxImageCount > 0) {
+        imageCount = std::min(imageCount, capabilities.maxImageCount);
+    }
+    return imageCount;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "queues.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class PresentPolicy {
+    LowLatency,     // MAILBOX, newest frame wins without tearing, keeps the GPU busy
+    PowerSaving,    // FIFO, classic vsync, the GPU idles once it is a frame ahead
+    RelaxedVsync,   // FIFO_RELAXED, vsync but tears instead of stuttering when a frame is late
+    Tearing         // IMMEDIATE, no waiting at all, lowest latency but tears
+};
+
+const char* presentPolicyName(PresentPolicy policy);
+std::optional<PresentPolicy> parsePresentPolicy(const std::string& name);
+const char* presentModeName(VkPresentModeKHR presentMode);
+
+struct SwapchainConfig {
+    PresentPolicy presentPolicy = PresentPolicy::LowLatency;
+    // 3 = triple buffering, clamped to what the surface allows
+    uint32_t imageCount = 3;
+};
+
+struct SwapchainSupportDetails {
+    /*
+     * This struct holds what a surface supports on a physical device
+     */
+    VkSurfaceCapabilitiesKHR capabilities{};
+    std::vector<VkSurfaceFormatKHR> formats;
+    std::vector<VkPresentModeKHR> presentModes;
+
+    static SwapchainSupportDetails query(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
+
+    bool isAdequate() const {
+        return !formats.empty() && !presentModes.empty();
+    }
+};
+
+class Swapchain {
+    /*
+     * This class owns the VkSwapchainKHR and its image views, and picks format, present mode and image count.
+     * Like the rest of the application it is created and destroyed explicitly, recreate() swaps it out on resize
+     */
+public:
+    void create(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface,
+                const QueueFamilyIndices& indices, const SwapchainConfig& config, VkExtent2D framebufferExtent);
+    void recreate(VkExtent2D framebufferExtent);
+    void destroy();
+
+    VkSwapchainKHR getHandle() const { return swapchain; }
+    VkFormat getImageFormat() const { return surfaceFormat.format; }
+    VkExtent2D getExtent() const { return extent; }
+    VkPresentModeKHR getPresentMode() const { return presentMode; }
+    uint32_t getImageCount() const { return static_cast<uint32_t>(images.size()); }
+    const std::vector<VkImage>& getImages() const { return images; }
+    const std::vector<VkImageView>& getImageViews() const { return imageViews; }
+    // whether the images can be cleared by a transfer
+    bool supportsTransferDestination() const { return transferDestination; }
+
+private:
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    QueueFamilyIndices indices;
+    SwapchainConfig config;
+
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkSurfaceFormatKHR surfaceFormat{};
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkExtent2D extent{};
+    bool transferDestination = false;
+    std::vector<VkImage> images;
+    std::vector<VkImageView> imageViews;
+
+    void build(VkExtent2D framebufferExtent, VkSwapchainKHR oldSwapchain);
+    void createImageViews();
+    void destroyImageViews();
+
+    static VkSurfaceFormatKHR chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
+    static VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes, PresentPolicy policy);
+    static VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D framebufferExtent);
+    static uint32_t chooseImageCount(const VkSurfaceCapabilitiesKHR& capabilities, uint32_t desiredCount);
+};
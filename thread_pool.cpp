@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <exception>
+
+ThreadPool::ThreadPool(uint32_t workerCount) {
+    workerCount = std::max(workerCount, 1u);
+    for (uint32_t i = 0; i < workerCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(int priority, std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push({priority, nextSequence++, std::move(job)});
+    }
+    jobAvailable.notify_one();
+}
+
+void ThreadPool::parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t first, uint32_t count)>& body) {
+    /*
+     * This function waits for its own pieces only, unlike waitIdle() it does not care about other jobs in the queue.
+     * It must not be called from one of the pool's workers, the pieces could end up queued behind the caller.
+     * A piece that throws still counts as done, the first exception is rethrown here once all pieces finished
+     */
+    if (count == 0) {
+        return;
+    }
+    grain = std::max(grain, 1u);
+    std::mutex doneMutex;
+    std::condition_variable done;
+    uint32_t remaining = (count + grain - 1) / grain;
+    std::exception_ptr error;
+    for (uint32_t first = 0; first < count; first += grain) {
+        uint32_t pieceCount = std::min(grain, count - first);
+        submit(0, [&body, &doneMutex, &done, &remaining, &error, first, pieceCount] {
+            std::exception_ptr pieceError;
+            try {
+                body(first, pieceCount);
+            } catch (...) {
+                pieceError = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (pieceError && !error) {
+                error = pieceError;
+            }
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        });
+    }
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&remaining] { return remaining == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return jobs.empty() && activeJobs == 0; });
+}
+
+uint32_t ThreadPool::defaultWorkerCount() {
+    uint32_t hardwareThreads = std::thread::hardware_concurrency();
+    return hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+}
+
+void ThreadPool::workerLoop() {
+    /*
+     * This function is what every worker runs, it sleeps until there is a job or the pool shuts down.
+     * Jobs still queued at shutdown are dropped
+     */
+    TRACE_THREAD_NAME("pool worker");
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = std::move(const_cast<QueuedJob&>(jobs.top()).job);
+            jobs.pop();
+            activeJobs++;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            activeJobs--;
+            if (jobs.empty() && activeJobs == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+    /*
+     * This class is a fixed set of worker threads serving one priority queue of jobs.
+     * Higher priority jobs run first, jobs with the same priority run in submission order
+     */
+public:
+    explicit ThreadPool(uint32_t workerCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(int priority, std::function<void()> job);
+    // splits [0, count) into pieces of at most grain items, runs them on the workers and blocks until all are done,
+    // then rethrows the first exception a piece threw
+    void parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t first, uint32_t count)>& body);
+    // blocks until the queue is empty and every worker is idle
+    void waitIdle();
+
+    uint32_t getWorkerCount() const { return static_cast<uint32_t>(workers.size()); }
+
+    // hardware threads minus one for the main thread, at least one
+    static uint32_t defaultWorkerCount();
+
+private:
+    struct QueuedJob {
+        int priority;
+        uint64_t sequence;
+        std::function<void()> job;
+
+        bool operator<(const QueuedJob& other) const {
+            // std::priority_queue pops the largest element, so the earlier sequence has to compare as larger
+            if (priority != other.priority) {
+                return priority < other.priority;
+            }
+            return sequence > other.sequence;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    std::priority_queue<QueuedJob> jobs;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable idle;
+    uint64_t nextSequence = 0;
+    uint32_t activeJobs = 0;
+    bool stopping = false;
+
+    void workerLoop();
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <utility>
+
+// non-dispatchable handles are pointers on 64 bit platforms and uint64_t elsewhere, the C cast takes both
+template<typename Handle>
+uint64_t handleBits(Handle handle) {
+    return (uint64_t)handle;
+}
+
+template<typename Handle>
+Handle handleFromBits(uint64_t bits) {
+    return (Handle)bits;
+}
+
+template<typename Handle, auto Destroy>
+class UniqueRoot {
+    /*
+     * This class owns a handle that is destroyed on its own, like VkInstance and VkDevice.
+     * It converts to the raw handle so it can be passed to any vk function, and destroys it when it goes out of
+     * scope or is reset, whatever was created from it has to be gone by then
+     */
+public:
+    UniqueRoot() = default;
+    explicit UniqueRoot(Handle handle) : handle(handle) {}
+    ~UniqueRoot() { reset(); }
+
+    UniqueRoot(UniqueRoot&& other) noexcept : handle(std::exchange(other.handle, VK_NULL_HANDLE)) {}
+    UniqueRoot& operator=(UniqueRoot&& other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, VK_NULL_HANDLE);
+        }
+        return *this;
+    }
+    UniqueRoot(const UniqueRoot&) = delete;
+    UniqueRoot& operator=(const UniqueRoot&) = delete;
+
+    void reset() {
+        if (handle != VK_NULL_HANDLE) {
+            Destroy(handle, nullptr);
+            handle = VK_NULL_HANDLE;
+        }
+    }
+    // gives up ownership without destroying
+    Handle release() { return std::exchange(handle, VK_NULL_HANDLE); }
+
+    Handle get() const { return handle; }
+    operator Handle() const { return handle; }
+
+private:
+    Handle handle = VK_NULL_HANDLE;
+};
+
+template<typename Parent, typename Handle, auto Destroy>
+class UniqueHandle {
+    /*
+     * This class owns a handle created from a parent (a device, or the instance for a surface) and destroys it
+     * through the parent. The parent is not owned and has to outlive it. Handles the GPU may still use go to a
+     * DeletionQueue instead of being reset
+     */
+public:
+    using HandleType = Handle;
+    static constexpr auto destroyFunction = Destroy;
+
+    UniqueHandle() = default;
+    UniqueHandle(Parent parent, Handle handle) : parent(parent), handle(handle) {}
+    ~UniqueHandle() { reset(); }
+
+    UniqueHandle(UniqueHandle&& other) noexcept
+        : parent(other.parent), handle(std::exchange(other.handle, VK_NULL_HANDLE)) {}
+    UniqueHandle& operator=(UniqueHandle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            parent = other.parent;
+            handle = std::exchange(other.handle, VK_NULL_HANDLE);
+        }
+        return *this;
+    }
+    UniqueHandle(const UniqueHandle&) = delete;
+    UniqueHandle& operator=(const UniqueHandle&) = delete;
+
+    void reset() {
+        if (handle != VK_NULL_HANDLE) {
+            Destroy(parent, handle, nullptr);
+            handle = VK_NULL_HANDLE;
+        }
+    }
+    Handle release() { return std::exchange(handle, VK_NULL_HANDLE); }
+
+    Handle get() const { return handle; }
+    Parent getParent() const { return parent; }
+    operator Handle() const { return handle; }
+
+private:
+    Parent parent = VK_NULL_HANDLE;
+    Handle handle = VK_NULL_HANDLE;
+};
+
+using UniqueInstance = UniqueRoot<VkInstance, vkDestroyInstance>;
+using UniqueDevice = UniqueRoot<VkDevice, vkDestroyDevice>;
+using UniqueSurface = UniqueHandle<VkInstance, VkSurfaceKHR, vkDestroySurfaceKHR>;
+
+template<typename Handle, auto Destroy>
+using UniqueDeviceHandle = UniqueHandle<VkDevice, Handle, Destroy>;
+
+using UniqueBuffer = UniqueDeviceHandle<VkBuffer, vkDestroyBuffer>;
+using UniqueImage = UniqueDeviceHandle<VkImage, vkDestroyImage>;
+using UniqueImageView = UniqueDeviceHandle<VkImageView, vkDestroyImageView>;
+using UniqueSampler = UniqueDeviceHandle<VkSampler, vkDestroySampler>;
+using UniquePipeline = UniqueDeviceHandle<VkPipeline, vkDestroyPipeline>;
+using UniquePipelineLayout = UniqueDeviceHandle<VkPipelineLayout, vkDestroyPipelineLayout>;
+using UniqueDescriptorSetLayout = UniqueDeviceHandle<VkDescriptorSetLayout, vkDestroyDescriptorSetLayout>;
+using UniqueDescriptorPool = UniqueDeviceHandle<VkDescriptorPool, vkDestroyDescriptorPool>;
+using UniqueCommandPool = UniqueDeviceHandle<VkCommandPool, vkDestroyCommandPool>;
+using UniqueFence = UniqueDeviceHandle<VkFence, vkDestroyFence>;
+using UniqueSemaphore = UniqueDeviceHandle<VkSemaphore, vkDestroySemaphore>;
+using UniqueQueryPool = UniqueDeviceHandle<VkQueryPool, vkDestroyQueryPool>;
+using UniqueShaderModule = UniqueDeviceHandle<VkShaderModule, vkDestroyShaderModule>;